@@ -0,0 +1,308 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! A ring buffer of messages in memory mapped into two sandboxes (or a
+//! sandbox and the host), through which one end sends messages to the
+//! other without the host copying them.
+//!
+//! The memory starts with a header holding the number of bytes ever
+//! written to the ring and the number ever read from it, each on a cache
+//! line of its own, followed by the ring itself. Each message is stored
+//! as a little-endian `u32` length and then the message, padded to a
+//! multiple of 8 bytes. A message never wraps around the end of the ring:
+//! if it does not fit before the end, the sender writes `PADDING` there
+//! and the message at the start of the ring, so the receiver can read it
+//! in place.
+//!
+//! There must be at most one sender and one receiver at a time. Both ends
+//! check everything they read from the header, so a misbehaving end can
+//! make the channel fail with `ChannelError::Corrupt`, but cannot make the
+//! other end access memory outside the ring.
+
+use core::ptr::copy_nonoverlapping;
+use core::slice::from_raw_parts;
+use core::sync::atomic::{AtomicU64, Ordering};
+
+/// The size of the header at the start of a channel's memory
+pub const CHANNEL_HEADER_SIZE: usize = 128;
+
+/// Where the number of bytes written to the ring is kept
+const WRITTEN_OFFSET: usize = 0;
+/// Where the number of bytes read from the ring is kept, on a different
+/// cache line to `WRITTEN_OFFSET` so that the two ends do not contend
+const READ_OFFSET: usize = 64;
+/// The size of the length before each message
+const LENGTH_SIZE: usize = 4;
+/// Messages are padded to a multiple of this
+const RECORD_ALIGN: usize = 8;
+/// The length that marks the rest of the ring as unused
+const PADDING: u32 = u32::MAX;
+
+/// The ways sending or receiving on a channel can fail
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ChannelError {
+    /// The message is larger than `ChannelRing::max_message_len`
+    MessageTooLarge,
+    /// There is not enough free space in the ring for the message until
+    /// the receiver has read more of it
+    Full,
+    /// The header or a message length is inconsistent, so the other end
+    /// has written to the channel's memory other than as a channel
+    Corrupt,
+}
+
+/// One end of a channel, which can send or receive messages on it
+#[derive(Debug)]
+pub struct ChannelRing {
+    /// The start of the channel's memory
+    base: *mut u8,
+    /// The size of the ring, which is a multiple of `RECORD_ALIGN`
+    capacity: usize,
+}
+
+// The ring is only accessed through atomics and raw copies, and its
+// users uphold the single sender and receiver rule
+unsafe impl Send for ChannelRing {}
+unsafe impl Sync for ChannelRing {}
+
+impl ChannelRing {
+    /// Use the `len` bytes at `base` as a channel, returning `None` if they
+    /// are too small to hold one or `base` is not 8 byte aligned.
+    ///
+    /// # Safety
+    ///
+    /// The memory must be valid for reads and writes for as long as the
+    /// `ChannelRing` is used, must have been zeroed before either end first
+    /// used it, and must only be accessed as a channel.
+    pub unsafe fn from_raw_parts(base: *mut u8, len: usize) -> Option<Self> {
+        if base as usize % RECORD_ALIGN != 0 {
+            return None;
+        }
+        let capacity = len.checked_sub(CHANNEL_HEADER_SIZE)? / RECORD_ALIGN * RECORD_ALIGN;
+        if capacity < 2 * RECORD_ALIGN {
+            return None;
+        }
+        Some(Self { base, capacity })
+    }
+
+    /// The size of the ring, in bytes
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// The largest message that can be sent. This is under half the size
+    /// of the ring, so that a message always fits once the receiver has
+    /// read everything before it.
+    pub fn max_message_len(&self) -> usize {
+        (self.capacity / 2 / RECORD_ALIGN * RECORD_ALIGN - LENGTH_SIZE).min(PADDING as usize - 1)
+    }
+
+    /// Whether there are no messages waiting to be received
+    pub fn is_empty(&self) -> bool {
+        self.written().load(Ordering::Acquire) == self.read().load(Ordering::Acquire)
+    }
+
+    /// Send `message`, or fail without sending it if there is no room for
+    /// it in the ring.
+    pub fn try_send(&self, message: &[u8]) -> Result<(), ChannelError> {
+        if message.len() > self.max_message_len() {
+            return Err(ChannelError::MessageTooLarge);
+        }
+        let record = (LENGTH_SIZE + message.len()).next_multiple_of(RECORD_ALIGN);
+
+        // Only the sender changes the number of bytes written
+        let mut written = self.written().load(Ordering::Relaxed);
+        let read = self.read().load(Ordering::Acquire);
+        let used = self.used(written, read)?;
+        let mut start = self.offset(written)?;
+        let to_end = self.capacity - start;
+        let needed = if record <= to_end {
+            record
+        } else {
+            to_end + record
+        };
+        if used + needed > self.capacity {
+            return Err(ChannelError::Full);
+        }
+
+        if record > to_end {
+            self.write_length(start, PADDING);
+            written = written.wrapping_add(to_end as u64);
+            start = 0;
+        }
+        self.write_length(start, message.len() as u32);
+        unsafe {
+            copy_nonoverlapping(
+                message.as_ptr(),
+                self.ring().add(start + LENGTH_SIZE),
+                message.len(),
+            );
+        }
+        self.written()
+            .store(written.wrapping_add(record as u64), Ordering::Release);
+        Ok(())
+    }
+
+    /// Receive the next message, if there is one, passing it to `f` in place
+    /// in the ring, and return what `f` returns.
+    ///
+    /// The sender does not reuse the message's space in the ring until `f`
+    /// has returned.
+    pub fn try_recv_with<R>(&self, f: impl FnOnce(&[u8]) -> R) -> Result<Option<R>, ChannelError> {
+        // Only the receiver changes the number of bytes read
+        let mut read = self.read().load(Ordering::Relaxed);
+        let written = self.written().load(Ordering::Acquire);
+        let mut used = self.used(written, read)?;
+        if used == 0 {
+            return Ok(None);
+        }
+
+        let mut start = self.offset(read)?;
+        let mut len = self.read_length(start);
+        if len == PADDING {
+            let to_end = self.capacity - start;
+            // The sender writes the padding and the message after it at
+            // once, so there must be a message after it
+            if used <= to_end {
+                return Err(ChannelError::Corrupt);
+            }
+            read = read.wrapping_add(to_end as u64);
+            used -= to_end;
+            start = 0;
+            len = self.read_length(start);
+        }
+        let len = len as usize;
+        let record = (LENGTH_SIZE + len).next_multiple_of(RECORD_ALIGN);
+        if record > used || start + record > self.capacity {
+            return Err(ChannelError::Corrupt);
+        }
+
+        let message = unsafe { from_raw_parts(self.ring().add(start + LENGTH_SIZE), len) };
+        let res = f(message);
+        self.read()
+            .store(read.wrapping_add(record as u64), Ordering::Release);
+        Ok(Some(res))
+    }
+
+    /// The number of bytes written to the ring
+    fn written(&self) -> &AtomicU64 {
+        unsafe { &*(self.base.add(WRITTEN_OFFSET) as *const AtomicU64) }
+    }
+
+    /// The number of bytes read from the ring
+    fn read(&self) -> &AtomicU64 {
+        unsafe { &*(self.base.add(READ_OFFSET) as *const AtomicU64) }
+    }
+
+    /// The ring itself
+    fn ring(&self) -> *mut u8 {
+        unsafe { self.base.add(CHANNEL_HEADER_SIZE) }
+    }
+
+    /// The number of bytes of the ring in use, given the numbers of bytes
+    /// written to it and read from it
+    fn used(&self, written: u64, read: u64) -> Result<usize, ChannelError> {
+        match written.checked_sub(read) {
+            Some(used) if used <= self.capacity as u64 => Ok(used as usize),
+            _ => Err(ChannelError::Corrupt),
+        }
+    }
+
+    /// Where in the ring the byte numbered `position` goes
+    fn offset(&self, position: u64) -> Result<usize, ChannelError> {
+        let offset = (position % self.capacity as u64) as usize;
+        // Every record is padded, so a position that is not aligned was
+        // not written by a well-behaved sender
+        if offset % RECORD_ALIGN != 0 {
+            return Err(ChannelError::Corrupt);
+        }
+        Ok(offset)
+    }
+
+    fn read_length(&self, offset: usize) -> u32 {
+        let mut bytes = [0u8; LENGTH_SIZE];
+        unsafe { copy_nonoverlapping(self.ring().add(offset), bytes.as_mut_ptr(), LENGTH_SIZE) };
+        u32::from_le_bytes(bytes)
+    }
+
+    fn write_length(&self, offset: usize, len: u32) {
+        let bytes = len.to_le_bytes();
+        unsafe { copy_nonoverlapping(bytes.as_ptr(), self.ring().add(offset), LENGTH_SIZE) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use alloc::vec;
+    use alloc::vec::Vec;
+
+    use super::{ChannelError, ChannelRing, CHANNEL_HEADER_SIZE};
+
+    fn new_ring(memory: &mut [u64]) -> ChannelRing {
+        unsafe { ChannelRing::from_raw_parts(memory.as_mut_ptr() as *mut u8, memory.len() * 8) }
+            .unwrap()
+    }
+
+    fn recv(ring: &ChannelRing) -> Option<Vec<u8>> {
+        ring.try_recv_with(|message| message.to_vec()).unwrap()
+    }
+
+    #[test]
+    fn send_and_receive() {
+        let mut memory = vec![0u64; (CHANNEL_HEADER_SIZE + 256) / 8];
+        let ring = new_ring(&mut memory);
+        assert_eq!(ring.capacity(), 256);
+        assert_eq!(ring.max_message_len(), 124);
+        assert!(ring.is_empty());
+        assert_eq!(recv(&ring), None);
+
+        // Enough messages to wrap around the ring several times, some of
+        // which have to skip the end of it
+        for i in 0..100u8 {
+            let message = vec![i; i as usize % 50];
+            ring.try_send(&message).unwrap();
+            ring.try_send(b"second").unwrap();
+            assert!(!ring.is_empty());
+            assert_eq!(recv(&ring), Some(message));
+            assert_eq!(recv(&ring), Some(b"second".to_vec()));
+            assert!(ring.is_empty());
+        }
+    }
+
+    #[test]
+    fn full_and_too_large() {
+        let mut memory = vec![0u64; (CHANNEL_HEADER_SIZE + 256) / 8];
+        let ring = new_ring(&mut memory);
+        assert_eq!(ring.try_send(&[0; 125]), Err(ChannelError::MessageTooLarge));
+        ring.try_send(&[1; 124]).unwrap();
+        ring.try_send(&[2; 100]).unwrap();
+        assert_eq!(ring.try_send(&[3; 100]), Err(ChannelError::Full));
+        assert_eq!(recv(&ring), Some(vec![1; 124]));
+        ring.try_send(&[3; 100]).unwrap();
+        assert_eq!(recv(&ring), Some(vec![2; 100]));
+        assert_eq!(recv(&ring), Some(vec![3; 100]));
+    }
+
+    #[test]
+    fn corrupt_header() {
+        let mut memory = vec![0u64; (CHANNEL_HEADER_SIZE + 256) / 8];
+        // More bytes written than the ring holds
+        memory[0] = 1000;
+        let ring = new_ring(&mut memory);
+        assert_eq!(ring.try_recv_with(|_| ()), Err(ChannelError::Corrupt));
+        assert_eq!(ring.try_send(b"hello"), Err(ChannelError::Corrupt));
+    }
+}
@@ -22,7 +22,7 @@ use flatbuffers::{size_prefixed_root, WIPOffset};
 #[cfg(feature = "tracing")]
 use tracing::{instrument, Span};
 
-use super::function_types::{ParameterValue, ReturnType};
+use super::function_types::{ParameterType, ParameterValue, ParameterValueRef, ReturnType};
 use crate::flatbuffers::hyperlight::generated::{
     hlbool, hlboolArgs, hldouble, hldoubleArgs, hlfloat, hlfloatArgs, hlint, hlintArgs, hllong,
     hllongArgs, hlstring, hlstringArgs, hluint, hluintArgs, hlulong, hlulongArgs, hlvecbytes,
@@ -32,7 +32,7 @@ use crate::flatbuffers::hyperlight::generated::{
 };
 
 /// The type of function call.
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum FunctionCallType {
     /// The function call is to a guest function.
     Guest,
@@ -70,7 +70,127 @@ impl FunctionCall {
 
     /// The type of the function call.
     pub fn function_call_type(&self) -> FunctionCallType {
-        self.function_call_type.clone()
+        self.function_call_type
+    }
+}
+
+/// `FunctionCallView` reads a serialised [`FunctionCall`] in place.
+///
+/// Unlike converting the buffer into a `FunctionCall`, creating a view does
+/// not allocate: the function name, string and byte array parameters are
+/// borrowed from the buffer.
+#[derive(Clone, Copy)]
+pub struct FunctionCallView<'a> {
+    function_call: FbFunctionCall<'a>,
+    function_call_type: FunctionCallType,
+    expected_return_type: ReturnType,
+}
+
+impl<'a> FunctionCallView<'a> {
+    /// The function name
+    pub fn function_name(&self) -> &'a str {
+        self.function_call.function_name()
+    }
+
+    /// The type of the function call.
+    pub fn function_call_type(&self) -> FunctionCallType {
+        self.function_call_type
+    }
+
+    /// The return type of the function call
+    pub fn expected_return_type(&self) -> ReturnType {
+        self.expected_return_type
+    }
+
+    /// The number of parameters passed to the function
+    pub fn parameter_count(&self) -> usize {
+        self.function_call
+            .parameters()
+            .map_or(0, |parameters| parameters.len())
+    }
+
+    /// The parameters passed to the function, in order
+    pub fn parameters(&self) -> impl Iterator<Item = ParameterValueRef<'a>> {
+        self.function_call
+            .parameters()
+            .into_iter()
+            .flatten()
+            .map(|parameter| {
+                // Every parameter was checked when the view was created
+                parameter
+                    .try_into()
+                    .expect("Function call parameter changed after validation")
+            })
+    }
+
+    /// The types of the parameters passed to the function, in order
+    pub fn parameter_types(&self) -> impl Iterator<Item = ParameterType> + 'a {
+        self.parameters().map(|parameter| (&parameter).into())
+    }
+
+    /// The parameter at `index`
+    pub fn parameter(&self, index: usize) -> Result<ParameterValueRef<'a>> {
+        match self.function_call.parameters() {
+            Some(parameters) if index < parameters.len() => parameters.get(index).try_into(),
+            _ => bail!(
+                "Function {} has no parameter at index {}",
+                self.function_name(),
+                index
+            ),
+        }
+    }
+
+    /// The parameter at `index` as a `T`, which is one of `i32`, `u32`,
+    /// `i64`, `u64`, `f32`, `f64`, `bool`, `&str` or `&[u8]`
+    pub fn get<T>(&self, index: usize) -> Result<T>
+    where
+        T: TryFrom<ParameterValueRef<'a>, Error = Error>,
+    {
+        self.parameter(index)?.try_into()
+    }
+}
+
+impl<'a> TryFrom<&'a [u8]> for FunctionCallView<'a> {
+    type Error = Error;
+    #[cfg_attr(feature = "tracing", instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace"))]
+    fn try_from(value: &'a [u8]) -> Result<Self> {
+        let function_call = size_prefixed_root::<FbFunctionCall>(value)
+            .map_err(|e| anyhow::anyhow!("Error reading function call buffer: {:?}", e))?;
+        let function_call_type = match function_call.function_call_type() {
+            FbFunctionCallType::guest => FunctionCallType::Guest,
+            FbFunctionCallType::host => FunctionCallType::Host,
+            other => {
+                bail!("Invalid function call type: {:?}", other);
+            }
+        };
+        let expected_return_type = function_call.expected_return_type().try_into()?;
+
+        // Check every parameter now, so that reading them later cannot fail
+        for parameter in function_call.parameters().into_iter().flatten() {
+            ParameterValueRef::try_from(parameter)?;
+        }
+
+        Ok(Self {
+            function_call,
+            function_call_type,
+            expected_return_type,
+        })
+    }
+}
+
+impl From<FunctionCallView<'_>> for FunctionCall {
+    #[cfg_attr(feature = "tracing", instrument(skip_all, parent = Span::current(), level= "Trace"))]
+    fn from(value: FunctionCallView<'_>) -> Self {
+        let parameters = value
+            .function_call
+            .parameters()
+            .map(|_| value.parameters().map(ParameterValue::from).collect());
+        Self {
+            function_name: value.function_name().to_string(),
+            parameters,
+            function_call_type: value.function_call_type,
+            expected_return_type: value.expected_return_type,
+        }
     }
 }
 
@@ -102,33 +222,7 @@ impl TryFrom<&[u8]> for FunctionCall {
     type Error = Error;
     #[cfg_attr(feature = "tracing", instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace"))]
     fn try_from(value: &[u8]) -> Result<Self> {
-        let function_call_fb = size_prefixed_root::<FbFunctionCall>(value)
-            .map_err(|e| anyhow::anyhow!("Error reading function call buffer: {:?}", e))?;
-        let function_name = function_call_fb.function_name();
-        let function_call_type = match function_call_fb.function_call_type() {
-            FbFunctionCallType::guest => FunctionCallType::Guest,
-            FbFunctionCallType::host => FunctionCallType::Host,
-            other => {
-                bail!("Invalid function call type: {:?}", other);
-            }
-        };
-        let expected_return_type = function_call_fb.expected_return_type().try_into()?;
-
-        let parameters = function_call_fb
-            .parameters()
-            .map(|v| {
-                v.iter()
-                    .map(|p| p.try_into())
-                    .collect::<Result<Vec<ParameterValue>>>()
-            })
-            .transpose()?;
-
-        Ok(Self {
-            function_name: function_name.to_string(),
-            parameters,
-            function_call_type,
-            expected_return_type,
-        })
+        Ok(FunctionCallView::try_from(value)?.into())
     }
 }
 
@@ -349,4 +443,54 @@ mod tests {
 
         Ok(())
     }
+
+    #[test]
+    fn read_view_from_flatbuffer() -> Result<()> {
+        let test_data: Vec<u8> = FunctionCall::new(
+            "TakesBytes".to_string(),
+            Some(vec![
+                ParameterValue::String("name".to_string()),
+                ParameterValue::VecBytes(vec![1, 2, 3, 4]),
+                ParameterValue::ULong(5),
+            ]),
+            FunctionCallType::Guest,
+            ReturnType::VecBytes,
+        )
+        .try_into()
+        .unwrap();
+
+        let view = FunctionCallView::try_from(test_data.as_slice())?;
+        assert_eq!(view.function_name(), "TakesBytes");
+        assert_eq!(view.function_call_type(), FunctionCallType::Guest);
+        assert_eq!(view.expected_return_type(), ReturnType::VecBytes);
+        assert_eq!(view.parameter_count(), 3);
+        assert!(view.parameter_types().eq([
+            ParameterType::String,
+            ParameterType::VecBytes,
+            ParameterType::ULong
+        ]));
+
+        assert_eq!(view.get::<&str>(0)?, "name");
+        assert_eq!(view.get::<u64>(2)?, 5);
+        // The bytes are borrowed from the buffer rather than copied
+        let bytes = view.get::<&[u8]>(1)?;
+        assert_eq!(bytes, &[1, 2, 3, 4]);
+        assert!(test_data.as_ptr_range().contains(&bytes.as_ptr()));
+
+        assert!(view.get::<i32>(0).is_err());
+        assert!(view.parameter(3).is_err());
+
+        let function_call = FunctionCall::from(view);
+        assert_eq!(function_call.function_name, "TakesBytes");
+        assert_eq!(
+            function_call.parameters,
+            Some(vec![
+                ParameterValue::String("name".to_string()),
+                ParameterValue::VecBytes(vec![1, 2, 3, 4]),
+                ParameterValue::ULong(5),
+            ])
+        );
+
+        Ok(())
+    }
 }
@@ -55,6 +55,31 @@ pub enum ParameterValue {
     VecBytes(Vec<u8>),
 }
 
+/// A parameter value read in place from a serialised function call by a
+/// [`FunctionCallView`](super::function_call::FunctionCallView): strings and
+/// byte arrays borrow from the buffer rather than being copied out of it.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum ParameterValueRef<'a> {
+    /// i32
+    Int(i32),
+    /// u32
+    UInt(u32),
+    /// i64
+    Long(i64),
+    /// u64
+    ULong(u64),
+    /// f32
+    Float(f32),
+    /// f64
+    Double(f64),
+    /// &str
+    String(&'a str),
+    /// bool
+    Bool(bool),
+    /// &[u8]
+    VecBytes(&'a [u8]),
+}
+
 /// Supported parameter types for function calling.
 #[derive(Debug, Clone, PartialEq, Eq)]
 #[repr(C)]
@@ -149,6 +174,87 @@ impl From<&ParameterValue> for ParameterType {
     }
 }
 
+impl From<&ParameterValueRef<'_>> for ParameterType {
+    #[cfg_attr(feature = "tracing", instrument(skip_all, parent = Span::current(), level= "Trace"))]
+    fn from(value: &ParameterValueRef<'_>) -> Self {
+        match *value {
+            ParameterValueRef::Int(_) => ParameterType::Int,
+            ParameterValueRef::UInt(_) => ParameterType::UInt,
+            ParameterValueRef::Long(_) => ParameterType::Long,
+            ParameterValueRef::ULong(_) => ParameterType::ULong,
+            ParameterValueRef::Float(_) => ParameterType::Float,
+            ParameterValueRef::Double(_) => ParameterType::Double,
+            ParameterValueRef::String(_) => ParameterType::String,
+            ParameterValueRef::Bool(_) => ParameterType::Bool,
+            ParameterValueRef::VecBytes(_) => ParameterType::VecBytes,
+        }
+    }
+}
+
+impl From<ParameterValueRef<'_>> for ParameterValue {
+    #[cfg_attr(feature = "tracing", instrument(skip_all, parent = Span::current(), level= "Trace"))]
+    fn from(value: ParameterValueRef<'_>) -> Self {
+        match value {
+            ParameterValueRef::Int(v) => ParameterValue::Int(v),
+            ParameterValueRef::UInt(v) => ParameterValue::UInt(v),
+            ParameterValueRef::Long(v) => ParameterValue::Long(v),
+            ParameterValueRef::ULong(v) => ParameterValue::ULong(v),
+            ParameterValueRef::Float(v) => ParameterValue::Float(v),
+            ParameterValueRef::Double(v) => ParameterValue::Double(v),
+            ParameterValueRef::String(v) => ParameterValue::String(v.to_string()),
+            ParameterValueRef::Bool(v) => ParameterValue::Bool(v),
+            ParameterValueRef::VecBytes(v) => ParameterValue::VecBytes(v.to_vec()),
+        }
+    }
+}
+
+impl<'a> TryFrom<Parameter<'a>> for ParameterValueRef<'a> {
+    type Error = Error;
+
+    #[cfg_attr(feature = "tracing", instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace"))]
+    fn try_from(param: Parameter<'a>) -> Result<Self> {
+        let value = param.value_type();
+        let result = match value {
+            FbParameterValue::hlint => param
+                .value_as_hlint()
+                .map(|hlint| ParameterValueRef::Int(hlint.value())),
+            FbParameterValue::hluint => param
+                .value_as_hluint()
+                .map(|hluint| ParameterValueRef::UInt(hluint.value())),
+            FbParameterValue::hllong => param
+                .value_as_hllong()
+                .map(|hllong| ParameterValueRef::Long(hllong.value())),
+            FbParameterValue::hlulong => param
+                .value_as_hlulong()
+                .map(|hlulong| ParameterValueRef::ULong(hlulong.value())),
+            FbParameterValue::hlfloat => param
+                .value_as_hlfloat()
+                .map(|hlfloat| ParameterValueRef::Float(hlfloat.value())),
+            FbParameterValue::hldouble => param
+                .value_as_hldouble()
+                .map(|hldouble| ParameterValueRef::Double(hldouble.value())),
+            FbParameterValue::hlbool => param
+                .value_as_hlbool()
+                .map(|hlbool| ParameterValueRef::Bool(hlbool.value())),
+            FbParameterValue::hlstring => param
+                .value_as_hlstring()
+                .map(|hlstring| ParameterValueRef::String(hlstring.value().unwrap_or_default())),
+            FbParameterValue::hlvecbytes => param.value_as_hlvecbytes().map(|hlvecbytes| {
+                ParameterValueRef::VecBytes(
+                    hlvecbytes
+                        .value()
+                        .map(|bytes| bytes.bytes())
+                        .unwrap_or_default(),
+                )
+            }),
+            other => {
+                bail!("Unexpected flatbuffer parameter value type: {:?}", other);
+            }
+        };
+        result.ok_or_else(|| anyhow!("Failed to get parameter value"))
+    }
+}
+
 impl TryFrom<Parameter<'_>> for ParameterValue {
     type Error = Error;
 
@@ -386,6 +492,39 @@ impl TryFrom<ParameterValue> for Vec<u8> {
     }
 }
 
+/// Implement `TryFrom<ParameterValueRef<'a>>` for the type of the value
+/// borrowed by a `ParameterValueRef` variant
+macro_rules! impl_try_from_parameter_value_ref {
+    ($($variant:ident => $ty:ty),* $(,)?) => {
+        $(
+            impl<'a> TryFrom<ParameterValueRef<'a>> for $ty {
+                type Error = Error;
+                #[cfg_attr(feature = "tracing", instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace"))]
+                fn try_from(value: ParameterValueRef<'a>) -> Result<Self> {
+                    match value {
+                        ParameterValueRef::$variant(v) => Ok(v),
+                        _ => {
+                            bail!("Unexpected parameter value type: {:?}", value)
+                        }
+                    }
+                }
+            }
+        )*
+    };
+}
+
+impl_try_from_parameter_value_ref!(
+    Int => i32,
+    UInt => u32,
+    Long => i64,
+    ULong => u64,
+    Float => f32,
+    Double => f64,
+    String => &'a str,
+    Bool => bool,
+    VecBytes => &'a [u8],
+);
+
 impl TryFrom<ReturnValue> for i32 {
     type Error = Error;
     #[cfg_attr(feature = "tracing", instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace"))]
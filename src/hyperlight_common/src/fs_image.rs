@@ -0,0 +1,310 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! A read-only archive of files, which the host builds and maps into
+//! guests so that they can read the files in place.
+//!
+//! An image is laid out as:
+//!
+//! - a header: `FS_IMAGE_MAGIC`, then the number of files as a
+//!   little-endian `u32`, then 4 bytes of zeroes
+//! - an index with an entry for each file, sorted by path so that a file
+//!   can be found with a binary search. Each entry is the offset and
+//!   length of the file's path, as little-endian `u32`s, and then the
+//!   offset and length of its contents, as little-endian `u64`s, all
+//!   relative to the start of the image.
+//! - the paths, as UTF-8 without a leading `/`
+//! - the contents of the files, each aligned to `FS_IMAGE_DATA_ALIGN`
+//!   bytes
+
+use alloc::vec::Vec;
+
+/// The bytes an image starts with
+pub const FS_IMAGE_MAGIC: [u8; 8] = *b"HLFSIMG1";
+/// What the contents of each file in an image are aligned to
+pub const FS_IMAGE_DATA_ALIGN: usize = 16;
+
+const HEADER_SIZE: usize = 16;
+const ENTRY_SIZE: usize = 24;
+
+/// The ways building or reading an image can fail
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum FsImageError {
+    /// The image does not start with `FS_IMAGE_MAGIC`
+    BadMagic,
+    /// A path or the contents of a file lie outside the image
+    OutOfBounds,
+    /// A path is empty or not UTF-8
+    InvalidPath,
+    /// Two files have the same path, or the index is not sorted by path
+    DuplicateOrUnsortedPath,
+    /// The image is too large to describe
+    TooLarge,
+}
+
+/// A parsed image, which finds files in the bytes of the image without
+/// copying them
+#[derive(Debug, Clone, Copy)]
+pub struct FsImage<'a> {
+    image: &'a [u8],
+    count: usize,
+}
+
+impl<'a> FsImage<'a> {
+    /// Check that `image` is a well-formed image, and return it parsed.
+    ///
+    /// Every entry of the index is checked, so later lookups cannot fail.
+    pub fn parse(image: &'a [u8]) -> Result<Self, FsImageError> {
+        if image.len() < HEADER_SIZE || image[..8] != FS_IMAGE_MAGIC {
+            return Err(FsImageError::BadMagic);
+        }
+        let count = read_u32(image, 8) as usize;
+        let index_len = count
+            .checked_mul(ENTRY_SIZE)
+            .ok_or(FsImageError::OutOfBounds)?;
+        if image.len() - HEADER_SIZE < index_len {
+            return Err(FsImageError::OutOfBounds);
+        }
+
+        let parsed = Self { image, count };
+        let mut previous: Option<&str> = None;
+        for i in 0..count {
+            let path = parsed.checked_path(i)?;
+            parsed.checked_contents(i)?;
+            if previous.is_some_and(|previous| previous >= path) {
+                return Err(FsImageError::DuplicateOrUnsortedPath);
+            }
+            previous = Some(path);
+        }
+        Ok(parsed)
+    }
+
+    /// Read `image` without checking every entry of its index first, for
+    /// an image that is known to have been built by `build_fs_image`. A
+    /// malformed image gives wrong answers, but nothing outside `image` is
+    /// ever read.
+    pub fn parse_unchecked(image: &'a [u8]) -> Self {
+        let count = if image.len() >= HEADER_SIZE && image[..8] == FS_IMAGE_MAGIC {
+            (read_u32(image, 8) as usize).min((image.len() - HEADER_SIZE) / ENTRY_SIZE)
+        } else {
+            0
+        };
+        Self { image, count }
+    }
+
+    /// The number of files in the image
+    pub fn len(&self) -> usize {
+        self.count
+    }
+
+    /// Whether the image has no files
+    pub fn is_empty(&self) -> bool {
+        self.count == 0
+    }
+
+    /// The contents of the file at `path`, if there is one. A leading `/`
+    /// on `path` is ignored.
+    pub fn get(&self, path: &str) -> Option<&'a [u8]> {
+        let path = path.trim_start_matches('/');
+        let (mut low, mut high) = (0, self.count);
+        while low < high {
+            let mid = low + (high - low) / 2;
+            match self.path(mid).cmp(path) {
+                core::cmp::Ordering::Less => low = mid + 1,
+                core::cmp::Ordering::Greater => high = mid,
+                core::cmp::Ordering::Equal => return Some(self.contents(mid)),
+            }
+        }
+        None
+    }
+
+    /// The paths and contents of the files in the image, sorted by path
+    pub fn files(&self) -> impl Iterator<Item = (&'a str, &'a [u8])> + 'a {
+        let fs = *self;
+        (0..self.count).map(move |i| (fs.path(i), fs.contents(i)))
+    }
+
+    fn path(&self, i: usize) -> &'a str {
+        // `parse` checked every path, and `parse_unchecked` is only for
+        // well-formed images
+        self.checked_path(i).unwrap_or_default()
+    }
+
+    fn contents(&self, i: usize) -> &'a [u8] {
+        // As for `path`
+        self.checked_contents(i).unwrap_or_default()
+    }
+
+    fn checked_path(&self, i: usize) -> Result<&'a str, FsImageError> {
+        let entry = HEADER_SIZE + i * ENTRY_SIZE;
+        let offset = read_u32(self.image, entry) as usize;
+        let len = read_u32(self.image, entry + 4) as usize;
+        let bytes = self.slice(offset, len)?;
+        match core::str::from_utf8(bytes) {
+            Ok(path) if !path.is_empty() => Ok(path),
+            _ => Err(FsImageError::InvalidPath),
+        }
+    }
+
+    fn checked_contents(&self, i: usize) -> Result<&'a [u8], FsImageError> {
+        let entry = HEADER_SIZE + i * ENTRY_SIZE;
+        let offset = usize::try_from(read_u64(self.image, entry + 8))
+            .map_err(|_| FsImageError::OutOfBounds)?;
+        let len = usize::try_from(read_u64(self.image, entry + 16))
+            .map_err(|_| FsImageError::OutOfBounds)?;
+        self.slice(offset, len)
+    }
+
+    fn slice(&self, offset: usize, len: usize) -> Result<&'a [u8], FsImageError> {
+        offset
+            .checked_add(len)
+            .and_then(|end| self.image.get(offset..end))
+            .ok_or(FsImageError::OutOfBounds)
+    }
+}
+
+/// Build an image holding `files`, given as pairs of a path and the file's
+/// contents. A leading `/` on a path is ignored.
+pub fn build_fs_image<'f>(
+    files: impl IntoIterator<Item = (&'f str, &'f [u8])>,
+) -> Result<Vec<u8>, FsImageError> {
+    let mut files: Vec<(&str, &[u8])> = files
+        .into_iter()
+        .map(|(path, contents)| (path.trim_start_matches('/'), contents))
+        .collect();
+    files.sort_unstable_by_key(|(path, _)| *path);
+    for (i, (path, _)) in files.iter().enumerate() {
+        if path.is_empty() {
+            return Err(FsImageError::InvalidPath);
+        }
+        if i > 0 && files[i - 1].0 == *path {
+            return Err(FsImageError::DuplicateOrUnsortedPath);
+        }
+    }
+
+    let count = u32::try_from(files.len()).map_err(|_| FsImageError::TooLarge)?;
+    let mut image = Vec::new();
+    image.extend_from_slice(&FS_IMAGE_MAGIC);
+    image.extend_from_slice(&count.to_le_bytes());
+    image.extend_from_slice(&[0; 4]);
+
+    // Lay out the paths and then the contents after the index, and fill
+    // in the index as we go
+    let mut path_offset = HEADER_SIZE + files.len() * ENTRY_SIZE;
+    let mut data_offset = path_offset + files.iter().map(|(path, _)| path.len()).sum::<usize>();
+    for (path, contents) in &files {
+        data_offset = data_offset.next_multiple_of(FS_IMAGE_DATA_ALIGN);
+        let path_offset_u32 = u32::try_from(path_offset).map_err(|_| FsImageError::TooLarge)?;
+        image.extend_from_slice(&path_offset_u32.to_le_bytes());
+        let path_len_u32 = u32::try_from(path.len()).map_err(|_| FsImageError::TooLarge)?;
+        image.extend_from_slice(&path_len_u32.to_le_bytes());
+        image.extend_from_slice(&(data_offset as u64).to_le_bytes());
+        image.extend_from_slice(&(contents.len() as u64).to_le_bytes());
+        path_offset += path.len();
+        data_offset += contents.len();
+    }
+    for (path, _) in &files {
+        image.extend_from_slice(path.as_bytes());
+    }
+    for (_, contents) in &files {
+        image.resize(image.len().next_multiple_of(FS_IMAGE_DATA_ALIGN), 0);
+        image.extend_from_slice(contents);
+    }
+    Ok(image)
+}
+
+fn read_u32(bytes: &[u8], offset: usize) -> u32 {
+    let mut buf = [0u8; 4];
+    buf.copy_from_slice(&bytes[offset..offset + 4]);
+    u32::from_le_bytes(buf)
+}
+
+fn read_u64(bytes: &[u8], offset: usize) -> u64 {
+    let mut buf = [0u8; 8];
+    buf.copy_from_slice(&bytes[offset..offset + 8]);
+    u64::from_le_bytes(buf)
+}
+
+#[cfg(test)]
+mod tests {
+    use alloc::vec;
+    use alloc::vec::Vec;
+
+    use super::{build_fs_image, FsImage, FsImageError, FS_IMAGE_DATA_ALIGN};
+
+    #[test]
+    fn build_and_read() {
+        let large = (0..1000).map(|i| i as u8).collect::<Vec<_>>();
+        let files: [(&str, &[u8]); 4] = [
+            ("templates/index.html", b"<html></html>"),
+            ("/empty", b""),
+            ("data/large.bin", &large),
+            ("a", b"first"),
+        ];
+        let image = build_fs_image(files).unwrap();
+        let fs = FsImage::parse(&image).unwrap();
+
+        assert_eq!(fs.len(), 4);
+        assert_eq!(fs.get("templates/index.html"), Some(&b"<html></html>"[..]));
+        assert_eq!(fs.get("/templates/index.html"), Some(&b"<html></html>"[..]));
+        assert_eq!(fs.get("empty"), Some(&b""[..]));
+        assert_eq!(fs.get("data/large.bin"), Some(&large[..]));
+        assert_eq!(fs.get("a"), Some(&b"first"[..]));
+        assert_eq!(fs.get("templates"), None);
+        assert_eq!(fs.get("missing"), None);
+
+        let paths = fs.files().map(|(path, _)| path).collect::<Vec<_>>();
+        assert_eq!(
+            paths,
+            vec!["a", "data/large.bin", "empty", "templates/index.html"]
+        );
+        for (_, contents) in fs.files() {
+            let offset = contents.as_ptr() as usize - image.as_ptr() as usize;
+            assert_eq!(offset % FS_IMAGE_DATA_ALIGN, 0);
+        }
+    }
+
+    #[test]
+    fn invalid_images() {
+        let files: [(&str, &[u8]); 2] = [("a", b"1"), ("/a", b"2")];
+        assert_eq!(
+            build_fs_image(files).unwrap_err(),
+            FsImageError::DuplicateOrUnsortedPath
+        );
+        let files: [(&str, &[u8]); 1] = [("/", b"1")];
+        assert_eq!(
+            build_fs_image(files).unwrap_err(),
+            FsImageError::InvalidPath
+        );
+
+        let files: [(&str, &[u8]); 1] = [("a", b"contents")];
+        let image = build_fs_image(files).unwrap();
+        assert_eq!(
+            FsImage::parse(&image[1..]).unwrap_err(),
+            FsImageError::BadMagic
+        );
+        assert_eq!(
+            FsImage::parse(&image[..image.len() - 1]).unwrap_err(),
+            FsImageError::OutOfBounds
+        );
+        let mut bad_path = image.clone();
+        bad_path[20] = 0xff;
+        assert_eq!(
+            FsImage::parse(&bad_path).unwrap_err(),
+            FsImageError::OutOfBounds
+        );
+    }
+}
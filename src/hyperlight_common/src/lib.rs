@@ -22,6 +22,8 @@ limitations under the License.
 
 extern crate alloc;
 
+/// A ring buffer of messages shared between two sandboxes
+pub mod channel;
 pub mod flatbuffer_wrappers;
 /// cbindgen:ignore
 /// FlatBuffers-related utilities and (mostly) generated code
@@ -34,5 +36,7 @@ pub mod flatbuffer_wrappers;
     non_camel_case_types
 )]
 mod flatbuffers;
+/// A read-only archive of files that guests read in place
+pub mod fs_image;
 /// cbindgen:ignore
 pub mod mem;
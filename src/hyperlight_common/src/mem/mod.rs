@@ -85,6 +85,37 @@ pub struct GuestPanicContextData {
     pub guestPanicContextDataBuffer: *mut c_void,
 }
 
+/// The most read-only shared data regions a sandbox can have mapped
+pub const MAX_SHARED_DATA_REGIONS: usize = 16;
+/// The most bytes the name of a shared data region can have
+pub const SHARED_DATA_NAME_LEN: usize = 32;
+
+/// Set in `SharedDataRegion::sharedDataFlags` if the guest can write to
+/// the region, which is then not read-only data but the end of a channel
+pub const SHARED_DATA_WRITABLE: u64 = 1;
+/// Set in `SharedDataRegion::sharedDataFlags` if the guest is to send
+/// messages on the channel in the region
+pub const SHARED_DATA_CHANNEL_SENDER: u64 = 2;
+/// Set in `SharedDataRegion::sharedDataFlags` if the guest is to receive
+/// messages on the channel in the region
+pub const SHARED_DATA_CHANNEL_RECEIVER: u64 = 4;
+
+#[repr(C)]
+pub struct SharedDataRegion {
+    /// The name of the region, padded with zeros
+    pub name: [u8; SHARED_DATA_NAME_LEN],
+    pub sharedDataSize: u64,
+    pub sharedDataBuffer: *const c_void,
+    /// `SHARED_DATA_WRITABLE` and which end of a channel the region is
+    pub sharedDataFlags: u64,
+}
+
+#[repr(C)]
+pub struct GuestSharedData {
+    pub sharedDataCount: u64,
+    pub sharedDataRegions: [SharedDataRegion; MAX_SHARED_DATA_REGIONS],
+}
+
 #[repr(C)]
 pub struct HyperlightPEB {
     pub security_cookie_seed: u64,
@@ -101,4 +132,5 @@ pub struct HyperlightPEB {
     pub guestPanicContextData: GuestPanicContextData,
     pub guestheapData: GuestHeapData,
     pub gueststackData: GuestStackData,
+    pub sharedData: GuestSharedData,
 }
@@ -42,6 +42,7 @@ fn copy_includes<P: AsRef<Path>, Q: AsRef<Path> + std::fmt::Debug>(include_dir:
 fn cargo_main() {
     println!("cargo:rerun-if-changed=third_party");
     println!("cargo:rerun-if-changed=include");
+    println!("cargo:rerun-if-changed=vecmath");
 
     let mut cfg = cc::Build::new();
 
@@ -61,6 +62,9 @@ fn cargo_main() {
             .include("third_party/musl/src/internal")
             .include("third_party/musl/arch/generic")
             .include("third_party/musl/arch/x86_64");
+
+        // batched math functions, which build on musl's libm
+        cfg.include("include").file("vecmath/vecmath.c");
     }
 
     let is_pe = env::var("CARGO_CFG_WINDOWS").is_ok();
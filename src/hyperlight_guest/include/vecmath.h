@@ -0,0 +1,63 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _VECMATH_H
+#define _VECMATH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/*
+ * Batched math functions: each one sets y[i] = f(x[i]) for i < n, using
+ * SSE2, or AVX2 when the guest's C code is compiled with it enabled. x and
+ * y may be the same array, but must not otherwise overlap.
+ *
+ * Inputs outside the range a kernel handles (infinities, nans, very large
+ * or very small values, and anything that would overflow or underflow) are
+ * passed to the scalar libm function. Other results are within these
+ * bounds of the exact result, in units in the last place:
+ *
+ *   hl_vexp, hl_vlog, hl_vsin, hl_vcos      1 ulp
+ *   hl_vexpf, hl_vlogf, hl_vsinf, hl_vcosf  1 ulp
+ *   hl_vtanh, hl_vtanhf                     2 ulp
+ *   hl_vsqrt, hl_vsqrtf                     correctly rounded
+ *
+ * The bounds hold for both the SSE2 and the AVX2 build, whether or not the
+ * compiler fuses multiplies and adds.
+ */
+
+void hl_vexp(const double *x, double *y, size_t n);
+void hl_vlog(const double *x, double *y, size_t n);
+void hl_vsin(const double *x, double *y, size_t n);
+void hl_vcos(const double *x, double *y, size_t n);
+void hl_vtanh(const double *x, double *y, size_t n);
+void hl_vsqrt(const double *x, double *y, size_t n);
+
+void hl_vexpf(const float *x, float *y, size_t n);
+void hl_vlogf(const float *x, float *y, size_t n);
+void hl_vsinf(const float *x, float *y, size_t n);
+void hl_vcosf(const float *x, float *y, size_t n);
+void hl_vtanhf(const float *x, float *y, size_t n);
+void hl_vsqrtf(const float *x, float *y, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VECMATH_H */
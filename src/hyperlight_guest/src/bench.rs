@@ -0,0 +1,143 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Micro-benchmarks that run entirely inside the guest.
+//!
+//! A benchmark is a function registered with [`register_benchmark`]. The
+//! host runs it with the guest function [`RUN_BENCHMARK_FUNCTION`], which
+//! takes the benchmark's name, a number of samples and a number of
+//! iterations per sample, and returns one timing per sample: the number
+//! of TSC cycles it took to call the benchmark that many times, as a
+//! little-endian `u64`. As the whole run happens in one guest call, the
+//! timings include no VM exits.
+//!
+//! Each iteration also includes an indirect call, which the built-in
+//! benchmark [`NOP_BENCHMARK`] measures on its own.
+
+use alloc::collections::BTreeMap;
+use alloc::format;
+use alloc::string::{String, ToString};
+use alloc::vec::Vec;
+use core::arch::asm;
+use core::hint::black_box;
+
+use hyperlight_common::flatbuffer_wrappers::function_call::FunctionCall;
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterType, ParameterValue, ReturnType,
+};
+use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
+use hyperlight_common::flatbuffer_wrappers::util::get_flatbuffer_result;
+
+use crate::error::{HyperlightGuestError, Result};
+use crate::guest_function_definition::GuestFunctionDefinition;
+use crate::guest_function_register::register_function;
+
+/// The name of the guest function that runs a benchmark
+pub const RUN_BENCHMARK_FUNCTION: &str = "RunGuestBenchmark";
+
+/// The name of the built-in benchmark that does nothing, which measures
+/// the overhead included in every iteration of every benchmark
+pub const NOP_BENCHMARK: &str = "nop";
+
+/// The registered benchmarks, by name
+static mut BENCHMARKS: BTreeMap<String, fn()> = BTreeMap::new();
+
+/// Register `body` as the benchmark `name`, replacing any benchmark already
+/// registered under that name.
+///
+/// `body` runs the code being measured once. Any setup it needs should be
+/// done before it is registered, and its results passed to
+/// `core::hint::black_box` so that they are not optimised away.
+pub fn register_benchmark(name: &str, body: fn()) {
+    // This is currently safe, because we are single threaded, as is
+    // `register_function`
+    #[allow(static_mut_refs)]
+    let benchmarks = unsafe { &mut BENCHMARKS };
+    if benchmarks.is_empty() {
+        benchmarks.insert(NOP_BENCHMARK.to_string(), nop);
+        register_function(GuestFunctionDefinition::new(
+            RUN_BENCHMARK_FUNCTION.to_string(),
+            Vec::from(&[
+                ParameterType::String,
+                ParameterType::Int,
+                ParameterType::Int,
+            ]),
+            ReturnType::VecBytes,
+            run_benchmark as usize,
+        ));
+    }
+    benchmarks.insert(name.to_string(), body);
+}
+
+fn nop() {}
+
+/// Read the TSC, after every earlier instruction has finished and before
+/// any later one starts
+#[inline(always)]
+fn read_tsc() -> u64 {
+    let low: u32;
+    let high: u32;
+    unsafe {
+        asm!(
+            "lfence",
+            "rdtsc",
+            "lfence",
+            out("eax") low,
+            out("edx") high,
+            options(nostack, preserves_flags)
+        );
+    }
+    (u64::from(high) << 32) | u64::from(low)
+}
+
+fn run_benchmark(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    let (name, samples, iterations) = match function_call.parameters.as_deref() {
+        Some(
+            [ParameterValue::String(name), ParameterValue::Int(samples), ParameterValue::Int(iterations)],
+        ) if *samples >= 0 && *iterations >= 0 => (name, *samples, *iterations),
+        _ => {
+            return Err(HyperlightGuestError::new(
+                ErrorCode::GuestFunctionParameterTypeMismatch,
+                "Invalid parameters passed to run_benchmark".to_string(),
+            ))
+        }
+    };
+
+    #[allow(static_mut_refs)]
+    let body = match unsafe { BENCHMARKS.get(name) } {
+        Some(body) => *body,
+        None => {
+            return Err(HyperlightGuestError::new(
+                ErrorCode::GuestError,
+                format!("No benchmark called {} is registered", name),
+            ))
+        }
+    };
+
+    // Keep the compiler from seeing which function `body` is, so that the
+    // loop below is the same for every benchmark
+    let body = black_box(body);
+    let mut timings = Vec::with_capacity(samples as usize * 8);
+    for _ in 0..samples {
+        let start = read_tsc();
+        for _ in 0..iterations {
+            body();
+        }
+        let end = read_tsc();
+        timings.extend_from_slice(&end.wrapping_sub(start).to_le_bytes());
+    }
+    Ok(get_flatbuffer_result(&*timings))
+}
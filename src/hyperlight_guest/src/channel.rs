@@ -0,0 +1,158 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! One-way channels of messages to or from other guests, which the host
+//! has mapped into this guest with `UninitializedSandbox::map_channel_sender`
+//! or `UninitializedSandbox::map_channel_receiver`.
+//!
+//! A channel is shared with one other guest (or the host), and this guest
+//! is given one end of it: either it sends messages on the channel with a
+//! `Sender`, or receives them with a `Receiver`. Sending copies the
+//! message into the channel, and receiving can read it in place, so
+//! passing a message from one guest to another copies it once.
+
+use alloc::format;
+use alloc::vec::Vec;
+use core::sync::atomic::{AtomicU32, Ordering};
+
+use hyperlight_common::channel::{ChannelError, ChannelRing};
+use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
+use hyperlight_common::mem::{
+    MAX_SHARED_DATA_REGIONS, SHARED_DATA_CHANNEL_RECEIVER, SHARED_DATA_CHANNEL_SENDER,
+};
+
+use crate::error::{HyperlightGuestError, Result};
+use crate::shared_data;
+
+/// A bit for each region in the PEB, set while a `Sender` or `Receiver`
+/// has it open, so that there is only ever one of each
+static OPEN: AtomicU32 = AtomicU32::new(0);
+const _: () = assert!(MAX_SHARED_DATA_REGIONS <= u32::BITS as usize);
+
+/// The end of a channel that the host mapped into this guest as an open
+/// region of the PEB
+struct OpenEnd {
+    ring: ChannelRing,
+    index: usize,
+}
+
+impl OpenEnd {
+    /// Open the region the host mapped under `name`, if it is the end of a
+    /// channel given by `channel_end` and is not already open
+    fn open(name: &str, channel_end: u64) -> Option<Self> {
+        let region = shared_data::find(name)?;
+        if !region.is_writable() || region.flags & channel_end == 0 {
+            return None;
+        }
+        let bit = 1 << region.index;
+        if OPEN.fetch_or(bit, Ordering::AcqRel) & bit != 0 {
+            return None;
+        }
+        // The host zeroes a channel's memory when it creates it, and the
+        // memory stays mapped for the life of the sandbox
+        match unsafe { ChannelRing::from_raw_parts(region.ptr, region.len) } {
+            Some(ring) => Some(Self {
+                ring,
+                index: region.index,
+            }),
+            None => {
+                OPEN.fetch_and(!bit, Ordering::AcqRel);
+                None
+            }
+        }
+    }
+}
+
+impl Drop for OpenEnd {
+    fn drop(&mut self) {
+        OPEN.fetch_and(!(1 << self.index), Ordering::AcqRel);
+    }
+}
+
+/// The sending end of a channel, which the host mapped into this guest
+/// with `UninitializedSandbox::map_channel_sender`
+pub struct Sender {
+    end: OpenEnd,
+}
+
+impl Sender {
+    /// Open the sending end of the channel the host mapped under `name`,
+    /// if there is one and it is not already open
+    pub fn open(name: &str) -> Option<Self> {
+        OpenEnd::open(name, SHARED_DATA_CHANNEL_SENDER).map(|end| Self { end })
+    }
+
+    /// The largest message that can be sent on the channel
+    pub fn max_message_len(&self) -> usize {
+        self.end.ring.max_message_len()
+    }
+
+    /// Whether the other end has received every message sent so far
+    pub fn is_empty(&self) -> bool {
+        self.end.ring.is_empty()
+    }
+
+    /// Send `message` on the channel, returning `Ok(false)` without sending
+    /// it if the channel does not have room for it until the other end has
+    /// received more messages.
+    pub fn try_send(&mut self, message: &[u8]) -> Result<bool> {
+        match self.end.ring.try_send(message) {
+            Ok(()) => Ok(true),
+            Err(ChannelError::Full) => Ok(false),
+            Err(e) => Err(channel_error("send a message on", e)),
+        }
+    }
+}
+
+/// The receiving end of a channel, which the host mapped into this guest
+/// with `UninitializedSandbox::map_channel_receiver`
+pub struct Receiver {
+    end: OpenEnd,
+}
+
+impl Receiver {
+    /// Open the receiving end of the channel the host mapped under `name`,
+    /// if there is one and it is not already open
+    pub fn open(name: &str) -> Option<Self> {
+        OpenEnd::open(name, SHARED_DATA_CHANNEL_RECEIVER).map(|end| Self { end })
+    }
+
+    /// Whether there are no messages waiting to be received
+    pub fn is_empty(&self) -> bool {
+        self.end.ring.is_empty()
+    }
+
+    /// Receive the next message on the channel, if there is one, passing it
+    /// to `f` where it is in the channel rather than copying it out.
+    pub fn try_recv_with<R>(&mut self, f: impl FnOnce(&[u8]) -> R) -> Result<Option<R>> {
+        self.end
+            .ring
+            .try_recv_with(f)
+            .map_err(|e| channel_error("receive a message on", e))
+    }
+
+    /// Receive the next message on the channel, if there is one
+    pub fn try_recv(&mut self) -> Result<Option<Vec<u8>>> {
+        self.try_recv_with(|message| message.to_vec())
+    }
+}
+
+fn channel_error(action: &str, e: ChannelError) -> HyperlightGuestError {
+    HyperlightGuestError::new(
+        ErrorCode::GuestError,
+        format!("Failed to {} a channel: {:?}", action, e),
+    )
+}
@@ -27,6 +27,7 @@ use crate::guest_error::reset_error;
 use crate::guest_function_call::dispatch_function;
 use crate::guest_logger::init_logger;
 use crate::host_function_call::{outb, OutBAction};
+use crate::host_functions::load_host_function_catalog;
 use crate::idtr::load_idt;
 use crate::{
     __security_cookie, HEAP_ALLOCATOR, MIN_STACK_ADDRESS, OS_PAGE_SIZE, OUTB_PTR,
@@ -82,6 +83,19 @@ pub extern "win64" fn entrypoint(peb_address: u64, seed: u64, ops: u64, max_log_
         panic!("PEB address is null");
     }
 
+    // The host may resume an already initialised guest on a new vCPU (after a
+    // cancelled call, or when loading a sandbox from a snapshot file). The GDT
+    // and IDT are vCPU state rather than memory, so load them again. A
+    // sandbox loaded from a snapshot file may also expose different host
+    // functions from the one the snapshot was taken of.
+    if INIT.is_completed() && unsafe { RUNNING_MODE } == RunMode::Hypervisor {
+        unsafe {
+            load_gdt();
+            load_idt();
+        }
+        load_host_function_catalog();
+    }
+
     INIT.call_once(|| {
         unsafe {
             P_PEB = Some(peb_address as *mut HyperlightPEB);
@@ -148,6 +162,10 @@ pub extern "win64" fn entrypoint(peb_address: u64, seed: u64, ops: u64, max_log_
 
             reset_error();
 
+            // Decode the host function details now, rather than on the first
+            // host function call
+            load_host_function_catalog();
+
             hyperlight_main();
         }
     });
@@ -0,0 +1,132 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Read-only file systems, which the host has built as images and mapped
+//! into this guest with `UninitializedSandbox::map_file_system_image`.
+//!
+//! Files are read straight from the image, which stays mapped for the
+//! life of the sandbox, so reading them needs no host calls.
+
+use alloc::format;
+use core::slice::from_raw_parts;
+
+use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
+use hyperlight_common::fs_image::FsImage;
+
+use crate::error::{HyperlightGuestError, Result};
+use crate::shared_data;
+
+/// A file system image the host has mapped into this guest
+#[derive(Clone, Copy)]
+pub struct FileSystem {
+    image: FsImage<'static>,
+}
+
+impl FileSystem {
+    /// Mount the file system image the host mapped under `name`, checking
+    /// that it is well-formed
+    pub fn mount(name: &str) -> Result<Self> {
+        let region = shared_data::find(name).ok_or_else(|| {
+            HyperlightGuestError::new(
+                ErrorCode::GuestError,
+                format!("There is no file system image called {}", name),
+            )
+        })?;
+        // Files are handed out as `&'static [u8]`, which must not change
+        if region.is_writable() {
+            return Err(HyperlightGuestError::new(
+                ErrorCode::GuestError,
+                format!("{} is a channel, not a file system image", name),
+            ));
+        }
+        let data = unsafe { from_raw_parts(region.ptr, region.len) };
+        let image = FsImage::parse(data).map_err(|e| {
+            HyperlightGuestError::new(
+                ErrorCode::GuestError,
+                format!("The file system image {} is not valid: {:?}", name, e),
+            )
+        })?;
+        Ok(Self { image })
+    }
+
+    /// Open the file at `path`, if there is one. A leading `/` on `path` is
+    /// ignored.
+    pub fn open(&self, path: &str) -> Option<File> {
+        self.image.get(path).map(|contents| File {
+            contents,
+            position: 0,
+        })
+    }
+
+    /// The contents of the file at `path`, if there is one, where they are
+    /// in the image
+    pub fn read(&self, path: &str) -> Option<&'static [u8]> {
+        self.image.get(path)
+    }
+
+    /// The paths and sizes of the files in the image, sorted by path
+    pub fn files(&self) -> impl Iterator<Item = (&'static str, usize)> {
+        self.image
+            .files()
+            .map(|(path, contents)| (path, contents.len()))
+    }
+}
+
+/// A file opened with `FileSystem::open`
+#[derive(Clone, Copy, Debug)]
+pub struct File {
+    contents: &'static [u8],
+    position: usize,
+}
+
+impl File {
+    /// The size of the file
+    pub fn len(&self) -> usize {
+        self.contents.len()
+    }
+
+    /// Whether the file is empty
+    pub fn is_empty(&self) -> bool {
+        self.contents.is_empty()
+    }
+
+    /// Where in the file the next `read` starts
+    pub fn position(&self) -> usize {
+        self.position
+    }
+
+    /// Move to `position` in the file, or to the end of it if `position` is
+    /// past the end
+    pub fn seek(&mut self, position: usize) {
+        self.position = position.min(self.contents.len());
+    }
+
+    /// Copy as much of the rest of the file as fits into `buf`, and return
+    /// the number of bytes copied, which is 0 at the end of the file
+    pub fn read(&mut self, buf: &mut [u8]) -> usize {
+        let rest = &self.contents[self.position..];
+        let len = rest.len().min(buf.len());
+        buf[..len].copy_from_slice(&rest[..len]);
+        self.position += len;
+        len
+    }
+
+    /// The whole of the file, where it is in the image, like a read-only
+    /// memory mapping of it
+    pub fn as_bytes(&self) -> &'static [u8] {
+        self.contents
+    }
+}
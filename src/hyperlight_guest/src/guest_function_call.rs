@@ -17,22 +17,32 @@ limitations under the License.
 use alloc::format;
 use alloc::vec::Vec;
 
-use hyperlight_common::flatbuffer_wrappers::function_call::{FunctionCall, FunctionCallType};
-use hyperlight_common::flatbuffer_wrappers::function_types::ParameterType;
+use hyperlight_common::flatbuffer_wrappers::function_call::{
+    FunctionCall, FunctionCallType, FunctionCallView,
+};
 use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 
 use crate::entrypoint::halt;
 use crate::error::{HyperlightGuestError, Result};
 use crate::guest_error::{reset_error, set_error};
-use crate::shared_input_data::try_pop_shared_input_data_into;
+use crate::shared_input_data::{peek_shared_input_data, pop_shared_input_data};
 use crate::shared_output_data::push_shared_output_data;
 use crate::REGISTERED_GUEST_FUNCTIONS;
 
 type GuestFunc = fn(&FunctionCall) -> Result<Vec<u8>>;
-
-pub(crate) fn call_guest_function(function_call: FunctionCall) -> Result<Vec<u8>> {
+type GuestViewFunc = fn(&FunctionCallView) -> Result<Vec<u8>>;
+
+/// Call the guest function `function_call` is for, then pop `function_call`
+/// from the shared input data buffer it is read from.
+///
+/// Functions registered with `GuestFunctionDefinition::new_view` read their
+/// parameters from the buffer, so it is only popped once they return. For
+/// all other functions, the call is copied into a `FunctionCall` and popped
+/// first, leaving the whole buffer free for the function's host calls.
+pub(crate) fn call_guest_function(function_call: FunctionCallView) -> Result<Vec<u8>> {
     // Validate this is a Guest Function Call
     if function_call.function_call_type() != FunctionCallType::Guest {
+        pop_shared_input_data()?;
         return Err(HyperlightGuestError::new(
             ErrorCode::GuestError,
             format!(
@@ -44,24 +54,27 @@ pub(crate) fn call_guest_function(function_call: FunctionCall) -> Result<Vec<u8>
 
     // Find the function definition for the function call.
     if let Some(registered_function_definition) =
-        unsafe { REGISTERED_GUEST_FUNCTIONS.get(&function_call.function_name) }
+        unsafe { REGISTERED_GUEST_FUNCTIONS.get(function_call.function_name()) }
     {
-        let function_call_parameter_types: Vec<ParameterType> = function_call
-            .parameters
-            .iter()
-            .flatten()
-            .map(|p| p.into())
-            .collect();
-
         // Verify that the function call has the correct parameter types and length.
-        registered_function_definition.verify_parameters(&function_call_parameter_types)?;
-
-        let p_function = unsafe {
-            let function_pointer = registered_function_definition.function_pointer;
-            core::mem::transmute::<usize, GuestFunc>(function_pointer)
-        };
+        if let Err(e) = registered_function_definition.verify_call(&function_call) {
+            pop_shared_input_data()?;
+            return Err(e);
+        }
 
-        p_function(&function_call)
+        let function_pointer = registered_function_definition.function_pointer;
+        if registered_function_definition.takes_view {
+            let p_function =
+                unsafe { core::mem::transmute::<usize, GuestViewFunc>(function_pointer) };
+            let result = p_function(&function_call);
+            pop_shared_input_data()?;
+            result
+        } else {
+            let p_function = unsafe { core::mem::transmute::<usize, GuestFunc>(function_pointer) };
+            let function_call = FunctionCall::from(function_call);
+            pop_shared_input_data()?;
+            p_function(&function_call)
+        }
     } else {
         // The given function is not registered. The guest should implement a function called guest_dispatch_function to handle this.
 
@@ -72,6 +85,8 @@ pub(crate) fn call_guest_function(function_call: FunctionCall) -> Result<Vec<u8>
             fn guest_dispatch_function(function_call: FunctionCall) -> Result<Vec<u8>>;
         }
 
+        let function_call = FunctionCall::from(function_call);
+        pop_shared_input_data()?;
         unsafe { guest_dispatch_function(function_call) }
     }
 }
@@ -86,7 +101,10 @@ fn internal_dispatch_function() -> Result<()> {
     #[cfg(debug_assertions)]
     log::trace!("internal_dispatch_function");
 
-    let function_call = try_pop_shared_input_data_into::<FunctionCall>()
+    // The call is read in place, and popped by `call_guest_function` once it
+    // is no longer needed
+    let function_call = unsafe { peek_shared_input_data() }
+        .and_then(|buffer| Ok(FunctionCallView::try_from(buffer)?))
         .expect("Function call deserialization failed");
 
     let result_vec = call_guest_function(function_call).inspect_err(|e| {
@@ -18,6 +18,7 @@ use alloc::format;
 use alloc::string::String;
 use alloc::vec::Vec;
 
+use hyperlight_common::flatbuffer_wrappers::function_call::FunctionCallView;
 use hyperlight_common::flatbuffer_wrappers::function_types::{ParameterType, ReturnType};
 use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 
@@ -34,6 +35,9 @@ pub struct GuestFunctionDefinition {
     pub return_type: ReturnType,
     /// The function pointer to the guest function
     pub function_pointer: usize,
+    /// Whether the guest function takes a `&FunctionCallView` rather than a
+    /// `&FunctionCall`
+    pub takes_view: bool,
 }
 
 impl GuestFunctionDefinition {
@@ -49,44 +53,78 @@ impl GuestFunctionDefinition {
             parameter_types,
             return_type,
             function_pointer,
+            takes_view: false,
+        }
+    }
+
+    /// Create a new `GuestFunctionDefinition` for a function that takes a
+    /// `&FunctionCallView`, which reads its parameters in place from the
+    /// input buffer rather than copying them into a `FunctionCall`.
+    pub fn new_view(
+        function_name: String,
+        parameter_types: Vec<ParameterType>,
+        return_type: ReturnType,
+        function_pointer: usize,
+    ) -> Self {
+        Self {
+            function_name,
+            parameter_types,
+            return_type,
+            function_pointer,
+            takes_view: true,
         }
     }
 
     /// Verify that `self` has same signature as the provided `parameter_types`.
     pub fn verify_parameters(&self, parameter_types: &[ParameterType]) -> Result<()> {
+        self.verify_parameter_types(parameter_types.len(), parameter_types.iter().cloned())
+    }
+
+    /// Verify that `function_call` passes parameters of the types `self` takes.
+    pub fn verify_call(&self, function_call: &FunctionCallView) -> Result<()> {
+        self.verify_parameter_types(
+            function_call.parameter_count(),
+            function_call.parameter_types(),
+        )
+    }
+
+    fn verify_parameter_types(
+        &self,
+        parameter_count: usize,
+        parameter_types: impl Iterator<Item = ParameterType>,
+    ) -> Result<()> {
         // Verify that the function does not have more than `MAX_PARAMETERS` parameters.
         const MAX_PARAMETERS: usize = 11;
-        if parameter_types.len() > MAX_PARAMETERS {
+        if parameter_count > MAX_PARAMETERS {
             return Err(HyperlightGuestError::new(
                 ErrorCode::GuestError,
                 format!(
                     "Function {} has too many parameters: {} (max allowed is {}).",
-                    self.function_name,
-                    parameter_types.len(),
-                    MAX_PARAMETERS
+                    self.function_name, parameter_count, MAX_PARAMETERS
                 ),
             ));
         }
 
-        if self.parameter_types.len() != parameter_types.len() {
+        if self.parameter_types.len() != parameter_count {
             return Err(HyperlightGuestError::new(
                 ErrorCode::GuestFunctionIncorrecNoOfParameters,
                 format!(
                     "Called function {} with {} parameters but it takes {}.",
                     self.function_name,
-                    parameter_types.len(),
+                    parameter_count,
                     self.parameter_types.len()
                 ),
             ));
         }
 
-        for (i, parameter_type) in self.parameter_types.iter().enumerate() {
-            if parameter_type != &parameter_types[i] {
+        for (i, (expected, actual)) in self.parameter_types.iter().zip(parameter_types).enumerate()
+        {
+            if *expected != actual {
                 return Err(HyperlightGuestError::new(
                     ErrorCode::GuestFunctionParameterTypeMismatch,
                     format!(
                         "Expected parameter type {:?} for parameter index {} of function {} but got {:?}.",
-                        parameter_type, i, self.function_name, parameter_types[i]
+                        expected, i, self.function_name, actual
                     ),
                 ));
             }
@@ -38,6 +38,10 @@ pub enum OutBAction {
     Log = 99,
     CallFunction = 101,
     Abort = 102,
+    WorkerCount = 103,
+    RunWorkers = 104,
+    JoinWorkers = 105,
+    GrowHeap = 106,
 }
 
 /// Get a return value from a host function call.
@@ -15,80 +15,158 @@ limitations under the License.
 */
 
 use alloc::format;
-use alloc::string::ToString;
+use alloc::string::{String, ToString};
 use alloc::vec::Vec;
 use core::slice::from_raw_parts;
 
 use hyperlight_common::flatbuffer_wrappers::function_call::FunctionCall;
-use hyperlight_common::flatbuffer_wrappers::function_types::ParameterType;
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterType, ParameterValue, ReturnType,
+};
 use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 use hyperlight_common::flatbuffer_wrappers::host_function_details::HostFunctionDetails;
+use spin::{RwLock, RwLockReadGuard};
 
 use crate::error::{HyperlightGuestError, Result};
 use crate::P_PEB;
 
-pub(crate) fn validate_host_function_call(function_call: &FunctionCall) -> Result<()> {
-    // get host function details
-    let host_function_details = get_host_function_details();
-
-    // check if there are any host functions
-    if host_function_details.host_functions.is_none() {
-        return Err(HyperlightGuestError::new(
-            ErrorCode::GuestError,
-            "No host functions found".to_string(),
-        ));
-    }
-
-    // check if function w/ given name exists
-    let host_function = if let Some(host_function) =
-        host_function_details.find_by_function_name(&function_call.function_name)
-    {
-        host_function
-    } else {
-        return Err(HyperlightGuestError::new(
-            ErrorCode::GuestError,
-            format!(
-                "Host Function Not Found: {}",
-                function_call.function_name.clone()
-            ),
-        ));
-    };
+/// The signature of a function exposed by the host
+#[derive(Debug, Clone)]
+pub struct HostFunctionSignature {
+    /// The name of the function
+    pub function_name: String,
+    /// The types of the function's parameters, which is empty if it has none
+    pub parameter_types: Vec<ParameterType>,
+    /// The type of the function's return value
+    pub return_type: ReturnType,
+    /// The hash of `function_name`, by which the catalog is sorted
+    name_hash: u64,
+}
 
-    let function_call_fparameters = if let Some(parameters) = function_call.parameters.clone() {
-        parameters
-    } else {
-        if host_function.parameter_types.is_some() {
+impl HostFunctionSignature {
+    /// Check whether `parameters` match the types of this function's
+    /// parameters, without allocating unless they don't.
+    fn verify_parameters(&self, parameters: &[ParameterValue]) -> Result<()> {
+        if parameters.len() != self.parameter_types.len() {
             return Err(HyperlightGuestError::new(
                 ErrorCode::GuestError,
                 format!(
                     "Incorrect parameter count for function: {}",
-                    function_call.function_name.clone()
+                    self.function_name
                 ),
             ));
         }
-
-        Vec::new() // if no parameters (and no mismatches), return empty vector
-    };
-
-    let function_call_parameter_types = function_call_fparameters
-        .iter()
-        .map(|p| p.into())
-        .collect::<Vec<ParameterType>>();
-
-    // Verify that the function call has the correct parameter types.
-    host_function
-        .verify_equal_parameter_types(&function_call_parameter_types)
-        .map_err(|_| {
-            HyperlightGuestError::new(
+        if !parameters
+            .iter()
+            .zip(&self.parameter_types)
+            .all(|(value, parameter_type)| ParameterType::from(value) == *parameter_type)
+        {
+            return Err(HyperlightGuestError::new(
                 ErrorCode::GuestError,
                 format!(
                     "Incorrect parameter type for function: {}",
-                    function_call.function_name.clone()
+                    self.function_name
                 ),
-            )
-        })?;
+            ));
+        }
+        Ok(())
+    }
+}
+
+/// The functions exposed by the host, decoded from the PEB once and indexed
+/// by the hash of their names.
+#[derive(Debug, Default)]
+pub struct HostFunctionCatalog {
+    /// Sorted by `name_hash`
+    functions: Vec<HostFunctionSignature>,
+}
+
+impl HostFunctionCatalog {
+    fn new(details: HostFunctionDetails) -> Self {
+        let mut functions: Vec<HostFunctionSignature> = details
+            .host_functions
+            .unwrap_or_default()
+            .into_iter()
+            .map(|definition| HostFunctionSignature {
+                name_hash: name_hash(&definition.function_name),
+                function_name: definition.function_name,
+                parameter_types: definition.parameter_types.unwrap_or_default(),
+                return_type: definition.return_type,
+            })
+            .collect();
+        functions.sort_unstable_by_key(|function| function.name_hash);
+        Self { functions }
+    }
+
+    /// Get the signature of the host function called `function_name`
+    pub fn get(&self, function_name: &str) -> Option<&HostFunctionSignature> {
+        let hash = name_hash(function_name);
+        let first = self
+            .functions
+            .partition_point(|function| function.name_hash < hash);
+        self.functions[first..]
+            .iter()
+            .take_while(|function| function.name_hash == hash)
+            .find(|function| function.function_name == function_name)
+    }
+
+    /// The number of functions exposed by the host
+    pub fn len(&self) -> usize {
+        self.functions.len()
+    }
+
+    /// Whether the host exposes no functions
+    pub fn is_empty(&self) -> bool {
+        self.functions.is_empty()
+    }
+}
+
+/// FNV-1a, which is cheap for the short strings function names are
+fn name_hash(name: &str) -> u64 {
+    name.bytes().fold(0xcbf2_9ce4_8422_2325, |hash, byte| {
+        (hash ^ u64::from(byte)).wrapping_mul(0x0100_0000_01b3)
+    })
+}
+
+static HOST_FUNCTION_CATALOG: RwLock<HostFunctionCatalog> = RwLock::new(HostFunctionCatalog {
+    functions: Vec::new(),
+});
+
+/// Decode the functions exposed by the host from the PEB into the catalog.
+///
+/// Called when the guest is initialised, and again whenever it is resumed
+/// on a new vCPU: a sandbox loaded from a snapshot file registers its host
+/// functions afresh, and they may differ from those in the snapshot.
+pub(crate) fn load_host_function_catalog() {
+    *HOST_FUNCTION_CATALOG.write() = HostFunctionCatalog::new(get_host_function_details());
+}
+
+/// Get the catalog of the functions exposed by the host
+pub fn host_function_catalog() -> RwLockReadGuard<'static, HostFunctionCatalog> {
+    HOST_FUNCTION_CATALOG.read()
+}
 
-    Ok(())
+pub(crate) fn validate_host_function_call(function_call: &FunctionCall) -> Result<()> {
+    let catalog = host_function_catalog();
+
+    // check if there are any host functions
+    if catalog.is_empty() {
+        return Err(HyperlightGuestError::new(
+            ErrorCode::GuestError,
+            "No host functions found".to_string(),
+        ));
+    }
+
+    // check if function w/ given name exists
+    let host_function = catalog.get(&function_call.function_name).ok_or_else(|| {
+        HyperlightGuestError::new(
+            ErrorCode::GuestError,
+            format!("Host Function Not Found: {}", function_call.function_name),
+        )
+    })?;
+
+    // Verify that the function call has the correct parameter types.
+    host_function.verify_parameters(function_call.parameters.as_deref().unwrap_or_default())
 }
 
 pub fn get_host_function_details() -> HostFunctionDetails {
@@ -17,10 +17,11 @@ limitations under the License.
 #![no_std]
 // Deps
 use alloc::string::ToString;
+use core::alloc::Layout;
 use core::hint::unreachable_unchecked;
-use core::ptr::copy_nonoverlapping;
+use core::ptr::{addr_of, copy_nonoverlapping, read_volatile};
 
-use buddy_system_allocator::LockedHeap;
+use buddy_system_allocator::{Heap, LockedHeapWithRescue};
 use guest_function_register::GuestFunctionRegister;
 use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 use hyperlight_common::mem::{HyperlightPEB, RunMode};
@@ -29,7 +30,10 @@ use crate::host_function_call::{outb, OutBAction};
 extern crate alloc;
 
 // Modules
+pub mod bench;
+pub mod channel;
 pub mod entrypoint;
+pub mod fs;
 pub mod shared_input_data;
 pub mod shared_output_data;
 
@@ -44,9 +48,13 @@ pub mod host_functions;
 
 pub(crate) mod guest_logger;
 pub mod memory;
+pub mod parallel;
 pub mod print;
 pub(crate) mod security_check;
 pub mod setjmp;
+pub mod shared_data;
+#[cfg(feature = "libc")]
+pub mod vecmath;
 
 pub mod chkstk;
 pub mod error;
@@ -74,6 +82,7 @@ pub(crate) static _fltused: i32 = 0;
 // to satisfy the clippy when cfg == test
 #[allow(dead_code)]
 fn panic(info: &core::panic::PanicInfo) -> ! {
+    parallel::on_panic();
     unsafe {
         let peb_ptr = P_PEB.unwrap();
         copy_nonoverlapping(
@@ -87,8 +96,42 @@ fn panic(info: &core::panic::PanicInfo) -> ! {
 }
 
 // Globals
+// The order of the allocator bounds the largest block it can manage, which
+// must cover the largest heap a sandbox can have (just under 512GB)
 #[global_allocator]
-pub(crate) static HEAP_ALLOCATOR: LockedHeap<32> = LockedHeap::<32>::empty();
+pub(crate) static HEAP_ALLOCATOR: LockedHeapWithRescue<40> = LockedHeapWithRescue::new(grow_heap);
+
+/// Called by the allocator when it cannot satisfy `layout`, before it
+/// tries once more. Asks the host to grow the heap, and hands whatever the
+/// host added to the allocator. If the sandbox's heap cannot grow, the
+/// host leaves its size as it is and the allocation fails as usual.
+///
+/// This runs with the allocator locked, so it must not allocate.
+fn grow_heap(heap: &mut Heap<40>, layout: &Layout) {
+    let Some(peb_ptr) = (unsafe { P_PEB }) else {
+        return;
+    };
+    // Only the first vCPU can call the host
+    if parallel::on_worker_vcpu() {
+        return;
+    }
+    let heap_data = unsafe { addr_of!((*peb_ptr).guestheapData) };
+    let heap_start = unsafe { (*heap_data).guestHeapBuffer } as usize;
+    let heap_size = || unsafe { read_volatile(addr_of!((*heap_data).guestHeapSize)) } as usize;
+
+    // The buddy allocator only hands out naturally aligned blocks, so ask
+    // for twice the room the allocation needs to be sure the new memory
+    // holds a block that fits it
+    let needed = layout.size().max(layout.align()).saturating_mul(2);
+    let min_growth_log2 = usize::BITS - needed.saturating_sub(1).leading_zeros();
+
+    let old_size = heap_size();
+    outb(OutBAction::GrowHeap as u16, min_growth_log2 as u8);
+    let new_size = heap_size();
+    if new_size > old_size {
+        unsafe { heap.add_to_heap(heap_start + old_size, heap_start + new_size) };
+    }
+}
 
 ///cbindgen:ignore
 #[no_mangle]
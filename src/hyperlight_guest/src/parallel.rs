@@ -0,0 +1,213 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Data-parallel loops over the worker vCPUs of a sandbox.
+//!
+//! A sandbox created with more than one vCPU runs the guest on the first
+//! vCPU as usual, and the others (the workers) sit idle until
+//! [`parallel_for`] hands them a share of a loop. On sandboxes without
+//! workers, [`parallel_for`] simply runs the loop on the calling vCPU.
+
+use alloc::alloc::{alloc, dealloc};
+use core::alloc::Layout;
+use core::arch::asm;
+use core::hint::spin_loop;
+use core::ops::Range;
+use core::ptr::null_mut;
+use core::sync::atomic::{AtomicPtr, AtomicUsize, Ordering};
+
+use hyperlight_common::mem::RunMode;
+
+use crate::host_function_call::OutBAction;
+use crate::RUNNING_MODE;
+
+/// The size of the stack each worker vCPU runs on
+const WORKER_STACK_SIZE: usize = 0x10000;
+
+/// How many chunks each vCPU gets, on average. More chunks balance uneven
+/// iterations better, at the cost of more contention on `Task::next`.
+const CHUNKS_PER_VCPU: usize = 8;
+
+/// A loop being run by `parallel_for`, shared by all the vCPUs running it
+struct Task<'a> {
+    /// The first iteration no vCPU has claimed yet
+    next: AtomicUsize,
+    /// One past the last iteration
+    end: usize,
+    /// The number of iterations a vCPU claims at a time
+    chunk: usize,
+    /// The loop body
+    body: &'a (dyn Fn(usize) + Sync),
+    /// The number of workers that have not finished their share yet
+    pending: AtomicUsize,
+    /// The memory the workers' stacks are in
+    stacks: Range<usize>,
+}
+
+/// The task `parallel_for` is running, if any
+static ACTIVE_TASK: AtomicPtr<Task<'static>> = AtomicPtr::new(null_mut());
+
+/// Get the number of worker vCPUs this sandbox has, i.e. the number of
+/// vCPUs besides the calling one that [`parallel_for`] can use.
+pub fn worker_count() -> usize {
+    if !matches!(unsafe { RUNNING_MODE }, RunMode::Hypervisor) {
+        return 0;
+    }
+    let count: u64;
+    unsafe {
+        asm!(
+            "out dx, al",
+            inout("rax") 0u64 => count,
+            in("dx") OutBAction::WorkerCount as u16,
+            options(nostack, preserves_flags)
+        );
+    }
+    count as usize
+}
+
+/// Call `body` once for each index in `range`, spreading the calls over
+/// the sandbox's worker vCPUs as well as the calling one, and return once
+/// all of them have completed. The order of the calls is unspecified.
+///
+/// Since the calls on the worker vCPUs run concurrently with each other
+/// and the calling vCPU, `body` must not:
+///
+/// - call host functions, or log (both of which go through the host, which
+///   only serves the first vCPU),
+/// - allocate more memory than the heap has free, as only the calling vCPU
+///   can ask the host to grow the heap,
+/// - use stack frames of 4KiB or more, which are checked against the
+///   guest's main stack by `__chkstk` and so fail on a worker's stack.
+///
+/// Nested calls to `parallel_for` run serially on the calling vCPU.
+pub fn parallel_for<F: Fn(usize) + Sync>(range: Range<usize>, body: F) {
+    let len = range.len();
+    let workers = if ACTIVE_TASK.load(Ordering::Acquire).is_null() {
+        worker_count().min(len.saturating_sub(1))
+    } else {
+        0
+    };
+    if workers == 0 {
+        range.for_each(body);
+        return;
+    }
+
+    let Ok(stacks_layout) = Layout::from_size_align(workers * WORKER_STACK_SIZE, 16) else {
+        range.for_each(body);
+        return;
+    };
+    let stacks = unsafe { alloc(stacks_layout) };
+    if stacks.is_null() {
+        range.for_each(body);
+        return;
+    }
+
+    let task = Task {
+        next: AtomicUsize::new(range.start),
+        end: range.end,
+        chunk: (len / ((workers + 1) * CHUNKS_PER_VCPU)).max(1),
+        body: &body,
+        pending: AtomicUsize::new(workers),
+        stacks: stacks as usize..stacks as usize + stacks_layout.size(),
+    };
+    let task_ptr = &task as *const Task as *mut Task<'static>;
+    ACTIVE_TASK.store(task_ptr, Ordering::Release);
+
+    let started: u64;
+    unsafe {
+        asm!(
+            "out dx, al",
+            inout("rax") workers as u64 => started,
+            in("dx") OutBAction::RunWorkers as u16,
+            in("rcx") task_ptr,
+            in("rdi") worker_main as usize,
+            in("r8") stacks,
+            in("r9") WORKER_STACK_SIZE,
+            options(nostack, preserves_flags)
+        );
+    }
+    // Fewer workers than asked for may have been started
+    task.pending
+        .fetch_sub(workers - started as usize, Ordering::AcqRel);
+
+    run_share(&task);
+    while task.pending.load(Ordering::Acquire) != 0 {
+        spin_loop();
+    }
+
+    // Every worker is done with its share and about to halt. The host
+    // fails the call here if any of them did not get that far.
+    unsafe {
+        asm!(
+            "out dx, al",
+            in("dx") OutBAction::JoinWorkers as u16,
+            in("al") 0u8,
+            options(nostack, preserves_flags)
+        );
+    }
+    ACTIVE_TASK.store(null_mut(), Ordering::Release);
+    unsafe { dealloc(stacks, stacks_layout) };
+}
+
+/// Claim and run chunks of `task` until there are none left
+fn run_share(task: &Task) {
+    while let Ok(start) = task
+        .next
+        .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |next| {
+            (next < task.end).then(|| next.saturating_add(task.chunk).min(task.end))
+        })
+    {
+        let end = start.saturating_add(task.chunk).min(task.end);
+        (start..end).for_each(task.body);
+    }
+}
+
+/// The entry point of the worker vCPUs, which the host starts with the
+/// task pointer passed to `RunWorkers` and the worker's index
+extern "win64" fn worker_main(task: *const Task, _index: u64) -> ! {
+    let task = unsafe { &*task };
+    run_share(task);
+    task.pending.fetch_sub(1, Ordering::AcqRel);
+    loop {
+        unsafe { asm!("hlt", options(nomem, nostack)) };
+    }
+}
+
+/// Called by the panic handler. If the panic is on a worker vCPU, count
+/// the worker as finished so that the calling vCPU does not wait for it
+/// forever; the host then fails the call when it is joined.
+pub(crate) fn on_panic() {
+    if let Some(task) = worker_task() {
+        task.pending.fetch_sub(1, Ordering::AcqRel);
+    }
+}
+
+/// Whether the caller is running on a worker vCPU
+pub(crate) fn on_worker_vcpu() -> bool {
+    worker_task().is_some()
+}
+
+/// The task the caller is running, if the caller is a worker vCPU
+fn worker_task() -> Option<&'static Task<'static>> {
+    let task = ACTIVE_TASK.load(Ordering::Acquire);
+    if task.is_null() {
+        return None;
+    }
+    let rsp: usize;
+    unsafe { asm!("mov {}, rsp", out(reg) rsp, options(nomem, nostack, preserves_flags)) };
+    let task = unsafe { &*task };
+    task.stacks.contains(&rsp).then_some(task)
+}
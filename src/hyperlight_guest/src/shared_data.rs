@@ -0,0 +1,72 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Read-only data the host has mapped into this guest, and possibly into
+//! many other guests too, with `UninitializedSandbox::map_shared_data`.
+
+use core::slice::from_raw_parts;
+
+use hyperlight_common::mem::{MAX_SHARED_DATA_REGIONS, SHARED_DATA_WRITABLE};
+
+use crate::P_PEB;
+
+/// Get the shared data region the host mapped under `name`, if there is
+/// one.
+///
+/// The data stays mapped, and unchanged, for the life of the sandbox.
+/// It is read-only: writing to it is a fault that aborts the guest call.
+/// The end of a channel is writable, and so is never returned.
+pub fn get(name: &str) -> Option<&'static [u8]> {
+    find(name)
+        .filter(|region| !region.is_writable())
+        .map(|region| unsafe { from_raw_parts(region.ptr, region.len) })
+}
+
+/// A region the host mapped into this guest, which is either shared data
+/// or the end of a channel
+pub(crate) struct Region {
+    /// The index of the region in the PEB
+    pub(crate) index: usize,
+    pub(crate) ptr: *mut u8,
+    pub(crate) len: usize,
+    /// The region's `SHARED_DATA_*` flags
+    pub(crate) flags: u64,
+}
+
+impl Region {
+    /// Whether the guest can write to the region, and so anything may
+    /// change it while it is being read
+    pub(crate) fn is_writable(&self) -> bool {
+        self.flags & SHARED_DATA_WRITABLE != 0
+    }
+}
+
+/// Find the region the host mapped under `name`
+pub(crate) fn find(name: &str) -> Option<Region> {
+    let peb_ptr = unsafe { P_PEB? };
+    let shared_data = unsafe { &(*peb_ptr).sharedData };
+    let count = (shared_data.sharedDataCount as usize).min(MAX_SHARED_DATA_REGIONS);
+    shared_data.sharedDataRegions[..count]
+        .iter()
+        .enumerate()
+        .find(|(_, region)| region.name.split(|b| *b == 0).next() == Some(name.as_bytes()))
+        .map(|(index, region)| Region {
+            index,
+            ptr: region.sharedDataBuffer as *mut u8,
+            len: region.sharedDataSize as usize,
+            flags: region.sharedDataFlags,
+        })
+}
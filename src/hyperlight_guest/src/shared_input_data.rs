@@ -29,6 +29,48 @@ pub fn try_pop_shared_input_data_into<T>() -> Result<T>
 where
     T: for<'a> TryFrom<&'a [u8]>,
 {
+    let (idb, last_element_offset_rel, stack_ptr_rel) = shared_input_data_top()?;
+
+    let buffer = &idb[last_element_offset_rel..];
+
+    // convert the buffer to T
+    let type_t = match T::try_from(buffer) {
+        Ok(t) => Ok(t),
+        Err(_e) => {
+            return Err(HyperlightGuestError::new(
+                ErrorCode::GuestError,
+                format!("Unable to convert buffer to {}", type_name::<T>()),
+            ));
+        }
+    };
+
+    pop(idb, last_element_offset_rel, stack_ptr_rel);
+
+    type_t
+}
+
+/// Get the top element of the shared input data buffer without popping it,
+/// so that it can be read in place.
+///
+/// # Safety
+///
+/// The returned slice must not be used after the element is popped with
+/// `pop_shared_input_data`, which zeroes it.
+pub(crate) unsafe fn peek_shared_input_data<'a>() -> Result<&'a [u8]> {
+    let (idb, last_element_offset_rel, _) = shared_input_data_top()?;
+    Ok(&idb[last_element_offset_rel..])
+}
+
+/// Pop the top element from the shared input data buffer without reading it
+pub(crate) fn pop_shared_input_data() -> Result<()> {
+    let (idb, last_element_offset_rel, stack_ptr_rel) = shared_input_data_top()?;
+    pop(idb, last_element_offset_rel, stack_ptr_rel);
+    Ok(())
+}
+
+// Gets the shared input data buffer, the offset of the element on top of its
+// stack and the stack pointer
+fn shared_input_data_top() -> Result<(&'static mut [u8], usize, usize)> {
     let peb_ptr = unsafe { P_PEB.unwrap() };
     let shared_buffer_size = unsafe { (*peb_ptr).inputdata.inputDataSize as usize };
 
@@ -67,24 +109,13 @@ where
             .expect("Invalid stack pointer in pop_shared_input_data_into"),
     );
 
-    let buffer = &idb[last_element_offset_rel..];
-
-    // convert the buffer to T
-    let type_t = match T::try_from(buffer) {
-        Ok(t) => Ok(t),
-        Err(_e) => {
-            return Err(HyperlightGuestError::new(
-                ErrorCode::GuestError,
-                format!("Unable to convert buffer to {}", type_name::<T>()),
-            ));
-        }
-    };
+    Ok((idb, last_element_offset_rel, stack_ptr_rel))
+}
 
+fn pop(idb: &mut [u8], last_element_offset_rel: usize, stack_ptr_rel: usize) {
     // update the stack pointer to point to the element we just popped of since that is now free
     idb[..8].copy_from_slice(&last_element_offset_rel.to_le_bytes());
 
     // zero out popped off buffer
     idb[last_element_offset_rel..stack_ptr_rel].fill(0);
-
-    type_t
 }
@@ -0,0 +1,71 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Batched math functions over slices of floats and doubles.
+//!
+//! Each function sets `output[i] = f(input[i])` for every element, a
+//! vector of elements at a time with SSE2, or AVX2 when the guest libc is
+//! compiled with it enabled. They are the functions of the guest libc's
+//! `vecmath.h`, which C guests can call directly, and whose documentation
+//! lists how accurate each one is.
+//!
+//! All of them panic if `input` and `output` have different lengths.
+
+mod ffi {
+    extern "C" {
+        pub(super) fn hl_vexp(x: *const f64, y: *mut f64, n: usize);
+        pub(super) fn hl_vlog(x: *const f64, y: *mut f64, n: usize);
+        pub(super) fn hl_vsin(x: *const f64, y: *mut f64, n: usize);
+        pub(super) fn hl_vcos(x: *const f64, y: *mut f64, n: usize);
+        pub(super) fn hl_vtanh(x: *const f64, y: *mut f64, n: usize);
+        pub(super) fn hl_vsqrt(x: *const f64, y: *mut f64, n: usize);
+        pub(super) fn hl_vexpf(x: *const f32, y: *mut f32, n: usize);
+        pub(super) fn hl_vlogf(x: *const f32, y: *mut f32, n: usize);
+        pub(super) fn hl_vsinf(x: *const f32, y: *mut f32, n: usize);
+        pub(super) fn hl_vcosf(x: *const f32, y: *mut f32, n: usize);
+        pub(super) fn hl_vtanhf(x: *const f32, y: *mut f32, n: usize);
+        pub(super) fn hl_vsqrtf(x: *const f32, y: *mut f32, n: usize);
+    }
+}
+
+macro_rules! batched {
+    ($($name:ident: $ty:ty => $func:ident, $doc:literal;)*) => {$(
+        #[doc = $doc]
+        pub fn $name(input: &[$ty], output: &mut [$ty]) {
+            assert_eq!(
+                input.len(),
+                output.len(),
+                "input and output lengths differ"
+            );
+            unsafe { ffi::$func(input.as_ptr(), output.as_mut_ptr(), input.len()) }
+        }
+    )*};
+}
+
+batched! {
+    exp: f64 => hl_vexp, "The exponential function";
+    log: f64 => hl_vlog, "The natural logarithm";
+    sin: f64 => hl_vsin, "The sine";
+    cos: f64 => hl_vcos, "The cosine";
+    tanh: f64 => hl_vtanh, "The hyperbolic tangent";
+    sqrt: f64 => hl_vsqrt, "The square root";
+    expf: f32 => hl_vexpf, "The exponential function";
+    logf: f32 => hl_vlogf, "The natural logarithm";
+    sinf: f32 => hl_vsinf, "The sine";
+    cosf: f32 => hl_vcosf, "The cosine";
+    tanhf: f32 => hl_vtanhf, "The hyperbolic tangent";
+    sqrtf: f32 => hl_vsqrtf, "The square root";
+}
@@ -0,0 +1,8 @@
+#ifndef FASTFLOAT_H
+#define FASTFLOAT_H
+
+#include <features.h>
+
+hidden int __fastfloat(const char *, char **, double *);
+
+#endif
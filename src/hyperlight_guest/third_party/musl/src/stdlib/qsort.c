@@ -1,221 +1,389 @@
-/* Copyright (C) 2011 by Valentin Ochs
+/* Copyright (c) 2021 Orson Peters <orsonpeters@gmail.com>
  *
- * Permission is hereby granted, free of charge, to any person obtaining a copy
- * of this software and associated documentation files (the "Software"), to
- * deal in the Software without restriction, including without limitation the
- * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
- * sell copies of the Software, and to permit persons to whom the Software is
- * furnished to do so, subject to the following conditions:
+ * This software is provided 'as-is', without any express or implied
+ * warranty. In no event will the authors be held liable for any damages
+ * arising from the use of this software.
  *
- * The above copyright notice and this permission notice shall be included in
- * all copies or substantial portions of the Software.
+ * Permission is granted to anyone to use this software for any purpose,
+ * including commercial applications, and to alter it and redistribute it
+ * freely, subject to the following restrictions:
  *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
- * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
- * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
- * IN THE SOFTWARE.
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software
+ *    in a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
  */
 
-/* Minor changes by Rich Felker for integration in musl, 2011-04-27. */
-
-/* Smoothsort, an adaptive variant of Heapsort.  Memory usage: O(1).
-   Run time: Worst case O(n log n), close to O(n) in the mostly-sorted case. */
+/* Altered for Hyperlight: a C translation of pdqsort
+ * (https://github.com/orlp/pdqsort), replacing musl's smoothsort.
+ *
+ * Pattern-defeating quicksort: quicksort with median-of-3 (or ninther)
+ * pivots and branchless block partitioning, insertion sort for small
+ * ranges, and a fallback to heapsort when too many partitions are badly
+ * unbalanced. Run time: worst case O(n log n), O(n) for sorted, reverse
+ * sorted and all-equal input. Memory usage: O(log n) stack.
+ *
+ * Elements are only ever swapped, never copied out, so any width works.
+ * The sort is instantiated separately for 4 and 8 byte elements, where
+ * a swap is a pair of loads and stores. */
 
 #define _BSD_SOURCE
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "atomic.h"
-#define ntz(x) a_ctz_l((x))
-
 typedef int (*cmpfun)(const void *, const void *, void *);
 
-static inline int pntz(size_t p[2]) {
-	int r = ntz(p[0] - 1);
-	if(r != 0 || (r = 8*sizeof(size_t) + ntz(p[1])) != 8*sizeof(size_t)) {
-		return r;
-	}
-	return 0;
-}
+/* Ranges shorter than this are insertion sorted */
+#define INSERTION_SORT_THRESHOLD 24
+/* Ranges longer than this use the ninther as pivot */
+#define NINTHER_THRESHOLD 128
+/* How many elements a partial insertion sort may move before giving up */
+#define PARTIAL_INSERTION_SORT_LIMIT 8
+/* Number of elements classified at once by the block partitioning */
+#define BLOCK_SIZE 64
 
-static void cycle(size_t width, unsigned char* ar[], int n)
+#define ALWAYS_INLINE static inline __attribute__((__always_inline__))
+
+ALWAYS_INLINE void swap(unsigned char *a, unsigned char *b, size_t width)
 {
-	unsigned char tmp[256];
+	unsigned char tmp[64];
 	size_t l;
-	int i;
 
-	if(n < 2) {
+	if (width == 4) {
+		uint32_t t;
+		memcpy(&t, a, 4);
+		memcpy(a, b, 4);
+		memcpy(b, &t, 4);
 		return;
 	}
-
-	ar[n] = tmp;
-	while(width) {
+	if (width == 8) {
+		uint64_t t;
+		memcpy(&t, a, 8);
+		memcpy(a, b, 8);
+		memcpy(b, &t, 8);
+		return;
+	}
+	while (width) {
 		l = sizeof(tmp) < width ? sizeof(tmp) : width;
-		memcpy(ar[n], ar[0], l);
-		for(i = 0; i < n; i++) {
-			memcpy(ar[i], ar[i + 1], l);
-			ar[i] += l;
-		}
+		memcpy(tmp, a, l);
+		memcpy(a, b, l);
+		memcpy(b, tmp, l);
+		a += l;
+		b += l;
 		width -= l;
 	}
 }
 
-/* shl() and shr() need n > 0 */
-static inline void shl(size_t p[2], int n)
+#define LESS(a, b) (cmp((a), (b), arg) < 0)
+
+ALWAYS_INLINE void sort2(unsigned char *a, unsigned char *b, size_t width, cmpfun cmp, void *arg)
 {
-	if(n >= 8 * sizeof(size_t)) {
-		n -= 8 * sizeof(size_t);
-		p[1] = p[0];
-		p[0] = 0;
+	if (LESS(b, a)) swap(a, b, width);
+}
+
+ALWAYS_INLINE void sort3(unsigned char *a, unsigned char *b, unsigned char *c, size_t width, cmpfun cmp, void *arg)
+{
+	sort2(a, b, width, cmp, arg);
+	sort2(b, c, width, cmp, arg);
+	sort2(a, b, width, cmp, arg);
+}
+
+/* Insertion sort. If unguarded, the element before begin must not be
+ * greater than any element in [begin, end). */
+ALWAYS_INLINE void insertion_sort(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg, int guarded)
+{
+	unsigned char *cur, *sift;
+
+	if (begin == end) return;
+	for (cur = begin + width; cur < end; cur += width)
+		for (sift = cur; (!guarded || sift > begin) && LESS(sift, sift - width); sift -= width)
+			swap(sift, sift - width, width);
+}
+
+/* Insertion sort that gives up, returning 0, once it has moved more than
+ * PARTIAL_INSERTION_SORT_LIMIT elements. Returns 1 if [begin, end) is now
+ * sorted. */
+ALWAYS_INLINE int partial_insertion_sort(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg)
+{
+	unsigned char *cur, *sift;
+	size_t moved = 0;
+
+	if (begin == end) return 1;
+	for (cur = begin + width; cur < end; cur += width) {
+		for (sift = cur; sift > begin && LESS(sift, sift - width); sift -= width)
+			swap(sift, sift - width, width);
+		moved += (cur - sift) / width;
+		if (moved > PARTIAL_INSERTION_SORT_LIMIT) return 0;
+	}
+	return 1;
+}
+
+ALWAYS_INLINE void sift_down(unsigned char *base, size_t root, size_t nel, size_t width, cmpfun cmp, void *arg)
+{
+	size_t child;
+
+	while ((child = 2*root + 1) < nel) {
+		if (child + 1 < nel && LESS(base + child*width, base + (child+1)*width))
+			child++;
+		if (!LESS(base + root*width, base + child*width)) return;
+		swap(base + root*width, base + child*width, width);
+		root = child;
 	}
-	p[1] <<= n;
-	p[1] |= p[0] >> (sizeof(size_t) * 8 - n);
-	p[0] <<= n;
 }
 
-static inline void shr(size_t p[2], int n)
+ALWAYS_INLINE void heap_sort(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg)
 {
-	if(n >= 8 * sizeof(size_t)) {
-		n -= 8 * sizeof(size_t);
-		p[0] = p[1];
-		p[1] = 0;
+	size_t nel = (end - begin) / width, i;
+
+	for (i = nel / 2; i-- > 0;)
+		sift_down(begin, i, nel, width, cmp, arg);
+	for (i = nel; i-- > 1;) {
+		swap(begin, begin + i*width, width);
+		sift_down(begin, 0, i, width, cmp, arg);
 	}
-	p[0] >>= n;
-	p[0] |= p[1] << (sizeof(size_t) * 8 - n);
-	p[1] >>= n;
 }
 
-static void sift(unsigned char *head, size_t width, cmpfun cmp, void *arg, int pshift, size_t lp[])
+/* Partitions [begin, end) around the pivot at *begin, putting elements
+ * equal to the pivot on the right. Returns the final position of the
+ * pivot, and sets *partitioned if no elements had to be swapped.
+ *
+ * After the first misplaced pair, the remaining elements are classified
+ * a block at a time without branching on the comparisons, and only the
+ * misplaced ones are swapped (see "BlockQuicksort: How Branch
+ * Mispredictions don't affect Quicksort", Edelkamp and Weiss). The
+ * median-of-3 pivot selection guarantees an element not less than the
+ * pivot at end - 1, which bounds the first scans. */
+ALWAYS_INLINE unsigned char *partition_right(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg, int *partitioned)
 {
-	unsigned char *rt, *lf;
-	unsigned char *ar[14 * sizeof(size_t) + 1];
-	int i = 1;
+	unsigned char offsets_l[BLOCK_SIZE], offsets_r[BLOCK_SIZE];
+	unsigned char *pivot = begin, *first = begin, *last = end;
+	unsigned char *offsets_l_base, *offsets_r_base;
+	size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+	size_t num_unknown, left_split, right_split, num, i;
 
-	ar[0] = head;
-	while(pshift > 1) {
-		rt = head - width;
-		lf = head - width - lp[pshift - 2];
+	do first += width; while (LESS(first, pivot));
+	if (first - width == begin) {
+		while (first < last && !LESS(last -= width, pivot));
+	} else {
+		do last -= width; while (!LESS(last, pivot));
+	}
 
-		if(cmp(ar[0], lf, arg) >= 0 && cmp(ar[0], rt, arg) >= 0) {
-			break;
+	*partitioned = first >= last;
+	if (*partitioned) goto done;
+
+	swap(first, last, width);
+	first += width;
+
+	offsets_l_base = first;
+	offsets_r_base = last;
+	while (first < last) {
+		/* Fill the empty offset buffers from whatever is left */
+		num_unknown = (last - first) / width;
+		left_split = num_l == 0 ? (num_r == 0 ? num_unknown / 2 : num_unknown) : 0;
+		right_split = num_r == 0 ? num_unknown - left_split : 0;
+		if (left_split > BLOCK_SIZE) left_split = BLOCK_SIZE;
+		if (right_split > BLOCK_SIZE) right_split = BLOCK_SIZE;
+
+		for (i = 0; i < left_split; i++) {
+			offsets_l[num_l] = i;
+			num_l += !LESS(first, pivot);
+			first += width;
 		}
-		if(cmp(lf, rt, arg) >= 0) {
-			ar[i++] = lf;
-			head = lf;
-			pshift -= 1;
-		} else {
-			ar[i++] = rt;
-			head = rt;
-			pshift -= 2;
+		for (i = 0; i < right_split; i++) {
+			last -= width;
+			offsets_r[num_r] = i + 1;
+			num_r += LESS(last, pivot);
 		}
+
+		num = num_l < num_r ? num_l : num_r;
+		for (i = 0; i < num; i++)
+			swap(offsets_l_base + offsets_l[start_l + i] * width,
+			     offsets_r_base - offsets_r[start_r + i] * width, width);
+		num_l -= num;
+		num_r -= num;
+		start_l += num;
+		start_r += num;
+		if (num_l == 0) {
+			start_l = 0;
+			offsets_l_base = first;
+		}
+		if (num_r == 0) {
+			start_r = 0;
+			offsets_r_base = last;
+		}
+	}
+
+	/* Everything is classified: move the leftover misplaced elements of
+	 * one side to the boundary */
+	if (num_l) {
+		while (num_l--)
+			swap(offsets_l_base + offsets_l[start_l + num_l] * width, last -= width, width);
+		first = last;
 	}
-	cycle(width, ar, i);
+	if (num_r) {
+		while (num_r--) {
+			swap(offsets_r_base - offsets_r[start_r + num_r] * width, first, width);
+			first += width;
+		}
+	}
+
+done:
+	swap(begin, first - width, width);
+	return first - width;
 }
 
-static void trinkle(unsigned char *head, size_t width, cmpfun cmp, void *arg, size_t pp[2], int pshift, int trusty, size_t lp[])
+/* Partitions [begin, end) around the pivot at *begin, putting elements
+ * equal to the pivot on the left. Used when the pivot equals the element
+ * before begin, so that runs of equal elements are handled in linear
+ * time. Returns the final position of the pivot. */
+ALWAYS_INLINE unsigned char *partition_left(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg)
 {
-	unsigned char *stepson,
-	              *rt, *lf;
-	size_t p[2];
-	unsigned char *ar[14 * sizeof(size_t) + 1];
-	int i = 1;
-	int trail;
-
-	p[0] = pp[0];
-	p[1] = pp[1];
-
-	ar[0] = head;
-	while(p[0] != 1 || p[1] != 0) {
-		stepson = head - lp[pshift];
-		if(cmp(stepson, ar[0], arg) <= 0) {
-			break;
-		}
-		if(!trusty && pshift > 1) {
-			rt = head - width;
-			lf = head - width - lp[pshift - 2];
-			if(cmp(rt, stepson, arg) >= 0 || cmp(lf, stepson, arg) >= 0) {
-				break;
-			}
-		}
+	unsigned char *pivot = begin, *first = begin, *last = end;
 
-		ar[i++] = stepson;
-		head = stepson;
-		trail = pntz(p);
-		shr(p, trail);
-		pshift += trail;
-		trusty = 0;
+	do last -= width; while (LESS(pivot, last));
+	if (last + width == end) {
+		while (first < last && !LESS(pivot, first += width));
+	} else {
+		do first += width; while (!LESS(pivot, first));
 	}
-	if(!trusty) {
-		cycle(width, ar, i);
-		sift(head, width, cmp, arg, pshift, lp);
+
+	while (first < last) {
+		swap(first, last, width);
+		do last -= width; while (LESS(pivot, last));
+		do first += width; while (!LESS(pivot, first));
 	}
+
+	swap(begin, last, width);
+	return last;
 }
 
-void __qsort_r(void *base, size_t nel, size_t width, cmpfun cmp, void *arg)
+typedef void (*sortfun)(unsigned char *, unsigned char *, size_t, cmpfun, void *, int, int);
+
+#define SHUFFLE(a, b) swap((a), (b), width)
+
+/* Sorts [begin, end), calling recurse to sort the smaller side of each
+ * partition. leftmost is 0 if the element before begin is not greater
+ * than any element in the range. */
+ALWAYS_INLINE void pdqsort(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg, int bad_allowed, int leftmost, sortfun recurse)
 {
-	size_t lp[12*sizeof(size_t)];
-	size_t i, size = width * nel;
-	unsigned char *head, *high;
-	size_t p[2] = {1, 0};
-	int pshift = 1;
-	int trail;
-
-	if (!size) return;
-
-	head = base;
-	high = head + size - width;
-
-	/* Precompute Leonardo numbers, scaled by element width */
-	for(lp[0]=lp[1]=width, i=2; (lp[i]=lp[i-2]+lp[i-1]+width) < size; i++);
-
-	while(head < high) {
-		if((p[0] & 3) == 3) {
-			sift(head, width, cmp, arg, pshift, lp);
-			shr(p, 2);
-			pshift += 2;
+	size_t size, s2, l_size, r_size;
+	unsigned char *pivot_pos;
+	int partitioned;
+
+	for (;;) {
+		size = (end - begin) / width;
+		if (size < INSERTION_SORT_THRESHOLD) {
+			insertion_sort(begin, end, width, cmp, arg, leftmost);
+			return;
+		}
+
+		/* Put the pivot at begin: the median of 3, or of 3 medians of
+		 * 3 for large ranges */
+		s2 = size / 2;
+		if (size > NINTHER_THRESHOLD) {
+			sort3(begin, begin + s2*width, end - width, width, cmp, arg);
+			sort3(begin + width, begin + (s2-1)*width, end - 2*width, width, cmp, arg);
+			sort3(begin + 2*width, begin + (s2+1)*width, end - 3*width, width, cmp, arg);
+			sort3(begin + (s2-1)*width, begin + s2*width, begin + (s2+1)*width, width, cmp, arg);
+			swap(begin, begin + s2*width, width);
 		} else {
-			if(lp[pshift - 1] >= high - head) {
-				trinkle(head, width, cmp, arg, p, pshift, 0, lp);
-			} else {
-				sift(head, width, cmp, arg, pshift, lp);
-			}
+			sort3(begin + s2*width, begin, end - width, width, cmp, arg);
+		}
 
-			if(pshift == 1) {
-				shl(p, 1);
-				pshift = 0;
-			} else {
-				shl(p, pshift - 1);
-				pshift = 1;
-			}
+		/* If the pivot equals the element before the range, which is
+		 * not greater than anything in it, then everything equal to the
+		 * pivot goes left and is already in its final place */
+		if (!leftmost && !LESS(begin - width, begin)) {
+			begin = partition_left(begin, end, width, cmp, arg) + width;
+			continue;
 		}
 
-		p[0] |= 1;
-		head += width;
-	}
+		pivot_pos = partition_right(begin, end, width, cmp, arg, &partitioned);
+		l_size = (pivot_pos - begin) / width;
+		r_size = (end - pivot_pos) / width - 1;
 
-	trinkle(head, width, cmp, arg, p, pshift, 0, lp);
+		if (l_size < size / 8 || r_size < size / 8) {
+			/* Highly unbalanced: after too many of these, give up on
+			 * quicksort. Otherwise shuffle some elements around to
+			 * break up patterns that fool the pivot selection. */
+			if (--bad_allowed == 0) {
+				heap_sort(begin, end, width, cmp, arg);
+				return;
+			}
+			if (l_size >= INSERTION_SORT_THRESHOLD) {
+				SHUFFLE(begin, begin + l_size/4*width);
+				SHUFFLE(pivot_pos - width, pivot_pos - l_size/4*width);
+				if (l_size > NINTHER_THRESHOLD) {
+					SHUFFLE(begin + width, begin + (l_size/4 + 1)*width);
+					SHUFFLE(begin + 2*width, begin + (l_size/4 + 2)*width);
+					SHUFFLE(pivot_pos - 2*width, pivot_pos - (l_size/4 + 1)*width);
+					SHUFFLE(pivot_pos - 3*width, pivot_pos - (l_size/4 + 2)*width);
+				}
+			}
+			if (r_size >= INSERTION_SORT_THRESHOLD) {
+				SHUFFLE(pivot_pos + width, pivot_pos + (1 + r_size/4)*width);
+				SHUFFLE(end - width, end - r_size/4*width);
+				if (r_size > NINTHER_THRESHOLD) {
+					SHUFFLE(pivot_pos + 2*width, pivot_pos + (2 + r_size/4)*width);
+					SHUFFLE(pivot_pos + 3*width, pivot_pos + (3 + r_size/4)*width);
+					SHUFFLE(end - 2*width, end - (1 + r_size/4)*width);
+					SHUFFLE(end - 3*width, end - (2 + r_size/4)*width);
+				}
+			}
+		} else if (partitioned &&
+		           partial_insertion_sort(begin, pivot_pos, width, cmp, arg) &&
+		           partial_insertion_sort(pivot_pos + width, end, width, cmp, arg)) {
+			/* Already partitioned and both sides were nearly sorted:
+			 * assume the input was sorted */
+			return;
+		}
 
-	while(pshift != 1 || p[0] != 1 || p[1] != 0) {
-		if(pshift <= 1) {
-			trail = pntz(p);
-			shr(p, trail);
-			pshift += trail;
+		/* Recurse into the smaller side and loop on the larger one, so
+		 * the stack depth stays below log2(nel) */
+		if (l_size < r_size) {
+			recurse(begin, pivot_pos, width, cmp, arg, bad_allowed, leftmost);
+			begin = pivot_pos + width;
+			leftmost = 0;
 		} else {
-			shl(p, 2);
-			pshift -= 2;
-			p[0] ^= 7;
-			shr(p, 1);
-			trinkle(head - lp[pshift] - width, width, cmp, arg, p, pshift + 1, 1, lp);
-			shl(p, 1);
-			p[0] |= 1;
-			trinkle(head - width, width, cmp, arg, p, pshift, 1, lp);
+			recurse(pivot_pos + width, end, width, cmp, arg, bad_allowed, 0);
+			end = pivot_pos;
 		}
-		head -= width;
 	}
 }
 
+#define DEFINE_PDQSORT(name, w) \
+static void name(unsigned char *begin, unsigned char *end, size_t width, cmpfun cmp, void *arg, int bad_allowed, int leftmost) \
+{ \
+	pdqsort(begin, end, (w), cmp, arg, bad_allowed, leftmost, name); \
+}
+
+DEFINE_PDQSORT(pdqsort_4, 4)
+DEFINE_PDQSORT(pdqsort_8, 8)
+DEFINE_PDQSORT(pdqsort_n, width)
+
+void __qsort_r(void *base, size_t nel, size_t width, cmpfun cmp, void *arg)
+{
+	unsigned char *begin = base, *end = begin + nel * width;
+	int bad_allowed = 0;
+
+	if (nel < 2 || !width) return;
+
+	/* Allow log2(nel) badly unbalanced partitions before falling back
+	 * to heapsort */
+	while (nel >>= 1) bad_allowed++;
+
+	if (width == 4)
+		pdqsort_4(begin, end, width, cmp, arg, bad_allowed, 1);
+	else if (width == 8)
+		pdqsort_8(begin, end, width, cmp, arg, bad_allowed, 1);
+	else
+		pdqsort_n(begin, end, width, cmp, arg, bad_allowed, 1);
+}
+
 weak_alias(__qsort_r, qsort_r);
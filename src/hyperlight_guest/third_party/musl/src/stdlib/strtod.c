@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include "shgetc.h"
 #include "floatscan.h"
+#include "fastfloat.h"
 #include "stdio_impl.h"
 
 static long double strtox(const char *s, char **p, int prec)
@@ -21,6 +22,8 @@ float strtof(const char *restrict s, char **restrict p)
 
 double strtod(const char *restrict s, char **restrict p)
 {
+	double y;
+	if (__fastfloat(s, p, &y)) return y;
 	return strtox(s, p, 1);
 }
 
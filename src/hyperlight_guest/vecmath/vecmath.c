@@ -0,0 +1,509 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * Batched math functions (see vecmath.h), written with the compiler's
+ * vector extensions so that the same code is SSE2 or, when __AVX2__ is
+ * defined, AVX2.
+ *
+ * The double kernels use the polynomials and range reductions of musl's
+ * (fdlibm's) scalar exp, log, __sin, __cos and __rem_pio2, with every
+ * branch that depends on the input turned into a select, and tanh uses
+ * the rational approximation from Cephes. The float kernels use Cephes'
+ * tanhf and fdlibm's logf, and the double exp kernel and musl's sinf and
+ * cosf, which are computed in double. Lanes a kernel cannot handle are recomputed with
+ * the scalar libm function.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "vecmath.h"
+
+#ifdef __AVX2__
+#define VEC_BYTES 32
+#else
+#define VEC_BYTES 16
+#endif
+
+typedef double vd __attribute__((__vector_size__(VEC_BYTES)));
+typedef int64_t vl __attribute__((__vector_size__(VEC_BYTES)));
+typedef uint64_t vul __attribute__((__vector_size__(VEC_BYTES)));
+typedef float vf __attribute__((__vector_size__(VEC_BYTES)));
+typedef int32_t vi __attribute__((__vector_size__(VEC_BYTES)));
+typedef uint32_t vui __attribute__((__vector_size__(VEC_BYTES)));
+/* Half as many floats as a vector holds doubles, for conversions */
+typedef float vfh __attribute__((__vector_size__(VEC_BYTES / 2)));
+
+#define DLANES (VEC_BYTES / 8)
+#define FLANES (VEC_BYTES / 4)
+
+#ifdef __AVX2__
+#define vsqrt(x) __builtin_ia32_sqrtpd256(x)
+#define vsqrtf(x) __builtin_ia32_sqrtps256(x)
+#else
+#define vsqrt(x) __builtin_ia32_sqrtpd(x)
+#define vsqrtf(x) __builtin_ia32_sqrtps(x)
+#endif
+
+#define INLINE static inline __attribute__((__always_inline__))
+
+/* m ? a : b, lane by lane, for masks from vector comparisons */
+INLINE vd vselect(vl m, vd a, vd b)
+{
+	return (vd)((m & (vl)a) | (~m & (vl)b));
+}
+
+INLINE vf vselectf(vi m, vf a, vf b)
+{
+	return (vf)((m & (vi)a) | (~m & (vi)b));
+}
+
+INLINE vd vfabs(vd x)
+{
+	return (vd)((vul)x & 0x7fffffffffffffff);
+}
+
+INLINE vf vfabsf(vf x)
+{
+	return (vf)((vui)x & 0x7fffffff);
+}
+
+/* Rounds x to the nearest integer, for |x| < 2^51, as a double and in the
+ * low bits of *n */
+INLINE vd vround(vd x, vl *n)
+{
+	const double shift = 0x1.8p52;
+	vd t = x + shift;
+	*n = (vl)t - (vl)((vd){} + shift);
+	return t - shift;
+}
+
+/* The same for floats, for |x| < 2^22 */
+INLINE vf vroundf(vf x, vi *n)
+{
+	const float shift = 0x1.8p23f;
+	vf t = x + shift;
+	*n = (vi)t - (vi)((vf){} + shift);
+	return t - shift;
+}
+
+/* 2^k for k in [-1022, 1023] */
+INLINE vd vexp2i(vl k)
+{
+	return (vd)((k + 0x3ff) << 52);
+}
+
+/* 2^k for k in [-126, 127] */
+INLINE vf vexp2if(vi k)
+{
+	return (vf)((k + 0x7f) << 23);
+}
+
+/* Double kernels */
+
+static const double
+ln2_hi = 6.93147180369123816490e-01, /* 0x3fe62e42 fee00000 */
+ln2_lo = 1.90821492927058770002e-10, /* 0x3dea39ef 35793c76 */
+invln2 = 1.44269504088896338700e+00; /* 0x3ff71547 652b82fe */
+
+/* exp(x) for |x| <= 708 */
+INLINE vd exp_kernel(vd x)
+{
+	static const double
+	P1 =  1.66666666666666019037e-01,
+	P2 = -2.77777777770155933842e-03,
+	P3 =  6.61375632143793436117e-05,
+	P4 = -1.65339022054652515390e-06,
+	P5 =  4.13813679705723846039e-08;
+	vl k;
+	vd kd, hi, lo, r, rr, c, y;
+
+	/* x = k*ln2 + r, |r| <= ln2/2, with r = hi - lo and hi exact */
+	kd = vround(x * invln2, &k);
+	hi = x - kd * ln2_hi;
+	lo = kd * ln2_lo;
+	r = hi - lo;
+
+	rr = r * r;
+	c = r - rr * (P1 + rr * (P2 + rr * (P3 + rr * (P4 + rr * P5))));
+	y = 1 + (r * c / (2 - c) - lo + hi);
+	return y * vexp2i(k);
+}
+
+INLINE vl exp_special(vd x)
+{
+	return ~(vl)(vfabs(x) <= 708);
+}
+
+/* log(x) for normal x > 0 */
+INLINE vd log_kernel(vd x)
+{
+	static const double
+	Lg1 = 6.666666666666735130e-01,
+	Lg2 = 3.999999999940941908e-01,
+	Lg3 = 2.857142874366239149e-01,
+	Lg4 = 2.222219843214978396e-01,
+	Lg5 = 1.818357216161805012e-01,
+	Lg6 = 1.531383769920937332e-01,
+	Lg7 = 1.479819860511658591e-01;
+	vul ix = (vul)x;
+	vl k;
+	vd f, hfsq, s, z, w, t1, t2, r, dk;
+
+	/* x = 2^k * m, m in [sqrt(2)/2, sqrt(2)) */
+	ix += (uint64_t)(0x3ff00000 - 0x3fe6a09e) << 32;
+	k = (vl)(ix >> 52) - 0x3ff;
+	ix = (ix & 0x000fffffffffffff) + ((uint64_t)0x3fe6a09e << 32);
+	f = (vd)ix - 1;
+
+	hfsq = 0.5 * f * f;
+	s = f / (2 + f);
+	z = s * s;
+	w = z * z;
+	t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+	t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+	r = t2 + t1;
+	dk = (vd)(k + (vl)((vd){} + 0x1.8p52)) - 0x1.8p52;
+	return s * (hfsq + r) + dk * ln2_lo - hfsq + f + dk * ln2_hi;
+}
+
+INLINE vl log_special(vd x)
+{
+	return ~((vl)(x >= 0x1p-1022) & (vl)(x <= 0x1.fffffffffffffp1023));
+}
+
+/* sin and cos of x for |x| <= 2^19, written to *s and *c */
+INLINE void sincos_kernel(vd x, vd *s, vd *c)
+{
+	static const double
+	invpio2 = 6.36619772367581382433e-01, /* 0x3fe45f30 6dc9c883 */
+	pio2_1  = 1.57079632673412561417e+00, /* 0x3ff921fb 54400000 */
+	pio2_2  = 6.07710050630396597660e-11, /* 0x3dd0b461 1a600000 */
+	pio2_2t = 2.02226624879595063154e-21, /* 0x3ba3198a 2e037073 */
+	S1 = -1.66666666666666324348e-01,
+	S2 =  8.33333333332248946124e-03,
+	S3 = -1.98412698298579493134e-04,
+	S4 =  2.75573137070700676789e-06,
+	S5 = -2.50507602534068634195e-08,
+	S6 =  1.58969099521155010221e-10,
+	C1 =  4.16666666666666019037e-02,
+	C2 = -1.38888888888741095749e-03,
+	C3 =  2.48015872894767294178e-05,
+	C4 = -2.75573143513906633035e-07,
+	C5 =  2.08757232129817482790e-09,
+	C6 = -1.13596475577881948265e-11;
+	vl n, swap;
+	vd fn, r, t, w, y0, y1, z, v, sr, cr, hz;
+
+	/* x = n*pi/2 + y0 + y1, with pi/2 as two 33 bit parts, so that
+	 * n*pio2_1 and n*pio2_2 are exact, and a 53 bit tail. That is 118
+	 * bits, enough for any |x| <= 2^19 however close to a multiple of
+	 * pi/2 (__rem_pio2's second iteration). */
+	fn = vround(x * invpio2, &n);
+	r = x - fn * pio2_1;
+	t = r;
+	w = fn * pio2_2;
+	r = t - w;
+	w = fn * pio2_2t - ((t - r) - w);
+	y0 = r - w;
+	y1 = (r - y0) - w;
+
+	/* __sin(y0, y1, 1) */
+	z = y0 * y0;
+	w = z * z;
+	sr = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+	v = z * y0;
+	sr = y0 - ((z * (0.5 * y1 - v * sr) - y1) - v * S1);
+
+	/* __cos(y0, y1) */
+	cr = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+	hz = 0.5 * z;
+	w = 1 - hz;
+	cr = w + (((1 - w) - hz) + (z * cr - y0 * y1));
+
+	/* Pick by quadrant: sin(x) is sin(r), cos(r), -sin(r), -cos(r)
+	 * for n&3 = 0, 1, 2, 3, and cos(x) is sin(x + pi/2) */
+	swap = -(n & 1);
+	*s = (vd)((vul)vselect(swap, cr, sr) ^ (vul)(n & 2) << 62);
+	*c = (vd)((vul)vselect(swap, sr, cr) ^ (vul)((n + 1) & 2) << 62);
+}
+
+INLINE vl sincos_special(vd x)
+{
+	return ~(vl)(vfabs(x) <= 0x1p19);
+}
+
+INLINE vd sin_kernel(vd x)
+{
+	vd s, c;
+	sincos_kernel(x, &s, &c);
+	return s;
+}
+
+INLINE vd cos_kernel(vd x)
+{
+	vd s, c;
+	sincos_kernel(x, &s, &c);
+	return c;
+}
+
+/* tanh(x) for any x but nan */
+INLINE vd tanh_kernel(vd x)
+{
+	static const double
+	P0 = -9.64399179425052238628e-01,
+	P1 = -9.92877231001918586564e+01,
+	P2 = -1.61468768441708447952e+03,
+	Q0 =  1.12811678491632931402e+02,
+	Q1 =  2.23548839060100448583e+03,
+	Q2 =  4.84406305325125486048e+03;
+	vd a = vfabs(x), z, e, big, small;
+	vul sign = (vul)x & 0x8000000000000000;
+
+	/* tanh(|x|) = 1 - 2/(exp(2|x|) + 1), which is 1 from |x| = 22 */
+	a = vselect((vl)(a < 22), a, (vd){} + 22);
+	e = exp_kernel(2 * a);
+	big = (vd)((vul)(1 - 2 / (e + 1)) | sign);
+
+	/* A rational approximation near 0 */
+	z = x * x;
+	small = x + x * z * ((P0 * z + P1) * z + P2) / (((z + Q0) * z + Q1) * z + Q2);
+
+	return vselect((vl)(a > 0.625), big, small);
+}
+
+INLINE vl tanh_special(vd x)
+{
+	return (vl)(x != x);
+}
+
+INLINE vd sqrt_kernel(vd x)
+{
+	return vsqrt(x);
+}
+
+INLINE vl sqrt_special(vd x)
+{
+	return (vl){};
+}
+
+/* Float kernels */
+
+/* expf(x) for -87 <= x <= 88, computed in double a half vector at a
+ * time. A float polynomial is too close to 1 ulp to stay within it once
+ * the compiler contracts it into fused multiply-adds. */
+INLINE vf expf_kernel(vf x)
+{
+	vfh xh[2], yh[2];
+	vf y;
+	int h;
+
+	memcpy(xh, &x, sizeof(x));
+	for (h = 0; h < 2; h++)
+		yh[h] = __builtin_convertvector(exp_kernel(__builtin_convertvector(xh[h], vd)), vfh);
+	memcpy(&y, yh, sizeof(y));
+	return y;
+}
+
+INLINE vi expf_special(vf x)
+{
+	return ~((vi)(x >= -87) & (vi)(x <= 88));
+}
+
+/* logf(x) for normal x > 0 */
+INLINE vf logf_kernel(vf x)
+{
+	static const float
+	ln2_hi_f = 6.9313812256e-01f, /* 0x3f317180 */
+	ln2_lo_f = 9.0580006145e-06f, /* 0x3717f7d1 */
+	Lg1 = 0xaaaaaa.0p-24f, /* 0.66666662693 */
+	Lg2 = 0xccce13.0p-25f, /* 0.40000972152 */
+	Lg3 = 0x91e9ee.0p-25f, /* 0.28498786688 */
+	Lg4 = 0xf89e26.0p-26f; /* 0.24279078841 */
+	vui ix = (vui)x;
+	vi k;
+	vf f, hfsq, s, z, w, t1, t2, r, dk;
+
+	ix += 0x3f800000 - 0x3f3504f3;
+	k = (vi)(ix >> 23) - 0x7f;
+	ix = (ix & 0x007fffff) + 0x3f3504f3;
+	f = (vf)ix - 1;
+
+	s = f / (2 + f);
+	z = s * s;
+	w = z * z;
+	t1 = w * (Lg2 + w * Lg4);
+	t2 = z * (Lg1 + w * Lg3);
+	r = t2 + t1;
+	hfsq = 0.5f * f * f;
+	dk = (vf)(k + (vi)((vf){} + 0x1.8p23f)) - 0x1.8p23f;
+	return s * (hfsq + r) + dk * ln2_lo_f - hfsq + f + dk * ln2_hi_f;
+}
+
+INLINE vi logf_special(vf x)
+{
+	return ~((vi)(x >= 0x1p-126f) & (vi)(x <= 0x1.fffffep127f));
+}
+
+/* sin and cos of x for |x| <= 2^28, to float precision: x is exactly a
+ * float, so __rem_pio2f's 25+53 bit pi/2 is enough, and the polynomials
+ * are __sindf's and __cosdf's */
+INLINE void sincosf_kernel_d(vd x, vd *s, vd *c)
+{
+	static const double
+	invpio2 = 6.36619772367581382433e-01, /* 0x3fe45f30 6dc9c883 */
+	pio2_1  = 1.57079631090164184570e+00, /* 0x3ff921fb 50000000 */
+	pio2_1t = 1.58932547735281966916e-08, /* 0x3e5110b4 611a6263 */
+	S1 = -0x15555554cbac77.0p-55, /* -0.166666666416265235595 */
+	S2 =  0x111110896efbb2.0p-59, /*  0.0083333293858894631756 */
+	S3 = -0x1a00f9e2cae774.0p-65, /* -0.000198393348360966317347 */
+	S4 =  0x16cd878c3b46a7.0p-71, /*  0.0000027183114939898219064 */
+	C0 = -0x1ffffffd0c5e81.0p-54, /* -0.499999997251031003120 */
+	C1 =  0x155553e1053a42.0p-57, /*  0.0416666233237390631894 */
+	C2 = -0x16c087e80f1e27.0p-62, /* -0.00138867637746099294692 */
+	C3 =  0x199342e0ee5069.0p-68; /*  0.0000243904487962774090654 */
+	vl n, swap;
+	vd fn, y, z, w, sr, cr;
+
+	fn = vround(x * invpio2, &n);
+	y = x - fn * pio2_1 - fn * pio2_1t;
+
+	z = y * y;
+	w = z * z;
+	sr = (y + z * y * (S1 + z * S2)) + z * y * w * (S3 + z * S4);
+	cr = ((1 + z * C0) + w * C1) + (w * z) * (C2 + z * C3);
+
+	swap = -(n & 1);
+	*s = (vd)((vul)vselect(swap, cr, sr) ^ (vul)(n & 2) << 62);
+	*c = (vd)((vul)vselect(swap, sr, cr) ^ (vul)((n + 1) & 2) << 62);
+}
+
+/* sinf and cosf of x for |x| <= 2^28, computed in double a half vector
+ * at a time */
+INLINE void sincosf_kernel(vf x, vf *s, vf *c)
+{
+	vfh xh[2], sh[2], ch[2];
+	vd sd, cd;
+	int h;
+
+	memcpy(xh, &x, sizeof(x));
+	for (h = 0; h < 2; h++) {
+		sincosf_kernel_d(__builtin_convertvector(xh[h], vd), &sd, &cd);
+		sh[h] = __builtin_convertvector(sd, vfh);
+		ch[h] = __builtin_convertvector(cd, vfh);
+	}
+	memcpy(s, sh, sizeof(*s));
+	memcpy(c, ch, sizeof(*c));
+}
+
+INLINE vi sincosf_special(vf x)
+{
+	return ~(vi)(vfabsf(x) <= 0x1p28f);
+}
+
+INLINE vf sinf_kernel(vf x)
+{
+	vf s, c;
+	sincosf_kernel(x, &s, &c);
+	return s;
+}
+
+INLINE vf cosf_kernel(vf x)
+{
+	vf s, c;
+	sincosf_kernel(x, &s, &c);
+	return c;
+}
+
+/* tanhf(x) for any x but nan */
+INLINE vf tanhf_kernel(vf x)
+{
+	vf a = vfabsf(x), z, e, big, small;
+	vui sign = (vui)x & 0x80000000;
+
+	a = vselectf((vi)(a < 10), a, (vf){} + 10);
+	e = expf_kernel(2 * a);
+	big = (vf)((vui)(1 - 2 / (e + 1)) | sign);
+
+	z = x * x;
+	small = ((((-5.70498872745e-3f * z + 2.06390887954e-2f) * z - 5.37397155531e-2f) * z
+	    + 1.33314422036e-1f) * z - 3.33332819422e-1f) * z * x + x;
+
+	return vselectf((vi)(a > 0.625f), big, small);
+}
+
+INLINE vi tanhf_special(vf x)
+{
+	return (vi)(x != x);
+}
+
+INLINE vf sqrtf_kernel(vf x)
+{
+	return vsqrtf(x);
+}
+
+INLINE vi sqrtf_special(vf x)
+{
+	return (vi){};
+}
+
+/*
+ * Defines name(x, y, n), which runs kernel over x a vector at a time and
+ * recomputes the lanes that special flags with scalar. The last partial
+ * vector is padded with ones, which every kernel handles.
+ */
+#define DEFINE_ARRAY_FUNCTION(name, type, vtype, itype, lanes, kernel, special, scalar) \
+static inline void name##_vector(const type *x, type *y, size_t m) \
+{ \
+	vtype vx = (vtype){} + 1, vy; \
+	itype sp; \
+	size_t j; \
+	int any = 0; \
+	if (m == lanes) memcpy(&vx, x, sizeof(vx)); \
+	else memcpy(&vx, x, m * sizeof(type)); \
+	vy = kernel(vx); \
+	sp = special(vx); \
+	if (m == lanes) memcpy(y, &vy, sizeof(vy)); \
+	else memcpy(y, &vy, m * sizeof(type)); \
+	for (j = 0; j < lanes; j++) any |= sp[j] != 0; \
+	if (any) \
+		for (j = 0; j < m; j++) \
+			if (sp[j]) y[j] = scalar(vx[j]); \
+} \
+void name(const type *x, type *y, size_t n) \
+{ \
+	size_t i; \
+	for (i = 0; i + lanes <= n; i += lanes) \
+		name##_vector(x + i, y + i, lanes); \
+	if (i < n) \
+		name##_vector(x + i, y + i, n - i); \
+}
+
+DEFINE_ARRAY_FUNCTION(hl_vexp, double, vd, vl, DLANES, exp_kernel, exp_special, exp)
+DEFINE_ARRAY_FUNCTION(hl_vlog, double, vd, vl, DLANES, log_kernel, log_special, log)
+DEFINE_ARRAY_FUNCTION(hl_vsin, double, vd, vl, DLANES, sin_kernel, sincos_special, sin)
+DEFINE_ARRAY_FUNCTION(hl_vcos, double, vd, vl, DLANES, cos_kernel, sincos_special, cos)
+DEFINE_ARRAY_FUNCTION(hl_vtanh, double, vd, vl, DLANES, tanh_kernel, tanh_special, tanh)
+DEFINE_ARRAY_FUNCTION(hl_vsqrt, double, vd, vl, DLANES, sqrt_kernel, sqrt_special, sqrt)
+
+DEFINE_ARRAY_FUNCTION(hl_vexpf, float, vf, vi, FLANES, expf_kernel, expf_special, expf)
+DEFINE_ARRAY_FUNCTION(hl_vlogf, float, vf, vi, FLANES, logf_kernel, logf_special, logf)
+DEFINE_ARRAY_FUNCTION(hl_vsinf, float, vf, vi, FLANES, sinf_kernel, sincosf_special, sinf)
+DEFINE_ARRAY_FUNCTION(hl_vcosf, float, vf, vi, FLANES, cosf_kernel, sincosf_special, cosf)
+DEFINE_ARRAY_FUNCTION(hl_vtanhf, float, vf, vi, FLANES, tanhf_kernel, tanhf_special, tanhf)
+DEFINE_ARRAY_FUNCTION(hl_vsqrtf, float, vf, vi, FLANES, sqrtf_kernel, sqrtf_special, sqrtf)
@@ -15,15 +15,23 @@ limitations under the License.
 */
 
 use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
 
-use criterion::{criterion_group, criterion_main, Criterion};
-use hyperlight_common::flatbuffer_wrappers::function_types::{ParameterValue, ReturnType};
+use criterion::measurement::{Measurement, ValueFormatter};
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterValue, ReturnType, ReturnValue,
+};
 use hyperlight_host::func::HostFunction2;
-use hyperlight_host::sandbox::{MultiUseSandbox, UninitializedSandbox};
+use hyperlight_host::sandbox::{
+    MemoryFootprint, MultiUseSandbox, SandboxConfiguration, UninitializedSandbox,
+};
 use hyperlight_host::sandbox_state::sandbox::EvolvableSandbox;
 use hyperlight_host::sandbox_state::transition::Noop;
-use hyperlight_host::GuestBinary;
-use hyperlight_testing::simple_guest_as_string;
+use hyperlight_host::{GuestBinary, MultiUseGuestCallContext};
+use hyperlight_testing::{c_simple_guest_as_string, simple_guest_as_string};
+use log::LevelFilter;
 
 fn create_uninit_sandbox() -> UninitializedSandbox {
     let path = simple_guest_as_string().unwrap();
@@ -34,6 +42,15 @@ fn create_multiuse_sandbox() -> MultiUseSandbox {
     create_uninit_sandbox().evolve(Noop::default()).unwrap()
 }
 
+fn create_c_guest_call_context() -> MultiUseGuestCallContext {
+    let path = c_simple_guest_as_string().unwrap();
+    UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None)
+        .unwrap()
+        .evolve(Noop::default())
+        .unwrap()
+        .new_call_context()
+}
+
 fn guest_call_benchmark(c: &mut Criterion) {
     let mut group = c.benchmark_group("guest_functions");
 
@@ -101,6 +118,44 @@ fn guest_call_benchmark(c: &mut Criterion) {
     group.finish();
 }
 
+fn vm_exit_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("vm_exits");
+
+    // The number of host function calls (and so IO exits) made by each guest call
+    const EXITS: i32 = 1000;
+
+    fn add(a: i32, b: i32) -> hyperlight_host::Result<i32> {
+        Ok(a + b)
+    }
+
+    let mut uninitialized_sandbox = create_uninit_sandbox();
+    Arc::new(Mutex::new(add))
+        .register(&mut uninitialized_sandbox, "HostAdd")
+        .unwrap();
+    let multiuse_sandbox: MultiUseSandbox = uninitialized_sandbox.evolve(Noop::default()).unwrap();
+    let mut call_ctx = multiuse_sandbox.new_call_context();
+
+    // The allocations made on each exit are measured separately, by the
+    // `vm_exit_allocations` benchmark, so that the allocator counting them
+    // does not slow down the other benchmarks.
+
+    // Benchmarks a guest function call making `EXITS` calls into the host.
+    // The benchmark does **not** include the time to reset the sandbox memory after the call.
+    group.bench_function("guest_call_with_1000_host_function_calls", |b| {
+        b.iter(|| {
+            call_ctx
+                .call(
+                    "AddRepeatedly",
+                    ReturnType::Int,
+                    Some(vec![ParameterValue::Int(EXITS)]),
+                )
+                .unwrap()
+        });
+    });
+
+    group.finish();
+}
+
 fn sandbox_benchmark(c: &mut Criterion) {
     let mut group = c.benchmark_group("sandboxes");
 
@@ -140,9 +195,642 @@ fn sandbox_benchmark(c: &mut Criterion) {
     group.finish();
 }
 
+/// The number of sandboxes kept alive at once by the density benchmarks
+const DENSITY_SANDBOXES: usize = 100;
+
+fn density_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("sandbox_density");
+    group.sample_size(10);
+
+    // Benchmarks the time to create `DENSITY_SANDBOXES` sandboxes that are
+    // all alive at once, reported per sandbox.
+    // Does **not** include the time to drop the sandboxes.
+    group.throughput(Throughput::Elements(DENSITY_SANDBOXES as u64));
+    group.bench_function("create_100_sandboxes", |b| {
+        b.iter_with_large_drop(|| {
+            (0..DENSITY_SANDBOXES)
+                .map(|_| create_multiuse_sandbox())
+                .collect::<Vec<_>>()
+        });
+    });
+
+    // Benchmarks the time to fork `DENSITY_SANDBOXES` sandboxes from one,
+    // that are all alive at once, reported per sandbox.
+    let parent = create_multiuse_sandbox();
+    group.bench_function("fork_100_sandboxes", |b| {
+        b.iter_with_large_drop(|| {
+            (0..DENSITY_SANDBOXES)
+                .map(|_| parent.fork().unwrap())
+                .collect::<Vec<_>>()
+        });
+    });
+
+    group.finish();
+}
+
+/// The sizes the benchmark matrix runs at, with the names the results are
+/// reported under
+const PAYLOAD_SIZES: [(&str, usize); 5] = [
+    ("1B", 1),
+    ("1KiB", 1024),
+    ("64KiB", 64 * 1024),
+    ("1MiB", 1024 * 1024),
+    ("16MiB", 16 * 1024 * 1024),
+];
+const MEMORY_SIZES: [(&str, u64); 5] = [
+    ("128KiB", 128 * 1024),
+    ("1MiB", 1024 * 1024),
+    ("16MiB", 16 * 1024 * 1024),
+    ("128MiB", 128 * 1024 * 1024),
+    ("512MiB", 512 * 1024 * 1024),
+];
+
+fn payload_benchmark(c: &mut Criterion) {
+    let largest = PAYLOAD_SIZES[PAYLOAD_SIZES.len() - 1].1;
+
+    // The buffers need room for the flatbuffer framing around the largest
+    // payload, and the guest heap for the copies it makes while
+    // deserializing and serializing it.
+    let mut cfg = SandboxConfiguration::default();
+    cfg.set_input_data_size(largest + 64 * 1024);
+    cfg.set_output_data_size(largest + 64 * 1024);
+    cfg.set_heap_size(8 * largest as u64);
+    let path = simple_guest_as_string().unwrap();
+    let mut call_ctx =
+        UninitializedSandbox::new(GuestBinary::FilePath(path), Some(cfg), None, None)
+            .unwrap()
+            .evolve(Noop::default())
+            .unwrap()
+            .new_call_context();
+
+    let mut group = c.benchmark_group("payloads");
+
+    // Benchmarks passing a byte array from the host to the guest, and
+    // returning one from the guest to the host.
+    // The benchmark does **not** include the time to reset the sandbox memory after the call.
+    for (name, size) in PAYLOAD_SIZES {
+        group.throughput(Throughput::Bytes(size as u64));
+        let payload = vec![0xA5u8; size];
+        group.bench_function(format!("host_to_guest_{name}"), |b| {
+            b.iter(|| {
+                call_ctx
+                    .call(
+                        "ByteLength",
+                        ReturnType::Int,
+                        Some(vec![ParameterValue::VecBytes(payload.clone())]),
+                    )
+                    .unwrap()
+            });
+        });
+        group.bench_function(format!("guest_to_host_{name}"), |b| {
+            b.iter(|| {
+                call_ctx
+                    .call(
+                        "MakeBytes",
+                        ReturnType::VecBytes,
+                        Some(vec![ParameterValue::Int(size as i32)]),
+                    )
+                    .unwrap()
+            });
+        });
+    }
+
+    group.finish();
+}
+
+fn host_call_depth_benchmark(c: &mut Criterion) {
+    fn add(a: i32, b: i32) -> hyperlight_host::Result<i32> {
+        Ok(a + b)
+    }
+
+    let mut uninitialized_sandbox = create_uninit_sandbox();
+    Arc::new(Mutex::new(add))
+        .register(&mut uninitialized_sandbox, "HostAdd")
+        .unwrap();
+    let multiuse_sandbox: MultiUseSandbox = uninitialized_sandbox.evolve(Noop::default()).unwrap();
+    let mut call_ctx = multiuse_sandbox.new_call_context();
+
+    let mut group = c.benchmark_group("host_call_depth");
+
+    // Benchmarks a guest function that recurses `depth` levels and calls
+    // the host from each one, reported per host call. Host functions
+    // cannot call back into the guest, so this is as deep as a chain of
+    // calls between the two gets.
+    // The benchmark does **not** include the time to reset the sandbox memory after the call.
+    for depth in [1, 8, 64, 256] {
+        group.throughput(Throughput::Elements(depth as u64));
+        group.bench_function(format!("depth_{depth}"), |b| {
+            b.iter(|| {
+                call_ctx
+                    .call(
+                        "AddNested",
+                        ReturnType::Int,
+                        Some(vec![ParameterValue::Int(depth)]),
+                    )
+                    .unwrap()
+            });
+        });
+    }
+
+    group.finish();
+}
+
+fn memory_size_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("memory_sizes");
+    // the larger sandboxes take long enough that the default 100 samples
+    // would make the matrix take many minutes
+    group.sample_size(10);
+
+    let create_sandbox = |cfg: SandboxConfiguration| -> MultiUseSandbox {
+        let path = simple_guest_as_string().unwrap();
+        UninitializedSandbox::new(GuestBinary::FilePath(path), Some(cfg), None, None)
+            .unwrap()
+            .evolve(Noop::default())
+            .unwrap()
+    };
+
+    // Benchmarks creating a sandbox, and a guest call including the time to
+    // reset the sandbox memory after it, with heaps and stacks of each size,
+    // reported in bytes of heap or stack.
+    for (name, size) in MEMORY_SIZES {
+        group.throughput(Throughput::Bytes(size));
+        let mut heap_cfg = SandboxConfiguration::default();
+        heap_cfg.set_heap_size(size);
+        let mut stack_cfg = SandboxConfiguration::default();
+        stack_cfg.set_stack_size(size);
+
+        for (kind, cfg) in [("heap", heap_cfg), ("stack", stack_cfg)] {
+            group.bench_function(format!("create_sandbox_{kind}_{name}"), |b| {
+                b.iter_with_large_drop(|| create_sandbox(cfg));
+            });
+
+            let mut sandbox = create_sandbox(cfg);
+            group.bench_function(format!("guest_call_with_reset_{kind}_{name}"), |b| {
+                b.iter(|| {
+                    sandbox
+                        .call_guest_function_by_name(
+                            "Echo",
+                            ReturnType::Int,
+                            Some(vec![ParameterValue::String("hello\n".to_string())]),
+                        )
+                        .unwrap()
+                });
+            });
+        }
+    }
+
+    group.finish();
+}
+
+fn logging_benchmark(c: &mut Criterion) {
+    // The number of messages each guest call logs
+    const MESSAGES: i32 = 100;
+
+    let mut group = c.benchmark_group("guest_logging");
+    group.throughput(Throughput::Elements(MESSAGES as u64));
+
+    // Benchmarks a guest function call logging `MESSAGES` messages, reported
+    // per message, both with the guest's log level letting them through to
+    // the host and with it filtering them out in the guest.
+    // The benchmark does **not** include the time to reset the sandbox memory after the call.
+    for (name, level) in [("info", LevelFilter::Info), ("off", LevelFilter::Off)] {
+        let mut uninitialized_sandbox = create_uninit_sandbox();
+        uninitialized_sandbox.set_max_guest_log_level(level);
+        let multiuse_sandbox: MultiUseSandbox =
+            uninitialized_sandbox.evolve(Noop::default()).unwrap();
+        let mut call_ctx = multiuse_sandbox.new_call_context();
+
+        for (size, message) in [("short", "x".repeat(16)), ("long", "x".repeat(1024))] {
+            group.bench_function(format!("log_{size}_messages_{name}"), |b| {
+                b.iter(|| {
+                    call_ctx
+                        .call(
+                            "LogRepeatedly",
+                            ReturnType::Int,
+                            Some(vec![
+                                ParameterValue::String(message.clone()),
+                                ParameterValue::Int(MESSAGES),
+                            ]),
+                        )
+                        .unwrap()
+                });
+            });
+        }
+    }
+
+    group.finish();
+}
+
+/// The NUMA nodes that are online, as listed in sysfs
+#[cfg(target_os = "linux")]
+fn online_numa_nodes() -> Vec<u32> {
+    let list = std::fs::read_to_string("/sys/devices/system/node/online").unwrap_or_default();
+    list.trim()
+        .split(',')
+        .filter(|range| !range.is_empty())
+        .flat_map(|range| {
+            let (first, last) = range.split_once('-').unwrap_or((range, range));
+            first.parse::<u32>().unwrap()..=last.parse::<u32>().unwrap()
+        })
+        .collect()
+}
+
+#[cfg(target_os = "linux")]
+fn numa_benchmark(c: &mut Criterion) {
+    // The amount of guest memory each call writes to, and how many times
+    const TOUCHED_SIZE: i32 = 16 * 1024 * 1024;
+    const PASSES: i32 = 8;
+
+    let nodes = online_numa_nodes();
+    if nodes.len() < 2 {
+        println!("numa: skipped, this host has fewer than two NUMA nodes");
+        return;
+    }
+    let (local, remote) = (nodes[0], nodes[1]);
+
+    // The vCPU thread always runs on `local`; only the memory moves
+    let create_sandbox = |memory_node: u32| -> MultiUseSandbox {
+        let mut cfg = SandboxConfiguration::default();
+        cfg.set_heap_size(2 * TOUCHED_SIZE as u64);
+        cfg.set_numa_node(memory_node);
+        cfg.set_vcpu_numa_node(local);
+        let path = simple_guest_as_string().unwrap();
+        UninitializedSandbox::new(GuestBinary::FilePath(path), Some(cfg), None, None)
+            .unwrap()
+            .evolve(Noop::default())
+            .unwrap()
+    };
+
+    let mut group = c.benchmark_group("numa");
+
+    // Benchmarks a memory bound guest call with the sandbox's memory on the
+    // same node as its vCPU thread, and on another node.
+    // The benchmark includes the time to reset the sandbox memory after the
+    // call, which is done on the benchmark thread.
+    for (name, memory_node) in [
+        ("guest_call_local_memory", local),
+        ("guest_call_remote_memory", remote),
+    ] {
+        let mut sbox = create_sandbox(memory_node);
+        group.bench_function(name, |b| {
+            b.iter(|| {
+                sbox.call_guest_function_by_name(
+                    "TouchMemory",
+                    ReturnType::Int,
+                    Some(vec![
+                        ParameterValue::Int(TOUCHED_SIZE),
+                        ParameterValue::Int(PASSES),
+                    ]),
+                )
+                .unwrap()
+            });
+        });
+    }
+
+    group.finish();
+}
+
+#[cfg(not(target_os = "linux"))]
+fn numa_benchmark(_: &mut Criterion) {
+    println!("numa: skipped, NUMA placement is only supported on Linux");
+}
+
+// Benchmarks the C guest's printf formatting doubles, per double formatted.
+// The shortest round-trip digits are enough for most conversions with the
+// default precision, while "%.17g" always needs the exact digits, so the
+// formats compare the two ways the guest formats doubles.
+fn float_formatting_benchmark(c: &mut Criterion) {
+    const COUNT: i32 = 1000;
+    let mut group = c.benchmark_group("float_formatting");
+    group.throughput(Throughput::Elements(COUNT as u64));
+
+    let mut call_ctx = create_c_guest_call_context();
+
+    for format in ["%f", "%e", "%g", "%.17g"] {
+        group.bench_function(format, |b| {
+            b.iter(|| {
+                call_ctx
+                    .call(
+                        "FormatDoubles",
+                        ReturnType::Int,
+                        Some(vec![
+                            ParameterValue::Int(COUNT),
+                            ParameterValue::String(format.to_string()),
+                        ]),
+                    )
+                    .unwrap()
+            });
+        });
+    }
+
+    group.finish();
+}
+
+// Benchmarks the C guest's strtod, per double parsed, on a row of numbers
+// with three decimals like those in a CSV file.
+fn float_parsing_benchmark(c: &mut Criterion) {
+    const COUNT: u64 = 500;
+    let mut group = c.benchmark_group("float_parsing");
+    group.throughput(Throughput::Elements(COUNT));
+
+    let mut state = 0x9E3779B97F4A7C15u64;
+    let row = (0..COUNT)
+        .map(|_| {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            format!("{:.3}", (state >> 40) as f64 / 1000.0)
+        })
+        .collect::<Vec<_>>()
+        .join(",");
+
+    let mut call_ctx = create_c_guest_call_context();
+
+    group.bench_function("strtod", |b| {
+        b.iter(|| {
+            call_ctx
+                .call(
+                    "ParseDoubles",
+                    ReturnType::Double,
+                    Some(vec![ParameterValue::String(row.clone())]),
+                )
+                .unwrap()
+        });
+    });
+
+    group.finish();
+}
+
+// Benchmarks the C guest's qsort on ints, per int sorted, both distinct and
+// with many duplicates.
+fn qsort_benchmark(c: &mut Criterion) {
+    const COUNT: i32 = 10000;
+    let mut group = c.benchmark_group("qsort");
+    group.throughput(Throughput::Elements(COUNT as u64));
+
+    let mut call_ctx = create_c_guest_call_context();
+
+    for (name, few_distinct) in [("random", false), ("few_distinct", true)] {
+        group.bench_function(name, |b| {
+            b.iter(|| {
+                call_ctx
+                    .call(
+                        "SortInts",
+                        ReturnType::Int,
+                        Some(vec![
+                            ParameterValue::Int(COUNT),
+                            ParameterValue::Bool(few_distinct),
+                        ]),
+                    )
+                    .unwrap()
+            });
+        });
+    }
+
+    group.finish();
+}
+
+/// Measure how many TSC cycles there are per second of the host's clock.
+/// The guest reads the same TSC, so this converts the cycle counts guest
+/// benchmarks report into time.
+fn tsc_frequency() -> f64 {
+    let read_tsc = || unsafe { std::arch::x86_64::_rdtsc() };
+    let (start, start_tsc) = (Instant::now(), read_tsc());
+    thread::sleep(Duration::from_millis(200));
+    let (end, end_tsc) = (Instant::now(), read_tsc());
+    (end_tsc - start_tsc) as f64 / (end - start).as_secs_f64()
+}
+
+// Benchmarks parts of the guest runtime from inside the guest, with the
+// simpleguest's `RunGuestBenchmark` (see `hyperlight_guest::bench`), so
+// that the timings include no VM exits or host-side work.
+fn guest_runtime_benchmark(c: &mut Criterion) {
+    let mut group = c.benchmark_group("guest_runtime");
+    let cycles_per_second = tsc_frequency();
+    let mut call_ctx = create_multiuse_sandbox().new_call_context();
+
+    // Every guest call has to finish well within the sandbox's
+    // `max_execution_time`, so each is limited to about this much guest
+    // time, going by how long a calibration run of each benchmark takes
+    const CALL_BUDGET: Duration = Duration::from_millis(100);
+    const CALIBRATION_ITERATIONS: u64 = 1000;
+
+    // Run the guest benchmark `name` for `iterations` iterations, at most
+    // `batch` of them per guest call, and return the TSC cycles they took
+    let mut run = |name: &str, iterations: u64, batch: u64| -> u64 {
+        let mut cycles = 0;
+        let mut remaining = iterations;
+        while remaining > 0 {
+            let batch = remaining.min(batch);
+            let res = call_ctx
+                .call(
+                    "RunGuestBenchmark",
+                    ReturnType::VecBytes,
+                    Some(vec![
+                        ParameterValue::String(name.to_string()),
+                        ParameterValue::Int(1),
+                        ParameterValue::Int(batch as i32),
+                    ]),
+                )
+                .unwrap();
+            match res {
+                ReturnValue::VecBytes(sample) => {
+                    cycles += u64::from_le_bytes(sample.try_into().unwrap());
+                }
+                other => panic!("Unexpected return value {:?}", other),
+            }
+            remaining -= batch;
+        }
+        cycles
+    };
+
+    // `nop` measures the overhead included in each iteration of the others
+    for name in [
+        "nop",
+        "malloc_free_64B",
+        "memcpy_4KiB",
+        "strtod",
+        "decode_function_call",
+        "decode_function_call_view",
+    ] {
+        let cycles = run(name, CALIBRATION_ITERATIONS, CALIBRATION_ITERATIONS);
+        let cycles_per_iteration = (cycles as f64 / CALIBRATION_ITERATIONS as f64).max(1.0);
+        let batch = (CALL_BUDGET.as_secs_f64() * cycles_per_second / cycles_per_iteration) as u64;
+        let batch = batch.clamp(1, i32::MAX as u64);
+        group.bench_function(name, |b| {
+            b.iter_custom(|iterations| {
+                Duration::from_secs_f64(run(name, iterations, batch) as f64 / cycles_per_second)
+            })
+        });
+    }
+
+    group.finish();
+}
+
+fn vecmath_benchmark(c: &mut Criterion) {
+    // the guest applies the function to this many doubles per round
+    const COUNT: u64 = 4096;
+    let mut group = c.benchmark_group("vecmath");
+    group.throughput(Throughput::Elements(COUNT));
+
+    let mut call_ctx = create_c_guest_call_context();
+
+    for name in ["exp", "log", "sin", "tanh"] {
+        for (kind, batched) in [("scalar", false), ("batched", true)] {
+            group.bench_function(format!("{name}_{kind}"), |b| {
+                b.iter(|| {
+                    call_ctx
+                        .call(
+                            "VecMathRun",
+                            ReturnType::Int,
+                            Some(vec![
+                                ParameterValue::String(name.to_string()),
+                                ParameterValue::Int(1),
+                                ParameterValue::Bool(batched),
+                            ]),
+                        )
+                        .unwrap()
+                });
+            });
+        }
+    }
+
+    group.finish();
+}
+
+/// A criterion measurement of memory, in bytes, for benchmarks that report
+/// how much memory something takes up rather than how long it takes. The
+/// bytes are counted by the benchmark itself, with `iter_custom`.
+struct Bytes;
+
+impl Measurement for Bytes {
+    type Intermediate = ();
+    type Value = usize;
+
+    fn start(&self) {}
+
+    fn end(&self, _: ()) -> usize {
+        0
+    }
+
+    fn add(&self, v1: &usize, v2: &usize) -> usize {
+        v1 + v2
+    }
+
+    fn zero(&self) -> usize {
+        0
+    }
+
+    fn to_f64(&self, value: &usize) -> f64 {
+        *value as f64
+    }
+
+    fn formatter(&self) -> &dyn ValueFormatter {
+        &BytesFormatter
+    }
+}
+
+struct BytesFormatter;
+
+impl ValueFormatter for BytesFormatter {
+    fn scale_values(&self, typical_value: f64, values: &mut [f64]) -> &'static str {
+        let (divisor, unit) = if typical_value >= 1024.0 * 1024.0 {
+            (1024.0 * 1024.0, "MiB")
+        } else if typical_value >= 1024.0 {
+            (1024.0, "KiB")
+        } else {
+            (1.0, "B")
+        };
+        for value in values {
+            *value /= divisor;
+        }
+        unit
+    }
+
+    fn scale_throughputs(
+        &self,
+        _typical_value: f64,
+        throughput: &Throughput,
+        values: &mut [f64],
+    ) -> &'static str {
+        let (count, unit) = match *throughput {
+            Throughput::Bytes(bytes) | Throughput::BytesDecimal(bytes) => (bytes, "B/B"),
+            Throughput::Elements(elements) => (elements, "elem/B"),
+        };
+        for value in values {
+            *value = count as f64 / *value;
+        }
+        unit
+    }
+
+    fn scale_for_machines(&self, _values: &mut [f64]) -> &'static str {
+        "B"
+    }
+}
+
+fn density_footprint_benchmark(c: &mut Criterion<Bytes>) {
+    let mut group = c.benchmark_group("sandbox_density_footprint");
+    group.sample_size(10);
+
+    // Reports what a sandbox takes up, on average, when `DENSITY_SANDBOXES`
+    // of them are alive at once, in total and broken down by what the
+    // memory is used for. Each sandbox has made one guest call, so that
+    // its memory is as it is when in use.
+    let mut bench = |name: &str, sandboxes: &mut [MultiUseSandbox]| {
+        for sandbox in sandboxes.iter_mut() {
+            sandbox
+                .call_guest_function_by_name(
+                    "Echo",
+                    ReturnType::String,
+                    Some(vec![ParameterValue::String("hello\n".to_string())]),
+                )
+                .unwrap();
+        }
+        let parts: [(&str, fn(&MemoryFootprint) -> usize); 6] = [
+            ("total", MemoryFootprint::total),
+            ("guest_memory", |f| f.guest_memory),
+            ("page_tables", |f| f.page_tables),
+            ("io_buffers", |f| f.io_buffers),
+            ("snapshots", |f| f.snapshots),
+            ("handler_thread_stack", |f| f.handler_thread_stack),
+        ];
+        for (part, bytes) in parts {
+            group.bench_function(format!("{}/{}", name, part), |b| {
+                b.iter_custom(|iters| {
+                    (0..iters)
+                        .map(|_| {
+                            let total: usize = sandboxes
+                                .iter()
+                                .map(|sandbox| bytes(&sandbox.memory_footprint().unwrap()))
+                                .sum();
+                            total / sandboxes.len()
+                        })
+                        .sum()
+                });
+            });
+        }
+    };
+
+    let mut sandboxes: Vec<MultiUseSandbox> = (0..DENSITY_SANDBOXES)
+        .map(|_| create_multiuse_sandbox())
+        .collect();
+    bench("created", &mut sandboxes);
+    let mut forks: Vec<MultiUseSandbox> = (0..DENSITY_SANDBOXES)
+        .map(|_| sandboxes[0].fork().unwrap())
+        .collect();
+    bench("forked", &mut forks);
+
+    group.finish();
+}
+
 criterion_group! {
     name = benches;
     config = Criterion::default();
-    targets = guest_call_benchmark, sandbox_benchmark
+    targets = guest_call_benchmark, vm_exit_benchmark, sandbox_benchmark, density_benchmark, payload_benchmark, host_call_depth_benchmark, memory_size_benchmark, logging_benchmark, numa_benchmark, float_formatting_benchmark, float_parsing_benchmark, qsort_benchmark, vecmath_benchmark, guest_runtime_benchmark
+}
+criterion_group! {
+    name = footprint_benches;
+    config = Criterion::default().with_measurement(Bytes);
+    targets = density_footprint_benchmark
 }
-criterion_main!(benches);
+criterion_main!(benches, footprint_benches);
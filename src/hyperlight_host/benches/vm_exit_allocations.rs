@@ -0,0 +1,175 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Measures the heap allocations the host makes per VM exit. This is a
+//! bench target of its own because it counts allocations with a global
+//! allocator, which would otherwise slow down every other benchmark.
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+
+use criterion::measurement::{Measurement, ValueFormatter};
+use criterion::{criterion_group, criterion_main, Criterion, Throughput};
+use hyperlight_common::flatbuffer_wrappers::function_types::{ParameterValue, ReturnType};
+use hyperlight_host::func::HostFunction2;
+use hyperlight_host::sandbox::{MultiUseSandbox, UninitializedSandbox};
+use hyperlight_host::sandbox_state::sandbox::EvolvableSandbox;
+use hyperlight_host::sandbox_state::transition::Noop;
+use hyperlight_host::GuestBinary;
+use hyperlight_testing::simple_guest_as_string;
+
+/// A global allocator that counts allocations. The count covers every
+/// thread, including the hypervisor handler thread that runs the vCPU.
+struct CountingAllocator;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+/// A criterion measurement of the number of heap allocations made
+struct Allocations;
+
+impl Measurement for Allocations {
+    type Intermediate = usize;
+    type Value = usize;
+
+    fn start(&self) -> usize {
+        ALLOCATIONS.load(Ordering::Relaxed)
+    }
+
+    fn end(&self, start: usize) -> usize {
+        ALLOCATIONS.load(Ordering::Relaxed) - start
+    }
+
+    fn add(&self, v1: &usize, v2: &usize) -> usize {
+        v1 + v2
+    }
+
+    fn zero(&self) -> usize {
+        0
+    }
+
+    fn to_f64(&self, value: &usize) -> f64 {
+        *value as f64
+    }
+
+    fn formatter(&self) -> &dyn ValueFormatter {
+        &AllocationsFormatter
+    }
+}
+
+struct AllocationsFormatter;
+
+impl ValueFormatter for AllocationsFormatter {
+    fn scale_values(&self, _typical_value: f64, _values: &mut [f64]) -> &'static str {
+        "allocs"
+    }
+
+    fn scale_throughputs(
+        &self,
+        _typical_value: f64,
+        throughput: &Throughput,
+        values: &mut [f64],
+    ) -> &'static str {
+        let (count, unit) = match *throughput {
+            Throughput::Bytes(bytes) | Throughput::BytesDecimal(bytes) => (bytes, "B/alloc"),
+            Throughput::Elements(elements) => (elements, "elem/alloc"),
+        };
+        for value in values {
+            *value = count as f64 / *value;
+        }
+        unit
+    }
+
+    fn scale_for_machines(&self, _values: &mut [f64]) -> &'static str {
+        "allocs"
+    }
+}
+
+fn vm_exit_allocations_benchmark(c: &mut Criterion<Allocations>) {
+    let mut group = c.benchmark_group("vm_exits");
+
+    // The number of host function calls (and so IO exits) made by each guest call
+    const EXITS: i32 = 1000;
+
+    fn add(a: i32, b: i32) -> hyperlight_host::Result<i32> {
+        Ok(a + b)
+    }
+
+    let path = simple_guest_as_string().unwrap();
+    let mut uninitialized_sandbox =
+        UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None).unwrap();
+    Arc::new(Mutex::new(add))
+        .register(&mut uninitialized_sandbox, "HostAdd")
+        .unwrap();
+    let multiuse_sandbox: MultiUseSandbox = uninitialized_sandbox.evolve(Noop::default()).unwrap();
+    let mut call_ctx = multiuse_sandbox.new_call_context();
+
+    let mut call_with_exits = |exits: i32| {
+        call_ctx
+            .call(
+                "AddRepeatedly",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(exits)]),
+            )
+            .unwrap()
+    };
+
+    // Measures the allocations made by `EXITS` host function calls from
+    // the guest. Subtracting those of a guest call that makes no host
+    // calls removes the cost of the guest call itself, so what remains is
+    // the exit path plus decoding each host function call and encoding its
+    // result.
+    group.bench_function("allocations_for_1000_host_function_call_exits", |b| {
+        b.iter_custom(|iters| {
+            let mut allocations = 0;
+            for _ in 0..iters {
+                let start = ALLOCATIONS.load(Ordering::Relaxed);
+                call_with_exits(EXITS);
+                let with_exits = ALLOCATIONS.load(Ordering::Relaxed) - start;
+
+                let start = ALLOCATIONS.load(Ordering::Relaxed);
+                call_with_exits(0);
+                let without_exits = ALLOCATIONS.load(Ordering::Relaxed) - start;
+
+                allocations += with_exits.saturating_sub(without_exits);
+            }
+            allocations
+        });
+    });
+
+    group.finish();
+}
+
+criterion_group! {
+    name = benches;
+    config = Criterion::default().with_measurement(Allocations);
+    targets = vm_exit_allocations_benchmark
+}
+criterion_main!(benches);
@@ -0,0 +1,488 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::str::FromStr;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use crossbeam_channel::{Receiver, Sender};
+use hyperlight_common::flatbuffer_wrappers::function_types::{ParameterValue, ReturnType};
+use hyperlight_host::func::{HostFunction1, HostFunction2};
+use hyperlight_host::sandbox_state::sandbox::EvolvableSandbox;
+use hyperlight_host::sandbox_state::transition::Noop;
+use hyperlight_host::{GuestBinary, MultiUseSandbox, UninitializedSandbox};
+use hyperlight_testing::{callback_guest_as_string, simple_guest_as_string};
+use rand::Rng;
+use serde_json::{json, Value};
+
+const USAGE: &str = "\
+Usage: load-generator [OPTIONS]
+
+Calls a guest function in a pool of sandboxes from a pool of threads, with
+calls arriving as a Poisson process at a fixed rate whether or not earlier
+calls have finished, and reports the latency of the calls.
+
+Options (lists are comma separated, and every combination is run):
+  --guest simple|callback   the guest to call (default simple)
+  --sandboxes N,...         the number of sandboxes (default 4)
+  --threads M,...           the number of threads calling them (default 4)
+  --rate R,...              calls per second to offer (default 1000)
+  --duration SECONDS        how long to offer calls for in each run (default 10)
+  --host-delay-us US        how long each host function call takes (default 0)
+  --output PATH             write the JSON results to PATH instead of stdout";
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Guest {
+    /// simpleguest's `Add`, which calls the `HostAdd` host function
+    Simple,
+    /// callbackguest's `GuestMethod1`, which calls the `HostMethod1` host function
+    Callback,
+}
+
+impl Guest {
+    fn name(self) -> &'static str {
+        match self {
+            Guest::Simple => "simple",
+            Guest::Callback => "callback",
+        }
+    }
+}
+
+struct Options {
+    guest: Guest,
+    sandboxes: Vec<usize>,
+    threads: Vec<usize>,
+    rates: Vec<f64>,
+    duration: Duration,
+    host_delay: Duration,
+    output: Option<String>,
+}
+
+impl Options {
+    fn parse(mut args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut options = Options {
+            guest: Guest::Simple,
+            sandboxes: vec![4],
+            threads: vec![4],
+            rates: vec![1000.0],
+            duration: Duration::from_secs(10),
+            host_delay: Duration::ZERO,
+            output: None,
+        };
+
+        while let Some(arg) = args.next() {
+            if arg == "--help" {
+                println!("{USAGE}");
+                std::process::exit(0);
+            }
+            let value = args.next().ok_or_else(|| format!("{arg} needs a value"))?;
+            match arg.as_str() {
+                "--guest" => {
+                    options.guest = match value.as_str() {
+                        "simple" => Guest::Simple,
+                        "callback" => Guest::Callback,
+                        _ => return Err(format!("unknown guest {value}")),
+                    }
+                }
+                "--sandboxes" => options.sandboxes = parse_list(&arg, &value)?,
+                "--threads" => options.threads = parse_list(&arg, &value)?,
+                "--rate" => options.rates = parse_list(&arg, &value)?,
+                "--duration" => {
+                    options.duration = Duration::from_secs_f64(parse_one(&arg, &value)?)
+                }
+                "--host-delay-us" => {
+                    options.host_delay = Duration::from_micros(parse_one(&arg, &value)?)
+                }
+                "--output" => options.output = Some(value),
+                _ => return Err(format!("unknown option {arg}")),
+            }
+        }
+
+        if options.sandboxes.contains(&0) || options.threads.contains(&0) {
+            return Err("--sandboxes and --threads must be at least 1".to_string());
+        }
+        if options.rates.iter().any(|rate| *rate <= 0.0) {
+            return Err("--rate must be positive".to_string());
+        }
+        Ok(options)
+    }
+}
+
+fn parse_one<T: FromStr>(arg: &str, value: &str) -> Result<T, String> {
+    value
+        .trim()
+        .parse()
+        .map_err(|_| format!("invalid value {value} for {arg}"))
+}
+
+fn parse_list<T: FromStr>(arg: &str, value: &str) -> Result<Vec<T>, String> {
+    value.split(',').map(|item| parse_one(arg, item)).collect()
+}
+
+/// A histogram of durations in nanoseconds, in the manner of HdrHistogram:
+/// values below 2^SUB_BUCKET_BITS are counted exactly, and larger values in
+/// buckets less than 1% of their value wide.
+struct Histogram {
+    counts: Vec<u64>,
+    total: u64,
+    sum: u128,
+    max: u64,
+}
+
+const SUB_BUCKET_BITS: u32 = 8;
+const HALF_SUB_BUCKETS: usize = 1 << (SUB_BUCKET_BITS - 1);
+
+impl Histogram {
+    fn new() -> Self {
+        Self {
+            counts: vec![0; Self::index(u64::MAX) + 1],
+            total: 0,
+            sum: 0,
+            max: 0,
+        }
+    }
+
+    fn index(value: u64) -> usize {
+        if value < 1 << SUB_BUCKET_BITS {
+            return value as usize;
+        }
+        // keep the top SUB_BUCKET_BITS bits of the value
+        let shift = 64 - value.leading_zeros() - SUB_BUCKET_BITS;
+        shift as usize * HALF_SUB_BUCKETS + (value >> shift) as usize
+    }
+
+    /// The largest value counted in the bucket at `index`
+    fn highest_value(index: usize) -> u64 {
+        if index < 1 << SUB_BUCKET_BITS {
+            return index as u64;
+        }
+        let shift = index / HALF_SUB_BUCKETS - 1;
+        let sub_bucket = (index - shift * HALF_SUB_BUCKETS) as u128;
+        (((sub_bucket + 1) << shift) - 1).min(u64::MAX as u128) as u64
+    }
+
+    fn record(&mut self, duration: Duration) {
+        let value = duration.as_nanos().min(u64::MAX as u128) as u64;
+        self.counts[Self::index(value)] += 1;
+        self.total += 1;
+        self.sum += value as u128;
+        self.max = self.max.max(value);
+    }
+
+    fn merge(&mut self, other: &Histogram) {
+        for (count, other_count) in self.counts.iter_mut().zip(&other.counts) {
+            *count += other_count;
+        }
+        self.total += other.total;
+        self.sum += other.sum;
+        self.max = self.max.max(other.max);
+    }
+
+    fn percentile(&self, percentile: f64) -> u64 {
+        let rank = ((percentile / 100.0 * self.total as f64).ceil() as u64).max(1);
+        let mut seen = 0;
+        for (index, count) in self.counts.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                return Self::highest_value(index).min(self.max);
+            }
+        }
+        self.max
+    }
+
+    fn to_json(&self) -> Value {
+        if self.total == 0 {
+            return json!({ "count": 0 });
+        }
+        json!({
+            "count": self.total,
+            "mean": (self.sum / self.total as u128) as u64,
+            "p50": self.percentile(50.0),
+            "p90": self.percentile(90.0),
+            "p99": self.percentile(99.0),
+            "p99_9": self.percentile(99.9),
+            "max": self.max,
+        })
+    }
+}
+
+/// The latency of each call, and the parts it is made up of
+struct Latencies {
+    /// From when the call was due to arrive until its sandbox was reset
+    end_to_end: Histogram,
+    /// Waiting for a thread and a sandbox to run the call
+    queueing: Histogram,
+    /// Running the guest function, not counting host function calls
+    guest: Histogram,
+    /// Running the host functions the guest function called
+    host_function: Histogram,
+    /// Resetting the sandbox's memory after the call
+    reset: Histogram,
+}
+
+impl Latencies {
+    fn new() -> Self {
+        Self {
+            end_to_end: Histogram::new(),
+            queueing: Histogram::new(),
+            guest: Histogram::new(),
+            host_function: Histogram::new(),
+            reset: Histogram::new(),
+        }
+    }
+
+    fn merge(&mut self, other: &Latencies) {
+        self.end_to_end.merge(&other.end_to_end);
+        self.queueing.merge(&other.queueing);
+        self.guest.merge(&other.guest);
+        self.host_function.merge(&other.host_function);
+        self.reset.merge(&other.reset);
+    }
+
+    fn to_json(&self) -> Value {
+        json!({
+            "end_to_end": self.end_to_end.to_json(),
+            "queueing": self.queueing.to_json(),
+            "guest": self.guest.to_json(),
+            "host_function": self.host_function.to_json(),
+            "reset": self.reset.to_json(),
+        })
+    }
+}
+
+/// A sandbox, and the time its host functions have spent running during
+/// the current call
+struct PooledSandbox {
+    sandbox: MultiUseSandbox,
+    host_time: Arc<AtomicU64>,
+}
+
+impl PooledSandbox {
+    fn new(guest: Guest, host_delay: Duration) -> hyperlight_host::Result<Self> {
+        let path = match guest {
+            Guest::Simple => simple_guest_as_string(),
+            Guest::Callback => callback_guest_as_string(),
+        }
+        .expect("Cannot find the guest binary at the expected location.");
+        let mut uninitialized_sandbox =
+            UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None)?;
+
+        let host_time = Arc::new(AtomicU64::new(0));
+        let time = host_time.clone();
+        match guest {
+            Guest::Simple => Arc::new(Mutex::new(
+                move |a: i32, b: i32| -> hyperlight_host::Result<i32> {
+                    Ok(timed(&time, host_delay, || a + b))
+                },
+            ))
+            .register(&mut uninitialized_sandbox, "HostAdd")?,
+            Guest::Callback => Arc::new(Mutex::new(
+                move |message: String| -> hyperlight_host::Result<i32> {
+                    Ok(timed(&time, host_delay, || message.len() as i32))
+                },
+            ))
+            .register(&mut uninitialized_sandbox, "HostMethod1")?,
+        }
+
+        Ok(Self {
+            sandbox: uninitialized_sandbox.evolve(Noop::default())?,
+            host_time,
+        })
+    }
+}
+
+/// Run `f`, busy waiting until at least `host_delay` has passed to stand in
+/// for a host function that does real work, and add the time taken to
+/// `host_time`
+fn timed<R>(host_time: &AtomicU64, host_delay: Duration, f: impl FnOnce() -> R) -> R {
+    let start = Instant::now();
+    let result = f();
+    while start.elapsed() < host_delay {
+        std::hint::spin_loop();
+    }
+    host_time.fetch_add(start.elapsed().as_nanos() as u64, Ordering::Relaxed);
+    result
+}
+
+/// Send the time each call is due to `arrivals`, with exponentially
+/// distributed gaps between them so that they form a Poisson process at
+/// `rate` calls per second, for `duration`. Calls are due when they are due
+/// whether or not the earlier ones have finished, so that a slow call
+/// delays the calls after it rather than the load easing off, and the
+/// delay shows up in their latency. Returns the number of calls sent.
+fn generate_arrivals(arrivals: Sender<Instant>, rate: f64, duration: Duration) -> u64 {
+    let mut rng = rand::rng();
+    let start = Instant::now();
+    let mut due = start;
+    let mut sent = 0;
+    loop {
+        let gap = -(1.0 - rng.random::<f64>()).ln() / rate;
+        due += Duration::from_secs_f64(gap);
+        if due - start >= duration {
+            return sent;
+        }
+        let now = Instant::now();
+        if due > now {
+            thread::sleep(due - now);
+        }
+        arrivals
+            .send(due)
+            .expect("The workers exited before the arrivals ended");
+        sent += 1;
+    }
+}
+
+/// Run each call from `arrivals` in a sandbox from the pool, returning the
+/// calls' latencies and how many of them failed
+fn worker(
+    arrivals: Receiver<Instant>,
+    pool: (Sender<PooledSandbox>, Receiver<PooledSandbox>),
+    guest: Guest,
+    host_delay: Duration,
+) -> (Latencies, u64) {
+    let (function_name, args) = match guest {
+        Guest::Simple => ("Add", vec![ParameterValue::Int(1), ParameterValue::Int(41)]),
+        Guest::Callback => (
+            "GuestMethod1",
+            vec![ParameterValue::String("load".to_string())],
+        ),
+    };
+    let mut latencies = Latencies::new();
+    let mut errors = 0;
+
+    for due in arrivals {
+        let PooledSandbox { sandbox, host_time } =
+            pool.1.recv().expect("The sandbox pool was closed");
+        let started = Instant::now();
+        host_time.store(0, Ordering::Relaxed);
+
+        let mut call_ctx = sandbox.new_call_context();
+        let result = call_ctx.call(function_name, ReturnType::Int, Some(args.clone()));
+        let called = Instant::now();
+        let sandbox = call_ctx.finish();
+        let finished = Instant::now();
+
+        let host_function = Duration::from_nanos(host_time.load(Ordering::Relaxed));
+        latencies.end_to_end.record(finished - due);
+        latencies
+            .queueing
+            .record(started.saturating_duration_since(due));
+        latencies
+            .guest
+            .record((called - started).saturating_sub(host_function));
+        latencies.host_function.record(host_function);
+        latencies.reset.record(finished - called);
+
+        if result.is_err() {
+            errors += 1;
+        }
+        // a sandbox that could not be reset is replaced, so that one failure
+        // doesn't shrink the pool for the rest of the run
+        let pooled = match sandbox {
+            Ok(sandbox) => PooledSandbox { sandbox, host_time },
+            Err(_) => PooledSandbox::new(guest, host_delay).expect("Failed to replace a sandbox"),
+        };
+        pool.0.send(pooled).expect("The sandbox pool was closed");
+    }
+
+    (latencies, errors)
+}
+
+fn run(
+    options: &Options,
+    sandboxes: usize,
+    threads: usize,
+    rate: f64,
+) -> hyperlight_host::Result<Value> {
+    let pool = crossbeam_channel::bounded(sandboxes);
+    for _ in 0..sandboxes {
+        pool.0
+            .send(PooledSandbox::new(options.guest, options.host_delay)?)
+            .expect("The sandbox pool was closed");
+    }
+
+    let (arrivals_tx, arrivals_rx) = crossbeam_channel::unbounded();
+    let workers: Vec<_> = (0..threads)
+        .map(|_| {
+            let arrivals = arrivals_rx.clone();
+            let pool = pool.clone();
+            let (guest, host_delay) = (options.guest, options.host_delay);
+            thread::spawn(move || worker(arrivals, pool, guest, host_delay))
+        })
+        .collect();
+    drop(arrivals_rx);
+
+    let start = Instant::now();
+    let offered = generate_arrivals(arrivals_tx, rate, options.duration);
+    let mut latencies = Latencies::new();
+    let mut errors = 0;
+    for worker in workers {
+        let (worker_latencies, worker_errors) = worker.join().expect("A worker thread panicked");
+        latencies.merge(&worker_latencies);
+        errors += worker_errors;
+    }
+    let elapsed = start.elapsed();
+
+    Ok(json!({
+        "guest": options.guest.name(),
+        "sandboxes": sandboxes,
+        "threads": threads,
+        "offered_rate": rate,
+        "duration_secs": options.duration.as_secs_f64(),
+        "host_delay_us": options.host_delay.as_micros() as u64,
+        "calls": offered,
+        "errors": errors,
+        "elapsed_secs": elapsed.as_secs_f64(),
+        "throughput": offered as f64 / elapsed.as_secs_f64(),
+        "latency_ns": latencies.to_json(),
+    }))
+}
+
+fn main() -> hyperlight_host::Result<()> {
+    let options = match Options::parse(std::env::args().skip(1)) {
+        Ok(options) => options,
+        Err(message) => {
+            eprintln!("{message}\n\n{USAGE}");
+            std::process::exit(2);
+        }
+    };
+
+    let mut results = Vec::new();
+    for &sandboxes in &options.sandboxes {
+        for &threads in &options.threads {
+            for &rate in &options.rates {
+                let result = run(&options, sandboxes, threads, rate)?;
+                eprintln!(
+                    "sandboxes={sandboxes} threads={threads} rate={rate}: {:.0} calls/s, p50 {}ns, p99 {}ns, p99.9 {}ns",
+                    result["throughput"].as_f64().unwrap_or_default(),
+                    result["latency_ns"]["end_to_end"]["p50"],
+                    result["latency_ns"]["end_to_end"]["p99"],
+                    result["latency_ns"]["end_to_end"]["p99_9"],
+                );
+                results.push(result);
+            }
+        }
+    }
+
+    let results = serde_json::to_string_pretty(&results)?;
+    match &options.output {
+        Some(path) => std::fs::write(path, results)?,
+        None => println!("{results}"),
+    }
+    Ok(())
+}
@@ -0,0 +1,77 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::path::Path;
+use std::time::Duration;
+
+use hyperlight_host::sandbox::CallRecording;
+use hyperlight_host::sandbox_state::sandbox::EvolvableSandbox;
+use hyperlight_host::sandbox_state::transition::Noop;
+use hyperlight_host::{GuestBinary, MultiUseSandbox, UninitializedSandbox};
+
+const USAGE: &str = "\
+Usage: replay RECORDING GUEST [ITERATIONS]
+
+Replays the guest calls in RECORDING (saved with `CallRecording::save`) on a
+sandbox for the guest binary at GUEST, ITERATIONS times (default 1), with
+stubs in place of the host functions, and reports how long the calls took
+and where the guest behaved differently from when they were recorded.";
+
+fn main() -> hyperlight_host::Result<()> {
+    let args: Vec<String> = std::env::args().skip(1).collect();
+    if args.len() < 2 || args.len() > 3 || args.iter().any(|arg| arg == "--help") {
+        eprintln!("{}", USAGE);
+        std::process::exit(2);
+    }
+    let iterations: u32 = match args.get(2).map(|arg| arg.parse()) {
+        None => 1,
+        Some(Ok(iterations)) if iterations > 0 => iterations,
+        _ => {
+            eprintln!("{}", USAGE);
+            std::process::exit(2);
+        }
+    };
+
+    let recording = CallRecording::load(Path::new(&args[0]))?;
+    let mut u_sbox =
+        UninitializedSandbox::new(GuestBinary::FilePath(args[1].clone()), None, None, None)?;
+    u_sbox.register_replay_stubs(&recording)?;
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default())?;
+
+    let mut elapsed = Duration::ZERO;
+    let mut divergences = 0;
+    for i in 0..iterations {
+        let report = sbox.replay_recording(&recording)?;
+        elapsed += report.elapsed;
+        divergences += report.divergences.len();
+        // Divergences are the same on every iteration, so only print them once
+        if i == 0 {
+            for divergence in &report.divergences {
+                println!("diverged: {}", divergence);
+            }
+        }
+    }
+
+    let calls = recording.calls().len() as u32 * iterations;
+    println!(
+        "replayed {} guest calls in {:?} ({:?} per call), {} divergences",
+        calls,
+        elapsed,
+        elapsed.checked_div(calls).unwrap_or_default(),
+        divergences
+    );
+    Ok(())
+}
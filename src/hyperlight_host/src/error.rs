@@ -103,6 +103,11 @@ pub enum HyperlightError {
     #[error("Execution was cancelled by the host.")]
     ExecutionCanceledByHost(),
 
+    /// Guest execution was suspended by the host, at the end of a time slice
+    /// or while the guest waits on an async host function, and can be resumed
+    #[error("Execution was suspended by the host.")]
+    ExecutionSuspendedByHost(),
+
     /// Accessing the value of a flatbuffer parameter failed
     #[error("Failed to get a value from flat buffer parameter")]
     FailedToGetValueFromParameter(),
@@ -267,6 +272,10 @@ pub enum HyperlightError {
     #[cfg(all(feature = "seccomp", target_os = "linux"))]
     SeccompFilterError(#[from] seccompiler::Error),
 
+    /// A sandbox snapshot file could not be loaded
+    #[error("Invalid sandbox snapshot file: {0}")]
+    SnapshotFileInvalid(String),
+
     /// SystemTimeError
     #[error("SystemTimeError {0:?}")]
     SystemTimeError(#[from] SystemTimeError),
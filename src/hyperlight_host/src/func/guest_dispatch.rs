@@ -14,6 +14,13 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+use std::future::Future;
+use std::pin::pin;
+use std::sync::Arc;
+use std::task::{Context, Poll, Wake, Waker};
+use std::thread::{self, Thread};
+use std::time::Duration;
+
 use hyperlight_common::flatbuffer_wrappers::function_call::{FunctionCall, FunctionCallType};
 use hyperlight_common::flatbuffer_wrappers::function_types::{
     ParameterValue, ReturnType, ReturnValue,
@@ -22,9 +29,10 @@ use tracing::{instrument, Span};
 
 use super::guest_err::check_for_guest_error;
 use crate::hypervisor::hypervisor_handler::HypervisorHandlerAction;
+use crate::sandbox::host_funcs::PendingHostCall;
 use crate::sandbox::WrapperGetter;
 use crate::HyperlightError::GuestExecutionHungOnHostFunctionCall;
-use crate::{HyperlightError, Result};
+use crate::{log_then_return, new_error, HyperlightError, Result};
 
 /// Call a guest function by name, using the given `wrapper_getter`.
 #[instrument(
@@ -39,30 +47,76 @@ pub(crate) fn call_function_on_guest<WrapperGetterT: WrapperGetter>(
     return_type: ReturnType,
     args: Option<Vec<ParameterValue>>,
 ) -> Result<ReturnValue> {
-    let mut timedout = false;
-
-    let fc = FunctionCall::new(
-        function_name.to_string(),
-        args,
-        FunctionCallType::Guest,
+    // Any async host functions the guest calls are blocked on, as nothing
+    // else runs on this thread until the call finishes
+    block_on(call_function_on_guest_async(
+        wrapper_getter,
+        function_name,
         return_type,
-    );
+        args,
+    ))
+}
 
-    let buffer: Vec<u8> = fc
-        .try_into()
-        .map_err(|_| HyperlightError::Error("Failed to serialize FunctionCall".to_string()))?;
+/// Call a guest function by name, using the given `wrapper_getter`, awaiting
+/// the futures of any async host functions the guest calls rather than
+/// blocking on them.
+///
+/// The guest itself still runs on the sandbox's hypervisor handler thread,
+/// and this blocks the task awaiting it while it does.
+#[instrument(
+    err(Debug),
+    skip(wrapper_getter, args),
+    parent = Span::current(),
+    level = "Trace"
+)]
+pub(crate) async fn call_function_on_guest_async<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    function_name: &str,
+    return_type: ReturnType,
+    args: Option<Vec<ParameterValue>>,
+) -> Result<ReturnValue> {
+    write_function_call(wrapper_getter, function_name, return_type, args.clone())?;
+    begin_guest_call(wrapper_getter, function_name, return_type, &args)?;
+    let mut action = HypervisorHandlerAction::DispatchCallFromHost(function_name.to_string());
+    let res = loop {
+        match run_function_on_guest(wrapper_getter, action) {
+            // The guest is waiting on an async host function, so wait for it
+            // here and carry on
+            Ok(None) => match take_pending_host_call(wrapper_getter) {
+                Ok(pending) => {
+                    let res = pending.future.await;
+                    if let Err(e) = complete_pending_host_call(wrapper_getter, pending.call, res) {
+                        break Err(e);
+                    }
+                    action = HypervisorHandlerAction::ResumeCallFromHost(function_name.to_string());
+                }
+                Err(e) => break Err(e),
+            },
+            Ok(Some(ret)) => break Ok(ret),
+            Err(e) => break Err(e),
+        }
+    };
+    end_guest_call(wrapper_getter, &res)?;
+    res
+}
 
-    {
-        let mem_mgr = wrapper_getter.get_mgr_wrapper_mut();
-        mem_mgr.as_mut().write_guest_function_call(&buffer)?;
-    }
+/// Send `action` (dispatching or resuming a call) to the hypervisor
+/// handler, and run the call until it finishes or suspends itself waiting
+/// on an async host function, cancelling it if it runs for longer than the
+/// sandbox's `max_execution_time`.
+///
+/// Returns `Ok(None)` if the call is waiting on an async host function.
+fn run_function_on_guest<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    action: HypervisorHandlerAction,
+) -> Result<Option<ReturnValue>> {
+    let mut timedout = false;
 
     let mut hv_handler = wrapper_getter.get_hv_handler().clone();
-    match hv_handler.execute_hypervisor_handler_action(
-        HypervisorHandlerAction::DispatchCallFromHost(function_name.to_string()),
-    ) {
+    match hv_handler.execute_hypervisor_handler_action(action) {
         Ok(()) => {}
         Err(e) => match e {
+            HyperlightError::ExecutionSuspendedByHost() => return Ok(None),
             HyperlightError::HypervisorHandlerMessageReceiveTimedout() => {
                 timedout = true;
                 match hv_handler.terminate_hypervisor_handler_execution_and_reinitialise(
@@ -79,6 +133,263 @@ pub(crate) fn call_function_on_guest<WrapperGetterT: WrapperGetter>(
         },
     };
 
+    get_function_call_result(wrapper_getter, timedout).map(Some)
+}
+
+/// Take the async host function call that the suspended guest is waiting on
+fn take_pending_host_call<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+) -> Result<PendingHostCall> {
+    let pending = wrapper_getter
+        .get_host_funcs()
+        .try_lock()
+        .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+        .take_pending_host_call();
+    match pending {
+        Some(pending) => Ok(pending),
+        None => {
+            reinitialise_vcpu(wrapper_getter)?;
+            log_then_return!("Guest call was suspended without waiting on a host function");
+        }
+    }
+}
+
+/// Give the guest the result of the async host function call it is waiting
+/// on, so that it can be resumed.
+///
+/// If the host function failed, the guest cannot carry on, so its vCPU is
+/// set up again and the error returned.
+fn complete_pending_host_call<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    call: FunctionCall,
+    res: Result<ReturnValue>,
+) -> Result<()> {
+    wrapper_getter
+        .get_host_funcs()
+        .try_lock()
+        .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+        .finish_pending_host_call(call, &res);
+    let written = res.and_then(|ret| {
+        wrapper_getter
+            .get_mgr_wrapper_mut()
+            .as_mut()
+            .write_response_from_host_method_call(&ret)
+    });
+    if written.is_err() {
+        reinitialise_vcpu(wrapper_getter)?;
+    }
+    written
+}
+
+/// Set the vCPU of a guest call that cannot be resumed up again, as is done
+/// after a call is cancelled on a timeout
+fn reinitialise_vcpu<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+) -> Result<()> {
+    wrapper_getter
+        .get_hv_handler()
+        .clone()
+        .execute_hypervisor_handler_action(HypervisorHandlerAction::Initialise)
+}
+
+/// Run `future` to completion on the current thread
+fn block_on<F: Future>(future: F) -> F::Output {
+    struct ThreadWaker(Thread);
+
+    impl Wake for ThreadWaker {
+        fn wake(self: Arc<Self>) {
+            self.0.unpark();
+        }
+    }
+
+    let waker = Waker::from(Arc::new(ThreadWaker(thread::current())));
+    let mut cx = Context::from_waker(&waker);
+    let mut future = pin!(future);
+    loop {
+        match future.as_mut().poll(&mut cx) {
+            Poll::Ready(output) => return output,
+            Poll::Pending => thread::park(),
+        }
+    }
+}
+
+/// Call a guest function by name, using the given `wrapper_getter`, and
+/// suspend it if it is still running after `time_slice`.
+///
+/// Returns `Ok(None)` if the call was suspended, in which case it must be
+/// continued with `resume_function_on_guest` (or discarded by restoring
+/// the sandbox's state and re-initialising its vCPU) before any other call
+/// is made.
+#[instrument(
+    err(Debug),
+    skip(wrapper_getter, args),
+    parent = Span::current(),
+    level = "Trace"
+)]
+pub(crate) fn call_function_on_guest_with_time_slice<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    function_name: &str,
+    return_type: ReturnType,
+    args: Option<Vec<ParameterValue>>,
+    time_slice: Duration,
+) -> Result<Option<ReturnValue>> {
+    write_function_call(wrapper_getter, function_name, return_type, args.clone())?;
+    begin_guest_call(wrapper_getter, function_name, return_type, &args)?;
+    let res = run_function_for_time_slice(
+        wrapper_getter,
+        HypervisorHandlerAction::DispatchCallFromHost(function_name.to_string()),
+        time_slice,
+    );
+    end_time_slice(wrapper_getter, res)
+}
+
+/// Continue a guest function call suspended by
+/// `call_function_on_guest_with_time_slice`, suspending it again if it is
+/// still running after `time_slice`.
+#[instrument(err(Debug), skip(wrapper_getter), parent = Span::current(), level = "Trace")]
+pub(crate) fn resume_function_on_guest<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    function_name: &str,
+    time_slice: Duration,
+) -> Result<Option<ReturnValue>> {
+    if !wrapper_getter.get_hv_handler().is_suspended() {
+        log_then_return!("There is no suspended guest function call to resume");
+    }
+    // If the guest was suspended waiting on an async host function, wait
+    // for that to finish first
+    let pending = wrapper_getter
+        .get_host_funcs()
+        .try_lock()
+        .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+        .take_pending_host_call();
+    if let Some(pending) = pending {
+        let res = block_on(pending.future);
+        if let Err(e) = complete_pending_host_call(wrapper_getter, pending.call, res) {
+            return end_time_slice(wrapper_getter, Err(e));
+        }
+    }
+    let res = run_function_for_time_slice(
+        wrapper_getter,
+        HypervisorHandlerAction::ResumeCallFromHost(function_name.to_string()),
+        time_slice,
+    );
+    end_time_slice(wrapper_getter, res)
+}
+
+/// Tell the sandbox's host functions that a guest call is starting, so
+/// that it (and the host function calls it makes) can be recorded
+fn begin_guest_call<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    function_name: &str,
+    return_type: ReturnType,
+    args: &Option<Vec<ParameterValue>>,
+) -> Result<()> {
+    wrapper_getter
+        .get_host_funcs()
+        .try_lock()
+        .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+        .begin_guest_call(function_name, return_type, args);
+    Ok(())
+}
+
+/// Tell the sandbox's host functions that the current guest call has
+/// finished with `res`
+fn end_guest_call<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    res: &Result<ReturnValue>,
+) -> Result<()> {
+    wrapper_getter
+        .get_host_funcs()
+        .try_lock()
+        .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+        .end_guest_call(res);
+    Ok(())
+}
+
+/// `end_guest_call`, unless the call was suspended rather than finished
+fn end_time_slice<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    res: Result<Option<ReturnValue>>,
+) -> Result<Option<ReturnValue>> {
+    match res.transpose() {
+        None => Ok(None),
+        Some(res) => {
+            end_guest_call(wrapper_getter, &res)?;
+            res.map(Some)
+        }
+    }
+}
+
+/// Serialize a call to `function_name` into the guest's input buffer
+fn write_function_call<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    function_name: &str,
+    return_type: ReturnType,
+    args: Option<Vec<ParameterValue>>,
+) -> Result<()> {
+    if wrapper_getter.get_hv_handler().is_suspended() {
+        log_then_return!(
+            "Cannot call guest function {} while another guest call is suspended",
+            function_name
+        );
+    }
+
+    let fc = FunctionCall::new(
+        function_name.to_string(),
+        args,
+        FunctionCallType::Guest,
+        return_type,
+    );
+
+    let buffer: Vec<u8> = fc
+        .try_into()
+        .map_err(|_| HyperlightError::Error("Failed to serialize FunctionCall".to_string()))?;
+
+    let mem_mgr = wrapper_getter.get_mgr_wrapper_mut();
+    mem_mgr.as_mut().write_guest_function_call(&buffer)?;
+    Ok(())
+}
+
+/// Send `action` (dispatching or resuming a call) to the hypervisor
+/// handler, and suspend the call if it has not finished after `time_slice`
+fn run_function_for_time_slice<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    action: HypervisorHandlerAction,
+    time_slice: Duration,
+) -> Result<Option<ReturnValue>> {
+    let mut hv_handler = wrapper_getter.get_hv_handler().clone();
+    let res = match hv_handler.execute_hypervisor_handler_action_with_timeout(action, time_slice) {
+        Err(HyperlightError::HypervisorHandlerMessageReceiveTimedout()) => {
+            hv_handler.suspend_execution()
+        }
+        res => res,
+    };
+
+    match res {
+        Ok(()) => get_function_call_result(wrapper_getter, false).map(Some),
+        Err(HyperlightError::ExecutionSuspendedByHost()) => Ok(None),
+        Err(HyperlightError::HypervisorHandlerMessageReceiveTimedout()) => {
+            // The call could neither be suspended nor finish within
+            // `max_exec_time` (e.g., it is stuck in a host function), so
+            // cancel it as `call_function_on_guest` does on a timeout
+            match hv_handler.terminate_hypervisor_handler_execution_and_reinitialise(
+                wrapper_getter.get_mgr_wrapper_mut().unwrap_mgr_mut(),
+            )? {
+                HyperlightError::HypervisorHandlerExecutionCancelAttemptOnFinishedExecution() => {
+                    get_function_call_result(wrapper_getter, true).map(Some)
+                }
+                e => Err(e),
+            }
+        }
+        Err(e) => Err(e),
+    }
+}
+
+/// Read the result of a finished guest function call from shared memory
+fn get_function_call_result<WrapperGetterT: WrapperGetter>(
+    wrapper_getter: &mut WrapperGetterT,
+    timedout: bool,
+) -> Result<ReturnValue> {
     let mem_mgr = wrapper_getter.get_mgr_wrapper_mut();
     mem_mgr.check_stack_guard()?; // <- wrapper around mem_mgr `check_for_stack_guard`
     check_for_guest_error(mem_mgr)?;
@@ -40,8 +40,12 @@ pub(crate) mod param_type;
 /// Definitions and functionality for supported return types
 pub mod ret_type;
 
+use std::future::Future;
+use std::pin::Pin;
 use std::sync::{Arc, Mutex};
 
+/// Re-export for `ParameterType` enum
+pub use hyperlight_common::flatbuffer_wrappers::function_types::ParameterType;
 /// Re-export for `ParameterValue` enum
 pub use hyperlight_common::flatbuffer_wrappers::function_types::ParameterValue;
 /// Re-export for `ReturnType` enum
@@ -77,6 +81,34 @@ impl HyperlightFunction {
     }
 }
 
+/// The future returned by a host function registered with
+/// `UninitializedSandbox::register_async_host_function`
+pub type HostFunctionFuture = Pin<Box<dyn Future<Output = Result<ReturnValue>> + Send>>;
+
+type AsyncHLFunc = Arc<dyn Fn(Vec<ParameterValue>) -> HostFunctionFuture + Send + Sync>;
+
+/// A host function that returns a future rather than a value. The guest
+/// that calls it is suspended until the future completes.
+#[derive(Clone)]
+pub(crate) struct AsyncHyperlightFunction(AsyncHLFunc);
+
+impl AsyncHyperlightFunction {
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn new<F, Fut>(f: F) -> Self
+    where
+        F: Fn(Vec<ParameterValue>) -> Fut + Send + Sync + 'static,
+        Fut: Future<Output = Result<ReturnValue>> + Send + 'static,
+    {
+        Self(Arc::new(move |args| Box::pin(f(args))))
+    }
+
+    /// Start the host function, returning the future that completes it
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn call(&self, args: Vec<ParameterValue>) -> HostFunctionFuture {
+        (self.0)(args)
+    }
+}
+
 /// Re-export for `HostFunction0` trait
 pub use host_functions::HostFunction0;
 /// Re-export for `HostFunction1` trait
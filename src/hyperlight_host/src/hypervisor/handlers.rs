@@ -23,9 +23,18 @@ use crate::{new_error, Result};
 /// The trait representing custom logic to handle the case when
 /// a Hypervisor's virtual CPU (vCPU) informs Hyperlight the guest
 /// has initiated an outb operation.
-pub trait OutBHandlerCaller: Sync + Send {
+pub trait OutBHandlerCaller: Send {
     /// Function that gets called when an outb operation has occurred.
     fn call(&mut self, port: u16, payload: u64) -> Result<()>;
+
+    /// Function that gets called with each run of a vCPU, which handles
+    /// the outb operations of the run with the `OutBHandlerCaller` it is
+    /// given. A handler that has to lock something to handle an operation
+    /// can lock it here, once for the whole run, rather than in `call`.
+    fn with_run(
+        &mut self,
+        run: &mut dyn FnMut(&mut dyn OutBHandlerCaller) -> Result<()>,
+    ) -> Result<()>;
 }
 
 /// A convenient type representing a common way `OutBHandler` implementations
@@ -41,24 +50,35 @@ pub(crate) type OutBHandlerFunction = Box<dyn FnMut(u16, u64) -> Result<()> + Se
 /// A `OutBHandler` implementation using a `OutBHandlerFunction`
 ///
 /// Note: This handler must live no longer than the `Sandbox` to which it belongs
-pub(crate) struct OutBHandler(Arc<Mutex<OutBHandlerFunction>>);
+///
+/// The `Mutex` only exists to make the handler `Sync`. `call` takes
+/// `&mut self`, so it reaches the function through `Mutex::get_mut`
+/// and never actually locks on the exit path.
+pub(crate) struct OutBHandler(Mutex<OutBHandlerFunction>);
 
 impl From<OutBHandlerFunction> for OutBHandler {
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
     fn from(func: OutBHandlerFunction) -> Self {
-        Self(Arc::new(Mutex::new(func)))
+        Self(Mutex::new(func))
     }
 }
 
 impl OutBHandlerCaller for OutBHandler {
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
     fn call(&mut self, port: u16, payload: u64) -> Result<()> {
-        let mut func = self
+        let func = self
             .0
-            .try_lock()
-            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+            .get_mut()
+            .map_err(|e| new_error!("Error accessing at {}:{}: {}", file!(), line!(), e))?;
         func(port, payload)
     }
+
+    fn with_run(
+        &mut self,
+        run: &mut dyn FnMut(&mut dyn OutBHandlerCaller) -> Result<()>,
+    ) -> Result<()> {
+        run(self)
+    }
 }
 
 /// The trait representing custom logic to handle the case when
@@ -83,22 +103,22 @@ pub(crate) type MemAccessHandlerFunction = Box<dyn FnMut() -> Result<()> + Send>
 ///
 /// Note: This handler must live for as long as its Sandbox or for
 /// static in the case of its C API usage.
-pub(crate) struct MemAccessHandler(Arc<Mutex<MemAccessHandlerFunction>>);
+pub(crate) struct MemAccessHandler(Mutex<MemAccessHandlerFunction>);
 
 impl From<MemAccessHandlerFunction> for MemAccessHandler {
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
     fn from(func: MemAccessHandlerFunction) -> Self {
-        Self(Arc::new(Mutex::new(func)))
+        Self(Mutex::new(func))
     }
 }
 
 impl MemAccessHandlerCaller for MemAccessHandler {
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
     fn call(&mut self) -> Result<()> {
-        let mut func = self
+        let func = self
             .0
-            .try_lock()
-            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+            .get_mut()
+            .map_err(|e| new_error!("Error accessing at {}:{}: {}", file!(), line!(), e))?;
         func()
     }
 }
@@ -54,7 +54,7 @@ use super::fpu::{FP_CONTROL_WORD_DEFAULT, FP_TAG_WORD_DEFAULT, MXCSR_DEFAULT};
 use super::gdb::{DebugCommChannel, DebugMsg, DebugResponse, GuestDebug, MshvDebug};
 #[cfg(gdb)]
 use super::handlers::DbgMemAccessHandlerWrapper;
-use super::handlers::{MemAccessHandlerWrapper, OutBHandlerWrapper};
+use super::handlers::{MemAccessHandlerWrapper, OutBHandlerCaller, OutBHandlerWrapper};
 use super::{
     Hypervisor, VirtualCPU, CR0_AM, CR0_ET, CR0_MP, CR0_NE, CR0_PE, CR0_PG, CR0_WP, CR4_OSFXSR,
     CR4_OSXMMEXCPT, CR4_PAE, EFER_LMA, EFER_LME, EFER_NX, EFER_SCE,
@@ -64,8 +64,8 @@ use crate::hypervisor::HyperlightExit;
 use crate::mem::memory_region::{MemoryRegion, MemoryRegionFlags};
 use crate::mem::ptr::{GuestPtr, RawPtr};
 #[cfg(gdb)]
-use crate::HyperlightError;
-use crate::{log_then_return, new_error, Result};
+use crate::new_error;
+use crate::{log_then_return, HyperlightError, Result};
 
 #[cfg(gdb)]
 mod debug {
@@ -537,16 +537,20 @@ impl Hypervisor for HypervLinuxDriver {
     fn handle_io(
         &mut self,
         port: u16,
-        data: Vec<u8>,
+        data: u64,
         rip: u64,
         instruction_length: u64,
-        outb_handle_fn: OutBHandlerWrapper,
+        outb_handle_fn: &mut dyn OutBHandlerCaller,
     ) -> Result<()> {
-        let payload = data[..8].try_into()?;
-        outb_handle_fn
-            .try_lock()
-            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
-            .call(port, u64::from_le_bytes(payload))?;
+        // A guest waiting on an async host function is suspended after its
+        // `out` instruction, so that resuming it carries on from there
+        let res = outb_handle_fn.call(port, data);
+        if !matches!(
+            res,
+            Ok(()) | Err(HyperlightError::ExecutionSuspendedByHost())
+        ) {
+            return res;
+        }
 
         // update rip
         self.vcpu_fd.set_reg(&[hv_register_assoc {
@@ -556,7 +560,7 @@ impl Hypervisor for HypervLinuxDriver {
             },
             ..Default::default()
         }])?;
-        Ok(())
+        res
     }
 
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
@@ -590,12 +594,7 @@ impl Hypervisor for HypervLinuxDriver {
                     let rax = io_message.rax;
                     let instruction_length = io_message.header.instruction_length() as u64;
                     crate::debug!("mshv IO Details : \nPort : {}\n{:#?}", port_number, &self);
-                    HyperlightExit::IoOut(
-                        port_number,
-                        rax.to_le_bytes().to_vec(),
-                        rip,
-                        instruction_length,
-                    )
+                    HyperlightExit::IoOut(port_number, rax, rip, instruction_length)
                 }
                 UNMAPPED_GPA_MESSAGE => {
                     let mimo_message = m.to_memory_info()?;
@@ -31,7 +31,7 @@ use windows::Win32::System::Hypervisor::{
 use super::fpu::{FP_TAG_WORD_DEFAULT, MXCSR_DEFAULT};
 #[cfg(gdb)]
 use super::handlers::DbgMemAccessHandlerWrapper;
-use super::handlers::{MemAccessHandlerWrapper, OutBHandlerWrapper};
+use super::handlers::{MemAccessHandlerWrapper, OutBHandlerCaller, OutBHandlerWrapper};
 use super::surrogate_process::SurrogateProcess;
 use super::surrogate_process_manager::*;
 use super::windows_hypervisor_platform::{VMPartition, VMProcessor};
@@ -45,7 +45,7 @@ use crate::hypervisor::hypervisor_handler::HypervisorHandler;
 use crate::hypervisor::wrappers::WHvGeneralRegisters;
 use crate::mem::memory_region::{MemoryRegion, MemoryRegionFlags};
 use crate::mem::ptr::{GuestPtr, RawPtr};
-use crate::{debug, new_error, Result};
+use crate::{debug, HyperlightError, Result};
 
 /// A Hypervisor driver for HyperV-on-Windows.
 pub(crate) struct HypervWindowsDriver {
@@ -385,20 +385,25 @@ impl Hypervisor for HypervWindowsDriver {
     fn handle_io(
         &mut self,
         port: u16,
-        data: Vec<u8>,
+        data: u64,
         rip: u64,
         instruction_length: u64,
-        outb_handle_fn: OutBHandlerWrapper,
+        outb_handle_fn: &mut dyn OutBHandlerCaller,
     ) -> Result<()> {
-        let payload = data[..8].try_into()?;
-        outb_handle_fn
-            .try_lock()
-            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
-            .call(port, u64::from_le_bytes(payload))?;
+        // A guest waiting on an async host function is suspended after its
+        // `out` instruction, so that resuming it carries on from there
+        let res = outb_handle_fn.call(port, data);
+        if !matches!(
+            res,
+            Ok(()) | Err(HyperlightError::ExecutionSuspendedByHost())
+        ) {
+            return res;
+        }
 
         let mut regs = self.processor.get_regs()?;
         regs.rip = rip + instruction_length;
-        self.processor.set_general_purpose_registers(&regs)
+        self.processor.set_general_purpose_registers(&regs)?;
+        res
     }
 
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
@@ -418,12 +423,7 @@ impl Hypervisor for HypervWindowsDriver {
                     );
                     HyperlightExit::IoOut(
                         exit_context.Anonymous.IoPortAccess.PortNumber,
-                        exit_context
-                            .Anonymous
-                            .IoPortAccess
-                            .Rax
-                            .to_le_bytes()
-                            .to_vec(),
+                        exit_context.Anonymous.IoPortAccess.Rax,
                         exit_context.VpContext.Rip,
                         instruction_length as u64,
                     )
@@ -45,9 +45,14 @@ use crate::hypervisor::wrappers::HandleWrapper;
 use crate::hypervisor::Hypervisor;
 use crate::mem::layout::SandboxMemoryLayout;
 use crate::mem::mgr::SandboxMemoryManager;
+#[cfg(target_os = "linux")]
+use crate::mem::numa::{node_cpus, pin_current_thread};
 use crate::mem::ptr::{GuestPtr, RawPtr};
 use crate::mem::ptr_offset::Offset;
+#[cfg(target_os = "linux")]
+use crate::mem::resident::resident_bytes;
 use crate::mem::shared_mem::{GuestSharedMemory, HostSharedMemory, SharedMemory};
+use crate::metrics::GuestCallTimer;
 #[cfg(gdb)]
 use crate::sandbox::config::DebugInfo;
 use crate::sandbox::hypervisor::{get_available_hypervisor, HypervisorType};
@@ -59,6 +64,11 @@ use crate::HyperlightError::{
 };
 use crate::{log_then_return, new_error, HyperlightError, Result};
 
+/// The size the Rust standard library gives the stacks of the threads it
+/// spawns, unless `RUST_MIN_STACK` says otherwise
+#[cfg(target_os = "windows")]
+const DEFAULT_THREAD_STACK_SIZE: usize = 2 * 1024 * 1024;
+
 type HypervisorHandlerTx = Sender<HypervisorHandlerAction>;
 type HypervisorHandlerRx = Receiver<HypervisorHandlerAction>;
 type HandlerMsgTx = Sender<HandlerMsg>;
@@ -82,6 +92,66 @@ impl HypervisorHandler {
     pub(crate) fn set_run_cancelled(&self, run_cancelled: bool) {
         self.execution_variables.run_cancelled.store(run_cancelled);
     }
+
+    /// Returns whether the host has asked for the running guest call to be
+    /// suspended rather than cancelled, and clears the request.
+    pub(crate) fn take_suspend_request(&self) -> bool {
+        self.execution_variables
+            .suspend_requested
+            .swap(false, Ordering::SeqCst)
+    }
+
+    /// Returns whether a guest call is currently suspended, waiting to be
+    /// resumed with `HypervisorHandlerAction::ResumeCallFromHost`
+    pub(crate) fn is_suspended(&self) -> bool {
+        self.execution_variables.suspended.load(Ordering::SeqCst)
+    }
+
+    /// Get the number of bytes of the stack of the handler thread, which
+    /// runs the vCPU and the host functions the guest calls, that are
+    /// resident in physical memory.
+    ///
+    /// On Windows this is the size of the whole stack, i.e. the stack is
+    /// assumed to be resident, as for `resident_bytes`.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(crate) fn thread_stack_resident_bytes(&self) -> Result<usize> {
+        #[cfg(target_os = "linux")]
+        {
+            use std::mem::MaybeUninit;
+
+            use libc::{pthread_attr_destroy, pthread_attr_getstack, pthread_getattr_np};
+
+            let thread_id = self.execution_variables.get_thread_id()?;
+            let mut attr = MaybeUninit::uninit();
+            let ret = unsafe { pthread_getattr_np(thread_id, attr.as_mut_ptr()) };
+            if ret != 0 {
+                log_then_return!(
+                    "Failed to get the handler thread's attributes: error {}",
+                    ret
+                );
+            }
+            let mut addr = std::ptr::null_mut();
+            let mut size = 0;
+            let ret = unsafe { pthread_attr_getstack(attr.as_ptr(), &mut addr, &mut size) };
+            unsafe { pthread_attr_destroy(attr.as_mut_ptr()) };
+            if ret != 0 {
+                log_then_return!("Failed to get the handler thread's stack: error {}", ret);
+            }
+            resident_bytes(addr as *const u8, size)
+        }
+        #[cfg(target_os = "windows")]
+        {
+            Ok(std::env::var("RUST_MIN_STACK")
+                .ok()
+                .and_then(|size| size.parse().ok())
+                .unwrap_or(DEFAULT_THREAD_STACK_SIZE))
+        }
+    }
+
+    /// Get the configuration this handler was created with
+    pub(crate) fn configuration(&self) -> &HvHandlerConfig {
+        &self.configuration
+    }
 }
 
 // Note: `join_handle` and `running` have to be `Arc` because we need
@@ -101,6 +171,11 @@ struct HvHandlerExecVars {
     running: Arc<AtomicBool>,
     #[cfg(target_os = "linux")]
     run_cancelled: Arc<crossbeam::atomic::AtomicCell<bool>>,
+    /// Set by the host to make the next vCPU cancellation suspend the
+    /// guest call instead of aborting it
+    suspend_requested: Arc<AtomicBool>,
+    /// Set by the handler thread while a guest call is suspended
+    suspended: Arc<AtomicBool>,
 }
 
 impl HvHandlerExecVars {
@@ -216,6 +291,8 @@ impl HypervisorHandler {
             running: Arc::new(AtomicBool::new(false)),
             #[cfg(target_os = "linux")]
             run_cancelled: Arc::new(AtomicCell::new(false)),
+            suspend_requested: Arc::new(AtomicBool::new(false)),
+            suspended: Arc::new(AtomicBool::new(false)),
             timeout: Arc::new(Mutex::new(configuration.max_init_time)),
         };
 
@@ -242,6 +319,13 @@ impl HypervisorHandler {
         let configuration = self.configuration.clone();
         #[cfg(target_os = "windows")]
         let in_process = sandbox_memory_manager.is_in_process();
+        // Look up the CPUs to pin the handler thread to here, so that a bad
+        // NUMA node is reported to the caller rather than by the thread
+        #[cfg(target_os = "linux")]
+        let vcpu_cpus = match sandbox_memory_manager.get_vcpu_numa_node() {
+            Some(node) => Some(node_cpus(node)?),
+            None => None,
+        };
 
         *self
             .execution_variables
@@ -294,14 +378,25 @@ impl HypervisorHandler {
             thread::Builder::new()
                 .name("Hypervisor Handler".to_string())
                 .spawn(move || -> Result<()> {
+                    #[cfg(target_os = "linux")]
+                    if let Some(cpus) = &vcpu_cpus {
+                        pin_current_thread(cpus)?;
+                    }
                     let mut hv: Option<Box<dyn Hypervisor>> = None;
+                    let mut guest_call_timer = GuestCallTimer::default();
                     for action in to_handler_rx {
+                        let resuming = matches!(action, HypervisorHandlerAction::ResumeCallFromHost(_));
                         match action {
                             HypervisorHandlerAction::Initialise => {
+                                // Re-initialising discards any suspended guest call
+                                execution_variables.suspended.store(false, Ordering::SeqCst);
+                                guest_call_timer = GuestCallTimer::default();
                                 {
                                     hv = Some(set_up_hypervisor_partition(
                                         execution_variables.shm.try_lock().map_err(|e| new_error!("Failed to lock shm: {}", e))?.deref_mut().as_mut().ok_or_else(|| new_error!("shm not set"))?,
                                         configuration.outb_handler.clone(),
+                                        #[cfg(target_os = "linux")]
+                                        vcpu_cpus.as_deref(),
                                         #[cfg(gdb)]
                                         &debug_info,
                                     )?);
@@ -386,13 +481,18 @@ impl HypervisorHandler {
                                     }
                                 }
                             }
-                            HypervisorHandlerAction::DispatchCallFromHost(function_name) => {
+                            HypervisorHandlerAction::DispatchCallFromHost(function_name)
+                            | HypervisorHandlerAction::ResumeCallFromHost(function_name) => {
                                 let hv = hv.as_mut().ok_or_else(|| new_error!("Hypervisor not initialized"))?;
 
                                 #[cfg(target_os = "linux")]
                                 execution_variables.run_cancelled.store(false);
 
-                                info!("Dispatching call from host: {}", function_name);
+                                if resuming {
+                                    info!("Resuming call from host: {}", function_name);
+                                } else {
+                                    info!("Dispatching call from host: {}", function_name);
+                                }
 
                                 let dispatch_function_addr = configuration
                                     .dispatch_function_addr
@@ -433,23 +533,40 @@ impl HypervisorHandler {
                                     .lock
                                         .try_read();
 
-                                let res = crate::metrics::maybe_time_and_emit_guest_call(
+                                // A guest call that is suspended and resumed is
+                                // timed as one call, over all of its runs
+                                let res = guest_call_timer.time_run(
                                     &function_name,
                                     || {
-                                        hv.dispatch_call_from_host(
-                                            dispatch_function_addr,
-                                            configuration.outb_handler.clone(),
-                                            configuration.mem_access_handler.clone(),
-                                            Some(hv_handler_clone.clone()),
-                                            #[cfg(gdb)]
-                                            configuration.dbg_mem_access_handler.clone(),
-                                        )
+                                        if resuming {
+                                            hv.resume_execution(
+                                                configuration.outb_handler.clone(),
+                                                configuration.mem_access_handler.clone(),
+                                                Some(hv_handler_clone.clone()),
+                                                #[cfg(gdb)]
+                                                configuration.dbg_mem_access_handler.clone(),
+                                            )
+                                        } else {
+                                            hv.dispatch_call_from_host(
+                                                dispatch_function_addr,
+                                                configuration.outb_handler.clone(),
+                                                configuration.mem_access_handler.clone(),
+                                                Some(hv_handler_clone.clone()),
+                                                #[cfg(gdb)]
+                                                configuration.dbg_mem_access_handler.clone(),
+                                            )
+                                        }
                                     },
+                                    |res| matches!(res, Err(HyperlightError::ExecutionSuspendedByHost())),
                                 );
 
                                 drop(mem_lock_guard);
                                 drop(evar_lock_guard);
 
+                                execution_variables.suspended.store(
+                                    matches!(res, Err(HyperlightError::ExecutionSuspendedByHost())),
+                                    Ordering::SeqCst,
+                                );
                                 execution_variables.running.store(false, Ordering::SeqCst);
 
                                 match res {
@@ -556,26 +673,33 @@ impl HypervisorHandler {
     pub(crate) fn execute_hypervisor_handler_action(
         &mut self,
         hypervisor_handler_action: HypervisorHandlerAction,
+    ) -> Result<()> {
+        let timeout = match hypervisor_handler_action {
+            HypervisorHandlerAction::Initialise => self.configuration.max_init_time,
+            HypervisorHandlerAction::DispatchCallFromHost(_)
+            | HypervisorHandlerAction::ResumeCallFromHost(_) => self.configuration.max_exec_time,
+            HypervisorHandlerAction::TerminateHandlerThread => self.configuration.max_init_time,
+            // note: terminate can never hang, so setting the timeout for it is just
+            // for completion of the match statement, and it is not really needed for
+            // `TerminateHandlerThread`.
+        };
+
+        self.execute_hypervisor_handler_action_with_timeout(hypervisor_handler_action, timeout)
+    }
+
+    /// Send a message to the Hypervisor Handler and wait up to `timeout`
+    /// for a response, instead of the timeout configured for the action.
+    pub(crate) fn execute_hypervisor_handler_action_with_timeout(
+        &mut self,
+        hypervisor_handler_action: HypervisorHandlerAction,
+        timeout: Duration,
     ) -> Result<()> {
         log::debug!(
             "Sending Hypervisor Handler Action: {:?}",
             hypervisor_handler_action
         );
 
-        match hypervisor_handler_action {
-            HypervisorHandlerAction::Initialise => self
-                .execution_variables
-                .set_timeout(self.configuration.max_init_time)?,
-            HypervisorHandlerAction::DispatchCallFromHost(_) => self
-                .execution_variables
-                .set_timeout(self.configuration.max_exec_time)?,
-            HypervisorHandlerAction::TerminateHandlerThread => self
-                .execution_variables
-                .set_timeout(self.configuration.max_init_time)?,
-            // note: terminate can never hang, so setting the timeout for it is just
-            // for completion of the match statement, and it is not really needed for
-            // `TerminateHandlerThread`.
-        }
+        self.execution_variables.set_timeout(timeout)?;
 
         self.set_running(true);
         self.communication_channels
@@ -729,6 +853,46 @@ impl HypervisorHandler {
         Ok(())
     }
 
+    /// Suspend the guest call the handler thread is running, leaving the
+    /// vCPU state intact so that the call can later be continued with a
+    /// `ResumeCallFromHost` action.
+    ///
+    /// This is intended to be called after waiting for a call timed out
+    /// (i.e., `execute_hypervisor_handler_action_with_timeout` returned
+    /// `HypervisorHandlerMessageReceiveTimedout`). It returns
+    /// `ExecutionSuspendedByHost` if the call was suspended, or the call's
+    /// own result if it finished first. A call cannot be interrupted while
+    /// it is running a host function, in which case this waits up to
+    /// `max_exec_time` for it to reach the next point it can be suspended
+    /// at, or to finish.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(crate) fn suspend_execution(&mut self) -> Result<()> {
+        self.execution_variables
+            .set_timeout(self.configuration.max_exec_time)?;
+
+        if self.execution_variables.running.load(Ordering::SeqCst) {
+            info!("Suspending guest execution");
+            self.execution_variables
+                .suspend_requested
+                .store(true, Ordering::SeqCst);
+            match self.interrupt_vcpu() {
+                Ok(()) | Err(GuestExecutionHungOnHostFunctionCall()) => {}
+                Err(e) => {
+                    self.execution_variables
+                        .suspend_requested
+                        .store(false, Ordering::SeqCst);
+                    return Err(e);
+                }
+            }
+        }
+
+        let res = self.try_receive_handler_msg();
+        self.execution_variables
+            .suspend_requested
+            .store(false, Ordering::SeqCst);
+        res
+    }
+
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
     pub(crate) fn terminate_execution(&self) -> Result<()> {
         error!(
@@ -736,6 +900,12 @@ impl HypervisorHandler {
             self.execution_variables.get_timeout()?.as_millis()
         );
 
+        self.interrupt_vcpu()
+    }
+
+    /// Interrupt the vCPU, so that its run loop exits with
+    /// `HyperlightExit::Cancelled`.
+    fn interrupt_vcpu(&self) -> Result<()> {
         #[cfg(target_os = "linux")]
         {
             let thread_id = self.execution_variables.get_thread_id()?;
@@ -753,7 +923,11 @@ impl HypervisorHandler {
             let number_of_iterations =
                 self.configuration.max_wait_for_cancellation.as_micros() / 500;
 
-            while !self.execution_variables.run_cancelled.load() {
+            // Stop as soon as the vCPU has been interrupted, or the call has
+            // finished on its own
+            while !self.execution_variables.run_cancelled.load()
+                && self.execution_variables.running.load(Ordering::SeqCst)
+            {
                 count += 1;
 
                 if count > number_of_iterations {
@@ -772,7 +946,9 @@ impl HypervisorHandler {
                 }
                 std::thread::sleep(Duration::from_micros(500));
             }
-            if !self.execution_variables.run_cancelled.load() {
+            if !self.execution_variables.run_cancelled.load()
+                && self.execution_variables.running.load(Ordering::SeqCst)
+            {
                 log_then_return!(GuestExecutionHungOnHostFunctionCall());
             }
         }
@@ -805,6 +981,8 @@ pub enum HypervisorHandlerAction {
     Initialise,
     /// Execute a function call (String = name) from the host
     DispatchCallFromHost(String),
+    /// Resume a suspended function call (String = name) from the host
+    ResumeCallFromHost(String),
     /// Terminate hypervisor handler thread
     TerminateHandlerThread,
 }
@@ -816,6 +994,7 @@ impl std::fmt::Debug for HypervisorHandlerAction {
         match self {
             HypervisorHandlerAction::Initialise => write!(f, "Initialise"),
             HypervisorHandlerAction::DispatchCallFromHost(_) => write!(f, "DispatchCallFromHost"),
+            HypervisorHandlerAction::ResumeCallFromHost(_) => write!(f, "ResumeCallFromHost"),
             HypervisorHandlerAction::TerminateHandlerThread => write!(f, "TerminateHandlerThread"),
         }
     }
@@ -834,6 +1013,11 @@ fn set_up_hypervisor_partition(
     mgr: &mut SandboxMemoryManager<GuestSharedMemory>,
     #[allow(unused_variables)] // parameter only used for in-process mode
     outb_handler: OutBHandlerWrapper,
+    // The CPUs the vCPU threads are pinned to, only used for KVM's worker
+    // vCPUs
+    #[cfg(target_os = "linux")]
+    #[cfg_attr(not(kvm), allow(unused_variables))]
+    vcpu_cpus: Option<&[usize]>,
     #[cfg(gdb)] debug_info: &Option<DebugInfo>,
 ) -> Result<Box<dyn Hypervisor>> {
     let mem_size = u64::try_from(mgr.shared_mem.mem_size())?;
@@ -843,6 +1027,13 @@ fn set_up_hypervisor_partition(
         let rsp_raw = RawPtr::from(rsp_u64);
         GuestPtr::try_from(rsp_raw)
     }?;
+    // Shared data lives outside the sandbox's memory, so it gets mapped
+    // into the VM as regions of its own
+    regions.extend(
+        mgr.shared_data
+            .iter()
+            .map(|mapped| mapped.data.memory_region(mapped.guest_address)),
+    );
     let base_ptr = GuestPtr::try_from(Offset::from(0))?;
     let pml4_ptr = {
         let pml4_offset_u64 = u64::try_from(SandboxMemoryLayout::PML4_OFFSET)?;
@@ -867,6 +1058,24 @@ fn set_up_hypervisor_partition(
             pml4_ptr
         );
     }
+    // Only the KVM driver can run worker vCPUs
+    let kvm_in_use = {
+        #[cfg(kvm)]
+        {
+            matches!(*get_available_hypervisor(), Some(HypervisorType::Kvm))
+        }
+        #[cfg(not(kvm))]
+        {
+            false
+        }
+    };
+    if mgr.get_vcpu_count() > 1 && (mgr.is_in_process() || !kvm_in_use) {
+        log_then_return!(
+            "Sandboxes with {} vCPUs are only supported on KVM",
+            mgr.get_vcpu_count()
+        );
+    }
+
     if mgr.is_in_process() {
         cfg_if::cfg_if! {
             if #[cfg(inprocess)] {
@@ -935,6 +1144,8 @@ fn set_up_hypervisor_partition(
                     pml4_ptr.absolute()?,
                     entrypoint_ptr.absolute()?,
                     rsp_ptr.absolute()?,
+                    mgr.get_vcpu_count(),
+                    vcpu_cpus.map(<[usize]>::to_vec),
                     #[cfg(gdb)]
                     gdb_conn,
                 )?;
@@ -25,7 +25,7 @@ use super::{HyperlightExit, Hypervisor};
 #[cfg(crashdump)]
 use crate::mem::memory_region::MemoryRegion;
 use crate::sandbox::leaked_outb::LeakedOutBWrapper;
-use crate::Result;
+use crate::{log_then_return, Result};
 
 /// Arguments passed to inprocess driver
 pub struct InprocessArgs<'a> {
@@ -109,13 +109,24 @@ impl<'a> Hypervisor for InprocessDriver<'a> {
         Ok(())
     }
 
+    fn resume_execution(
+        &mut self,
+        _outb_handle_fn: super::handlers::OutBHandlerWrapper,
+        _mem_access_fn: super::handlers::MemAccessHandlerWrapper,
+        _hv_handler: Option<super::hypervisor_handler::HypervisorHandler>,
+        #[cfg(gdb)] _dbg_mem_access_fn: DbgMemAccessHandlerWrapper,
+    ) -> crate::Result<()> {
+        // In-process calls cannot be interrupted, so they are never suspended
+        log_then_return!("In-process guest calls are never suspended, so cannot be resumed")
+    }
+
     fn handle_io(
         &mut self,
         _port: u16,
-        _data: Vec<u8>,
+        _data: u64,
         _rip: u64,
         _instruction_length: u64,
-        _outb_handle_fn: super::handlers::OutBHandlerWrapper,
+        _outb_handle_fn: &mut dyn super::handlers::OutBHandlerCaller,
     ) -> crate::Result<()> {
         unimplemented!("handle_io should not be needed since we are in in-process mode")
     }
@@ -30,7 +30,8 @@ use super::fpu::{FP_CONTROL_WORD_DEFAULT, FP_TAG_WORD_DEFAULT, MXCSR_DEFAULT};
 use super::gdb::{DebugCommChannel, DebugMsg, DebugResponse, GuestDebug, KvmDebug, VcpuStopReason};
 #[cfg(gdb)]
 use super::handlers::DbgMemAccessHandlerWrapper;
-use super::handlers::{MemAccessHandlerWrapper, OutBHandlerWrapper};
+use super::handlers::{MemAccessHandlerWrapper, OutBHandlerCaller, OutBHandlerWrapper};
+use super::kvm_workers::WorkerVcpus;
 use super::{
     HyperlightExit, Hypervisor, VirtualCPU, CR0_AM, CR0_ET, CR0_MP, CR0_NE, CR0_PE, CR0_PG, CR0_WP,
     CR4_OSFXSR, CR4_OSXMMEXCPT, CR4_PAE, EFER_LMA, EFER_LME, EFER_NX, EFER_SCE,
@@ -39,8 +40,8 @@ use crate::hypervisor::hypervisor_handler::HypervisorHandler;
 use crate::mem::memory_region::{MemoryRegion, MemoryRegionFlags};
 use crate::mem::ptr::{GuestPtr, RawPtr};
 #[cfg(gdb)]
-use crate::HyperlightError;
-use crate::{log_then_return, new_error, Result};
+use crate::new_error;
+use crate::{log_then_return, HyperlightError, Result};
 
 /// Return `true` if the KVM API is available, version 12, and has UserMemory capability, or `false` otherwise
 #[instrument(skip_all, parent = Span::current(), level = "Trace")]
@@ -281,6 +282,7 @@ pub(super) struct KVMDriver {
     entrypoint: u64,
     orig_rsp: GuestPtr,
     mem_regions: Vec<MemoryRegion>,
+    workers: WorkerVcpus,
 
     #[cfg(gdb)]
     debug: Option<KvmDebug>,
@@ -292,16 +294,31 @@ impl KVMDriver {
     /// Create a new instance of a `KVMDriver`, with only control registers
     /// set. Standard registers will not be set, and `initialise` must
     /// be called to do so.
+    ///
+    /// `vcpu_count` is the total number of vCPUs in the VM; all but the
+    /// first are worker vCPUs (see `kvm_workers`), whose threads are pinned
+    /// to `worker_cpus` if given.
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
     pub(super) fn new(
         mem_regions: Vec<MemoryRegion>,
         pml4_addr: u64,
         entrypoint: u64,
         rsp: u64,
+        vcpu_count: u32,
+        worker_cpus: Option<Vec<usize>>,
         #[cfg(gdb)] gdb_conn: Option<DebugCommChannel<DebugResponse, DebugMsg>>,
     ) -> Result<Self> {
         let kvm = Kvm::new()?;
 
+        let max_vcpus = kvm.get_max_vcpus();
+        if vcpu_count == 0 || vcpu_count as usize > max_vcpus {
+            log_then_return!(
+                "Cannot create a VM with {} vCPUs, KVM supports 1 to {}",
+                vcpu_count,
+                max_vcpus
+            );
+        }
+
         let vm_fd = kvm.create_vm_with_type(0)?;
 
         let perm_flags =
@@ -324,6 +341,7 @@ impl KVMDriver {
 
         let mut vcpu_fd = vm_fd.create_vcpu(0)?;
         Self::setup_initial_sregs(&mut vcpu_fd, pml4_addr)?;
+        let workers = WorkerVcpus::new(&vm_fd, vcpu_count - 1, worker_cpus)?;
 
         #[cfg(gdb)]
         let (debug, gdb_conn) = if let Some(gdb_conn) = gdb_conn {
@@ -345,6 +363,7 @@ impl KVMDriver {
             entrypoint,
             orig_rsp: rsp_gp,
             mem_regions,
+            workers,
 
             #[cfg(gdb)]
             debug,
@@ -355,6 +374,16 @@ impl KVMDriver {
         Ok(ret)
     }
 
+    /// Stop the worker vCPUs once a run of the first vCPU has returned
+    /// `res`. If the call was suspended, the workers are only paused, so
+    /// that they carry on when the call is resumed.
+    fn stop_workers(&mut self, res: &Result<()>) {
+        match res {
+            Err(HyperlightError::ExecutionSuspendedByHost()) => self.workers.pause(),
+            _ => self.workers.stop(),
+        }
+    }
+
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
     fn setup_initial_sregs(vcpu_fd: &mut VcpuFd, pml4_addr: u64) -> Result<()> {
         // setup paging and IA-32e (64-bit) mode
@@ -429,16 +458,16 @@ impl Hypervisor for KVMDriver {
         };
         self.vcpu_fd.set_regs(&regs)?;
 
-        VirtualCPU::run(
+        let res = VirtualCPU::run(
             self.as_mut_hypervisor(),
             hv_handler,
             outb_hdl,
             mem_access_hdl,
             #[cfg(gdb)]
             dbg_mem_access_fn,
-        )?;
-
-        Ok(())
+        );
+        self.stop_workers(&res);
+        res
     }
 
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
@@ -468,43 +497,53 @@ impl Hypervisor for KVMDriver {
         self.vcpu_fd.set_fpu(&fpu)?;
 
         // run
-        VirtualCPU::run(
+        let res = VirtualCPU::run(
             self.as_mut_hypervisor(),
             hv_handler,
             outb_handle_fn,
             mem_access_fn,
             #[cfg(gdb)]
             dbg_mem_access_fn,
-        )?;
+        );
+        self.stop_workers(&res);
+        res
+    }
 
-        Ok(())
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    fn resume_execution(
+        &mut self,
+        outb_handle_fn: OutBHandlerWrapper,
+        mem_access_fn: MemAccessHandlerWrapper,
+        hv_handler: Option<HypervisorHandler>,
+        #[cfg(gdb)] dbg_mem_access_fn: DbgMemAccessHandlerWrapper,
+    ) -> Result<()> {
+        self.workers.resume()?;
+        let res = VirtualCPU::run(
+            self.as_mut_hypervisor(),
+            hv_handler,
+            outb_handle_fn,
+            mem_access_fn,
+            #[cfg(gdb)]
+            dbg_mem_access_fn,
+        );
+        self.stop_workers(&res);
+        res
     }
 
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
     fn handle_io(
         &mut self,
         port: u16,
-        data: Vec<u8>,
+        data: u64,
         _rip: u64,
         _instruction_length: u64,
-        outb_handle_fn: OutBHandlerWrapper,
+        outb_handle_fn: &mut dyn OutBHandlerCaller,
     ) -> Result<()> {
         // KVM does not need RIP or instruction length, as it automatically sets the RIP
-
-        // The payload param for the outb_handle_fn is the first byte
-        // of the data array cast to an u64. Thus, we need to make sure
-        // the data array has at least one u8, then convert that to an u64
-        if data.is_empty() {
-            log_then_return!("no data was given in IO interrupt");
-        } else {
-            let payload_u64 = u64::from(data[0]);
-            outb_handle_fn
-                .try_lock()
-                .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
-                .call(port, payload_u64)?;
+        if self.workers.handle_outb(&self.vcpu_fd, port)? {
+            return Ok(());
         }
-
-        Ok(())
+        outb_handle_fn.call(port, data)
     }
 
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
@@ -518,8 +557,14 @@ impl Hypervisor for KVMDriver {
             Ok(VcpuExit::IoOut(port, data)) => {
                 // because vcpufd.run() mutably borrows self we cannot pass self to crate::debug! macro here
                 crate::debug!("KVM IO Details : \nPort : {}\nData : {:?}", port, data);
+                // The payload for the outb handler is the first byte written,
+                // so make sure there is one; it is passed on by value rather
+                // than copying the data slice into a new allocation.
+                if data.is_empty() {
+                    log_then_return!("no data was given in IO interrupt");
+                }
                 // KVM does not need to set RIP or instruction length so these are set to 0
-                HyperlightExit::IoOut(port, data.to_vec(), 0, 0)
+                HyperlightExit::IoOut(port, u64::from(data[0]), 0, 0)
             }
             Ok(VcpuExit::MmioRead(addr, _)) => {
                 crate::debug!("KVM MMIO Read -Details: Address: {} \n {:#?}", addr, &self);
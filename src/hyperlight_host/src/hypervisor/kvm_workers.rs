@@ -0,0 +1,431 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+//! Worker vCPUs for KVM sandboxes created with more than one vCPU.
+//!
+//! The guest always runs on the first vCPU, driven by `VirtualCPU::run` on
+//! the hypervisor handler thread. The remaining vCPUs only run when the
+//! guest asks for them with the following outb actions:
+//!
+//! - `WorkerCount`: the number of worker vCPUs is returned in RAX.
+//! - `RunWorkers`: start up to RAX workers, returning the number actually
+//!   started in RAX. Worker `i` (counting from 1) starts at RDI with RCX
+//!   passed through as its first argument and `i` as its second (the win64
+//!   calling convention the guest entrypoint also uses), on the stack
+//!   `[R8 + (i - 1) * R9, R8 + i * R9)`. Workers share the first vCPU's
+//!   page tables, GDT and IDT, and must halt when they are done.
+//! - `JoinWorkers`: wait for the started workers to halt, failing if any
+//!   of them did not.
+//!
+//! Each worker vCPU has its own host thread, spawned with the sandbox,
+//! which is parked between batches and told to run its vCPU over a
+//! channel. Workers cannot call the host: any outb from a worker fails it.
+//! When the call on the first vCPU is suspended the workers are paused
+//! with it, and they are always stopped once that call ends.
+
+use std::os::unix::thread::JoinHandleExt;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+
+use crossbeam_channel::{Receiver, RecvTimeoutError, Sender};
+use kvm_bindings::{kvm_fpu, kvm_regs, kvm_sregs};
+use kvm_ioctls::{VcpuExit, VcpuFd, VmFd};
+use libc::{pthread_kill, ESRCH};
+use tracing::{instrument, Span};
+use vmm_sys_util::signal::SIGRTMIN;
+
+use super::fpu::{FP_CONTROL_WORD_DEFAULT, FP_TAG_WORD_DEFAULT, MXCSR_DEFAULT};
+use crate::mem::numa::pin_current_thread;
+use crate::sandbox::outb::OutBAction;
+use crate::{log_then_return, new_error, HyperlightError, Result};
+
+/// How long `JoinWorkers` waits for workers that have not halted yet.
+/// A well behaved guest only joins once every worker has finished its
+/// work, so this only needs to cover the time it takes a worker to halt.
+const JOIN_TIMEOUT: Duration = Duration::from_millis(100);
+
+/// Why a worker vCPU stopped running
+#[derive(Debug)]
+enum WorkerExit {
+    /// The worker executed HLT, i.e. finished its work
+    Halted,
+    /// The host interrupted the worker, which can be run again later
+    Interrupted,
+    /// The worker failed
+    Failed(HyperlightError),
+}
+
+/// What a worker thread is told to do with its vCPU
+enum WorkerCommand {
+    /// Run the vCPU from the given registers as worker `index` of a batch
+    Start {
+        index: u64,
+        regs: kvm_regs,
+        sregs: Box<kvm_sregs>,
+    },
+    /// Carry on running the vCPU from where it was interrupted
+    Resume,
+}
+
+/// Where a worker vCPU is at
+#[derive(Debug)]
+enum WorkerState {
+    /// Not part of a batch
+    Idle,
+    /// Running as part of the current batch
+    Running,
+    /// Part of the current batch, but not running
+    Stopped(WorkerExit),
+    /// The worker's thread panicked, so the vCPU cannot be run again
+    Lost,
+}
+
+/// A worker vCPU and the thread that runs it
+struct Worker {
+    /// The worker's index in the current batch, counting from 1
+    index: u64,
+    state: WorkerState,
+    commands: Sender<WorkerCommand>,
+    exits: Receiver<WorkerExit>,
+    thread: JoinHandle<()>,
+}
+
+impl Worker {
+    /// Wait until `deadline` for the worker to stop, if it is running
+    fn wait(&mut self, deadline: Instant) {
+        if !matches!(self.state, WorkerState::Running) {
+            return;
+        }
+        match self.exits.recv_deadline(deadline) {
+            Ok(exit) => self.state = WorkerState::Stopped(exit),
+            Err(RecvTimeoutError::Timeout) => {}
+            // The vCPU is lost with the thread, so the sandbox has one
+            // fewer worker from now on
+            Err(RecvTimeoutError::Disconnected) => {
+                log::error!("The thread of guest worker vCPU {} panicked", self.index);
+                self.state = WorkerState::Lost;
+            }
+        }
+    }
+
+    /// Tell the worker's thread to run its vCPU
+    fn send(&mut self, command: WorkerCommand) -> Result<()> {
+        self.commands
+            .send(command)
+            .map_err(|_| new_error!("The thread of a guest worker vCPU has exited"))?;
+        self.state = WorkerState::Running;
+        Ok(())
+    }
+}
+
+/// The worker vCPUs of a KVM sandbox
+pub(super) struct WorkerVcpus {
+    workers: Vec<Worker>,
+    /// Set to make running workers stop at their next exit
+    interrupt: Arc<AtomicBool>,
+}
+
+impl WorkerVcpus {
+    /// Create `count` worker vCPUs in `vm_fd`, with ids starting at 1,
+    /// along with their threads, pinned to `cpus` if given
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(super) fn new(vm_fd: &VmFd, count: u32, cpus: Option<Vec<usize>>) -> Result<Self> {
+        let interrupt = Arc::new(AtomicBool::new(false));
+        let mut workers = Vec::new();
+        for id in 1..=u64::from(count) {
+            let vcpu = vm_fd.create_vcpu(id)?;
+            let (commands, commands_rx) = crossbeam_channel::bounded(1);
+            let (exits_tx, exits) = crossbeam_channel::bounded(1);
+            let (ready_tx, ready) = crossbeam_channel::bounded(1);
+            let interrupt = interrupt.clone();
+            let cpus = cpus.clone();
+            let thread = thread::Builder::new()
+                .name(format!("Hypervisor Worker vCPU {}", id))
+                .spawn(move || {
+                    let pinned = match cpus {
+                        Some(cpus) => pin_current_thread(&cpus),
+                        None => Ok(()),
+                    };
+                    let failed = pinned.is_err();
+                    let _ = ready_tx.send(pinned);
+                    if !failed {
+                        worker_thread(vcpu, commands_rx, exits_tx, &interrupt);
+                    }
+                })?;
+            ready
+                .recv()
+                .map_err(|_| new_error!("The thread of guest worker vCPU {} panicked", id))??;
+            workers.push(Worker {
+                index: id,
+                state: WorkerState::Idle,
+                commands,
+                exits,
+                thread,
+            });
+        }
+        Ok(Self { workers, interrupt })
+    }
+
+    /// Handle an outb to `port` made by the guest on `primary`.
+    /// Returns `Ok(false)` if `port` is not one of the worker actions.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(super) fn handle_outb(&mut self, primary: &VcpuFd, port: u16) -> Result<bool> {
+        const WORKER_COUNT: u16 = OutBAction::WorkerCount as u16;
+        const RUN_WORKERS: u16 = OutBAction::RunWorkers as u16;
+        const JOIN_WORKERS: u16 = OutBAction::JoinWorkers as u16;
+        match port {
+            WORKER_COUNT => {
+                let mut regs = primary.get_regs()?;
+                regs.rax = self.count() as u64;
+                primary.set_regs(&regs)?;
+            }
+            RUN_WORKERS => self.run(primary)?,
+            JOIN_WORKERS => self.join()?,
+            _ => return Ok(false),
+        }
+        Ok(true)
+    }
+
+    /// The total number of worker vCPUs
+    fn count(&self) -> usize {
+        self.workers
+            .iter()
+            .filter(|w| !matches!(w.state, WorkerState::Lost))
+            .count()
+    }
+
+    /// Start the workers requested by the guest on `primary`
+    fn run(&mut self, primary: &VcpuFd) -> Result<()> {
+        if self
+            .workers
+            .iter()
+            .any(|w| matches!(w.state, WorkerState::Running | WorkerState::Stopped(_)))
+        {
+            log_then_return!("The guest started worker vCPUs without joining the previous ones");
+        }
+
+        let mut regs = primary.get_regs()?;
+        let sregs = primary.get_sregs()?;
+        let count = usize::try_from(regs.rax)?.min(self.count());
+        let (entry, arg, stacks, stack_size) = (regs.rdi, regs.rcx, regs.r8, regs.r9);
+
+        self.interrupt.store(false, Ordering::SeqCst);
+        let idle = self
+            .workers
+            .iter_mut()
+            .filter(|w| matches!(w.state, WorkerState::Idle));
+        for (index, worker) in (1..=count as u64).zip(idle) {
+            let stack_top = index
+                .checked_mul(stack_size)
+                .and_then(|len| stacks.checked_add(len))
+                .ok_or_else(|| new_error!("Invalid guest worker stacks"))?;
+
+            worker.index = index;
+            worker.send(WorkerCommand::Start {
+                index,
+                regs: kvm_regs {
+                    rip: entry,
+                    // Leave room for the return address and the 32 bytes of
+                    // shadow space a win64 function expects on entry
+                    rsp: (stack_top & !0xf) - 0x28,
+                    rcx: arg,
+                    rdx: index,
+                    rflags: 1 << 1,
+                    ..Default::default()
+                },
+                sregs: Box::new(sregs),
+            })?;
+        }
+
+        regs.rax = count as u64;
+        primary.set_regs(&regs)?;
+        Ok(())
+    }
+
+    /// Wait for the workers of the current batch to halt. Workers that
+    /// have not halted within `JOIN_TIMEOUT` are stopped, and fail the
+    /// join.
+    fn join(&mut self) -> Result<()> {
+        let deadline = Instant::now() + JOIN_TIMEOUT;
+        for worker in &mut self.workers {
+            worker.wait(deadline);
+        }
+        if self
+            .workers
+            .iter()
+            .any(|w| matches!(w.state, WorkerState::Running))
+        {
+            self.stop();
+            log_then_return!("The guest joined worker vCPUs that had not finished");
+        }
+
+        let mut res = Ok(());
+        for worker in &mut self.workers {
+            if !matches!(worker.state, WorkerState::Stopped(_)) {
+                continue;
+            }
+            match std::mem::replace(&mut worker.state, WorkerState::Idle) {
+                WorkerState::Stopped(WorkerExit::Failed(e)) if res.is_ok() => res = Err(e),
+                WorkerState::Stopped(WorkerExit::Interrupted) if res.is_ok() => {
+                    res = Err(new_error!(
+                        "Guest worker vCPU {} was interrupted",
+                        worker.index
+                    ))
+                }
+                _ => {}
+            }
+        }
+        res
+    }
+
+    /// Interrupt the running workers, keeping their state so that `resume`
+    /// can carry on running them. Used when the call running on the first
+    /// vCPU is suspended.
+    pub(super) fn pause(&mut self) {
+        if !self
+            .workers
+            .iter()
+            .any(|w| matches!(w.state, WorkerState::Running))
+        {
+            return;
+        }
+        self.interrupt.store(true, Ordering::SeqCst);
+        for worker in &mut self.workers {
+            // As in `HypervisorHandler::terminate_execution`, the signal
+            // may arrive just before the thread enters the vCPU, so keep
+            // sending it until the worker stops
+            while matches!(worker.state, WorkerState::Running) {
+                let ret = unsafe { pthread_kill(worker.thread.as_pthread_t(), SIGRTMIN()) };
+                if ret != 0 && ret != ESRCH {
+                    log::error!("error {} calling pthread_kill on a worker vCPU", ret);
+                }
+                worker.wait(Instant::now() + Duration::from_micros(500));
+            }
+        }
+    }
+
+    /// Carry on running the workers `pause` interrupted
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(super) fn resume(&mut self) -> Result<()> {
+        self.interrupt.store(false, Ordering::SeqCst);
+        for worker in &mut self.workers {
+            if matches!(worker.state, WorkerState::Stopped(WorkerExit::Interrupted)) {
+                worker.send(WorkerCommand::Resume)?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Stop the workers of the current batch, if any, and make all worker
+    /// vCPUs idle.
+    ///
+    /// Called whenever the call running on the first vCPU ends, so that no
+    /// worker ever runs while the sandbox's memory is being reset.
+    pub(super) fn stop(&mut self) {
+        self.pause();
+        for worker in &mut self.workers {
+            if matches!(worker.state, WorkerState::Stopped(_)) {
+                worker.state = WorkerState::Idle;
+            }
+        }
+    }
+}
+
+impl Drop for WorkerVcpus {
+    fn drop(&mut self) {
+        self.stop();
+        for worker in self.workers.drain(..) {
+            // Closing the command channel ends the worker's thread
+            drop(worker.commands);
+            if worker.thread.join().is_err() {
+                log::error!("The thread of guest worker vCPU {} panicked", worker.index);
+            }
+        }
+    }
+}
+
+/// The body of a worker's thread: run `vcpu` whenever told to on
+/// `commands`, reporting why it stopped on `exits`, until `commands` is
+/// closed
+fn worker_thread(
+    mut vcpu: VcpuFd,
+    commands: Receiver<WorkerCommand>,
+    exits: Sender<WorkerExit>,
+    interrupt: &AtomicBool,
+) {
+    let mut current = 0;
+    for command in commands {
+        let exit = match command {
+            WorkerCommand::Start { index, regs, sregs } => {
+                current = index;
+                match start_worker(&vcpu, &regs, &sregs) {
+                    Ok(()) => run_worker(&mut vcpu, index, interrupt),
+                    Err(e) => WorkerExit::Failed(e),
+                }
+            }
+            WorkerCommand::Resume => run_worker(&mut vcpu, current, interrupt),
+        };
+        if exits.send(exit).is_err() {
+            return;
+        }
+    }
+}
+
+/// Set up `vcpu` to start running from `regs`, sharing the first vCPU's
+/// `sregs`
+fn start_worker(vcpu: &VcpuFd, regs: &kvm_regs, sregs: &kvm_sregs) -> Result<()> {
+    vcpu.set_sregs(sregs)?;
+    vcpu.set_regs(regs)?;
+    vcpu.set_fpu(&kvm_fpu {
+        fcw: FP_CONTROL_WORD_DEFAULT,
+        ftwx: FP_TAG_WORD_DEFAULT,
+        mxcsr: MXCSR_DEFAULT,
+        ..Default::default()
+    })?;
+    Ok(())
+}
+/// Run worker vCPU `index` until it halts, fails, or `interrupt` is set
+fn run_worker(vcpu: &mut VcpuFd, index: u64, interrupt: &AtomicBool) -> WorkerExit {
+    loop {
+        if interrupt.load(Ordering::SeqCst) {
+            return WorkerExit::Interrupted;
+        }
+        let err = match vcpu.run() {
+            Ok(VcpuExit::Hlt) => return WorkerExit::Halted,
+            Ok(VcpuExit::IoOut(port, data)) if port == OutBAction::Abort as u16 => new_error!(
+                "Guest worker vCPU {} aborted with code {}",
+                index,
+                data.first().copied().unwrap_or_default()
+            ),
+            Ok(VcpuExit::IoOut(port, _)) => new_error!(
+                "Guest worker vCPU {} wrote to port {}, but only the first vCPU can call the host",
+                index,
+                port
+            ),
+            Ok(other) => new_error!(
+                "Unexpected exit from guest worker vCPU {}: {:?}",
+                index,
+                other
+            ),
+            Err(e) if e.errno() == libc::EINTR || e.errno() == libc::EAGAIN => continue,
+            Err(e) => e.into(),
+        };
+        log::error!("{}", err);
+        return WorkerExit::Failed(err);
+    }
+}
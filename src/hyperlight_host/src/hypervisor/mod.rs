@@ -19,7 +19,7 @@ use tracing::{instrument, Span};
 
 use crate::error::HyperlightError::ExecutionCanceledByHost;
 use crate::mem::memory_region::{MemoryRegion, MemoryRegionFlags};
-use crate::metrics::METRIC_GUEST_CANCELLATION;
+use crate::metrics::{VcpuRunTimer, METRIC_GUEST_CANCELLATION};
 use crate::{log_then_return, new_error, HyperlightError, Result};
 
 /// Util for handling x87 fpu state
@@ -45,6 +45,9 @@ pub mod inprocess;
 #[cfg(kvm)]
 /// Functionality to manipulate KVM-based virtual machines
 pub mod kvm;
+#[cfg(kvm)]
+/// Worker vCPUs for KVM sandboxes with more than one vCPU
+pub(crate) mod kvm_workers;
 #[cfg(target_os = "windows")]
 /// Hyperlight Surrogate Process
 pub(crate) mod surrogate_process;
@@ -99,8 +102,12 @@ pub enum HyperlightExit {
     Debug(VcpuStopReason),
     /// The vCPU has halted
     Halt(),
-    /// The vCPU has issued a write to the given port with the given value
-    IoOut(u16, Vec<u8>, u64, u64),
+    /// The vCPU has issued a write to the given port with the given value.
+    ///
+    /// The fields are the port, the value written (zero extended to a
+    /// `u64`), the RIP of the `out` instruction and its length. The value
+    /// is carried inline so that building this exit never allocates.
+    IoOut(u16, u64, u64, u64),
     /// The vCPU has attempted to read or write from an unmapped address
     Mmio(u64),
     /// The vCPU tried to access memory but was missing the required permissions
@@ -150,14 +157,40 @@ pub(crate) trait Hypervisor: Debug + Sync + Send {
         #[cfg(gdb)] dbg_mem_access_fn: DbgMemAccessHandlerWrapper,
     ) -> Result<()>;
 
+    /// Continue running the vCPU from the state a suspended call left it
+    /// in (see `HyperlightError::ExecutionSuspendedByHost`), until a halt
+    /// instruction.
+    ///
+    /// Unlike `dispatch_call_from_host`, this does not touch the vCPU's
+    /// registers, so the guest carries on exactly where it was interrupted.
+    fn resume_execution(
+        &mut self,
+        outb_handle_fn: OutBHandlerWrapper,
+        mem_access_fn: MemAccessHandlerWrapper,
+        hv_handler: Option<HypervisorHandler>,
+        #[cfg(gdb)] dbg_mem_access_fn: DbgMemAccessHandlerWrapper,
+    ) -> Result<()> {
+        VirtualCPU::run(
+            self.as_mut_hypervisor(),
+            hv_handler,
+            outb_handle_fn,
+            mem_access_fn,
+            #[cfg(gdb)]
+            dbg_mem_access_fn,
+        )
+    }
+
     /// Handle an IO exit from the internally stored vCPU.
+    ///
+    /// `outb_handle_fn` is borrowed from a lock `VirtualCPU::run` holds
+    /// for the whole run, so handling an exit neither allocates nor locks.
     fn handle_io(
         &mut self,
         port: u16,
-        data: Vec<u8>,
+        data: u64,
         rip: u64,
         instruction_length: u64,
-        outb_handle_fn: OutBHandlerWrapper,
+        outb_handle_fn: &mut dyn OutBHandlerCaller,
     ) -> Result<()>;
 
     /// Run the vCPU
@@ -261,76 +294,99 @@ impl VirtualCPU {
         mem_access_fn: Arc<Mutex<dyn MemAccessHandlerCaller>>,
         #[cfg(gdb)] dbg_mem_access_fn: Arc<Mutex<dyn DbgMemAccessHandlerCaller>>,
     ) -> Result<()> {
-        loop {
-            match hv.run() {
-                #[cfg(gdb)]
-                Ok(HyperlightExit::Debug(stop_reason)) => {
-                    if let Err(e) = hv.handle_debug(dbg_mem_access_fn.clone(), stop_reason) {
-                        log_then_return!(e);
+        // Take the outb handler once for the whole run rather than once per
+        // exit: guests that log or call the host in a tight loop otherwise
+        // pay for a lock (and an `Arc` clone) on every IO exit. The handler
+        // likewise locks anything it needs to handle an exit once, in
+        // `with_run`.
+        let mut outb_handler = outb_handle_fn
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+
+        outb_handler.with_run(&mut |outb_handler| {
+            loop {
+                let run_timer = VcpuRunTimer::start();
+                let exit = hv.run();
+                // Times the handling of the exit until the end of this iteration
+                let _handling_timer = run_timer.exited(&exit);
+                match exit {
+                    #[cfg(gdb)]
+                    Ok(HyperlightExit::Debug(stop_reason)) => {
+                        if let Err(e) = hv.handle_debug(dbg_mem_access_fn.clone(), stop_reason) {
+                            log_then_return!(e);
+                        }
                     }
-                }
 
-                Ok(HyperlightExit::Halt()) => {
-                    break;
-                }
-                Ok(HyperlightExit::IoOut(port, data, rip, instruction_length)) => {
-                    hv.handle_io(port, data, rip, instruction_length, outb_handle_fn.clone())?
-                }
-                Ok(HyperlightExit::Mmio(addr)) => {
-                    #[cfg(crashdump)]
-                    crashdump::crashdump_to_tempfile(hv)?;
-
-                    mem_access_fn
-                        .clone()
-                        .try_lock()
-                        .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
-                        .call()?;
-
-                    log_then_return!("MMIO access address {:#x}", addr);
-                }
-                Ok(HyperlightExit::AccessViolation(addr, tried, region_permission)) => {
-                    #[cfg(crashdump)]
-                    crashdump::crashdump_to_tempfile(hv)?;
-
-                    if region_permission.intersects(MemoryRegionFlags::STACK_GUARD) {
-                        return Err(HyperlightError::StackOverflow());
+                    Ok(HyperlightExit::Halt()) => {
+                        break;
                     }
-                    log_then_return!(HyperlightError::MemoryAccessViolation(
-                        addr,
-                        tried,
-                        region_permission
-                    ));
-                }
-                Ok(HyperlightExit::Cancelled()) => {
-                    // Shutdown is returned when the host has cancelled execution
-                    // After termination, the main thread will re-initialize the VM
-                    if let Some(hvh) = hv_handler {
-                        // If hvh is None, then we are running from the C API, which doesn't use
-                        // the HypervisorHandler
-                        hvh.set_running(false);
-                        #[cfg(target_os = "linux")]
-                        hvh.set_run_cancelled(true);
+                    Ok(HyperlightExit::IoOut(port, data, rip, instruction_length)) => {
+                        hv.handle_io(port, data, rip, instruction_length, outb_handler)?
                     }
-                    metrics::counter!(METRIC_GUEST_CANCELLATION).increment(1);
-                    log_then_return!(ExecutionCanceledByHost());
-                }
-                Ok(HyperlightExit::Unknown(reason)) => {
-                    #[cfg(crashdump)]
-                    crashdump::crashdump_to_tempfile(hv)?;
+                    Ok(HyperlightExit::Mmio(addr)) => {
+                        #[cfg(crashdump)]
+                        crashdump::crashdump_to_tempfile(hv)?;
+
+                        mem_access_fn
+                            .try_lock()
+                            .map_err(|e| {
+                                new_error!("Error locking at {}:{}: {}", file!(), line!(), e)
+                            })?
+                            .call()?;
+
+                        log_then_return!("MMIO access address {:#x}", addr);
+                    }
+                    Ok(HyperlightExit::AccessViolation(addr, tried, region_permission)) => {
+                        #[cfg(crashdump)]
+                        crashdump::crashdump_to_tempfile(hv)?;
+
+                        if region_permission.intersects(MemoryRegionFlags::STACK_GUARD) {
+                            return Err(HyperlightError::StackOverflow());
+                        }
+                        log_then_return!(HyperlightError::MemoryAccessViolation(
+                            addr,
+                            tried,
+                            region_permission
+                        ));
+                    }
+                    Ok(HyperlightExit::Cancelled()) => {
+                        // Shutdown is returned when the host has cancelled execution
+                        // After termination, the main thread will re-initialize the VM
+                        if let Some(hvh) = &hv_handler {
+                            // If hvh is None, then we are running from the C API, which doesn't use
+                            // the HypervisorHandler
+                            hvh.set_running(false);
+                            #[cfg(target_os = "linux")]
+                            hvh.set_run_cancelled(true);
+
+                            // The host asked for the call to be suspended rather
+                            // than cancelled: leave the vCPU state as it is so
+                            // that `resume_execution` can carry on from here.
+                            if hvh.take_suspend_request() {
+                                return Err(HyperlightError::ExecutionSuspendedByHost());
+                            }
+                        }
+                        metrics::counter!(METRIC_GUEST_CANCELLATION).increment(1);
+                        log_then_return!(ExecutionCanceledByHost());
+                    }
+                    Ok(HyperlightExit::Unknown(reason)) => {
+                        #[cfg(crashdump)]
+                        crashdump::crashdump_to_tempfile(hv)?;
 
-                    log_then_return!("Unexpected VM Exit {:?}", reason);
-                }
-                Ok(HyperlightExit::Retry()) => continue,
-                Err(e) => {
-                    #[cfg(crashdump)]
-                    crashdump::crashdump_to_tempfile(hv)?;
+                        log_then_return!("Unexpected VM Exit {:?}", reason);
+                    }
+                    Ok(HyperlightExit::Retry()) => continue,
+                    Err(e) => {
+                        #[cfg(crashdump)]
+                        crashdump::crashdump_to_tempfile(hv)?;
 
-                    return Err(e);
+                        return Err(e);
+                    }
                 }
             }
-        }
 
-        Ok(())
+            Ok(())
+        })
     }
 }
 
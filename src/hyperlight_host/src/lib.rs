@@ -87,6 +87,16 @@ pub(crate) mod testing;
 
 /// The re-export for the `HyperlightError` type
 pub use error::HyperlightError;
+/// The re-export for the `channel` function
+pub use mem::channel::channel;
+/// The re-export for the `ChannelReceiver` type
+pub use mem::channel::ChannelReceiver;
+/// The re-export for the `ChannelSender` type
+pub use mem::channel::ChannelSender;
+/// The re-export for the `FileSystemImage` type
+pub use mem::fs_image::FileSystemImage;
+/// The re-export for the `SharedData` type
+pub use mem::shared_data::SharedData;
 /// The re-export for the `is_hypervisor_present` type
 pub use sandbox::is_hypervisor_present;
 /// The re-export for the `GuestBinary` type
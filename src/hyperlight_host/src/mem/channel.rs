@@ -0,0 +1,183 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::fmt::Debug;
+
+use hyperlight_common::channel::{ChannelError, ChannelRing, CHANNEL_HEADER_SIZE};
+use tracing::{instrument, Span};
+
+use super::shared_data::SharedData;
+use crate::{log_then_return, Result};
+
+/// Create a new, empty one-way channel of messages between two sandboxes,
+/// in memory that is mapped into both of them, so that a guest can pass
+/// messages straight to another guest rather than returning them to the
+/// host to be passed on. The channel can hold `capacity` bytes of
+/// messages: each message takes up its length plus up to 11 bytes, and a
+/// message can be at most half of `capacity`.
+///
+/// Either end can be used by the host, or mapped into a sandbox with
+/// `UninitializedSandbox::map_channel_sender` or
+/// `UninitializedSandbox::map_channel_receiver`, where the guest opens it
+/// with `hyperlight_guest::channel::Sender::open` or
+/// `hyperlight_guest::channel::Receiver::open`. The sender copies each
+/// message into the channel, and the receiver can read it in place. The
+/// host only has to call the guests in turn, and can also be one end
+/// itself, e.g. to feed the first sandbox in a pipeline.
+///
+/// Neither end can be cloned, and mapping an end into a sandbox gives it
+/// to that sandbox, so there is only ever one sender and one receiver.
+/// Like `SharedData`, a channel is not part of the snapshots of the
+/// sandboxes it is mapped into, so messages are not lost when their state
+/// is reset after a guest call.
+///
+/// Like shared data, channels are not yet supported on Windows.
+#[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+pub fn channel(capacity: usize) -> Result<(ChannelSender, ChannelReceiver)> {
+    let data = SharedData::new_writable(CHANNEL_HEADER_SIZE + capacity)?;
+    // The memory is 2MB aligned, zeroed when it was allocated and kept
+    // alive by `data`, which each end holds
+    let ring = || match unsafe { ChannelRing::from_raw_parts(data.as_mut_ptr(), data.len()) } {
+        Some(ring) => Ok(ring),
+        None => {
+            log_then_return!("A channel of {} bytes is too small", data.len());
+        }
+    };
+    Ok((
+        ChannelSender {
+            ring: ring()?,
+            data: data.clone(),
+        },
+        ChannelReceiver {
+            ring: ring()?,
+            data,
+        },
+    ))
+}
+
+/// The end of a channel that sends messages on it, created by `channel`
+pub struct ChannelSender {
+    ring: ChannelRing,
+    data: SharedData,
+}
+
+impl ChannelSender {
+    /// The largest message that can be sent on the channel
+    pub fn max_message_len(&self) -> usize {
+        self.ring.max_message_len()
+    }
+
+    /// Whether the receiver has received every message sent so far
+    pub fn is_empty(&self) -> bool {
+        self.ring.is_empty()
+    }
+
+    /// Send `message` on the channel, returning `Ok(false)` without sending
+    /// it if the channel does not have room for it until more messages
+    /// have been received.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub fn try_send(&mut self, message: &[u8]) -> Result<bool> {
+        match self.ring.try_send(message) {
+            Ok(()) => Ok(true),
+            Err(ChannelError::Full) => Ok(false),
+            Err(e) => {
+                log_then_return!("Failed to send a message on a channel: {:?}", e);
+            }
+        }
+    }
+
+    /// The memory to map into the sandbox this end is given to
+    pub(crate) fn shared_data(&self) -> &SharedData {
+        &self.data
+    }
+}
+
+/// The end of a channel that receives messages on it, created by `channel`
+pub struct ChannelReceiver {
+    ring: ChannelRing,
+    data: SharedData,
+}
+
+impl ChannelReceiver {
+    /// Whether there are no messages waiting to be received
+    pub fn is_empty(&self) -> bool {
+        self.ring.is_empty()
+    }
+
+    /// Receive the next message on the channel, if there is one
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub fn try_recv(&mut self) -> Result<Option<Vec<u8>>> {
+        match self.ring.try_recv_with(|message| message.to_vec()) {
+            Ok(message) => Ok(message),
+            Err(e) => {
+                log_then_return!("Failed to receive a message on a channel: {:?}", e);
+            }
+        }
+    }
+
+    /// The memory to map into the sandbox this end is given to
+    pub(crate) fn shared_data(&self) -> &SharedData {
+        &self.data
+    }
+}
+
+impl Debug for ChannelSender {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("ChannelSender")
+            .field("len", &format_args!("{:#x}", self.data.len()))
+            .finish()
+    }
+}
+
+impl Debug for ChannelReceiver {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("ChannelReceiver")
+            .field("len", &format_args!("{:#x}", self.data.len()))
+            .finish()
+    }
+}
+
+#[cfg(test)]
+#[cfg(target_os = "linux")]
+mod tests {
+    use super::channel;
+
+    #[test]
+    fn send_and_receive() {
+        let (mut sender, mut receiver) = channel(4096).unwrap();
+        assert!(receiver.is_empty());
+        assert!(sender.try_send(b"hello").unwrap());
+        assert!(sender.try_send(b"world").unwrap());
+        assert!(!sender.is_empty());
+        assert_eq!(receiver.try_recv().unwrap(), Some(b"hello".to_vec()));
+        assert_eq!(receiver.try_recv().unwrap(), Some(b"world".to_vec()));
+        assert_eq!(receiver.try_recv().unwrap(), None);
+        assert!(sender.is_empty());
+
+        // A message of the largest size always fits in an empty channel
+        let (mut sender, _receiver) = channel(4096).unwrap();
+        let message = vec![1; sender.max_message_len()];
+        assert!(sender.try_send(&message).unwrap());
+        assert!(sender.try_send(&message).unwrap());
+        assert!(!sender.try_send(&message).unwrap());
+        assert!(sender.try_send(&[0; 4097]).is_err());
+    }
+
+    #[test]
+    fn too_small() {
+        assert!(channel(0).is_err());
+    }
+}
@@ -0,0 +1,147 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::fmt::Debug;
+use std::path::Path;
+
+use hyperlight_common::fs_image::{build_fs_image, FsImage};
+use tracing::{instrument, Span};
+
+use super::shared_data::SharedData;
+use crate::{new_error, Result};
+
+/// A read-only archive of files, such as templates, lookup tables or WASM
+/// modules, that can be mapped into the guest address space of any number
+/// of sandboxes.
+///
+/// Map an image into a sandbox with
+/// `UninitializedSandbox::map_file_system_image`, and the guest can open
+/// and read its files with `hyperlight_guest::fs`, or get at their
+/// contents directly, without any VM exits or copies. The image is built
+/// once, with an index sorted by path, and is shared and left out of
+/// snapshots in the same way as `SharedData`.
+#[derive(Clone)]
+pub struct FileSystemImage {
+    data: SharedData,
+}
+
+impl FileSystemImage {
+    /// Build an image holding `files`, given as pairs of a path and the
+    /// file's contents. Paths are relative to the root of the image, and a
+    /// leading `/` is ignored.
+    ///
+    /// Like shared data, file system images are not yet supported on
+    /// Windows.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub fn new<'f>(files: impl IntoIterator<Item = (&'f str, &'f [u8])>) -> Result<Self> {
+        let image = build_fs_image(files)
+            .map_err(|e| new_error!("Failed to build a file system image: {:?}", e))?;
+        Ok(Self {
+            data: SharedData::new(&image)?,
+        })
+    }
+
+    /// Build an image holding every file under the directory `dir`, at
+    /// its path relative to `dir`, with components separated by `/`.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub fn from_directory(dir: &Path) -> Result<Self> {
+        let mut files = Vec::new();
+        read_directory(dir, "", &mut files)?;
+        Self::new(
+            files
+                .iter()
+                .map(|(path, contents)| (path.as_str(), contents.as_slice())),
+        )
+    }
+
+    /// The number of files in the image
+    pub fn len(&self) -> usize {
+        self.image().len()
+    }
+
+    /// Whether the image has no files
+    pub fn is_empty(&self) -> bool {
+        self.image().is_empty()
+    }
+
+    /// The contents of the file at `path`, if there is one
+    pub fn get(&self, path: &str) -> Option<&[u8]> {
+        self.image().get(path)
+    }
+
+    /// The memory to map into sandboxes
+    pub(crate) fn shared_data(&self) -> &SharedData {
+        &self.data
+    }
+
+    fn image(&self) -> FsImage<'_> {
+        // The image was built by `build_fs_image`, and is read-only
+        FsImage::parse_unchecked(self.data.as_slice())
+    }
+}
+
+/// Read every file under `dir` into `files`, with its path relative to
+/// `dir` prefixed with `prefix`
+fn read_directory(dir: &Path, prefix: &str, files: &mut Vec<(String, Vec<u8>)>) -> Result<()> {
+    for entry in std::fs::read_dir(dir)? {
+        let entry = entry?;
+        let name = entry.file_name().into_string().map_err(|name| {
+            new_error!(
+                "File system image paths must be UTF-8, and {:?} is not",
+                name
+            )
+        })?;
+        let path = format!("{}{}", prefix, name);
+        if entry.file_type()?.is_dir() {
+            read_directory(&entry.path(), &format!("{}/", path), files)?;
+        } else {
+            files.push((path, std::fs::read(entry.path())?));
+        }
+    }
+    Ok(())
+}
+
+impl Debug for FileSystemImage {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("FileSystemImage")
+            .field("files", &self.len())
+            .field("len", &format_args!("{:#x}", self.data.len()))
+            .finish()
+    }
+}
+
+#[cfg(test)]
+#[cfg(target_os = "linux")]
+mod tests {
+    use super::FileSystemImage;
+
+    #[test]
+    fn from_directory() {
+        let dir = tempfile::tempdir().unwrap();
+        std::fs::create_dir(dir.path().join("templates")).unwrap();
+        std::fs::write(dir.path().join("templates/index.html"), "<html></html>").unwrap();
+        std::fs::write(dir.path().join("config.json"), "{}").unwrap();
+
+        let image = FileSystemImage::from_directory(dir.path()).unwrap();
+        assert_eq!(image.len(), 2);
+        assert_eq!(
+            image.get("templates/index.html"),
+            Some(&b"<html></html>"[..])
+        );
+        assert_eq!(image.get("/config.json"), Some(&b"{}"[..]));
+        assert_eq!(image.get("templates"), None);
+    }
+}
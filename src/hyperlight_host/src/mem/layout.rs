@@ -16,7 +16,9 @@ limitations under the License.
 use std::fmt::Debug;
 use std::mem::{offset_of, size_of};
 
-use hyperlight_common::mem::{GuestStackData, HyperlightPEB, RunMode, PAGE_SIZE_USIZE};
+use hyperlight_common::mem::{
+    GuestSharedData, HyperlightPEB, RunMode, SharedDataRegion, PAGE_SIZE_USIZE,
+};
 use paste::paste;
 use rand::{rng, RngCore};
 use tracing::{instrument, Span};
@@ -26,7 +28,7 @@ use super::memory_region::MemoryRegionType::{
     InputData, KernelStack, OutputData, PageTables, PanicContext, Peb, Stack,
 };
 use super::memory_region::{MemoryRegion, MemoryRegionFlags, MemoryRegionVecBuilder};
-use super::mgr::AMOUNT_OF_MEMORY_PER_PT;
+use super::mgr::{AMOUNT_OF_MEMORY_PER_PD, AMOUNT_OF_MEMORY_PER_PT};
 use super::shared_mem::{ExclusiveSharedMemory, GuestSharedMemory, SharedMemory};
 use crate::error::HyperlightError::{GuestOffsetIsInvalid, MemoryRequestTooBig};
 use crate::sandbox::SandboxConfiguration;
@@ -63,9 +65,9 @@ use crate::{log_then_return, new_error, Result};
 // +-------------------------------------------+
 // |               Guest Code                  |
 // +-------------------------------------------+
-// |                    PT                     |
-// +-------------------------------------------+ 0x203_000
-// |                    PD                     |
+// |                   PTs                     |
+// +-------------------------------------------+ 0x202_000 + 0x1000 * num PDs
+// |                   PDs                     |
 // +-------------------------------------------+ 0x202_000
 // |                   PDPT                    |
 // +-------------------------------------------+ 0x201_000
@@ -117,8 +119,15 @@ pub(crate) struct SandboxMemoryLayout {
     pub(super) sandbox_memory_config: SandboxConfiguration,
     /// The total stack size of this sandbox.
     pub(super) stack_size: usize,
-    /// The heap size of this sandbox.
+    /// The heap size of this sandbox. If the heap can grow on demand, this
+    /// is the size it can grow to, and is reserved in full.
     pub(super) heap_size: usize,
+    /// The size the heap starts out at, which is what the guest is told
+    /// its heap size is when the sandbox is created.
+    pub(super) initial_heap_size: usize,
+    /// The amount of guest address space reserved for read-only shared
+    /// data regions, which lies outside the sandbox's memory
+    pub(super) shared_data_size: usize,
 
     /// The following fields are offsets to the actual PEB struct fields.
     /// They are used when writing the PEB struct itself
@@ -135,6 +144,7 @@ pub(crate) struct SandboxMemoryLayout {
     peb_guest_panic_context_offset: usize,
     peb_heap_data_offset: usize,
     peb_guest_stack_data_offset: usize,
+    peb_shared_data_offset: usize,
 
     // The following are the actual values
     // that are written to the PEB struct
@@ -156,7 +166,7 @@ pub(crate) struct SandboxMemoryLayout {
 
     // other
     pub(crate) peb_address: usize,
-    code_size: usize,
+    pub(super) code_size: usize,
     // The total size of the page tables
     total_page_table_size: usize,
     // The offset in the sandbox memory where the code starts
@@ -172,6 +182,10 @@ impl Debug for SandboxMemoryLayout {
             )
             .field("Stack Size", &format_args!("{:#x}", self.stack_size))
             .field("Heap Size", &format_args!("{:#x}", self.heap_size))
+            .field(
+                "Initial Heap Size",
+                &format_args!("{:#x}", self.initial_heap_size),
+            )
             .field("PEB Address", &format_args!("{:#x}", self.peb_address))
             .field("PEB Offset", &format_args!("{:#x}", self.peb_offset))
             .field("Code Size", &format_args!("{:#x}", self.code_size))
@@ -219,6 +233,14 @@ impl Debug for SandboxMemoryLayout {
                 "Guest Stack Offset",
                 &format_args!("{:#x}", self.peb_guest_stack_data_offset),
             )
+            .field(
+                "Shared Data Offset",
+                &format_args!("{:#x}", self.peb_shared_data_offset),
+            )
+            .field(
+                "Shared Data Size",
+                &format_args!("{:#x}", self.shared_data_size),
+            )
             .field(
                 "Host Function Definitions Buffer Offset",
                 &format_args!("{:#x}", self.host_function_definitions_buffer_offset),
@@ -290,22 +312,19 @@ impl SandboxMemoryLayout {
     /// The offset into the sandbox's memory where the Page Directory Pointer
     /// Table starts.
     pub(super) const PDPT_OFFSET: usize = 0x1000;
-    /// The offset into the sandbox's memory where the Page Directory starts.
+    /// The offset into the sandbox's memory where the Page Directories
+    /// start. There is one Page Directory for every 1GB of memory, and
+    /// the Page Tables follow the last one.
     pub(super) const PD_OFFSET: usize = 0x2000;
-    /// The offset into the sandbox's memory where the Page Tables start.
-    pub(super) const PT_OFFSET: usize = 0x3000;
-    /// The address (not the offset) to the start of the page directory
+    /// The address (not the offset) to the start of the first page directory
     pub(super) const PD_GUEST_ADDRESS: usize = Self::BASE_ADDRESS + Self::PD_OFFSET;
     /// The address (not the offset) into sandbox memory where the Page
     /// Directory Pointer Table starts
     pub(super) const PDPT_GUEST_ADDRESS: usize = Self::BASE_ADDRESS + Self::PDPT_OFFSET;
-    /// The address (not the offset) into sandbox memory where the Page
-    /// Tables start
-    pub(super) const PT_GUEST_ADDRESS: usize = Self::BASE_ADDRESS + Self::PT_OFFSET;
     /// The maximum amount of memory a single sandbox will be allowed.
-    /// The addressable virtual memory with current paging setup is virtual address 0x0 - 0x40000000 (excl.),
+    /// The single PDPT can map virtual addresses 0x0 - 0x80_0000_0000 (excl.), i.e. 512GB,
     /// However, the memory up to Self::BASE_ADDRESS is not used.
-    const MAX_MEMORY_SIZE: usize = 0x40000000 - Self::BASE_ADDRESS;
+    const MAX_MEMORY_SIZE: usize = 512 * AMOUNT_OF_MEMORY_PER_PD - Self::BASE_ADDRESS;
 
     /// The base address of the sandbox's memory.
     pub(crate) const BASE_ADDRESS: usize = 0x0200000;
@@ -322,8 +341,17 @@ impl SandboxMemoryLayout {
         stack_size: usize,
         heap_size: usize,
     ) -> Result<Self> {
-        let total_page_table_size =
-            Self::get_total_page_table_size(cfg, code_size, stack_size, heap_size);
+        // A heap that can grow is laid out (and mapped) at its maximum size
+        let initial_heap_size = heap_size;
+        let heap_size = heap_size.max(usize::try_from(cfg.get_max_heap_size())?);
+        let shared_data_size = Self::get_shared_data_size(cfg)?;
+        let total_page_table_size = Self::get_total_page_table_size(
+            cfg,
+            code_size,
+            stack_size,
+            heap_size,
+            shared_data_size,
+        );
         let guest_code_offset = total_page_table_size;
         // The following offsets are to the fields of the PEB struct itself!
         let peb_offset = total_page_table_size + round_up_to(code_size, PAGE_SIZE_USIZE);
@@ -343,15 +371,14 @@ impl SandboxMemoryLayout {
             peb_offset + offset_of!(HyperlightPEB, guestPanicContextData);
         let peb_heap_data_offset = peb_offset + offset_of!(HyperlightPEB, guestheapData);
         let peb_guest_stack_data_offset = peb_offset + offset_of!(HyperlightPEB, gueststackData);
+        let peb_shared_data_offset = peb_offset + offset_of!(HyperlightPEB, sharedData);
 
         // The following offsets are the actual values that relate to memory layout,
         // which are written to PEB struct
         let peb_address = Self::BASE_ADDRESS + peb_offset;
         // make sure host function definitions buffer starts at 4K boundary
-        let host_function_definitions_buffer_offset = round_up_to(
-            peb_guest_stack_data_offset + size_of::<GuestStackData>(),
-            PAGE_SIZE_USIZE,
-        );
+        let host_function_definitions_buffer_offset =
+            round_up_to(peb_offset + size_of::<HyperlightPEB>(), PAGE_SIZE_USIZE);
         // make sure host exception buffer starts at 4K boundary
         let host_exception_buffer_offset = round_up_to(
             host_function_definitions_buffer_offset + cfg.get_host_function_definition_size(),
@@ -390,10 +417,12 @@ impl SandboxMemoryLayout {
         let kernel_stack_guard_page_offset = kernel_stack_buffer_offset + kernel_stack_size_rounded;
         let boot_stack_buffer_offset = kernel_stack_guard_page_offset + PAGE_SIZE_USIZE;
 
-        Ok(Self {
+        let layout = Self {
             peb_offset,
             stack_size: stack_size_rounded,
             heap_size,
+            initial_heap_size,
+            shared_data_size,
             peb_security_cookie_seed_offset,
             peb_guest_dispatch_function_ptr_offset,
             peb_host_function_definitions_offset,
@@ -406,6 +435,7 @@ impl SandboxMemoryLayout {
             peb_guest_panic_context_offset,
             peb_heap_data_offset,
             peb_guest_stack_data_offset,
+            peb_shared_data_offset,
             guest_error_buffer_offset,
             sandbox_memory_config: cfg,
             code_size,
@@ -425,7 +455,10 @@ impl SandboxMemoryLayout {
             kernel_stack_guard_page_offset,
             kernel_stack_size_rounded,
             boot_stack_buffer_offset,
-        })
+        };
+        // Make sure the shared data fits in the address space
+        layout.get_shared_data_guest_address()?;
+        Ok(layout)
     }
 
     /// Gets the offset in guest memory to the RunMode field in the PEB struct.
@@ -565,7 +598,7 @@ impl SandboxMemoryLayout {
 
     /// Get the offset in guest memory to the heap size
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
-    fn get_heap_size_offset(&self) -> usize {
+    pub(super) fn get_heap_size_offset(&self) -> usize {
         self.peb_heap_data_offset
     }
 
@@ -577,6 +610,12 @@ impl SandboxMemoryLayout {
         self.get_heap_size_offset() + size_of::<u64>()
     }
 
+    /// Get the offset in guest memory to the start of the heap
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_guest_heap_buffer_offset(&self) -> usize {
+        self.guest_heap_buffer_offset
+    }
+
     /// Get the offset to the top of the stack in guest memory
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
     pub(super) fn get_top_of_user_stack_offset(&self) -> usize {
@@ -688,30 +727,94 @@ impl SandboxMemoryLayout {
         self.boot_stack_buffer_offset
     }
 
-    #[cfg(test)]
-    /// Get the page table size
-    fn get_page_table_size(&self) -> usize {
+    /// Get the size of the area at the start of the sandbox's memory
+    /// that the page tables are written to
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_page_table_size(&self) -> usize {
         self.total_page_table_size
     }
 
+    /// Get the amount of guest address space `cfg` reserves for shared
+    /// data regions, which is mapped in whole 2MB pages
+    fn get_shared_data_size(cfg: SandboxConfiguration) -> Result<usize> {
+        let size = usize::try_from(cfg.get_shared_data_size())?;
+        if size > Self::MAX_MEMORY_SIZE {
+            log_then_return!(MemoryRequestTooBig(size, Self::MAX_MEMORY_SIZE));
+        }
+        Ok(size.next_multiple_of(AMOUNT_OF_MEMORY_PER_PT))
+    }
+
+    /// Get the number of Page Directories that map the shared data
+    /// regions, i.e. one for every 1GB of address space reserved for them
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_shared_data_page_directory_count(&self) -> usize {
+        self.shared_data_size.div_ceil(AMOUNT_OF_MEMORY_PER_PD)
+    }
+
+    /// Get the offset in the sandbox's memory of the Page Directories that
+    /// map the shared data regions, which are the last pages of the page
+    /// tables
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_shared_data_page_directory_offset(&self) -> usize {
+        self.total_page_table_size - self.get_shared_data_page_directory_count() * PAGE_SIZE_USIZE
+    }
+
+    /// Get the guest address the space reserved for shared data regions
+    /// starts at: the first 1GB boundary after the sandbox's memory, so
+    /// that the shared data has Page Directories of its own
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_shared_data_guest_address(&self) -> Result<usize> {
+        let address = (Self::BASE_ADDRESS + self.get_memory_size()?)
+            .next_multiple_of(AMOUNT_OF_MEMORY_PER_PD);
+        let end = address + self.shared_data_size;
+        // The single PDPT maps the first 512GB of the address space
+        if self.shared_data_size > 0 && end > 512 * AMOUNT_OF_MEMORY_PER_PD {
+            log_then_return!(MemoryRequestTooBig(
+                end - Self::BASE_ADDRESS,
+                Self::MAX_MEMORY_SIZE
+            ));
+        }
+        Ok(address)
+    }
+
+    /// Get the offset in guest memory to the number of shared data
+    /// regions in the PEB
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_shared_data_count_offset(&self) -> usize {
+        self.peb_shared_data_offset + offset_of!(GuestSharedData, sharedDataCount)
+    }
+
+    /// Get the offset in guest memory to the PEB entry of shared data
+    /// region `index`
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn get_shared_data_region_offset(&self, index: usize) -> usize {
+        self.peb_shared_data_offset
+            + offset_of!(GuestSharedData, sharedDataRegions)
+            + index * size_of::<SharedDataRegion>()
+    }
+
+    /// Get the number of Page Directories needed to map a sandbox with
+    /// `mem_size` bytes of memory, i.e. one for every 1GB of the address
+    /// space up to the end of the sandbox's memory
+    pub(super) fn get_page_directory_count(mem_size: usize) -> usize {
+        (Self::BASE_ADDRESS + mem_size).div_ceil(AMOUNT_OF_MEMORY_PER_PD)
+    }
+
     // This function calculates the page table size for the sandbox
-    // We need enough memory to store the PML4, PDPT, PD and PTs
-    // The size of a single table is 4K, we can map up to 1GB total memory which requires 1 PML4, 1 PDPT, 1 PD and 512 PTs
-    // but we only need enough PTs to map the memory we are using. (In other words we only need 512 PTs to map the memory if the memory size is 1GB)
+    // We need enough memory to store the PML4, the PDPT, a PD for every 1GB of memory, and the PTs
+    // Each PD entry maps 2MB, either with a PT of 4K pages or, for 2MB of memory that is all heap,
+    // directly as a 2MB page (see `SandboxMemoryManager::set_up_shared_memory`), so we need a PT
+    // for every 2MB of memory apart from the 2MB below 0x200_000 (which is not mapped) and the heap.
     //
-    // Because we always start the physical address space at 0x200_000
-    // we can calculate the amount of memory needed for the PTs by calculating how much memory is needed for the sandbox configuration in total,
-    // then add 0x200_000 to that (as we start at 0x200_000),
-    // and then add 3 * 4K (for the PML4, PDPT and PD)  to that,
-    // then add 2MB to that (the maximum size of memory required for the PTs themselves is 2MB when we map 1GB of memory in 4K pages),
-    // then divide that by 0x200_000 (as we can map 2MB in each PT) and then round the result up by 1 .
-    // This will give us the total size of the PTs required for the sandbox to which we can add the size of the PML4, PDPT and PD.
+    // The page tables are part of the memory they map, so their size is found by starting from no
+    // page tables and growing them until they are big enough to map themselves and everything else.
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
     fn get_total_page_table_size(
         cfg: SandboxConfiguration,
         code_size: usize,
         stack_size: usize,
         heap_size: usize,
+        shared_data_size: usize,
     ) -> usize {
         // Get the configured memory size (assume each section is 4K aligned)
 
@@ -727,24 +830,30 @@ impl SandboxMemoryLayout {
         total_mapped_memory_size +=
             round_up_to(cfg.get_guest_panic_context_buffer_size(), PAGE_SIZE_USIZE);
         total_mapped_memory_size += round_up_to(size_of::<HyperlightPEB>(), PAGE_SIZE_USIZE);
-
-        // Add the base address of the sandbox
-        total_mapped_memory_size += Self::BASE_ADDRESS;
-
-        // Add the size of  the PML4, PDPT and PD
-        total_mapped_memory_size += 3 * PAGE_SIZE_USIZE;
-
-        // Add the maximum possible size of the PTs
-        total_mapped_memory_size += 512 * PAGE_SIZE_USIZE;
-
-        // Get the number of pages needed for the PTs
-
-        let num_pages: usize = ((total_mapped_memory_size + AMOUNT_OF_MEMORY_PER_PT - 1)
-            / AMOUNT_OF_MEMORY_PER_PT)
-            + 1 // Round up
-            + 3; // PML4, PDPT, PD
-
-        num_pages * PAGE_SIZE_USIZE
+        total_mapped_memory_size += round_up_to(cfg.get_kernel_stack_size(), PAGE_SIZE_USIZE);
+
+        // Add the guard pages and the boot stack
+        total_mapped_memory_size += 4 * PAGE_SIZE_USIZE;
+
+        // An area of the heap contains at least this many whole, 2MB aligned, 2MB pages
+        let heap_large_pages = (heap_size / AMOUNT_OF_MEMORY_PER_PT).saturating_sub(1);
+        // The shared data regions, which are mapped in 2MB pages, have PDs of their own
+        let shared_data_pds = shared_data_size.div_ceil(AMOUNT_OF_MEMORY_PER_PD);
+
+        let mut page_table_size = 0;
+        loop {
+            let mem_size = total_mapped_memory_size + page_table_size;
+            let num_pds = Self::get_page_directory_count(mem_size);
+            let num_pts = (Self::BASE_ADDRESS + mem_size).div_ceil(AMOUNT_OF_MEMORY_PER_PT)
+                - 1 // Below 0x200_000
+                - heap_large_pages
+                + 1; // Slack for the rounding of the sections to page boundaries
+            let size = (2 + num_pds + num_pts + shared_data_pds) * PAGE_SIZE_USIZE; // PML4, PDPT, PDs, PTs, shared data PDs
+            if size <= page_table_size {
+                return page_table_size;
+            }
+            page_table_size = size;
+        }
     }
 
     /// Get the total size of guest memory in `self`'s memory
@@ -1181,7 +1290,10 @@ impl SandboxMemoryLayout {
 
         // Set up heap buffer pointer
         let addr = get_address!(guest_heap_buffer);
-        shared_mem.write_u64(self.get_heap_size_offset(), self.heap_size.try_into()?)?;
+        shared_mem.write_u64(
+            self.get_heap_size_offset(),
+            self.initial_heap_size.try_into()?,
+        )?;
         shared_mem.write_u64(self.get_heap_pointer_offset(), addr)?;
 
         // Set up user stack pointers
@@ -1235,6 +1347,9 @@ impl SandboxMemoryLayout {
 
         shared_mem.write_u64(self.get_boot_stack_pointer_offset(), start_of_boot_stack)?;
 
+        // No shared data regions are mapped yet
+        shared_mem.write_u64(self.get_shared_data_count_offset(), 0)?;
+
         // End of setting up the PEB
 
         // Initialize the stack pointers of input data and output data
@@ -153,6 +153,8 @@ pub enum MemoryRegionType {
     KernelStack,
     /// The region contains the Boot Stack
     BootStack,
+    /// The region contains read-only data shared with other sandboxes
+    SharedData,
 }
 
 /// represents a single memory region inside the guest. All memory within a region has
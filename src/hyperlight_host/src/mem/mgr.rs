@@ -14,8 +14,12 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
-use core::mem::size_of;
+use core::mem::{offset_of, size_of};
 use std::cmp::Ordering;
+use std::fs::File;
+use std::io::{BufWriter, Seek, SeekFrom, Write};
+use std::ops::Range;
+use std::path::Path;
 use std::str::from_utf8;
 use std::sync::{Arc, Mutex};
 
@@ -26,6 +30,10 @@ use hyperlight_common::flatbuffer_wrappers::function_types::ReturnValue;
 use hyperlight_common::flatbuffer_wrappers::guest_error::{ErrorCode, GuestError};
 use hyperlight_common::flatbuffer_wrappers::guest_log_data::GuestLogData;
 use hyperlight_common::flatbuffer_wrappers::host_function_details::HostFunctionDetails;
+use hyperlight_common::mem::{
+    SharedDataRegion, MAX_SHARED_DATA_REGIONS, PAGE_SIZE_USIZE, SHARED_DATA_NAME_LEN,
+    SHARED_DATA_WRITABLE,
+};
 use serde_json::from_str;
 use tracing::{instrument, Span};
 
@@ -36,14 +44,17 @@ use super::loaded_lib::LoadedLib;
 use super::memory_region::{MemoryRegion, MemoryRegionType};
 use super::ptr::{GuestPtr, RawPtr};
 use super::ptr_offset::Offset;
+use super::resident::resident_bytes;
+use super::shared_data::{MappedSharedData, SharedData};
 use super::shared_mem::{ExclusiveSharedMemory, GuestSharedMemory, HostSharedMemory, SharedMemory};
 use super::shared_mem_snapshot::SharedMemorySnapshot;
+use super::snapshot_file::{SnapshotFileHeader, SNAPSHOT_IMAGE_OFFSET};
 use crate::error::HyperlightError::{
     ExceptionDataLengthIncorrect, ExceptionMessageTooBig, JsonConversionFailure, NoMemorySnapshot,
-    UTF8SliceConversionFailure,
+    SnapshotFileInvalid, UTF8SliceConversionFailure,
 };
 use crate::error::HyperlightHostError;
-use crate::sandbox::SandboxConfiguration;
+use crate::sandbox::{MemoryFootprint, SandboxConfiguration};
 use crate::{log_then_return, new_error, HyperlightError, Result};
 
 /// Paging Flags
@@ -56,9 +67,12 @@ const PAGE_PRESENT: u64 = 1; // Page is Present
 const PAGE_RW: u64 = 1 << 1; // Page is Read/Write (if not set page is read only so long as the WP bit in CR0 is set to 1 - which it is in Hyperlight)
 const PAGE_USER: u64 = 1 << 2; // User/Supervisor (if this bit is set then the page is accessible by user mode code)
 const PAGE_NX: u64 = 1 << 63; // Execute Disable (if this bit is set then data in the page cannot be executed)
+const PAGE_LARGE: u64 = 1 << 7; // Page Size (if this bit is set in a PDE then it maps a 2MB page rather than pointing to a PT)
 
 // The amount of memory that can be mapped per page table
 pub(super) const AMOUNT_OF_MEMORY_PER_PT: usize = 0x200000;
+// The amount of memory that can be mapped per page directory
+pub(super) const AMOUNT_OF_MEMORY_PER_PD: usize = 0x40000000;
 /// Read/write permissions flag for the 64-bit PDE
 /// The page size for the 64-bit PDE
 /// The size of stack guard cookies
@@ -81,6 +95,14 @@ pub(crate) struct SandboxMemoryManager<S> {
     /// A vector of memory snapshots that can be used to save and  restore the state of the memory
     /// This is used by the Rust Sandbox implementation (rather than the mem_snapshot field above which only exists to support current C API)
     snapshots: Arc<Mutex<Vec<SharedMemorySnapshot>>>,
+    /// The read-only shared data regions mapped into the sandbox, which
+    /// live outside of `shared_mem`
+    pub(crate) shared_data: Vec<MappedSharedData>,
+    /// The snapshot file `shared_mem` was loaded from, if any. The first
+    /// snapshot is mapped from it rather than copied, so that the image is
+    /// still only read as it is used.
+    #[cfg(target_os = "linux")]
+    image_file: Option<Arc<File>>,
     /// This field must be present, even though it's not read,
     /// so that its underlying resources are properly dropped at
     /// the right time.
@@ -109,6 +131,9 @@ where
             load_addr,
             entrypoint_offset,
             snapshots: Arc::new(Mutex::new(Vec::new())),
+            shared_data: Vec::new(),
+            #[cfg(target_os = "linux")]
+            image_file: None,
             #[cfg(target_os = "windows")]
             _lib: lib,
         }
@@ -152,6 +177,13 @@ where
             + self.layout.stack_size as u64
             - 0x28;
 
+        let mem_size = usize::try_from(mem_size)?;
+        // The PTs must stop short of the PDs for the shared data, which are
+        // the last pages of the page tables
+        let page_table_size = self.layout.get_shared_data_page_directory_offset();
+        let shared_data_address = self.layout.get_shared_data_guest_address()?;
+        let shared_data_pds = self.layout.get_shared_data_page_directory_count();
+        let shared_data = &self.shared_data;
         self.shared_mem.with_exclusivity(|shared_mem| {
             // Create PDL4 table with only 1 PML4E
             shared_mem.write_u64(
@@ -159,79 +191,84 @@ where
                 SandboxMemoryLayout::PDPT_GUEST_ADDRESS as u64 | PAGE_PRESENT | PAGE_RW,
             )?;
 
-            // Create PDPT with only 1 PDPTE
-            shared_mem.write_u64(
-                SandboxMemoryLayout::PDPT_OFFSET,
-                SandboxMemoryLayout::PD_GUEST_ADDRESS as u64 | PAGE_PRESENT | PAGE_RW,
-            )?;
-
-            for i in 0..512 {
-                let offset = SandboxMemoryLayout::PD_OFFSET + (i * 8);
-                let val_to_write: u64 = (SandboxMemoryLayout::PT_GUEST_ADDRESS as u64
-                    + (i * 4096) as u64)
-                    | PAGE_PRESENT
-                    | PAGE_RW;
-                shared_mem.write_u64(offset, val_to_write)?;
+            // Create the PDPT with one PDPTE for each 1GB of memory. The PDs
+            // are contiguous, so PDE `p` of the whole set maps the 2MB of
+            // memory starting at `p << 21`.
+            let num_pds = SandboxMemoryLayout::get_page_directory_count(mem_size);
+            for pd in 0..num_pds {
+                shared_mem.write_u64(
+                    SandboxMemoryLayout::PDPT_OFFSET + (pd * 8),
+                    (SandboxMemoryLayout::PD_GUEST_ADDRESS + (pd * PAGE_SIZE_USIZE)) as u64
+                        | PAGE_PRESENT
+                        | PAGE_RW,
+                )?;
             }
 
-            // We only need to create enough PTEs to map the amount of memory we have
-            // We need one PT for every 2MB of memory that is mapped
-            // We can use the memory size to calculate the number of PTs we need
-            // We round up mem_size/2MB and then we need to add 1 as we start our memory mapping at 0x200000
-
-            let mem_size = usize::try_from(mem_size)?;
+            // We only need to create enough PDEs to map the amount of memory we have.
+            // The first 2MB is not mapped at all, as our memory mapping starts at 0x200000.
+            // 2MB that is all heap is mapped with a single 2MB page, which keeps the page
+            // tables small for large heaps and saves TLB entries; the rest of memory is
+            // mapped in 4K pages, with a PT for every 2MB.
+            let num_pdes =
+                (SandboxMemoryLayout::BASE_ADDRESS + mem_size).div_ceil(AMOUNT_OF_MEMORY_PER_PT);
+            let mut pt_offset = SandboxMemoryLayout::PD_OFFSET + (num_pds * PAGE_SIZE_USIZE);
+            for p in 1..num_pdes {
+                let pde_offset = SandboxMemoryLayout::PD_OFFSET + (p * 8);
+                let pde_addr = p * AMOUNT_OF_MEMORY_PER_PT;
+
+                if Self::is_all_heap(pde_addr, regions) {
+                    let flags = Self::get_page_flags(MemoryRegionType::Heap);
+                    shared_mem.write_u64(pde_offset, pde_addr as u64 | flags | PAGE_LARGE)?;
+                    continue;
+                }
 
-            let num_pages: usize =
-                ((mem_size + AMOUNT_OF_MEMORY_PER_PT - 1) / AMOUNT_OF_MEMORY_PER_PT) + 1;
+                if pt_offset + PAGE_SIZE_USIZE > page_table_size {
+                    log_then_return!(
+                        "The page tables for {:#x} bytes of memory do not fit in {:#x} bytes",
+                        mem_size,
+                        page_table_size
+                    );
+                }
+                shared_mem.write_u64(
+                    pde_offset,
+                    (SandboxMemoryLayout::BASE_ADDRESS + pt_offset) as u64 | PAGE_PRESENT | PAGE_RW,
+                )?;
 
-            // Create num_pages PT with 512 PTEs
-            for p in 0..num_pages {
+                // Create a PT with 512 PTEs, each of which maps a 4KB page
                 for i in 0..512 {
-                    let offset = SandboxMemoryLayout::PT_OFFSET + (p * 4096) + (i * 8);
-                    // Each PTE maps a 4KB page
-                    let val_to_write = if p == 0 {
-                        (p << 21) as u64 | (i << 12) as u64
-                    } else {
-                        let flags = match Self::get_page_flags(p, i, regions) {
-                            Ok(region_type) => match region_type {
-                                // TODO: We parse and load the exe according to its sections and then
-                                // have the correct flags set rather than just marking the entire binary as executable
-                                MemoryRegionType::Code => PAGE_PRESENT | PAGE_RW | PAGE_USER,
-                                MemoryRegionType::Stack => {
-                                    PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_NX
-                                }
-                                #[cfg(feature = "executable_heap")]
-                                MemoryRegionType::Heap => PAGE_PRESENT | PAGE_RW | PAGE_USER,
-                                #[cfg(not(feature = "executable_heap"))]
-                                MemoryRegionType::Heap => {
-                                    PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_NX
-                                }
-                                // The guard page is marked RW and User so that if it gets written to we can detect it in the host
-                                // If/When we implement an interrupt handler for page faults in the guest then we can remove this access and handle things properly there
-                                MemoryRegionType::GuardPage => {
-                                    PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_NX
-                                }
-                                MemoryRegionType::InputData => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                                MemoryRegionType::OutputData => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                                MemoryRegionType::Peb => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                                // Host Function Definitions are readonly in the guest
-                                MemoryRegionType::HostFunctionDefinitions => PAGE_PRESENT | PAGE_NX,
-                                MemoryRegionType::PanicContext => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                                MemoryRegionType::GuestErrorData => {
-                                    PAGE_PRESENT | PAGE_RW | PAGE_NX
-                                }
-                                // Host Exception Data are readonly in the guest
-                                MemoryRegionType::HostExceptionData => PAGE_PRESENT | PAGE_NX,
-                                MemoryRegionType::PageTables => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                                MemoryRegionType::KernelStack => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                                MemoryRegionType::BootStack => PAGE_PRESENT | PAGE_RW | PAGE_NX,
-                            },
-                            // If there is an error then the address isn't mapped so mark it as not present
-                            Err(_) => 0,
-                        };
-                        ((p << 21) as u64 | (i << 12) as u64) | flags
+                    let addr = pde_addr + (i << 12);
+                    let flags = match Self::find_region(addr, regions) {
+                        Some(region) => Self::get_page_flags(region.region_type),
+                        // If there is no region then the address isn't mapped so mark it as not present
+                        None => 0,
                     };
-                    shared_mem.write_u64(offset, val_to_write)?;
+                    shared_mem.write_u64(pt_offset + (i * 8), addr as u64 | flags)?;
+                }
+                pt_offset += PAGE_SIZE_USIZE;
+            }
+
+            // The space reserved for shared data starts on a 1GB boundary and
+            // has PDs of its own, so none of the PDEs above are shared with it.
+            // Every mapped region is 2MB aligned and is mapped in 2MB pages.
+            for pd in 0..shared_data_pds {
+                let pd_offset = page_table_size + (pd * PAGE_SIZE_USIZE);
+                shared_mem.write_u64(
+                    SandboxMemoryLayout::PDPT_OFFSET
+                        + ((shared_data_address / AMOUNT_OF_MEMORY_PER_PD + pd) * 8),
+                    (SandboxMemoryLayout::BASE_ADDRESS + pd_offset) as u64 | PAGE_PRESENT | PAGE_RW,
+                )?;
+            }
+            for mapped in shared_data {
+                let mut flags = Self::get_page_flags(MemoryRegionType::SharedData);
+                // Channels are written to by the guests at either end
+                if mapped.data.is_writable() {
+                    flags |= PAGE_RW;
+                }
+                let region = mapped.data.memory_region(mapped.guest_address);
+                for addr in region.guest_region.step_by(AMOUNT_OF_MEMORY_PER_PT) {
+                    let p = (addr - shared_data_address) / AMOUNT_OF_MEMORY_PER_PT;
+                    shared_mem
+                        .write_u64(page_table_size + (p * 8), addr as u64 | flags | PAGE_LARGE)?;
                 }
             }
             Ok::<(), HyperlightError>(())
@@ -240,29 +277,62 @@ where
         Ok(rsp)
     }
 
-    fn get_page_flags(
-        p: usize,
-        i: usize,
-        regions: &mut [MemoryRegion],
-    ) -> Result<MemoryRegionType> {
-        let addr = (p << 21) + (i << 12);
-
-        let idx = regions.binary_search_by(|region| {
-            if region.guest_region.contains(&addr) {
-                std::cmp::Ordering::Equal
-            } else if region.guest_region.start > addr {
-                std::cmp::Ordering::Greater
-            } else {
-                std::cmp::Ordering::Less
-            }
-        });
-
-        match idx {
-            Ok(index) => Ok(regions[index].region_type),
-            Err(_) => Err(new_error!("Could not find region for address: {}", addr)),
+    /// Get the page table flags for memory of type `region_type`
+    fn get_page_flags(region_type: MemoryRegionType) -> u64 {
+        match region_type {
+            // TODO: We parse and load the exe according to its sections and then
+            // have the correct flags set rather than just marking the entire binary as executable
+            MemoryRegionType::Code => PAGE_PRESENT | PAGE_RW | PAGE_USER,
+            MemoryRegionType::Stack => PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_NX,
+            #[cfg(feature = "executable_heap")]
+            MemoryRegionType::Heap => PAGE_PRESENT | PAGE_RW | PAGE_USER,
+            #[cfg(not(feature = "executable_heap"))]
+            MemoryRegionType::Heap => PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_NX,
+            // The guard page is marked RW and User so that if it gets written to we can detect it in the host
+            // If/When we implement an interrupt handler for page faults in the guest then we can remove this access and handle things properly there
+            MemoryRegionType::GuardPage => PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_NX,
+            MemoryRegionType::InputData => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            MemoryRegionType::OutputData => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            MemoryRegionType::Peb => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            // Host Function Definitions are readonly in the guest
+            MemoryRegionType::HostFunctionDefinitions => PAGE_PRESENT | PAGE_NX,
+            MemoryRegionType::PanicContext => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            MemoryRegionType::GuestErrorData => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            // Host Exception Data are readonly in the guest
+            MemoryRegionType::HostExceptionData => PAGE_PRESENT | PAGE_NX,
+            MemoryRegionType::PageTables => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            MemoryRegionType::KernelStack => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            MemoryRegionType::BootStack => PAGE_PRESENT | PAGE_RW | PAGE_NX,
+            // Shared data is readonly in the guest, as other sandboxes map it too
+            MemoryRegionType::SharedData => PAGE_PRESENT | PAGE_USER | PAGE_NX,
         }
     }
 
+    /// Find the region containing guest address `addr`
+    fn find_region(addr: usize, regions: &[MemoryRegion]) -> Option<&MemoryRegion> {
+        regions
+            .binary_search_by(|region| {
+                if region.guest_region.contains(&addr) {
+                    std::cmp::Ordering::Equal
+                } else if region.guest_region.start > addr {
+                    std::cmp::Ordering::Greater
+                } else {
+                    std::cmp::Ordering::Less
+                }
+            })
+            .ok()
+            .map(|index| &regions[index])
+    }
+
+    /// Whether all of the 2MB of memory starting at guest address `addr`
+    /// is heap
+    fn is_all_heap(addr: usize, regions: &[MemoryRegion]) -> bool {
+        Self::find_region(addr, regions).is_some_and(|region| {
+            region.region_type == MemoryRegionType::Heap
+                && region.guest_region.end >= addr + AMOUNT_OF_MEMORY_PER_PT
+        })
+    }
+
     /// Get the process environment block (PEB) address assuming `start_addr`
     /// is the address of the start of memory, using the given
     /// `SandboxMemoryLayout` to calculate the address.
@@ -276,10 +346,49 @@ where
         Ok(start_addr + self.layout.get_in_process_peb_offset() as u64)
     }
 
+    /// The number of vCPUs this sandbox's VM should be created with
+    pub(crate) fn get_vcpu_count(&self) -> u32 {
+        self.layout.sandbox_memory_config.get_vcpu_count()
+    }
+
+    /// The NUMA node this sandbox's memory is bound to, if any
+    #[cfg(target_os = "linux")]
+    pub(crate) fn get_numa_node(&self) -> Option<u32> {
+        self.layout.sandbox_memory_config.get_numa_node()
+    }
+
+    /// The NUMA node whose CPUs the thread running this sandbox's vCPU
+    /// should be pinned to, if any
+    #[cfg(target_os = "linux")]
+    pub(crate) fn get_vcpu_numa_node(&self) -> Option<u32> {
+        self.layout.sandbox_memory_config.get_vcpu_numa_node()
+    }
+
     /// this function will create a memory snapshot and push it onto the stack of snapshots
     /// It should be used when you want to save the state of the memory, for example, when evolving a sandbox to a new state
     pub(crate) fn push_state(&mut self) -> Result<()> {
-        let snapshot = SharedMemorySnapshot::new(&mut self.shared_mem)?;
+        let unused = self.unused_heap()?;
+        #[cfg(target_os = "linux")]
+        if let Some(file) = self.image_file.take() {
+            let snapshot = SharedMemorySnapshot::from_file(
+                &mut self.shared_mem,
+                unused,
+                &file,
+                SNAPSHOT_IMAGE_OFFSET,
+                self.get_numa_node(),
+            )?;
+            self.snapshots
+                .try_lock()
+                .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+                .push(snapshot);
+            return Ok(());
+        }
+        let snapshot = SharedMemorySnapshot::new(
+            &mut self.shared_mem,
+            unused,
+            #[cfg(target_os = "linux")]
+            self.get_numa_node(),
+        )?;
         self.snapshots
             .try_lock()
             .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
@@ -287,11 +396,55 @@ where
         Ok(())
     }
 
+    /// Measure how much of this sandbox's memory, and of the snapshots its
+    /// memory is restored from, is resident in physical memory. The
+    /// `handler_thread_stack` of the result is left at 0.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn memory_footprint(&self) -> Result<MemoryFootprint> {
+        let base = self.shared_mem.base_ptr();
+        let resident_at = |offset: usize, len: usize| {
+            resident_bytes(
+                base.wrapping_add(offset),
+                len.min(self.shared_mem.mem_size().saturating_sub(offset)),
+            )
+        };
+        let config = &self.layout.sandbox_memory_config;
+
+        let mut snapshots = 0;
+        for snapshot in self
+            .snapshots
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+            .iter()
+        {
+            snapshots += snapshot.resident_size()?;
+        }
+
+        Ok(MemoryFootprint {
+            guest_memory_size: self.shared_mem.mem_size(),
+            guest_memory: resident_at(0, self.shared_mem.mem_size())?,
+            page_tables: resident_at(
+                SandboxMemoryLayout::PML4_OFFSET,
+                self.layout.get_page_table_size(),
+            )?,
+            io_buffers: resident_at(
+                self.layout.input_data_buffer_offset,
+                config.get_input_data_size(),
+            )? + resident_at(
+                self.layout.output_data_buffer_offset,
+                config.get_output_data_size(),
+            )?,
+            snapshots,
+            handler_thread_stack: 0,
+        })
+    }
+
     /// this function restores a memory snapshot from the last snapshot in the list but does not pop the snapshot
     /// off the stack
     /// It should be used when you want to restore the state of the memory to a previous state but still want to
     /// retain that state, for example after calling a function in the guest
     pub(crate) fn restore_state_from_last_snapshot(&mut self) -> Result<()> {
+        let in_use_end = self.unused_heap()?.start;
         let mut snapshots = self
             .snapshots
             .try_lock()
@@ -302,7 +455,7 @@ where
         }
         #[allow(clippy::unwrap_used)] // We know that last is not None because we checked it above
         let snapshot = last.unwrap();
-        snapshot.restore_from_snapshot(&mut self.shared_mem)
+        snapshot.restore_from_snapshot(&mut self.shared_mem, in_use_end)
     }
 
     /// this function pops the last snapshot off the stack and restores the memory to the previous state
@@ -320,6 +473,21 @@ where
         self.restore_state_from_last_snapshot()
     }
 
+    /// The part of the memory reserved for the guest heap that the heap
+    /// has not grown into (according to the size in the PEB), which is
+    /// left out of snapshots. Empty unless the heap can grow.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    fn unused_heap(&mut self) -> Result<Range<usize>> {
+        let heap_offset = self.layout.get_guest_heap_buffer_offset();
+        let heap_size_offset = self.layout.get_heap_size_offset();
+        let in_use = self
+            .shared_mem
+            .with_exclusivity(|e| e.read_u64(heap_size_offset))??;
+        let in_use = usize::try_from(in_use)?.min(self.layout.heap_size);
+        Ok((heap_offset + in_use).next_multiple_of(PAGE_SIZE_USIZE)
+            ..(heap_offset + self.layout.heap_size).next_multiple_of(PAGE_SIZE_USIZE))
+    }
+
     /// Sets `addr` to the correct offset in the memory referenced by
     /// `shared_mem` to indicate the address of the outb pointer and context
     /// for calling outb function
@@ -357,6 +525,12 @@ where
         usize::try_from(cfg.get_heap_size(exe_info))?,
     )?;
     let mut shared_mem = ExclusiveSharedMemory::new(layout.get_memory_size()?)?;
+    // Bind before anything is written, so that no page is first allocated
+    // on the wrong node
+    #[cfg(target_os = "linux")]
+    if let Some(node) = cfg.get_numa_node() {
+        shared_mem.bind_to_numa_node(node)?;
+    }
 
     let load_addr: RawPtr = load_addr_fn(&shared_mem, &layout)?;
 
@@ -517,6 +691,147 @@ impl SandboxMemoryManager<ExclusiveSharedMemory> {
         self.shared_mem.copy_from_slice(cookie, stack_offset)
     }
 
+    /// Load the memory image of an initialised sandbox from the snapshot
+    /// file at `path`, previously written by `write_snapshot_file`.
+    ///
+    /// On Linux the image is mapped copy-on-write, so loading costs only
+    /// the page faults for the pages the guest (or host) actually touches.
+    /// The snapshot guest calls are reset to is another mapping of the
+    /// same image (see `push_state`), so it does not read the image
+    /// either.
+    ///
+    /// Returns the new manager, together with the stack cookie that was
+    /// written into the image when the original sandbox was created.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn load_snapshot_file(
+        path: &Path,
+        cfg: SandboxConfiguration,
+    ) -> Result<(Self, [u8; STACK_COOKIE_LEN])> {
+        let mut file = File::open(path)?;
+        let header = SnapshotFileHeader::read_from(&mut file)?;
+        let layout = header.layout(cfg)?;
+
+        let mem_size = usize::try_from(header.mem_size)?;
+        let file_len = file.metadata()?.len();
+        if file_len < SNAPSHOT_IMAGE_OFFSET + header.mem_size {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "file is {:#x} bytes, but the memory image needs {:#x}",
+                file_len,
+                SNAPSHOT_IMAGE_OFFSET + header.mem_size
+            )));
+        }
+        let shared_mem = ExclusiveSharedMemory::from_file(&file, SNAPSHOT_IMAGE_OFFSET, mem_size)?;
+        // Pages the guest writes to are copied out of the page cache, and
+        // those copies are what gets bound
+        #[cfg(target_os = "linux")]
+        if let Some(node) = cfg.get_numa_node() {
+            shared_mem.bind_to_numa_node(node)?;
+        }
+
+        #[cfg_attr(target_os = "windows", allow(unused_mut))]
+        let mut mgr = Self::new(
+            layout,
+            shared_mem,
+            false,
+            RawPtr::from(header.load_addr),
+            Offset::from(header.entrypoint_offset),
+            #[cfg(target_os = "windows")]
+            None,
+        );
+        #[cfg(target_os = "linux")]
+        {
+            mgr.image_file = Some(Arc::new(file));
+        }
+        Ok((mgr, header.stack_cookie))
+    }
+
+    /// Map `data` into the guest, read-only unless it is a channel's
+    /// memory, and list it in the PEB under `name` so the guest can find
+    /// it. `channel_end` is `SHARED_DATA_CHANNEL_SENDER` or
+    /// `SHARED_DATA_CHANNEL_RECEIVER` for the end of a channel, and 0
+    /// otherwise; together with `SHARED_DATA_WRITABLE` for writable
+    /// memory, it is recorded in the PEB so that the guest can tell what
+    /// the region is.
+    ///
+    /// Shared data is mapped one region after another into the guest
+    /// address space reserved for it (see
+    /// `SandboxConfiguration::set_shared_data_size`), and stays mapped for
+    /// the life of the sandbox. It is not part of `shared_mem`, so it is
+    /// left out of snapshots.
+    #[instrument(err(Debug), skip(self, data), parent = Span::current(), level= "Trace")]
+    pub(crate) fn map_shared_data(
+        &mut self,
+        name: &str,
+        data: &SharedData,
+        channel_end: u64,
+    ) -> Result<()> {
+        if self.inprocess {
+            log_then_return!("Shared data is not supported for in-process sandboxes");
+        }
+        if name.is_empty() || name.len() > SHARED_DATA_NAME_LEN || name.contains('\0') {
+            log_then_return!(
+                "Shared data region names must be 1 to {} bytes long and must not contain NUL",
+                SHARED_DATA_NAME_LEN
+            );
+        }
+        if self.shared_data.len() >= MAX_SHARED_DATA_REGIONS {
+            log_then_return!(
+                "At most {} shared data regions can be mapped into a sandbox",
+                MAX_SHARED_DATA_REGIONS
+            );
+        }
+
+        let offset = self.layout.get_shared_data_count_offset();
+        let count = self.shared_data.len();
+        let mut used = 0;
+        for index in 0..count {
+            let entry = self.layout.get_shared_data_region_offset(index);
+            let entry_name = &self.shared_mem.as_slice()[entry..entry + SHARED_DATA_NAME_LEN];
+            if entry_name.split(|b| *b == 0).next() == Some(name.as_bytes()) {
+                log_then_return!("A shared data region named {} is already mapped", name);
+            }
+            used += self.shared_data[index].data.mapped_len();
+        }
+        if used + data.mapped_len() > self.layout.shared_data_size {
+            log_then_return!(
+                "Shared data of {:#x} bytes does not fit in the {:#x} bytes left of the space reserved for it",
+                data.len(),
+                self.layout.shared_data_size - used
+            );
+        }
+
+        let guest_address = self.layout.get_shared_data_guest_address()? + used;
+        let entry = self.layout.get_shared_data_region_offset(count);
+        let mut entry_name = [0u8; SHARED_DATA_NAME_LEN];
+        entry_name[..name.len()].copy_from_slice(name.as_bytes());
+        self.shared_mem.copy_from_slice(&entry_name, entry)?;
+        self.shared_mem.write_u64(
+            entry + offset_of!(SharedDataRegion, sharedDataSize),
+            u64::try_from(data.len())?,
+        )?;
+        self.shared_mem.write_u64(
+            entry + offset_of!(SharedDataRegion, sharedDataBuffer),
+            u64::try_from(guest_address)?,
+        )?;
+        let writable = if data.is_writable() {
+            SHARED_DATA_WRITABLE
+        } else {
+            0
+        };
+        self.shared_mem.write_u64(
+            entry + offset_of!(SharedDataRegion, sharedDataFlags),
+            writable | channel_end,
+        )?;
+        self.shared_mem
+            .write_u64(offset, u64::try_from(count + 1)?)?;
+
+        self.shared_data.push(MappedSharedData {
+            data: data.clone(),
+            guest_address,
+        });
+        Ok(())
+    }
+
     /// Wraps ExclusiveSharedMemory::build
     pub fn build(
         self,
@@ -533,6 +848,9 @@ impl SandboxMemoryManager<ExclusiveSharedMemory> {
                 load_addr: self.load_addr.clone(),
                 entrypoint_offset: self.entrypoint_offset,
                 snapshots: Arc::new(Mutex::new(Vec::new())),
+                shared_data: self.shared_data.clone(),
+                #[cfg(target_os = "linux")]
+                image_file: self.image_file,
                 #[cfg(target_os = "windows")]
                 _lib: self._lib,
             },
@@ -543,6 +861,9 @@ impl SandboxMemoryManager<ExclusiveSharedMemory> {
                 load_addr: self.load_addr.clone(),
                 entrypoint_offset: self.entrypoint_offset,
                 snapshots: Arc::new(Mutex::new(Vec::new())),
+                shared_data: self.shared_data,
+                #[cfg(target_os = "linux")]
+                image_file: None,
                 #[cfg(target_os = "windows")]
                 _lib: None,
             },
@@ -551,6 +872,32 @@ impl SandboxMemoryManager<ExclusiveSharedMemory> {
 }
 
 impl SandboxMemoryManager<HostSharedMemory> {
+    /// Grow the guest heap, which the guest's allocator asks for when it
+    /// runs out of memory, by at least `1 << min_growth_log2` bytes.
+    ///
+    /// The heap at least doubles, to keep the number of requests down,
+    /// but never grows past the size it was laid out with (see
+    /// `SandboxConfiguration::set_max_heap_size`); if it cannot grow at
+    /// all it is left as it is. The memory and page tables for the whole
+    /// heap are already in place, so growing it just means writing the new
+    /// size to the PEB, where the guest picks it up. Restoring a snapshot
+    /// restores the size along with the rest of the PEB.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn grow_heap(&mut self, min_growth_log2: u8) -> Result<()> {
+        let offset = self.layout.get_heap_size_offset();
+        let max_size = u64::try_from(self.layout.heap_size)?;
+        let size = self.shared_mem.read::<u64>(offset)?.min(max_size);
+        let min_growth = 1u64
+            .checked_shl(u32::from(min_growth_log2))
+            .unwrap_or(u64::MAX);
+        let new_size = size
+            .saturating_add(min_growth.max(size))
+            .min(max_size)
+            .next_multiple_of(PAGE_SIZE_USIZE as u64)
+            .min(max_size);
+        self.shared_mem.write::<u64>(offset, new_size)
+    }
+
     /// Check the stack guard of the memory in `shared_mem`, using
     /// `layout` to calculate its location.
     ///
@@ -571,6 +918,104 @@ impl SandboxMemoryManager<HostSharedMemory> {
         Ok(cmp_res == Ordering::Equal)
     }
 
+    /// Write the current memory image of this sandbox, along with what is
+    /// needed to rebuild its layout, to a new snapshot file at `path`.
+    ///
+    /// The image can only be used to resume an initialised sandbox, so
+    /// this must not be called while the guest is running. In-process
+    /// sandboxes embed host addresses in their memory and are rejected.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn write_snapshot_file(
+        &mut self,
+        path: &Path,
+        stack_cookie: [u8; STACK_COOKIE_LEN],
+    ) -> Result<()> {
+        if self.inprocess {
+            log_then_return!("Snapshot files are not supported for in-process sandboxes");
+        }
+        // The PEB and page tables of a sandbox with shared data refer to
+        // memory that is not part of the image
+        if !self.shared_data.is_empty() {
+            log_then_return!("Snapshot files are not supported for sandboxes with shared data");
+        }
+
+        let header = SnapshotFileHeader::new(
+            &self.layout,
+            u64::from(&self.load_addr),
+            u64::from(self.entrypoint_offset),
+            stack_cookie,
+        )?;
+
+        // The part of the heap the guest has not grown into is left out,
+        // as it is of snapshots, and so reads back as zeros
+        let unused = self.unused_heap()?;
+        let mut file = BufWriter::new(File::create(path)?);
+        header.write_to(&mut file)?;
+        self.shared_mem.with_exclusivity(|e| -> Result<()> {
+            let image = e.as_slice();
+            file.write_all(&image[..unused.start])?;
+            file.seek(SeekFrom::Current(i64::try_from(unused.len())?))?;
+            file.write_all(&image[unused.end..])?;
+            Ok(())
+        })??;
+        file.into_inner()
+            .map_err(|e| new_error!("Error flushing snapshot file: {}", e))?
+            .sync_all()?;
+        Ok(())
+    }
+
+    /// Create a new, independent memory manager whose memory starts out
+    /// as the last snapshot of `self`, i.e. the state guest calls in this
+    /// sandbox are reset to.
+    ///
+    /// The new memory is a copy-on-write view of the snapshot where the
+    /// platform supports it, and the new manager's snapshot stack starts
+    /// out with that same (shared) snapshot, so guest calls in it are reset
+    /// to the forked state.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn fork(&self) -> Result<SandboxMemoryManager<ExclusiveSharedMemory>> {
+        if self.inprocess {
+            log_then_return!("Forking is not supported for in-process sandboxes");
+        }
+        // The fork would have the same end of each channel as `self`, and
+        // there must only be one of each
+        if self
+            .shared_data
+            .iter()
+            .any(|mapped| mapped.data.is_writable())
+        {
+            log_then_return!("Forking is not supported for sandboxes with channels");
+        }
+
+        let mut snapshots = self
+            .snapshots
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+        let last = match snapshots.last_mut() {
+            Some(last) => last,
+            None => log_then_return!(NoMemorySnapshot),
+        };
+        let shared_mem = last.to_shared_memory()?;
+        #[cfg(target_os = "linux")]
+        if let Some(node) = self.get_numa_node() {
+            shared_mem.bind_to_numa_node(node)?;
+        }
+
+        Ok(SandboxMemoryManager {
+            shared_mem,
+            layout: self.layout,
+            inprocess: false,
+            load_addr: self.load_addr.clone(),
+            entrypoint_offset: self.entrypoint_offset,
+            snapshots: Arc::new(Mutex::new(vec![last.clone()])),
+            shared_data: self.shared_data.clone(),
+            #[cfg(target_os = "linux")]
+            image_file: None,
+            #[cfg(target_os = "windows")]
+            _lib: None,
+        })
+    }
+
     /// Get the address of the dispatch function in memory
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
     pub(crate) fn get_pointer_to_dispatch_function(&self) -> Result<u64> {
@@ -808,6 +1253,7 @@ impl SandboxMemoryManager<HostSharedMemory> {
 
 #[cfg(test)]
 mod tests {
+    use hyperlight_common::mem::PAGE_SIZE_USIZE;
     use hyperlight_testing::rust_guest_as_pathbuf;
     use serde_json::to_string;
     #[cfg(all(target_os = "windows", inprocess))]
@@ -819,7 +1265,7 @@ mod tests {
     use crate::mem::layout::SandboxMemoryLayout;
     use crate::mem::ptr::RawPtr;
     use crate::mem::ptr_offset::Offset;
-    use crate::mem::shared_mem::{ExclusiveSharedMemory, SharedMemory};
+    use crate::mem::shared_mem::{ExclusiveSharedMemory, HostSharedMemory, SharedMemory};
     use crate::sandbox::SandboxConfiguration;
     use crate::testing::bytes_for_path;
 
@@ -963,4 +1409,123 @@ mod tests {
         assert!(host_err_opt.is_some());
         assert_eq!(err, host_err_opt.unwrap());
     }
+
+    /// Walk the page tables in `hshm` to translate guest address `addr`,
+    /// returning the physical address and the flags of the final entry
+    fn translate(hshm: &HostSharedMemory, addr: usize) -> Option<(usize, u64)> {
+        const ADDR_MASK: u64 = 0x000f_ffff_ffff_f000;
+        let mut table = SandboxMemoryLayout::BASE_ADDRESS;
+        for (level, shift) in [39, 30, 21, 12].into_iter().enumerate() {
+            let index = (addr >> shift) & 0x1ff;
+            let entry: u64 = hshm
+                .read(table - SandboxMemoryLayout::BASE_ADDRESS + index * 8)
+                .unwrap();
+            if entry & super::PAGE_PRESENT == 0 {
+                return None;
+            }
+            if level == 3 || (level == 2 && entry & super::PAGE_LARGE != 0) {
+                let page_mask = (1usize << shift) - 1;
+                let phys = (entry & ADDR_MASK) as usize & !page_mask;
+                return Some((phys | (addr & page_mask), entry));
+            }
+            table = (entry & ADDR_MASK) as usize;
+        }
+        unreachable!()
+    }
+
+    #[test]
+    fn page_tables_map_more_than_1gb() {
+        const HEAP_SIZE: usize = 3 << 30;
+        let cfg = SandboxConfiguration::default();
+        let layout = SandboxMemoryLayout::new(cfg, 0x4000, 0x8000, HEAP_SIZE).unwrap();
+        let mem_size = layout.get_memory_size().unwrap();
+        assert!(mem_size > HEAP_SIZE);
+        // 2MB pages for the heap keep the page tables small
+        assert!(layout.get_page_table_size() < 32 * PAGE_SIZE_USIZE);
+
+        let (hshm, gshm) = ExclusiveSharedMemory::new(mem_size).unwrap().build();
+        let mut regions = layout.get_memory_regions(&gshm).unwrap();
+        let mut mgr = SandboxMemoryManager::new(
+            layout,
+            gshm,
+            false,
+            RawPtr::from(0),
+            Offset::from(0),
+            #[cfg(target_os = "windows")]
+            None,
+        );
+        mgr.set_up_shared_memory(mem_size as u64, &mut regions)
+            .unwrap();
+
+        // All mapped memory is identity mapped, whatever the page size
+        let base = SandboxMemoryLayout::BASE_ADDRESS;
+        for region in &regions {
+            let last = region.guest_region.end - 1;
+            for addr in [region.guest_region.start, last] {
+                let (phys, _) = translate(&hshm, addr).unwrap();
+                assert_eq!(addr, phys, "{:?}", region.region_type);
+            }
+        }
+        let (_, heap_entry) = translate(&hshm, base + mem_size / 2).unwrap();
+        assert_ne!(heap_entry & super::PAGE_LARGE, 0);
+        let (_, code_entry) = translate(&hshm, layout.get_guest_code_address()).unwrap();
+        assert_eq!(code_entry & super::PAGE_LARGE, 0);
+
+        // Nothing outside the sandbox's memory is mapped
+        assert!(translate(&hshm, 0).is_none());
+        assert!(translate(&hshm, base + mem_size).is_none());
+    }
+
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn shared_data_is_mapped_read_only() {
+        use crate::mem::shared_data::SharedData;
+
+        let mut cfg = SandboxConfiguration::default();
+        cfg.set_shared_data_size(4 << 20);
+        let layout = SandboxMemoryLayout::new(cfg, 0x4000, 0x8000, 0x10000).unwrap();
+        let mem_size = layout.get_memory_size().unwrap();
+        let shared_data_address = layout.get_shared_data_guest_address().unwrap();
+        assert_eq!(shared_data_address, 1 << 30);
+
+        let shared_mem = ExclusiveSharedMemory::new(mem_size).unwrap();
+        let mut mgr = SandboxMemoryManager::new(
+            layout,
+            shared_mem,
+            false,
+            RawPtr::from(0),
+            Offset::from(0),
+            #[cfg(target_os = "windows")]
+            None,
+        );
+        let small = SharedData::new(b"small").unwrap();
+        let large = SharedData::new(&vec![1; 3 << 20]).unwrap();
+        mgr.map_shared_data("small", &small, 0).unwrap();
+        assert!(mgr.map_shared_data("small", &small, 0).is_err());
+        assert!(mgr.map_shared_data("", &small, 0).is_err());
+        // 2MB + 4MB does not fit in the 4MB reserved
+        assert!(mgr.map_shared_data("large", &large, 0).is_err());
+        mgr.map_shared_data("other", &small, 0).unwrap();
+        assert!(mgr.map_shared_data("full", &small, 0).is_err());
+        assert_eq!(
+            2,
+            mgr.shared_mem
+                .read_u64(layout.get_shared_data_count_offset())
+                .unwrap()
+        );
+
+        let (hmgr, mut gmgr) = mgr.build();
+        let mut regions = layout.get_memory_regions(&gmgr.shared_mem).unwrap();
+        gmgr.set_up_shared_memory(mem_size as u64, &mut regions)
+            .unwrap();
+
+        for addr in [shared_data_address, shared_data_address + (3 << 20)] {
+            let (phys, entry) = translate(&hmgr.shared_mem, addr).unwrap();
+            assert_eq!(addr, phys);
+            assert_ne!(entry & super::PAGE_LARGE, 0);
+            assert_ne!(entry & super::PAGE_USER, 0);
+            assert_eq!(entry & super::PAGE_RW, 0);
+        }
+        assert!(translate(&hmgr.shared_mem, shared_data_address + (4 << 20)).is_none());
+    }
 }
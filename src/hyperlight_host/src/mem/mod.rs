@@ -14,6 +14,8 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+/// One-way channels of messages between sandboxes
+pub mod channel;
 /// Reusable structure to hold data and provide a `Drop` implementation
 #[cfg(inprocess)]
 pub(crate) mod custom_drop;
@@ -21,6 +23,8 @@ pub(crate) mod custom_drop;
 pub(crate) mod elf;
 /// A generic wrapper for executable files (PE, ELF, etc)
 pub(crate) mod exe;
+/// Read-only archives of files that can be mapped into many sandboxes
+pub mod fs_image;
 /// Functionality to establish a sandbox's memory layout.
 pub mod layout;
 /// Safe wrapper around an HINSTANCE created by the windows
@@ -32,6 +36,9 @@ pub mod memory_region;
 /// Functionality that wraps a `SandboxMemoryLayout` and a
 /// `SandboxMemoryConfig` to mutate a sandbox's memory as necessary.
 pub mod mgr;
+/// Binding memory and threads to NUMA nodes
+#[cfg(target_os = "linux")]
+pub(crate) mod numa;
 /// Functionality to read and mutate a PE file in a structured manner.
 pub(crate) mod pe;
 /// Structures to represent pointers into guest and host memory
@@ -41,12 +48,19 @@ pub mod ptr;
 pub(super) mod ptr_addr_space;
 /// Structures to represent an offset into a memory space
 pub mod ptr_offset;
+/// Measuring how much of a range of memory is resident
+pub(crate) mod resident;
+/// Read-only data that can be mapped into many sandboxes at once
+pub mod shared_data;
 /// A wrapper around unsafe functionality to create and initialize
 /// a memory region for a guest running in a sandbox.
 pub mod shared_mem;
 /// A wrapper around a `SharedMemory` and a snapshot in time
 /// of the memory therein
 pub mod shared_mem_snapshot;
+/// A versioned on-disk format for the memory image of an initialised
+/// sandbox
+pub(crate) mod snapshot_file;
 /// Utilities for writing shared memory tests
 #[cfg(test)]
 pub(crate) mod shared_mem_tests;
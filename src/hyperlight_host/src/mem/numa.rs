@@ -0,0 +1,159 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::io::Error;
+use std::mem::size_of;
+
+use hyperlight_common::mem::PAGE_SIZE_USIZE;
+use libc::{c_int, c_uint, c_ulong};
+use tracing::{instrument, Span};
+
+use crate::{log_then_return, new_error, Result};
+
+/// `MPOL_BIND` from `<linux/mempolicy.h>`: allocate only on the given nodes
+const MPOL_BIND: c_int = 2;
+/// `MPOL_MF_MOVE` from `<linux/mempolicy.h>`: migrate pages that are
+/// already allocated on other nodes
+const MPOL_MF_MOVE: c_uint = 1 << 1;
+
+/// Bind the memory in `[addr, addr + len)` to NUMA node `node`.
+///
+/// Pages not yet faulted in will be allocated on `node`, and pages
+/// already allocated elsewhere are migrated to it. Only the pages wholly
+/// inside the range are bound.
+#[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+pub(crate) fn bind_to_node(addr: *const u8, len: usize, node: u32) -> Result<()> {
+    let start = (addr as usize).next_multiple_of(PAGE_SIZE_USIZE);
+    let end = (addr as usize).saturating_add(len) / PAGE_SIZE_USIZE * PAGE_SIZE_USIZE;
+    if end <= start {
+        return Ok(());
+    }
+
+    let bits = c_ulong::BITS as usize;
+    let node = node as usize;
+    let mut nodemask: Vec<c_ulong> = vec![0; node / bits + 1];
+    nodemask[node / bits] |= 1 << (node % bits);
+
+    // The kernel ignores the last bit of `maxnode`, hence the + 1
+    let res = unsafe {
+        libc::syscall(
+            libc::SYS_mbind,
+            start,
+            end - start,
+            MPOL_BIND,
+            nodemask.as_ptr(),
+            nodemask.len() * bits + 1,
+            MPOL_MF_MOVE,
+        )
+    };
+    if res != 0 {
+        log_then_return!(
+            "Failed to bind memory to NUMA node {}: {}",
+            node,
+            Error::last_os_error()
+        );
+    }
+    Ok(())
+}
+
+/// Get the CPUs that belong to NUMA node `node`
+#[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+pub(crate) fn node_cpus(node: u32) -> Result<Vec<usize>> {
+    let path = format!("/sys/devices/system/node/node{}/cpulist", node);
+    let list = std::fs::read_to_string(&path)
+        .map_err(|e| new_error!("Failed to read the CPUs of NUMA node {}: {}", node, e))?;
+    let cpus = parse_cpu_list(list.trim())?;
+    if cpus.is_empty() {
+        log_then_return!("NUMA node {} has no CPUs", node);
+    }
+    Ok(cpus)
+}
+
+/// Pin the calling thread to `cpus`
+#[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+pub(crate) fn pin_current_thread(cpus: &[usize]) -> Result<()> {
+    let mut set: libc::cpu_set_t = unsafe { std::mem::zeroed() };
+    for &cpu in cpus {
+        if cpu >= libc::CPU_SETSIZE as usize {
+            log_then_return!("CPU {} is out of range", cpu);
+        }
+        unsafe { libc::CPU_SET(cpu, &mut set) };
+    }
+    let res = unsafe { libc::sched_setaffinity(0, size_of::<libc::cpu_set_t>(), &set) };
+    if res != 0 {
+        log_then_return!(
+            "Failed to set the CPU affinity of the current thread: {}",
+            Error::last_os_error()
+        );
+    }
+    Ok(())
+}
+
+/// Parse a CPU list in the format used by sysfs, e.g. `0-3,8,10-11`
+fn parse_cpu_list(list: &str) -> Result<Vec<usize>> {
+    let parse = |cpu: &str| {
+        cpu.parse::<usize>()
+            .map_err(|e| new_error!("Invalid CPU list {:?}: {}", list, e))
+    };
+    let mut cpus = Vec::new();
+    for range in list.split(',').filter(|r| !r.is_empty()) {
+        let (first, last) = match range.split_once('-') {
+            Some((first, last)) => (parse(first)?, parse(last)?),
+            None => (parse(range)?, parse(range)?),
+        };
+        cpus.extend(first..=last);
+    }
+    Ok(cpus)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{bind_to_node, node_cpus, parse_cpu_list, pin_current_thread};
+    use crate::mem::shared_mem::{ExclusiveSharedMemory, SharedMemory};
+
+    #[test]
+    fn cpu_list() {
+        assert_eq!(parse_cpu_list("").unwrap(), Vec::<usize>::new());
+        assert_eq!(parse_cpu_list("3").unwrap(), vec![3]);
+        assert_eq!(
+            parse_cpu_list("0-3,8,10-11").unwrap(),
+            vec![0, 1, 2, 3, 8, 10, 11]
+        );
+        assert!(parse_cpu_list("0-x").is_err());
+    }
+
+    // Node 0 exists on every Linux system, NUMA or not
+    #[test]
+    fn bind_and_pin_to_node_0() {
+        let mut eshm = ExclusiveSharedMemory::new(16 * 4096).unwrap();
+        bind_to_node(eshm.base_ptr(), eshm.mem_size(), 0).unwrap();
+        eshm.as_mut_slice().fill(0xab);
+        assert!(eshm.as_slice().iter().all(|b| *b == 0xab));
+
+        let cpus = node_cpus(0).unwrap();
+        std::thread::spawn(move || pin_current_thread(&cpus))
+            .join()
+            .unwrap()
+            .unwrap();
+    }
+
+    #[test]
+    fn nonexistent_node() {
+        let eshm = ExclusiveSharedMemory::new(4096).unwrap();
+        assert!(bind_to_node(eshm.base_ptr(), eshm.mem_size(), 1 << 20).is_err());
+        assert!(node_cpus(1 << 20).is_err());
+    }
+}
@@ -0,0 +1,161 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use hyperlight_common::mem::PAGE_SIZE_USIZE;
+use tracing::{instrument, Span};
+
+use crate::Result;
+
+/// Get the number of bytes of the pages overlapping `[addr, addr + len)`
+/// that are resident in physical memory.
+///
+/// On Linux this asks the kernel which of the pages are resident. On
+/// Windows it returns the size of those pages, i.e. it assumes all of
+/// them are resident.
+#[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+pub(crate) fn resident_bytes(addr: *const u8, len: usize) -> Result<usize> {
+    if len == 0 {
+        return Ok(0);
+    }
+
+    let start = addr as usize / PAGE_SIZE_USIZE * PAGE_SIZE_USIZE;
+    let end = (addr as usize + len).next_multiple_of(PAGE_SIZE_USIZE);
+
+    #[cfg(target_os = "linux")]
+    {
+        use std::io::Error;
+
+        use crate::log_then_return;
+
+        let mut pages = vec![0u8; (end - start) / PAGE_SIZE_USIZE];
+        let res =
+            unsafe { libc::mincore(start as *mut libc::c_void, end - start, pages.as_mut_ptr()) };
+        if res != 0 {
+            log_then_return!(
+                "Failed to get the resident pages of {:#x}..{:#x}: {}",
+                start,
+                end,
+                Error::last_os_error()
+            );
+        }
+        // The lowest bit of each byte is set if the page is resident
+        Ok(pages.iter().filter(|page| *page & 1 != 0).count() * PAGE_SIZE_USIZE)
+    }
+    #[cfg(target_os = "windows")]
+    Ok(end - start)
+}
+
+/// Get the offsets from `addr` of the pages of `[addr, addr + len)`, a
+/// private mapping of a file, that have been written to since they were
+/// mapped, i.e. that have been copied out of the file.
+///
+/// `addr` and `len` must be multiples of the page size. This reads the
+/// flags of each page from `/proc/self/pagemap`, which any process can
+/// do for its own pages.
+#[cfg(target_os = "linux")]
+#[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+pub(crate) fn written_pages(addr: *const u8, len: usize) -> Result<Vec<usize>> {
+    use std::fs::File;
+    use std::os::unix::fs::FileExt;
+
+    use crate::log_then_return;
+
+    /// Set in a pagemap entry if the page is present
+    const PM_PRESENT: u64 = 1 << 63;
+    /// Set if the page is swapped out, which only private copies can be
+    const PM_SWAPPED: u64 = 1 << 62;
+    /// Set if the page is a page of the file (or of shared memory), i.e.
+    /// it has not been copied
+    const PM_FILE: u64 = 1 << 61;
+    const ENTRY_SIZE: usize = std::mem::size_of::<u64>();
+
+    if addr as usize % PAGE_SIZE_USIZE != 0 || len % PAGE_SIZE_USIZE != 0 {
+        log_then_return!(
+            "Cannot get the written pages of {:#x} bytes at {:p}, which are not page aligned",
+            len,
+            addr
+        );
+    }
+    let mut entries = vec![0u8; len / PAGE_SIZE_USIZE * ENTRY_SIZE];
+    let offset = addr as usize / PAGE_SIZE_USIZE * ENTRY_SIZE;
+    File::open("/proc/self/pagemap")?.read_exact_at(&mut entries, offset as u64)?;
+
+    Ok(entries
+        .chunks_exact(ENTRY_SIZE)
+        .enumerate()
+        .filter(|(_, entry)| {
+            let mut bytes = [0u8; ENTRY_SIZE];
+            bytes.copy_from_slice(entry);
+            let entry = u64::from_ne_bytes(bytes);
+            entry & PM_SWAPPED != 0 || (entry & PM_PRESENT != 0 && entry & PM_FILE == 0)
+        })
+        .map(|(page, _)| page * PAGE_SIZE_USIZE)
+        .collect())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::resident_bytes;
+
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn counts_touched_pages() {
+        use hyperlight_common::mem::PAGE_SIZE_USIZE;
+
+        use crate::mem::shared_mem::{ExclusiveSharedMemory, SharedMemory};
+
+        let mut mem = ExclusiveSharedMemory::new(16 * PAGE_SIZE_USIZE).unwrap();
+        let before = resident_bytes(mem.base_ptr(), mem.mem_size()).unwrap();
+        assert_eq!(before, 0);
+        for page in 0..4 {
+            mem.copy_from_slice(&[1], page * PAGE_SIZE_USIZE).unwrap();
+        }
+        let after = resident_bytes(mem.base_ptr(), mem.mem_size()).unwrap();
+        assert_eq!(after, 4 * PAGE_SIZE_USIZE);
+    }
+
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn written_pages_of_file_mapping() {
+        use std::io::Write;
+
+        use hyperlight_common::mem::PAGE_SIZE_USIZE;
+
+        use super::written_pages;
+        use crate::mem::shared_mem::{ExclusiveSharedMemory, SharedMemory};
+
+        let mut file = tempfile::tempfile().unwrap();
+        file.write_all(&[1; 4 * PAGE_SIZE_USIZE]).unwrap();
+        let mut mem = ExclusiveSharedMemory::from_file(&file, 0, 4 * PAGE_SIZE_USIZE).unwrap();
+        assert!(written_pages(mem.base_ptr(), mem.mem_size())
+            .unwrap()
+            .is_empty());
+
+        // Reading a page leaves it a page of the file
+        assert_eq!(mem.read_u8(0).unwrap(), 1);
+        mem.copy_from_slice(&[2], 2 * PAGE_SIZE_USIZE + 1).unwrap();
+        assert_eq!(
+            written_pages(mem.base_ptr(), mem.mem_size()).unwrap(),
+            vec![2 * PAGE_SIZE_USIZE]
+        );
+    }
+
+    #[test]
+    fn empty_range() {
+        let data = [0u8; 16];
+        assert_eq!(resident_bytes(data.as_ptr(), 0).unwrap(), 0);
+    }
+}
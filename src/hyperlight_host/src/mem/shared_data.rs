@@ -0,0 +1,258 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::fmt::Debug;
+use std::sync::Arc;
+
+use tracing::{instrument, Span};
+
+use super::memory_region::{MemoryRegion, MemoryRegionFlags, MemoryRegionType};
+use super::mgr::AMOUNT_OF_MEMORY_PER_PT;
+use crate::Result;
+
+/// Read-only data that can be mapped into the guest address space of any
+/// number of sandboxes, without being copied into any of them.
+///
+/// This is meant for large datasets that many guests consult but never
+/// modify, such as rule tables, dictionaries or model weights. The data
+/// is copied once, into memory of its own, when the `SharedData` is
+/// created; mapping it into a sandbox (see
+/// `UninitializedSandbox::map_shared_data`) costs no more memory, and the
+/// data is not part of the sandbox's snapshots.
+///
+/// Cloning a `SharedData` is cheap, and the memory is freed once the last
+/// clone is dropped and no sandbox has it mapped anymore.
+#[derive(Clone)]
+pub struct SharedData {
+    inner: Arc<SharedDataMemory>,
+}
+
+/// The memory a `SharedData` lives in
+struct SharedDataMemory {
+    /// The start of the memory, which is 2MB aligned
+    ptr: *mut u8,
+    /// The size of the data
+    len: usize,
+    /// The size of the memory, which is a multiple of 2MB so that the
+    /// guest can map all of it with 2MB pages
+    mapped_len: usize,
+    /// Whether guests can write to the memory
+    writable: bool,
+}
+
+// Read-only memory is never written to after it is initialised, and
+// writable memory is only accessed as a `ChannelRing`
+unsafe impl Send for SharedDataMemory {}
+unsafe impl Sync for SharedDataMemory {}
+
+impl SharedDataMemory {
+    /// Allocate `len` zeroed, writable bytes
+    #[cfg(target_os = "linux")]
+    fn new(len: usize, writable: bool) -> Result<Self> {
+        use std::io::Error;
+
+        use libc::{
+            c_void, mmap, mprotect, munmap, MAP_ANONYMOUS, MAP_FAILED, MAP_NORESERVE, MAP_PRIVATE,
+            PROT_NONE, PROT_READ, PROT_WRITE,
+        };
+
+        use crate::error::HyperlightError::{MmapFailed, MprotectFailed};
+        use crate::log_then_return;
+
+        let mapped_len = len.max(1).next_multiple_of(AMOUNT_OF_MEMORY_PER_PT);
+
+        // Over-allocate by 2MB of address space so that the memory can be
+        // 2MB aligned, which lets the host back it with huge pages too
+        let reserved_len = mapped_len + AMOUNT_OF_MEMORY_PER_PT;
+        let reserved = unsafe {
+            mmap(
+                std::ptr::null_mut(),
+                reserved_len,
+                PROT_NONE,
+                MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE,
+                -1,
+                0,
+            )
+        };
+        if reserved == MAP_FAILED {
+            log_then_return!(MmapFailed(Error::last_os_error().raw_os_error()));
+        }
+        let start = (reserved as usize).next_multiple_of(AMOUNT_OF_MEMORY_PER_PT);
+        let head = start - reserved as usize;
+        let tail = reserved_len - head - mapped_len;
+        unsafe {
+            if head > 0 {
+                munmap(reserved, head);
+            }
+            if tail > 0 {
+                munmap((start + mapped_len) as *mut c_void, tail);
+            }
+        }
+
+        // From here on, dropping `memory` unmaps it
+        let memory = SharedDataMemory {
+            ptr: start as *mut u8,
+            len,
+            mapped_len,
+            writable,
+        };
+        if unsafe { mprotect(start as *mut c_void, mapped_len, PROT_READ | PROT_WRITE) } != 0 {
+            log_then_return!(MprotectFailed(Error::last_os_error().raw_os_error()));
+        }
+        Ok(memory)
+    }
+
+    /// Shared data regions are not yet supported on Windows.
+    #[cfg(target_os = "windows")]
+    fn new(_len: usize, _writable: bool) -> Result<Self> {
+        crate::log_then_return!("Shared data regions are not supported on Windows");
+    }
+
+    /// Stop the host from writing to the memory, once it is initialised
+    fn make_read_only(&self) -> Result<()> {
+        #[cfg(target_os = "linux")]
+        {
+            use std::io::Error;
+
+            use libc::{c_void, mprotect, PROT_READ};
+
+            use crate::error::HyperlightError::MprotectFailed;
+            use crate::log_then_return;
+
+            if unsafe { mprotect(self.ptr as *mut c_void, self.mapped_len, PROT_READ) } != 0 {
+                log_then_return!(MprotectFailed(Error::last_os_error().raw_os_error()));
+            }
+        }
+        Ok(())
+    }
+}
+
+impl SharedData {
+    /// Create a new `SharedData` holding a copy of `data`.
+    ///
+    /// Shared data regions are not yet supported on Windows.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub fn new(data: &[u8]) -> Result<Self> {
+        let memory = SharedDataMemory::new(data.len(), false)?;
+        unsafe { std::ptr::copy_nonoverlapping(data.as_ptr(), memory.ptr, data.len()) };
+        memory.make_read_only()?;
+        Ok(Self {
+            inner: Arc::new(memory),
+        })
+    }
+
+    /// Create a new `SharedData` of `len` zeroed bytes that every sandbox
+    /// it is mapped into can write to, for a channel
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn new_writable(len: usize) -> Result<Self> {
+        Ok(Self {
+            inner: Arc::new(SharedDataMemory::new(len, true)?),
+        })
+    }
+
+    /// The size of the data, in bytes
+    pub fn len(&self) -> usize {
+        self.inner.len
+    }
+
+    /// Whether the data is empty
+    pub fn is_empty(&self) -> bool {
+        self.inner.len == 0
+    }
+
+    /// The data itself
+    pub fn as_slice(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.inner.ptr, self.inner.len) }
+    }
+
+    /// The start of the data, for the ends of a channel to access it
+    pub(crate) fn as_mut_ptr(&self) -> *mut u8 {
+        self.inner.ptr
+    }
+
+    /// Whether guests can write to the data
+    pub(crate) fn is_writable(&self) -> bool {
+        self.inner.writable
+    }
+
+    /// The amount of guest address space the data takes up when mapped
+    pub(crate) fn mapped_len(&self) -> usize {
+        self.inner.mapped_len
+    }
+
+    /// The memory region to map the data at guest address `guest_address`
+    pub(crate) fn memory_region(&self, guest_address: usize) -> MemoryRegion {
+        let host_address = self.inner.ptr as usize;
+        MemoryRegion {
+            guest_region: guest_address..guest_address + self.inner.mapped_len,
+            host_region: host_address..host_address + self.inner.mapped_len,
+            flags: if self.inner.writable {
+                MemoryRegionFlags::READ | MemoryRegionFlags::WRITE
+            } else {
+                MemoryRegionFlags::READ
+            },
+            region_type: MemoryRegionType::SharedData,
+        }
+    }
+}
+
+impl Debug for SharedData {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("SharedData")
+            .field("len", &format_args!("{:#x}", self.inner.len))
+            .finish()
+    }
+}
+
+impl Drop for SharedDataMemory {
+    fn drop(&mut self) {
+        #[cfg(target_os = "linux")]
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.mapped_len);
+        }
+    }
+}
+
+/// A `SharedData` mapped into a sandbox
+#[derive(Clone, Debug)]
+pub(crate) struct MappedSharedData {
+    pub(crate) data: SharedData,
+    /// The guest address the data is mapped at
+    pub(crate) guest_address: usize,
+}
+
+#[cfg(test)]
+#[cfg(target_os = "linux")]
+mod tests {
+    use super::SharedData;
+    use crate::mem::mgr::AMOUNT_OF_MEMORY_PER_PT;
+
+    #[test]
+    fn new() {
+        let data = (0..0x1234).map(|i| i as u8).collect::<Vec<_>>();
+        let shared = SharedData::new(&data).unwrap();
+        assert_eq!(data, shared.as_slice());
+        assert_eq!(AMOUNT_OF_MEMORY_PER_PT, shared.mapped_len());
+
+        let region = shared.memory_region(0x4000_0000);
+        assert_eq!(0x4000_0000..0x4020_0000, region.guest_region);
+        assert_eq!(0, region.host_region.start % AMOUNT_OF_MEMORY_PER_PT);
+
+        let clone = shared.clone();
+        drop(shared);
+        assert_eq!(data, clone.as_slice());
+    }
+}
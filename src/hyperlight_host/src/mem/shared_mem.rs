@@ -96,6 +96,10 @@ macro_rules! generate_writer {
 pub struct HostMapping {
     ptr: *mut u8,
     size: usize,
+    /// Whether the usable part of the mapping is a private, copy-on-write
+    /// mapping of a file (see `ExclusiveSharedMemory::from_file`)
+    #[cfg(target_os = "linux")]
+    copy_on_write: bool,
     #[cfg(target_os = "windows")]
     handle: HANDLE,
 }
@@ -386,10 +390,102 @@ impl ExclusiveSharedMemory {
             region: Arc::new(HostMapping {
                 ptr: addr as *mut u8,
                 size: total_size,
+                copy_on_write: false,
             }),
         })
     }
 
+    /// Bind this memory to NUMA node `node`, so that it is allocated (or
+    /// migrated) there rather than on the node of whichever thread first
+    /// touches it.
+    #[cfg(target_os = "linux")]
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn bind_to_numa_node(&self, node: u32) -> Result<()> {
+        super::numa::bind_to_node(self.base_ptr(), self.mem_size(), node)
+    }
+
+    /// Create a new region of shared memory, surrounded by guard pages,
+    /// whose contents are a private copy-on-write mapping of `size` bytes
+    /// of `file`, starting at `offset`.
+    ///
+    /// Pages are faulted in from the page cache on first access and are
+    /// only copied when they are written to, so neither the file nor any
+    /// other mapping of it is ever modified through the returned region.
+    ///
+    /// `offset` and `size` must both be multiples of the page size.
+    #[cfg(target_os = "linux")]
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn from_file(file: &std::fs::File, offset: u64, size: usize) -> Result<Self> {
+        use std::os::fd::AsRawFd;
+
+        use libc::{
+            mmap, off_t, size_t, MAP_FAILED, MAP_FIXED, MAP_PRIVATE, PROT_READ, PROT_WRITE,
+        };
+
+        use crate::error::HyperlightError::MmapFailed;
+
+        if offset % PAGE_SIZE_USIZE as u64 != 0 {
+            return Err(new_error!(
+                "file offset must be a multiple of {}",
+                PAGE_SIZE_USIZE
+            ));
+        }
+
+        // Reserve the whole region (including the guard pages) first, then
+        // replace the usable part of it with the file mapping.
+        let mut excl = Self::new(size)?;
+        if excl.mem_size() != size {
+            return Err(new_error!(
+                "shared memory must be a multiple of {}",
+                PAGE_SIZE_USIZE
+            ));
+        }
+
+        let addr = unsafe {
+            mmap(
+                excl.base_ptr() as *mut c_void,
+                size as size_t,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_FIXED,
+                file.as_raw_fd(),
+                offset as off_t,
+            )
+        };
+        if addr == MAP_FAILED {
+            log_then_return!(MmapFailed(Error::last_os_error().raw_os_error()));
+        }
+        Arc::get_mut(&mut excl.region)
+            .ok_or_else(|| new_error!("New shared memory is already in use"))?
+            .copy_on_write = true;
+
+        Ok(excl)
+    }
+
+    /// Whether this memory is a private, copy-on-write mapping of a file
+    /// (see `from_file`), whose pages are only copied once they are
+    /// written to
+    #[cfg(target_os = "linux")]
+    pub(crate) fn is_copy_on_write(&self) -> bool {
+        self.region.copy_on_write
+    }
+
+    /// Create a new region of shared memory holding a copy of `size` bytes
+    /// of `file`, starting at `offset`.
+    ///
+    /// Windows has no equivalent to a private file mapping that can back
+    /// a partition, so the file contents are read into fresh memory.
+    #[cfg(target_os = "windows")]
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn from_file(file: &std::fs::File, offset: u64, size: usize) -> Result<Self> {
+        use std::io::{Read, Seek, SeekFrom};
+
+        let mut excl = Self::new(size)?;
+        let mut file = file;
+        file.seek(SeekFrom::Start(offset))?;
+        file.read_exact(&mut excl.as_mut_slice()[..size])?;
+        Ok(excl)
+    }
+
     /// Create a new region of shared memory with the given minimum
     /// size in bytes. The region will be surrounded by guard pages.
     ///
@@ -624,6 +720,50 @@ impl ExclusiveSharedMemory {
         Ok(())
     }
 
+    /// Zero `len` bytes of memory starting at `offset`.
+    ///
+    /// On Linux the pages are given back to the OS rather than written to,
+    /// so this is cheap for pages that were never touched, and the pages
+    /// only take up memory again once they are next touched. For memory
+    /// mapped from a file (see `from_file`), the pages are only reset to
+    /// the file's contents, so the file must be zero in this range.
+    ///
+    /// `offset` and `len` must both be multiples of the page size.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn discard(&mut self, offset: usize, len: usize) -> Result<()> {
+        bounds_check!(offset, len, self.mem_size());
+        if offset % PAGE_SIZE_USIZE != 0 || len % PAGE_SIZE_USIZE != 0 {
+            return Err(new_error!(
+                "discarded memory must be aligned to {}",
+                PAGE_SIZE_USIZE
+            ));
+        }
+        if len == 0 {
+            return Ok(());
+        }
+        let base = self.base_ptr().wrapping_add(offset);
+
+        #[cfg(target_os = "linux")]
+        {
+            use libc::{madvise, EACCES, MADV_DONTNEED, MADV_REMOVE};
+
+            // MADV_REMOVE frees the pages of shared mappings. It fails with
+            // EACCES for private (copy-on-write) file mappings, where
+            // MADV_DONTNEED drops the private copies instead.
+            if unsafe { madvise(base as *mut c_void, len, MADV_REMOVE) } == 0 {
+                return Ok(());
+            }
+            if Error::last_os_error().raw_os_error() == Some(EACCES)
+                && unsafe { madvise(base as *mut c_void, len, MADV_DONTNEED) } == 0
+            {
+                return Ok(());
+            }
+        }
+
+        unsafe { base.write_bytes(0, len) };
+        Ok(())
+    }
+
     /// Return the address of memory at an offset to this `SharedMemory` checking
     /// that the memory is within the bounds of the `SharedMemory`.
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
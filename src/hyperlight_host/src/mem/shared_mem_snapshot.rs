@@ -14,48 +14,357 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#[cfg(target_os = "linux")]
+use std::fs::File;
+use std::ops::Range;
+use std::sync::Arc;
+
+use hyperlight_common::mem::PAGE_SIZE_USIZE;
 use tracing::{instrument, Span};
 
-use super::shared_mem::SharedMemory;
-use crate::Result;
+use super::shared_mem::{ExclusiveSharedMemory, SharedMemory};
+use crate::{new_error, Result};
 
 /// A wrapper around a `SharedMemory` reference and a snapshot
 /// of the memory therein
 #[derive(Clone)]
 pub(super) struct SharedMemorySnapshot {
-    snapshot: Vec<u8>,
+    /// The snapshot itself. This is shared (never mutated in place) so
+    /// that sandboxes forked from one another can share their base state.
+    snapshot: Arc<SnapshotMemory>,
+    /// The part of memory that is not copied into `snapshot`, and is
+    /// zeroed instead of restored: the part of a growable heap that the
+    /// guest had not grown into when the snapshot was taken
+    unused: Range<usize>,
+    /// The NUMA node the snapshot is bound to, if any
+    #[cfg(target_os = "linux")]
+    numa_node: Option<u32>,
+    /// A sealed memfd holding a copy of `snapshot`, created the first time
+    /// the snapshot is used to back a new sandbox's memory
+    #[cfg(target_os = "linux")]
+    frozen: Option<Arc<File>>,
+}
+
+/// The memory a snapshot is kept in. This is mapped for the snapshot
+/// alone rather than allocated on the heap, so that it can be bound to a
+/// NUMA node without affecting other allocations, and is only written to
+/// while the snapshot is being taken. For a sandbox loaded from a snapshot
+/// file it is a private mapping of the file (see `from_file`).
+struct SnapshotMemory(ExclusiveSharedMemory);
+
+// Once a snapshot has been taken its memory is only ever read
+unsafe impl Sync for SnapshotMemory {}
+
+impl SnapshotMemory {
+    fn as_slice(&self) -> &[u8] {
+        self.0.as_slice()
+    }
 }
 
 impl SharedMemorySnapshot {
-    /// Take a snapshot of the memory in `shared_mem`, then create a new
-    /// instance of `Self` with the snapshot stored therein.
+    /// Take a snapshot of the memory in `shared_mem`, leaving out the
+    /// page-aligned range `unused`, then create a new instance of `Self`
+    /// with the snapshot stored therein, bound to NUMA node `numa_node` if
+    /// given.
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
-    pub(super) fn new<S: SharedMemory>(shared_mem: &mut S) -> Result<Self> {
+    pub(super) fn new<S: SharedMemory>(
+        shared_mem: &mut S,
+        unused: Range<usize>,
+        #[cfg(target_os = "linux")] numa_node: Option<u32>,
+    ) -> Result<Self> {
         // TODO: Track dirty pages instead of copying entire memory
-        let snapshot = shared_mem.with_exclusivity(|e| e.copy_all_to_vec())??;
-        Ok(Self { snapshot })
+        let snapshot = shared_mem.with_exclusivity(|e| {
+            copy_except(
+                e,
+                &unused,
+                #[cfg(target_os = "linux")]
+                numa_node,
+            )
+        })??;
+        Ok(Self {
+            snapshot: Arc::new(snapshot),
+            unused,
+            #[cfg(target_os = "linux")]
+            numa_node,
+            #[cfg(target_os = "linux")]
+            frozen: None,
+        })
+    }
+
+    /// Take a snapshot of the memory in `shared_mem`, which was mapped
+    /// copy-on-write from `file` at `offset`, leaving out the page-aligned
+    /// range `unused`.
+    ///
+    /// The snapshot is another private mapping of the same part of `file`,
+    /// with only the pages written to in `shared_mem` copied into it, so
+    /// the rest of it is read from the file as it is used rather than all
+    /// up front. What the range `unused` holds in the snapshot is
+    /// unspecified, as it is never restored.
+    #[cfg(target_os = "linux")]
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn from_file<S: SharedMemory>(
+        shared_mem: &mut S,
+        unused: Range<usize>,
+        file: &File,
+        offset: u64,
+        numa_node: Option<u32>,
+    ) -> Result<Self> {
+        let snapshot = shared_mem.with_exclusivity(|e| -> Result<SnapshotMemory> {
+            check_unused(&unused, e.mem_size())?;
+            let mut snapshot = ExclusiveSharedMemory::from_file(file, offset, e.mem_size())?;
+            if let Some(node) = numa_node {
+                snapshot.bind_to_numa_node(node)?;
+            }
+            copy_written_pages(
+                e.as_slice(),
+                super::resident::written_pages(e.base_ptr(), e.mem_size()),
+                snapshot.as_mut_slice(),
+                &unused,
+            );
+            Ok(SnapshotMemory(snapshot))
+        })??;
+        Ok(Self {
+            snapshot: Arc::new(snapshot),
+            unused,
+            numa_node,
+            frozen: None,
+        })
     }
 
     /// Take another snapshot of the internally-stored `SharedMemory`,
-    /// then store it internally.
+    /// leaving out the page-aligned range `unused`, then store it
+    /// internally.
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
 
-    pub(super) fn replace_snapshot<S: SharedMemory>(&mut self, shared_mem: &mut S) -> Result<()> {
-        self.snapshot = shared_mem.with_exclusivity(|e| e.copy_all_to_vec())??;
+    pub(super) fn replace_snapshot<S: SharedMemory>(
+        &mut self,
+        shared_mem: &mut S,
+        unused: Range<usize>,
+    ) -> Result<()> {
+        self.snapshot = Arc::new(shared_mem.with_exclusivity(|e| {
+            copy_except(
+                e,
+                &unused,
+                #[cfg(target_os = "linux")]
+                self.numa_node,
+            )
+        })??);
+        self.unused = unused;
+        #[cfg(target_os = "linux")]
+        {
+            self.frozen = None;
+        }
         Ok(())
     }
 
+    /// Get the number of bytes of the snapshot that are resident in
+    /// physical memory
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn resident_size(&self) -> Result<usize> {
+        super::resident::resident_bytes(self.snapshot.0.base_ptr(), self.snapshot.0.mem_size())
+    }
+
     /// Copy the memory from the internally-stored memory snapshot
     /// into the internally-stored `SharedMemory`
+    ///
+    /// Memory mapped copy-on-write (see `to_shared_memory`) only has the
+    /// pages the guest wrote to restored, so that the rest stay shared.
+    /// Any other memory is copied over in full, which is cheaper than
+    /// working out which pages changed.
+    ///
+    /// The part of memory the snapshot left out is discarded instead. On
+    /// Linux all of it is, as that is cheap for pages that were never
+    /// touched; elsewhere only the part below `in_use_end`, the end of the
+    /// memory the guest's heap currently takes up.
     #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
     pub(super) fn restore_from_snapshot<S: SharedMemory>(
         &mut self,
         shared_mem: &mut S,
+        #[cfg_attr(target_os = "linux", allow(unused_variables))] in_use_end: usize,
     ) -> Result<()> {
-        shared_mem.with_exclusivity(|e| e.copy_from_slice(self.snapshot.as_slice(), 0))?
+        #[cfg(target_os = "linux")]
+        let discard = self.unused.clone();
+        #[cfg(target_os = "windows")]
+        let discard = self.unused.start..in_use_end.clamp(self.unused.start, self.unused.end);
+
+        shared_mem.with_exclusivity(|e| {
+            let src = self.snapshot.as_slice();
+            if src.len() != e.mem_size() {
+                return Err(new_error!(
+                    "Snapshot size {} does not match memory size {}",
+                    src.len(),
+                    e.mem_size()
+                ));
+            }
+            #[cfg(target_os = "linux")]
+            if e.is_copy_on_write() {
+                // Every page of `e` that has not been written to is still
+                // the page of the file it was mapped from. That file holds
+                // either `src` itself or an earlier state that differs from
+                // it only in pages written to before `src` was taken.
+                let written = super::resident::written_pages(e.base_ptr(), e.mem_size());
+                copy_written_pages(src, written, e.as_mut_slice(), &self.unused);
+                return e.discard(discard.start, discard.len());
+            }
+            let dst = e.as_mut_slice();
+            dst[..self.unused.start].copy_from_slice(&src[..self.unused.start]);
+            dst[self.unused.end..].copy_from_slice(&src[self.unused.end..]);
+
+            e.discard(discard.start, discard.len())
+        })?
+    }
+
+    /// Create a new `ExclusiveSharedMemory` whose contents are this
+    /// snapshot.
+    ///
+    /// On Linux the snapshot is frozen into a sealed memfd (once per
+    /// snapshot) which is then mapped copy-on-write, so every further call
+    /// only costs the pages that the new memory ends up writing to.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(super) fn to_shared_memory(&mut self) -> Result<ExclusiveSharedMemory> {
+        #[cfg(target_os = "linux")]
+        {
+            let frozen = match &self.frozen {
+                Some(frozen) => frozen.clone(),
+                None => {
+                    let frozen = Arc::new(freeze(self.snapshot.as_slice(), &self.unused)?);
+                    self.frozen = Some(frozen.clone());
+                    frozen
+                }
+            };
+            ExclusiveSharedMemory::from_file(&frozen, 0, self.snapshot.0.mem_size())
+        }
+        #[cfg(target_os = "windows")]
+        {
+            let src = self.snapshot.as_slice();
+            let mut excl = ExclusiveSharedMemory::new(src.len())?;
+            excl.copy_from_slice(&src[..self.unused.start], 0)?;
+            excl.copy_from_slice(&src[self.unused.end..], self.unused.end)?;
+            Ok(excl)
+        }
     }
 }
 
+/// Copy the memory in `e` into new memory of its own, leaving the range
+/// `unused` zero. The new memory is bound to NUMA node `numa_node`, if
+/// given, before it is written to, so that its pages are allocated there
+/// rather than migrated. The pages of `unused` take up no memory until
+/// they are written to.
+fn copy_except(
+    e: &ExclusiveSharedMemory,
+    unused: &Range<usize>,
+    #[cfg(target_os = "linux")] numa_node: Option<u32>,
+) -> Result<SnapshotMemory> {
+    let src = e.as_slice();
+    check_unused(unused, src.len())?;
+    let mut snapshot = ExclusiveSharedMemory::new(src.len())?;
+    #[cfg(target_os = "linux")]
+    if let Some(node) = numa_node {
+        snapshot.bind_to_numa_node(node)?;
+    }
+    snapshot.copy_from_slice(&src[..unused.start], 0)?;
+    snapshot.copy_from_slice(&src[unused.end..], unused.end)?;
+    Ok(SnapshotMemory(snapshot))
+}
+
+/// Check that `unused` is a page-aligned range within `len` bytes
+fn check_unused(unused: &Range<usize>, len: usize) -> Result<()> {
+    if unused.start > unused.end
+        || unused.end > len
+        || unused.start % PAGE_SIZE_USIZE != 0
+        || unused.end % PAGE_SIZE_USIZE != 0
+    {
+        return Err(new_error!(
+            "Invalid range {:#x?} to leave out of a snapshot of {:#x} bytes",
+            unused,
+            len
+        ));
+    }
+    Ok(())
+}
+
+/// Copy the pages of `src` at the offsets `written` into `dst`, leaving
+/// out `unused`, where `dst` is already the same as `src` in every other
+/// page. If `written` could not be found, every page is compared instead.
+#[cfg(target_os = "linux")]
+fn copy_written_pages(
+    src: &[u8],
+    written: Result<Vec<usize>>,
+    dst: &mut [u8],
+    unused: &Range<usize>,
+) {
+    match written {
+        Ok(written) => {
+            for offset in written
+                .into_iter()
+                .filter(|offset| !unused.contains(offset))
+            {
+                let page = offset..offset + PAGE_SIZE_USIZE;
+                dst[page.clone()].copy_from_slice(&src[page]);
+            }
+        }
+        Err(_) => {
+            restore_changed_pages(&src[..unused.start], &mut dst[..unused.start]);
+            restore_changed_pages(&src[unused.end..], &mut dst[unused.end..]);
+        }
+    }
+}
+
+/// Copy the pages of `src` that differ from those of `dst` into `dst`
+#[cfg(target_os = "linux")]
+fn restore_changed_pages(src: &[u8], dst: &mut [u8]) {
+    for (src, dst) in src
+        .chunks(PAGE_SIZE_USIZE)
+        .zip(dst.chunks_mut(PAGE_SIZE_USIZE))
+    {
+        if src != dst {
+            dst.copy_from_slice(src);
+        }
+    }
+}
+
+/// Copy `data` into a new memfd and seal it, so that it can be mapped
+/// privately by any number of sandboxes but never modified. The range
+/// `unused` of `data` is zero and is left as a hole in the file.
+#[cfg(target_os = "linux")]
+fn freeze(data: &[u8], unused: &Range<usize>) -> Result<File> {
+    use std::io::Error;
+    use std::os::fd::{AsRawFd, FromRawFd};
+    use std::os::unix::fs::FileExt;
+
+    use libc::{
+        fcntl, memfd_create, F_ADD_SEALS, F_SEAL_GROW, F_SEAL_SEAL, F_SEAL_SHRINK, F_SEAL_WRITE,
+        MFD_ALLOW_SEALING, MFD_CLOEXEC,
+    };
+
+    use crate::error::HyperlightError::MemoryAllocationFailed;
+    use crate::log_then_return;
+
+    let fd = unsafe {
+        memfd_create(
+            c"hyperlight-snapshot".as_ptr(),
+            MFD_CLOEXEC | MFD_ALLOW_SEALING,
+        )
+    };
+    if fd < 0 {
+        log_then_return!(MemoryAllocationFailed(
+            Error::last_os_error().raw_os_error()
+        ));
+    }
+    let file = unsafe { File::from_raw_fd(fd) };
+    file.set_len(data.len() as u64)?;
+    file.write_all_at(&data[..unused.start], 0)?;
+    file.write_all_at(&data[unused.end..], unused.end as u64)?;
+
+    let seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL;
+    if unsafe { fcntl(file.as_raw_fd(), F_ADD_SEALS, seals) } < 0 {
+        log_then_return!(MemoryAllocationFailed(
+            Error::last_os_error().raw_os_error()
+        ));
+    }
+    Ok(file)
+}
+
 #[cfg(test)]
 mod tests {
     use hyperlight_common::mem::PAGE_SIZE_USIZE;
@@ -69,7 +378,13 @@ mod tests {
         let data2 = data1.iter().map(|b| b + 1).collect::<Vec<u8>>();
         let mut gm = ExclusiveSharedMemory::new(PAGE_SIZE_USIZE).unwrap();
         gm.copy_from_slice(data1.as_slice(), 0).unwrap();
-        let mut snap = super::SharedMemorySnapshot::new(&mut gm).unwrap();
+        let mut snap = super::SharedMemorySnapshot::new(
+            &mut gm,
+            0..0,
+            #[cfg(target_os = "linux")]
+            None,
+        )
+        .unwrap();
         {
             // after the first snapshot is taken, make sure gm has the equivalent
             // of data1
@@ -81,7 +396,7 @@ mod tests {
             // snapshot. we should have the equivalent of data1 again
             gm.copy_from_slice(data2.as_slice(), 0).unwrap();
             assert_eq!(data2, gm.copy_all_to_vec().unwrap());
-            snap.restore_from_snapshot(&mut gm).unwrap();
+            snap.restore_from_snapshot(&mut gm, 0).unwrap();
             assert_eq!(data1, gm.copy_all_to_vec().unwrap());
         }
         {
@@ -89,10 +404,78 @@ mod tests {
             // from the new snapshot. we should have the equivalent of data2
             gm.copy_from_slice(data2.as_slice(), 0).unwrap();
             assert_eq!(data2, gm.copy_all_to_vec().unwrap());
-            snap.replace_snapshot(&mut gm).unwrap();
+            snap.replace_snapshot(&mut gm, 0..0).unwrap();
             assert_eq!(data2, gm.copy_all_to_vec().unwrap());
-            snap.restore_from_snapshot(&mut gm).unwrap();
+            snap.restore_from_snapshot(&mut gm, 0).unwrap();
             assert_eq!(data2, gm.copy_all_to_vec().unwrap());
         }
     }
+
+    #[test]
+    fn to_shared_memory() {
+        let mut data = vec![b'a', b'b', b'c'];
+        data.resize_with(PAGE_SIZE_USIZE * 2, || 0);
+        let mut gm = ExclusiveSharedMemory::new(PAGE_SIZE_USIZE * 2).unwrap();
+        gm.copy_from_slice(data.as_slice(), 0).unwrap();
+        let mut snap = super::SharedMemorySnapshot::new(
+            &mut gm,
+            0..0,
+            #[cfg(target_os = "linux")]
+            None,
+        )
+        .unwrap();
+
+        let mut copy1 = snap.to_shared_memory().unwrap();
+        let copy2 = snap.to_shared_memory().unwrap();
+        assert_eq!(data, copy1.copy_all_to_vec().unwrap());
+        assert_eq!(data, copy2.copy_all_to_vec().unwrap());
+
+        // writes to one copy must not be visible in the others, nor in the
+        // memory the snapshot was taken from
+        copy1.copy_from_slice(&[b'x'; 4], PAGE_SIZE_USIZE).unwrap();
+        assert_ne!(data, copy1.copy_all_to_vec().unwrap());
+        assert_eq!(data, copy2.copy_all_to_vec().unwrap());
+        assert_eq!(data, gm.copy_all_to_vec().unwrap());
+
+        snap.restore_from_snapshot(&mut copy1, 0).unwrap();
+        assert_eq!(data, copy1.copy_all_to_vec().unwrap());
+    }
+
+    #[test]
+    fn unused_range() {
+        let unused = PAGE_SIZE_USIZE..PAGE_SIZE_USIZE * 2;
+        let mut data = vec![b'a'; PAGE_SIZE_USIZE * 3];
+        data[unused.clone()].fill(0);
+        let mut gm = ExclusiveSharedMemory::new(PAGE_SIZE_USIZE * 3).unwrap();
+        gm.copy_from_slice(data.as_slice(), 0).unwrap();
+        let mut snap = super::SharedMemorySnapshot::new(
+            &mut gm,
+            unused.clone(),
+            #[cfg(target_os = "linux")]
+            None,
+        )
+        .unwrap();
+
+        // the unused range is discarded rather than restored
+        gm.copy_from_slice(&vec![b'x'; PAGE_SIZE_USIZE * 3], 0)
+            .unwrap();
+        snap.restore_from_snapshot(&mut gm, unused.end).unwrap();
+        assert_eq!(data, gm.copy_all_to_vec().unwrap());
+
+        // and is not part of the snapshot at all
+        gm.copy_from_slice(&[b'x'; 4], unused.start).unwrap();
+        snap.replace_snapshot(&mut gm, unused.clone()).unwrap();
+        assert_eq!(
+            data,
+            snap.to_shared_memory().unwrap().copy_all_to_vec().unwrap()
+        );
+
+        assert!(super::SharedMemorySnapshot::new(
+            &mut gm,
+            1..PAGE_SIZE_USIZE,
+            #[cfg(target_os = "linux")]
+            None,
+        )
+        .is_err());
+    }
 }
@@ -0,0 +1,356 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::io::{Read, Write};
+
+use hyperlight_common::mem::PAGE_SIZE_USIZE;
+use tracing::{instrument, Span};
+
+use super::layout::SandboxMemoryLayout;
+use super::mgr::STACK_COOKIE_LEN;
+use crate::error::HyperlightError::SnapshotFileInvalid;
+use crate::sandbox::SandboxConfiguration;
+use crate::{log_then_return, Result};
+
+/// The magic bytes every sandbox snapshot file starts with
+const SNAPSHOT_FILE_MAGIC: [u8; 8] = *b"HLSNAPSH";
+
+/// The version of the snapshot file format. This must be bumped whenever
+/// the header below, or the way a guest's memory is laid out, changes in
+/// an incompatible way.
+const SNAPSHOT_FILE_VERSION: u32 = 4;
+
+/// The length of the (zero padded) hyperlight-host version string
+/// stored in the header
+const HOST_VERSION_LEN: usize = 32;
+
+/// The offset in the file at which the memory image starts. The image is
+/// page aligned so that it can be mapped directly into a new sandbox.
+pub(crate) const SNAPSHOT_IMAGE_OFFSET: u64 = PAGE_SIZE_USIZE as u64;
+
+/// How the header records that no NUMA node was set
+const NO_NUMA_NODE: u64 = u64::MAX;
+
+/// The header of an on-disk sandbox snapshot.
+///
+/// A snapshot file consists of this header, zero padding up to
+/// `SNAPSHOT_IMAGE_OFFSET`, then the full memory image of an initialised
+/// sandbox (page tables, code, PEB, buffers, heap and stacks).
+///
+/// The vCPU registers do not need to be stored: every call into the guest
+/// starts from the dispatch function with freshly set registers, and the
+/// dispatch function address is read from the PEB in the image. What
+/// the header does store is everything needed to rebuild the
+/// `SandboxMemoryLayout` describing the image, where the guest binary was
+/// loaded, and the stack cookie the host checks after each call. It also
+/// records the vCPU count and NUMA nodes the sandbox was configured with,
+/// which the configuration it is loaded with must match.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub(crate) struct SnapshotFileHeader {
+    pub(crate) input_data_size: u64,
+    pub(crate) output_data_size: u64,
+    pub(crate) host_function_definition_size: u64,
+    pub(crate) host_exception_size: u64,
+    pub(crate) guest_error_buffer_size: u64,
+    pub(crate) guest_panic_context_buffer_size: u64,
+    pub(crate) kernel_stack_size: u64,
+    pub(crate) code_size: u64,
+    pub(crate) stack_size: u64,
+    pub(crate) heap_size: u64,
+    pub(crate) load_addr: u64,
+    pub(crate) entrypoint_offset: u64,
+    pub(crate) mem_size: u64,
+    pub(crate) vcpu_count: u64,
+    pub(crate) numa_node: u64,
+    pub(crate) vcpu_numa_node: u64,
+    pub(crate) stack_cookie: [u8; STACK_COOKIE_LEN],
+}
+
+impl SnapshotFileHeader {
+    /// Create a header describing a sandbox with the given `layout`
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn new(
+        layout: &SandboxMemoryLayout,
+        load_addr: u64,
+        entrypoint_offset: u64,
+        stack_cookie: [u8; STACK_COOKIE_LEN],
+    ) -> Result<Self> {
+        let cfg = layout.sandbox_memory_config;
+        let (numa_node, vcpu_numa_node) = numa_nodes(&cfg);
+        Ok(Self {
+            input_data_size: cfg.get_input_data_size() as u64,
+            output_data_size: cfg.get_output_data_size() as u64,
+            host_function_definition_size: cfg.get_host_function_definition_size() as u64,
+            host_exception_size: cfg.get_host_exception_size() as u64,
+            guest_error_buffer_size: cfg.get_guest_error_buffer_size() as u64,
+            guest_panic_context_buffer_size: cfg.get_guest_panic_context_buffer_size() as u64,
+            kernel_stack_size: cfg.get_kernel_stack_size() as u64,
+            code_size: layout.code_size as u64,
+            stack_size: layout.stack_size as u64,
+            heap_size: layout.heap_size as u64,
+            load_addr,
+            entrypoint_offset,
+            mem_size: layout.get_memory_size()? as u64,
+            vcpu_count: cfg.get_vcpu_count() as u64,
+            numa_node,
+            vcpu_numa_node,
+            stack_cookie,
+        })
+    }
+
+    /// Rebuild the `SandboxMemoryLayout` described by this header.
+    ///
+    /// `cfg` supplies the settings that do not affect the layout (e.g.
+    /// timeouts); all buffer sizes are taken from the header. The vCPU
+    /// count and NUMA nodes in `cfg` must be those the header records.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn layout(&self, mut cfg: SandboxConfiguration) -> Result<SandboxMemoryLayout> {
+        if cfg.get_vcpu_count() as u64 != self.vcpu_count {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "written with {} vCPUs, but the configuration has {}",
+                self.vcpu_count,
+                cfg.get_vcpu_count()
+            )));
+        }
+        let nodes = numa_nodes(&cfg);
+        if nodes != (self.numa_node, self.vcpu_numa_node) {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "written with NUMA nodes {:?}, but the configuration has {:?}",
+                (self.numa_node, self.vcpu_numa_node),
+                nodes
+            )));
+        }
+        cfg.set_input_data_size(usize::try_from(self.input_data_size)?);
+        cfg.set_output_data_size(usize::try_from(self.output_data_size)?);
+        cfg.set_host_function_definition_size(usize::try_from(self.host_function_definition_size)?);
+        cfg.set_host_exception_size(usize::try_from(self.host_exception_size)?);
+        cfg.set_guest_error_buffer_size(usize::try_from(self.guest_error_buffer_size)?);
+        cfg.set_guest_panic_context_buffer_size(usize::try_from(
+            self.guest_panic_context_buffer_size,
+        )?);
+        cfg.set_kernel_stack_size(usize::try_from(self.kernel_stack_size)?);
+        // The header's heap size already includes any room for the heap to
+        // grow, and how far it has grown is recorded in the image's PEB
+        cfg.set_max_heap_size(0);
+        // Sandboxes with shared data cannot be written to snapshot files
+        cfg.set_shared_data_size(0);
+
+        let layout = SandboxMemoryLayout::new(
+            cfg,
+            usize::try_from(self.code_size)?,
+            usize::try_from(self.stack_size)?,
+            usize::try_from(self.heap_size)?,
+        )?;
+
+        let mem_size = layout.get_memory_size()? as u64;
+        if mem_size != self.mem_size {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "memory size {:#x} does not match the rebuilt layout ({:#x})",
+                self.mem_size, mem_size
+            )));
+        }
+        Ok(layout)
+    }
+
+    /// Write this header to `w`, including the padding up to
+    /// `SNAPSHOT_IMAGE_OFFSET`
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn write_to<W: Write>(&self, w: &mut W) -> Result<()> {
+        let mut buf = Vec::with_capacity(SNAPSHOT_IMAGE_OFFSET as usize);
+        buf.extend_from_slice(&SNAPSHOT_FILE_MAGIC);
+        buf.extend_from_slice(&SNAPSHOT_FILE_VERSION.to_le_bytes());
+        buf.extend_from_slice(&host_version());
+        for field in [
+            self.input_data_size,
+            self.output_data_size,
+            self.host_function_definition_size,
+            self.host_exception_size,
+            self.guest_error_buffer_size,
+            self.guest_panic_context_buffer_size,
+            self.kernel_stack_size,
+            self.code_size,
+            self.stack_size,
+            self.heap_size,
+            self.load_addr,
+            self.entrypoint_offset,
+            self.mem_size,
+            self.vcpu_count,
+            self.numa_node,
+            self.vcpu_numa_node,
+        ] {
+            buf.extend_from_slice(&field.to_le_bytes());
+        }
+        buf.extend_from_slice(&self.stack_cookie);
+        buf.resize(SNAPSHOT_IMAGE_OFFSET as usize, 0);
+        w.write_all(&buf)?;
+        Ok(())
+    }
+
+    /// Read and validate a header from `r`, consuming everything up to
+    /// `SNAPSHOT_IMAGE_OFFSET`
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn read_from<R: Read>(r: &mut R) -> Result<Self> {
+        let mut buf = vec![0u8; SNAPSHOT_IMAGE_OFFSET as usize];
+        r.read_exact(&mut buf)
+            .map_err(|e| SnapshotFileInvalid(format!("failed to read header: {}", e)))?;
+
+        if buf[..8] != SNAPSHOT_FILE_MAGIC {
+            log_then_return!(SnapshotFileInvalid("bad magic".to_string()));
+        }
+        let version = u32::from_le_bytes(buf[8..12].try_into()?);
+        if version != SNAPSHOT_FILE_VERSION {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "unsupported version {} (expected {})",
+                version, SNAPSHOT_FILE_VERSION
+            )));
+        }
+        // The image embeds the PEB and page table formats of the host that
+        // wrote it, so only the same host version can load it.
+        if buf[12..12 + HOST_VERSION_LEN] != host_version() {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "written by a different hyperlight-host version (this is {})",
+                env!("CARGO_PKG_VERSION")
+            )));
+        }
+
+        let mut pos = 12 + HOST_VERSION_LEN;
+        let mut next = || -> Result<u64> {
+            let val = u64::from_le_bytes(buf[pos..pos + 8].try_into()?);
+            pos += 8;
+            Ok(val)
+        };
+        let mut header = Self {
+            input_data_size: next()?,
+            output_data_size: next()?,
+            host_function_definition_size: next()?,
+            host_exception_size: next()?,
+            guest_error_buffer_size: next()?,
+            guest_panic_context_buffer_size: next()?,
+            kernel_stack_size: next()?,
+            code_size: next()?,
+            stack_size: next()?,
+            heap_size: next()?,
+            load_addr: next()?,
+            entrypoint_offset: next()?,
+            mem_size: next()?,
+            vcpu_count: next()?,
+            numa_node: next()?,
+            vcpu_numa_node: next()?,
+            stack_cookie: [0; STACK_COOKIE_LEN],
+        };
+        header
+            .stack_cookie
+            .copy_from_slice(&buf[pos..pos + STACK_COOKIE_LEN]);
+
+        if header.mem_size == 0 || header.mem_size % PAGE_SIZE_USIZE as u64 != 0 {
+            log_then_return!(SnapshotFileInvalid(format!(
+                "memory size {:#x} is not a non-zero multiple of the page size",
+                header.mem_size
+            )));
+        }
+        Ok(header)
+    }
+}
+
+/// The NUMA nodes the memory and vCPU of a sandbox with `cfg` are placed
+/// on, as recorded in the header
+fn numa_nodes(
+    #[cfg_attr(target_os = "windows", allow(unused_variables))] cfg: &SandboxConfiguration,
+) -> (u64, u64) {
+    #[cfg(target_os = "linux")]
+    {
+        let node = |node: Option<u32>| node.map_or(NO_NUMA_NODE, u64::from);
+        (node(cfg.get_numa_node()), node(cfg.get_vcpu_numa_node()))
+    }
+    #[cfg(target_os = "windows")]
+    {
+        (NO_NUMA_NODE, NO_NUMA_NODE)
+    }
+}
+
+/// The version of this crate, zero padded to `HOST_VERSION_LEN` bytes
+fn host_version() -> [u8; HOST_VERSION_LEN] {
+    let mut version = [0u8; HOST_VERSION_LEN];
+    let src = env!("CARGO_PKG_VERSION").as_bytes();
+    let len = src.len().min(HOST_VERSION_LEN);
+    version[..len].copy_from_slice(&src[..len]);
+    version
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{SnapshotFileHeader, SNAPSHOT_IMAGE_OFFSET};
+    use crate::mem::layout::SandboxMemoryLayout;
+    use crate::sandbox::SandboxConfiguration;
+
+    #[test]
+    fn header_round_trip() {
+        let cfg = SandboxConfiguration::default();
+        let layout = SandboxMemoryLayout::new(cfg, 0x4000, 0x8000, 0x10000).unwrap();
+        let header = SnapshotFileHeader::new(&layout, 0x230000, 0x1234, [7; 16]).unwrap();
+
+        let mut buf = Vec::new();
+        header.write_to(&mut buf).unwrap();
+        assert_eq!(buf.len() as u64, SNAPSHOT_IMAGE_OFFSET);
+
+        let read = SnapshotFileHeader::read_from(&mut buf.as_slice()).unwrap();
+        assert_eq!(header, read);
+
+        let rebuilt = read.layout(cfg).unwrap();
+        assert_eq!(
+            layout.get_memory_size().unwrap(),
+            rebuilt.get_memory_size().unwrap()
+        );
+    }
+
+    #[test]
+    fn rejects_bad_header() {
+        let cfg = SandboxConfiguration::default();
+        let layout = SandboxMemoryLayout::new(cfg, 0x4000, 0x8000, 0x10000).unwrap();
+        let header = SnapshotFileHeader::new(&layout, 0x230000, 0x1234, [7; 16]).unwrap();
+        let mut buf = Vec::new();
+        header.write_to(&mut buf).unwrap();
+
+        let mut bad_magic = buf.clone();
+        bad_magic[0] ^= 0xff;
+        assert!(SnapshotFileHeader::read_from(&mut bad_magic.as_slice()).is_err());
+
+        let mut bad_version = buf.clone();
+        bad_version[8] = bad_version[8].wrapping_add(1);
+        assert!(SnapshotFileHeader::read_from(&mut bad_version.as_slice()).is_err());
+
+        assert!(SnapshotFileHeader::read_from(&mut &buf[..100]).is_err());
+    }
+
+    #[test]
+    fn rejects_mismatched_configuration() {
+        let cfg = SandboxConfiguration::default();
+        let layout = SandboxMemoryLayout::new(cfg, 0x4000, 0x8000, 0x10000).unwrap();
+        let header = SnapshotFileHeader::new(&layout, 0x230000, 0x1234, [7; 16]).unwrap();
+        assert!(header.layout(cfg).is_ok());
+
+        let mut more_vcpus = cfg;
+        more_vcpus.set_vcpu_count(2);
+        assert!(header.layout(more_vcpus).is_err());
+
+        #[cfg(target_os = "linux")]
+        {
+            let mut numa = cfg;
+            numa.set_numa_node(0);
+            assert!(header.layout(numa).is_err());
+        }
+    }
+}
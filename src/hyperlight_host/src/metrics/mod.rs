@@ -29,29 +29,167 @@ pub(crate) static METRIC_GUEST_FUNC_DURATION: &str = "guest_call_duration_second
 #[cfg(feature = "function_call_metrics")]
 pub(crate) static METRIC_HOST_FUNC_DURATION: &str = "host_call_duration_seconds";
 
-/// If the the `function_call_metrics` feature is enabled, this function measures
-/// the time it takes to execute the given closure, and will then emit a guest call metric
-/// with the given function name.
-///
-/// If the feature is not enabled, the given closure is executed without any additional metrics being emitted,
-/// and the result of the closure is returned directly.
-pub(crate) fn maybe_time_and_emit_guest_call<T, F: FnOnce() -> T>(
-    #[allow(unused_variables)] name: &str,
-    f: F,
-) -> T {
-    cfg_if::cfg_if! {
-        if #[cfg(feature = "function_call_metrics")] {
-            use std::time::Instant;
+// Counter of the exits of vCPUs, and histograms that measure the time a vCPU ran the
+// guest for before each exit and the time the host took to handle it, by exit reason
+// (and by port, for IO exits)
+#[cfg(feature = "exit_metrics")]
+pub(crate) static METRIC_VM_EXITS: &str = "vm_exits_total";
+#[cfg(feature = "exit_metrics")]
+pub(crate) static METRIC_VM_EXIT_GUEST_DURATION: &str = "vm_exit_guest_duration_seconds";
+#[cfg(feature = "exit_metrics")]
+pub(crate) static METRIC_VM_EXIT_HANDLING_DURATION: &str = "vm_exit_handling_duration_seconds";
+#[cfg(feature = "exit_metrics")]
+pub(crate) static METRIC_VM_EXIT_LABEL_REASON: &str = "reason";
+#[cfg(feature = "exit_metrics")]
+pub(crate) static METRIC_VM_EXIT_LABEL_PORT: &str = "port";
 
-            let start = Instant::now();
-            let result = f();
-            let duration = start.elapsed();
+/// If the `exit_metrics` feature is enabled, this measures how long a vCPU runs the
+/// guest for before it exits. Otherwise it does nothing.
+pub(crate) struct VcpuRunTimer {
+    #[cfg(feature = "exit_metrics")]
+    start: std::time::Instant,
+}
 
-            static LABEL_GUEST_FUNC_NAME: &str = "function_name";
-            metrics::histogram!(METRIC_GUEST_FUNC_DURATION, LABEL_GUEST_FUNC_NAME => name.to_string()).record(duration);
-            result
-        } else {
-            f()
+/// If the `exit_metrics` feature is enabled, this measures how long the host takes to
+/// handle a vCPU exit, from when it is created until it is dropped. Otherwise it does
+/// nothing.
+pub(crate) struct ExitHandlingTimer {
+    #[cfg(feature = "exit_metrics")]
+    reason: &'static str,
+    #[cfg(feature = "exit_metrics")]
+    port: Option<&'static str>,
+    #[cfg(feature = "exit_metrics")]
+    start: std::time::Instant,
+}
+
+impl VcpuRunTimer {
+    /// Start timing a run of a vCPU
+    #[inline]
+    pub(crate) fn start() -> Self {
+        Self {
+            #[cfg(feature = "exit_metrics")]
+            start: std::time::Instant::now(),
+        }
+    }
+
+    /// Emit the exit count and the time the vCPU ran for before `exit`, and start
+    /// timing how long the host takes to handle `exit`
+    #[inline]
+    pub(crate) fn exited(
+        self,
+        #[allow(unused_variables)] exit: &crate::Result<crate::hypervisor::HyperlightExit>,
+    ) -> ExitHandlingTimer {
+        cfg_if::cfg_if! {
+            if #[cfg(feature = "exit_metrics")] {
+                let (reason, port) = exit_labels(exit);
+                let now = std::time::Instant::now();
+                let in_guest = now - self.start;
+                match port {
+                    Some(port) => {
+                        metrics::counter!(METRIC_VM_EXITS, METRIC_VM_EXIT_LABEL_REASON => reason, METRIC_VM_EXIT_LABEL_PORT => port).increment(1);
+                        metrics::histogram!(METRIC_VM_EXIT_GUEST_DURATION, METRIC_VM_EXIT_LABEL_REASON => reason, METRIC_VM_EXIT_LABEL_PORT => port).record(in_guest);
+                    }
+                    None => {
+                        metrics::counter!(METRIC_VM_EXITS, METRIC_VM_EXIT_LABEL_REASON => reason).increment(1);
+                        metrics::histogram!(METRIC_VM_EXIT_GUEST_DURATION, METRIC_VM_EXIT_LABEL_REASON => reason).record(in_guest);
+                    }
+                }
+                ExitHandlingTimer {
+                    reason,
+                    port,
+                    start: now,
+                }
+            } else {
+                ExitHandlingTimer {}
+            }
+        }
+    }
+}
+
+#[cfg(feature = "exit_metrics")]
+impl Drop for ExitHandlingTimer {
+    fn drop(&mut self) {
+        let handling = self.start.elapsed();
+        match self.port {
+            Some(port) => {
+                metrics::histogram!(METRIC_VM_EXIT_HANDLING_DURATION, METRIC_VM_EXIT_LABEL_REASON => self.reason, METRIC_VM_EXIT_LABEL_PORT => port).record(handling);
+            }
+            None => {
+                metrics::histogram!(METRIC_VM_EXIT_HANDLING_DURATION, METRIC_VM_EXIT_LABEL_REASON => self.reason).record(handling);
+            }
+        }
+    }
+}
+
+/// The reason label for `exit`, and the port label if it is an IO exit. The labels are
+/// static strings, so that emitting the exit metrics does not allocate.
+#[cfg(feature = "exit_metrics")]
+fn exit_labels(
+    exit: &crate::Result<crate::hypervisor::HyperlightExit>,
+) -> (&'static str, Option<&'static str>) {
+    use crate::hypervisor::HyperlightExit;
+    use crate::sandbox::outb::OutBAction;
+
+    match exit {
+        #[cfg(gdb)]
+        Ok(HyperlightExit::Debug(_)) => ("debug", None),
+        Ok(HyperlightExit::Halt()) => ("halt", None),
+        Ok(HyperlightExit::IoOut(port, ..)) => {
+            let port = match *port {
+                p if p == OutBAction::Log as u16 => "log",
+                p if p == OutBAction::CallFunction as u16 => "call_function",
+                p if p == OutBAction::Abort as u16 => "abort",
+                p if p == OutBAction::WorkerCount as u16 => "worker_count",
+                p if p == OutBAction::RunWorkers as u16 => "run_workers",
+                p if p == OutBAction::JoinWorkers as u16 => "join_workers",
+                p if p == OutBAction::GrowHeap as u16 => "grow_heap",
+                _ => "other",
+            };
+            ("io_out", Some(port))
+        }
+        Ok(HyperlightExit::Mmio(_)) => ("mmio", None),
+        Ok(HyperlightExit::AccessViolation(..)) => ("access_violation", None),
+        Ok(HyperlightExit::Cancelled()) => ("cancelled", None),
+        Ok(HyperlightExit::Unknown(_)) => ("unknown", None),
+        Ok(HyperlightExit::Retry()) => ("retry", None),
+        Err(_) => ("error", None),
+    }
+}
+
+/// If the `function_call_metrics` feature is enabled, this measures how long a guest
+/// call runs for, adding up the runs it is split into when it is suspended and
+/// resumed, and emits a single guest call metric once the call finishes. Otherwise it
+/// does nothing.
+#[derive(Default)]
+pub(crate) struct GuestCallTimer {
+    #[cfg(feature = "function_call_metrics")]
+    in_guest: std::time::Duration,
+}
+
+impl GuestCallTimer {
+    /// Run `f`, which runs the guest call `name` until it finishes or is suspended,
+    /// adding the time it takes to the call's. Unless `suspended` says that `f` left
+    /// the call suspended, emit the call's metric and start timing a new call.
+    pub(crate) fn time_run<T>(
+        &mut self,
+        #[allow(unused_variables)] name: &str,
+        f: impl FnOnce() -> T,
+        #[allow(unused_variables)] suspended: impl FnOnce(&T) -> bool,
+    ) -> T {
+        cfg_if::cfg_if! {
+            if #[cfg(feature = "function_call_metrics")] {
+                let start = std::time::Instant::now();
+                let result = f();
+                self.in_guest += start.elapsed();
+
+                if !suspended(&result) {
+                    static LABEL_GUEST_FUNC_NAME: &str = "function_name";
+                    metrics::histogram!(METRIC_GUEST_FUNC_DURATION, LABEL_GUEST_FUNC_NAME => name.to_string()).record(std::mem::take(&mut self.in_guest));
+                }
+                result
+            } else {
+                f()
+            }
         }
     }
 }
@@ -134,7 +272,12 @@ mod tests {
 
         // Convert snapshot into a hashmap for easier lookup
         #[expect(clippy::mutable_key_type)]
-        let snapshot = snapshot.into_hashmap();
+        #[allow(unused_mut)]
+        let mut snapshot = snapshot.into_hashmap();
+
+        // The exit metrics are checked by `test_exit_metrics_are_emitted`
+        #[cfg(feature = "exit_metrics")]
+        snapshot.retain(|key, _| !key.key().name().starts_with("vm_exit"));
 
         cfg_if::cfg_if! {
             if #[cfg(feature = "function_call_metrics")] {
@@ -217,4 +360,141 @@ mod tests {
             }
         }
     }
+
+    #[test]
+    #[cfg(feature = "function_call_metrics")]
+    #[ignore = "This test needs to be run separately to avoid having other tests interfere with it"]
+    fn test_suspended_guest_call_is_timed_once() {
+        use hyperlight_common::flatbuffer_wrappers::function_types::{ParameterType, ReturnValue};
+        use metrics::Label;
+        use metrics_util::debugging::DebugValue;
+        use metrics_util::MetricKind;
+
+        let recorder = metrics_util::debugging::DebuggingRecorder::new();
+        let snapshotter = recorder.snapshotter();
+        recorder.install().unwrap();
+
+        let snapshot = {
+            let mut uninit = UninitializedSandbox::new(
+                GuestBinary::FilePath(simple_guest_as_string().unwrap()),
+                None,
+                None,
+                None,
+            )
+            .unwrap();
+            uninit
+                .register_async_host_function(
+                    "HostAdd",
+                    vec![ParameterType::Int, ParameterType::Int],
+                    ReturnType::Int,
+                    |args| async move {
+                        match args.as_slice() {
+                            [ParameterValue::Int(a), ParameterValue::Int(b)] => {
+                                Ok(ReturnValue::Int(a + b))
+                            }
+                            _ => Err(crate::new_error!("Unexpected parameters")),
+                        }
+                    },
+                )
+                .unwrap();
+            let mut multi = uninit.evolve(Noop::default()).unwrap();
+            // The guest is suspended on each of its 3 calls to `HostAdd`
+            let res = multi
+                .call_guest_function_by_name(
+                    "AddRepeatedly",
+                    ReturnType::Int,
+                    Some(vec![ParameterValue::Int(3)]),
+                )
+                .unwrap();
+            assert_eq!(res, ReturnValue::Int(3));
+            snapshotter.snapshot()
+        };
+
+        #[expect(clippy::mutable_key_type)]
+        let snapshot = snapshot.into_hashmap();
+        let histogram_key = CompositeKey::new(
+            MetricKind::Histogram,
+            Key::from_parts(
+                METRIC_GUEST_FUNC_DURATION,
+                vec![Label::new("function_name", "AddRepeatedly")],
+            ),
+        );
+        assert!(matches!(
+            &snapshot.get(&histogram_key).unwrap().2,
+            DebugValue::Histogram(histogram) if histogram.len() == 1
+        ));
+    }
+
+    #[test]
+    #[cfg(feature = "exit_metrics")]
+    #[ignore = "This test needs to be run separately to avoid having other tests interfere with it"]
+    fn test_exit_metrics_are_emitted() {
+        use metrics::Label;
+        use metrics_util::debugging::DebugValue;
+        use metrics_util::MetricKind;
+
+        let recorder = metrics_util::debugging::DebuggingRecorder::new();
+        let snapshotter = recorder.snapshotter();
+        recorder.install().unwrap();
+
+        let snapshot = {
+            let uninit = UninitializedSandbox::new(
+                GuestBinary::FilePath(simple_guest_as_string().unwrap()),
+                None,
+                None,
+                None,
+            )
+            .unwrap();
+            let mut multi = uninit.evolve(Noop::default()).unwrap();
+            multi
+                .call_guest_function_by_name(
+                    "PrintOutput",
+                    ReturnType::Int,
+                    Some(vec![ParameterValue::String("Hello".to_string())]),
+                )
+                .unwrap();
+            snapshotter.snapshot()
+        };
+
+        #[expect(clippy::mutable_key_type)]
+        let snapshot = snapshot.into_hashmap();
+
+        let count = |labels: Vec<Label>| match snapshot
+            .get(&CompositeKey::new(
+                MetricKind::Counter,
+                Key::from_parts(METRIC_VM_EXITS, labels),
+            ))
+            .map(|(_, _, value)| value)
+        {
+            Some(DebugValue::Counter(count)) => *count,
+            _ => 0,
+        };
+        let samples = |name: &'static str, labels: Vec<Label>| match snapshot
+            .get(&CompositeKey::new(
+                MetricKind::Histogram,
+                Key::from_parts(name, labels),
+            ))
+            .map(|(_, _, value)| value)
+        {
+            Some(DebugValue::Histogram(histogram)) => histogram.len() as u64,
+            _ => 0,
+        };
+
+        // Initialising the sandbox and the guest call each end with a halt, and the
+        // guest calls HostPrint through the call_function port
+        let halt = vec![Label::new(METRIC_VM_EXIT_LABEL_REASON, "halt")];
+        let call_function = vec![
+            Label::new(METRIC_VM_EXIT_LABEL_REASON, "io_out"),
+            Label::new(METRIC_VM_EXIT_LABEL_PORT, "call_function"),
+        ];
+        for labels in [halt, call_function] {
+            let exits = count(labels.clone());
+            assert!(exits >= 1, "Expected exits labelled {:?}", labels);
+            assert_eq!(
+                samples(METRIC_VM_EXIT_GUEST_DURATION, labels.clone()),
+                exits
+            );
+            assert_eq!(samples(METRIC_VM_EXIT_HANDLING_DURATION, labels), exits);
+        }
+    }
 }
@@ -96,6 +96,21 @@ pub struct SandboxConfiguration {
     /// The size of the memory buffer that is made available for serializing
     /// guest panic context
     guest_panic_context_buffer_size: usize,
+    /// The number of vCPUs the sandbox's VM is created with
+    vcpu_count: u32,
+    /// The size the guest heap can grow to on demand. If 0, or no larger
+    /// than the heap size, the heap does not grow.
+    max_heap_size: u64,
+    /// The amount of the guest's address space reserved for read-only
+    /// shared data regions
+    shared_data_size: u64,
+    /// The NUMA node to allocate the sandbox's memory on, if any
+    #[cfg(target_os = "linux")]
+    numa_node: Option<u32>,
+    /// The NUMA node whose CPUs the thread running the sandbox's vCPU is
+    /// pinned to, if any. Defaults to `numa_node` when unset.
+    #[cfg(target_os = "linux")]
+    vcpu_numa_node: Option<u32>,
 }
 
 impl SandboxConfiguration {
@@ -143,6 +158,8 @@ impl SandboxConfiguration {
     pub const DEFAULT_GUEST_PANIC_CONTEXT_BUFFER_SIZE: usize = 0x400;
     /// The minimum value for guest panic context data
     pub const MIN_GUEST_PANIC_CONTEXT_BUFFER_SIZE: usize = 0x400;
+    /// The maximum number of vCPUs a sandbox can have
+    pub const MAX_VCPU_COUNT: u32 = 64;
     /// The minimum value for kernel stack size
     pub const MIN_KERNEL_STACK_SIZE: usize = 0x1000;
     /// The default value for kernel stack size
@@ -234,6 +251,13 @@ impl SandboxConfiguration {
             ),
             #[cfg(gdb)]
             guest_debug_info,
+            vcpu_count: 1,
+            max_heap_size: 0,
+            shared_data_size: 0,
+            #[cfg(target_os = "linux")]
+            numa_node: None,
+            #[cfg(target_os = "linux")]
+            vcpu_numa_node: None,
         }
     }
 
@@ -288,6 +312,35 @@ impl SandboxConfiguration {
         self.heap_size_override = heap_size;
     }
 
+    /// Let the guest heap grow on demand, up to `max_heap_size` bytes.
+    ///
+    /// The heap starts out at the size set by `set_heap_size` (or taken
+    /// from the PE file header), and the guest allocator asks the host for
+    /// more whenever it runs out. The memory up to `max_heap_size` is
+    /// reserved up front but is only allocated once the guest writes to
+    /// it, and is neither copied into nor restored from snapshots until
+    /// the guest has grown into it. Restoring the sandbox's state shrinks
+    /// the heap back to its size when the snapshot was taken.
+    ///
+    /// If set to 0 (the default), or to a size no larger than the heap
+    /// size, the heap does not grow.
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub fn set_max_heap_size(&mut self, max_heap_size: u64) {
+        self.max_heap_size = max_heap_size;
+    }
+
+    /// Reserve `shared_data_size` bytes of the guest's address space for
+    /// read-only shared data regions, which are mapped into the sandbox
+    /// with `UninitializedSandbox::map_shared_data`. Each region takes up
+    /// its size rounded up to a multiple of 2MB.
+    ///
+    /// The reservation costs one page of page tables for each 1GB, and no
+    /// memory besides. The default is 0, i.e. no shared data regions.
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub fn set_shared_data_size(&mut self, shared_data_size: u64) {
+        self.shared_data_size = shared_data_size;
+    }
+
     /// Set the kernel stack size to use in the guest sandbox. If less than the minimum value of MIN_KERNEL_STACK_SIZE, the minimum value will be used.
     /// If its not a multiple of the page size, it will be increased to the a multiple of the page size when memory is allocated.
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
@@ -367,6 +420,42 @@ impl SandboxConfiguration {
         self.guest_debug_info = Some(debug_info);
     }
 
+    /// Set the number of vCPUs the sandbox's VM is created with. The
+    /// minimum value is 1 and the maximum is `MAX_VCPU_COUNT`.
+    ///
+    /// The guest starts on the first vCPU as usual; the others are idle
+    /// until the guest hands them work, e.g. with
+    /// `hyperlight_guest::parallel::parallel_for`, so that a single guest
+    /// call can use several host cores. More than one vCPU is currently
+    /// only supported on KVM.
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub fn set_vcpu_count(&mut self, vcpu_count: u32) {
+        self.vcpu_count = vcpu_count.clamp(1, Self::MAX_VCPU_COUNT);
+    }
+
+    /// Place the sandbox on NUMA node `node`.
+    ///
+    /// The sandbox's memory, and the snapshot its memory is restored from
+    /// after each guest call, are bound to `node`, and the thread running
+    /// the sandbox's vCPU is pinned to the CPUs of `node`. Creating the
+    /// sandbox fails if `node` does not exist.
+    #[cfg(target_os = "linux")]
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub fn set_numa_node(&mut self, node: u32) {
+        self.numa_node = Some(node);
+    }
+
+    /// Pin the thread running the sandbox's vCPU to the CPUs of NUMA node
+    /// `node`, instead of those of the node set with `set_numa_node`.
+    ///
+    /// This is mostly useful for measuring the cost of running a guest
+    /// whose memory is on a remote node.
+    #[cfg(target_os = "linux")]
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub fn set_vcpu_numa_node(&mut self, node: u32) {
+        self.vcpu_numa_node = Some(node);
+    }
+
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
     pub(crate) fn get_guest_error_buffer_size(&self) -> usize {
         self.guest_error_buffer_size
@@ -417,6 +506,33 @@ impl SandboxConfiguration {
         self.guest_debug_info
     }
 
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn get_vcpu_count(&self) -> u32 {
+        self.vcpu_count
+    }
+
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn get_max_heap_size(&self) -> u64 {
+        self.max_heap_size
+    }
+
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn get_shared_data_size(&self) -> u64 {
+        self.shared_data_size
+    }
+
+    #[cfg(target_os = "linux")]
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn get_numa_node(&self) -> Option<u32> {
+        self.numa_node
+    }
+
+    #[cfg(target_os = "linux")]
+    #[instrument(skip_all, parent = Span::current(), level= "Trace")]
+    pub(crate) fn get_vcpu_numa_node(&self) -> Option<u32> {
+        self.vcpu_numa_node.or(self.numa_node)
+    }
+
     #[instrument(skip_all, parent = Span::current(), level= "Trace")]
     fn stack_size_override_opt(&self) -> Option<u64> {
         (self.stack_size_override > 0).then_some(self.stack_size_override)
@@ -662,6 +778,42 @@ mod tests {
         );
     }
 
+    #[test]
+    fn vcpu_count() {
+        let mut cfg = SandboxConfiguration::default();
+        assert_eq!(1, cfg.get_vcpu_count());
+        cfg.set_vcpu_count(4);
+        assert_eq!(4, cfg.get_vcpu_count());
+        cfg.set_vcpu_count(0);
+        assert_eq!(1, cfg.get_vcpu_count());
+        cfg.set_vcpu_count(u32::MAX);
+        assert_eq!(SandboxConfiguration::MAX_VCPU_COUNT, cfg.get_vcpu_count());
+    }
+
+    #[test]
+    fn max_heap_size() {
+        let mut cfg = SandboxConfiguration::default();
+        assert_eq!(0, cfg.get_max_heap_size());
+        cfg.set_max_heap_size(0x4000_0000);
+        assert_eq!(0x4000_0000, cfg.get_max_heap_size());
+    }
+
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn numa_nodes() {
+        let mut cfg = SandboxConfiguration::default();
+        assert_eq!(None, cfg.get_numa_node());
+        assert_eq!(None, cfg.get_vcpu_numa_node());
+
+        cfg.set_numa_node(1);
+        assert_eq!(Some(1), cfg.get_numa_node());
+        assert_eq!(Some(1), cfg.get_vcpu_numa_node());
+
+        cfg.set_vcpu_numa_node(0);
+        assert_eq!(Some(1), cfg.get_numa_node());
+        assert_eq!(Some(0), cfg.get_vcpu_numa_node());
+    }
+
     mod proptests {
         use proptest::prelude::*;
 
@@ -14,26 +14,46 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+use std::collections::HashMap;
 use std::io::{IsTerminal, Write};
 
-use hyperlight_common::flatbuffer_wrappers::function_types::{ParameterValue, ReturnValue};
+use hyperlight_common::flatbuffer_wrappers::function_call::FunctionCall;
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterValue, ReturnType, ReturnValue,
+};
 use hyperlight_common::flatbuffer_wrappers::host_function_definition::HostFunctionDefinition;
 use hyperlight_common::flatbuffer_wrappers::host_function_details::HostFunctionDetails;
 use termcolor::{Color, ColorChoice, ColorSpec, StandardStream, WriteColor};
 use tracing::{instrument, Span};
 
+use super::recording::{CallRecording, Replay};
 use super::{ExtraAllowedSyscall, FunctionsMap};
-use crate::func::HyperlightFunction;
+use crate::func::{AsyncHyperlightFunction, HostFunctionFuture, HyperlightFunction};
 use crate::mem::mgr::SandboxMemoryManager;
 use crate::mem::shared_mem::ExclusiveSharedMemory;
-use crate::HyperlightError::HostFunctionNotFound;
+use crate::HyperlightError::{ExecutionSuspendedByHost, HostFunctionNotFound};
 use crate::{new_error, Result};
 
-#[derive(Default, Clone)]
+/// A call to an async host function that the guest is suspended waiting on
+pub(crate) struct PendingHostCall {
+    /// The call the guest made
+    pub(crate) call: FunctionCall,
+    /// The future that completes the call
+    pub(crate) future: HostFunctionFuture,
+}
+
+#[derive(Default)]
 /// A Wrapper around details of functions exposed by the Host
 pub struct HostFuncsWrapper {
     functions_map: FunctionsMap,
+    async_functions: HashMap<String, AsyncHyperlightFunction>,
     function_details: HostFunctionDetails,
+    /// The async host function call the guest is waiting on, if any
+    pending: Option<PendingHostCall>,
+    /// The guest calls being recorded, if a recording is in progress
+    recording: Option<CallRecording>,
+    /// The guest call being replayed, if one is
+    replay: Option<Replay>,
 }
 
 impl HostFuncsWrapper {
@@ -54,6 +74,11 @@ impl HostFuncsWrapper {
         &mut self.function_details
     }
 
+    /// Whether a host function called `name` has been registered
+    pub(super) fn has_host_function(&self, name: &str) -> bool {
+        self.functions_map.get(name).is_some() || self.async_functions.contains_key(name)
+    }
+
     /// Register a host function with the sandbox.
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
     pub(crate) fn register_host_function(
@@ -79,6 +104,19 @@ impl HostFuncsWrapper {
         register_host_function_helper(self, mgr, hfd, func, Some(extra_allowed_syscalls))
     }
 
+    /// Register a host function that returns a future with the sandbox.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(crate) fn register_async_host_function(
+        &mut self,
+        mgr: &mut SandboxMemoryManager<ExclusiveSharedMemory>,
+        hfd: &HostFunctionDefinition,
+        func: AsyncHyperlightFunction,
+    ) -> Result<()> {
+        self.async_functions
+            .insert(hfd.function_name.to_string(), func);
+        write_host_function_details(self, mgr, hfd)
+    }
+
     /// Assuming a host function called `"HostPrint"` exists, and takes a
     /// single string parameter, call it with the given `msg` parameter.
     ///
@@ -109,6 +147,110 @@ impl HostFuncsWrapper {
     ) -> Result<ReturnValue> {
         call_host_func_impl(self.get_host_funcs(), name, args)
     }
+
+    /// Call the host function the guest asked for with `call`, recording
+    /// the call and its result if a recording is in progress. While a
+    /// guest call is being replayed the host function is not called, and
+    /// the guest gets the recorded result instead.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub(super) fn call_host_function_for_guest(
+        &mut self,
+        call: FunctionCall,
+    ) -> Result<ReturnValue> {
+        if let Some(replay) = self.replay.as_mut() {
+            return replay.next_host_result(&call);
+        }
+        if let Some(func) = self.async_functions.get(&call.function_name) {
+            // Start the host function, and suspend the guest until whoever
+            // is driving the guest call has awaited the future and resumed it
+            let future = func.call(call.parameters.clone().unwrap_or_default());
+            self.pending = Some(PendingHostCall { call, future });
+            return Err(ExecutionSuspendedByHost());
+        }
+        let args = call.parameters.clone().unwrap_or_default();
+        let res = self.call_host_function(&call.function_name, args);
+        if let Some(recording) = self.recording.as_mut() {
+            recording.record_host_call(call, &res);
+        }
+        res
+    }
+
+    /// Take the async host function call the guest is suspended waiting on
+    pub(crate) fn take_pending_host_call(&mut self) -> Option<PendingHostCall> {
+        self.pending.take()
+    }
+
+    /// Record the result of an async host function call taken with
+    /// `take_pending_host_call`, if a recording is in progress
+    pub(crate) fn finish_pending_host_call(
+        &mut self,
+        call: FunctionCall,
+        result: &Result<ReturnValue>,
+    ) {
+        if let Some(recording) = self.recording.as_mut() {
+            recording.record_host_call(call, result);
+        }
+    }
+
+    /// Start recording guest calls, replacing any recording in progress
+    pub(super) fn start_recording(&mut self) {
+        self.recording = Some(CallRecording::new(self.function_details.clone()));
+    }
+
+    /// Stop recording guest calls, and return what was recorded
+    pub(super) fn stop_recording(&mut self) -> Option<CallRecording> {
+        self.recording.take()
+    }
+
+    /// Record the start of a guest call, if a recording is in progress
+    pub(crate) fn begin_guest_call(
+        &mut self,
+        function_name: &str,
+        return_type: ReturnType,
+        args: &Option<Vec<ParameterValue>>,
+    ) {
+        if let Some(recording) = self.recording.as_mut() {
+            recording.begin_guest_call(function_name, return_type, args);
+        }
+    }
+
+    /// Record the result of the guest call started by `begin_guest_call`
+    pub(crate) fn end_guest_call(&mut self, result: &Result<ReturnValue>) {
+        if let Some(recording) = self.recording.as_mut() {
+            recording.end_guest_call(result);
+        }
+    }
+
+    /// Record that the sandbox's state was reset after the last guest call
+    pub(super) fn record_reset(&mut self) {
+        if let Some(recording) = self.recording.as_mut() {
+            recording.record_reset();
+        }
+    }
+
+    /// Answer the guest's host function calls from `replay` rather than
+    /// calling the host functions, until `stop_replay` is called
+    pub(super) fn start_replay(&mut self, replay: Replay) {
+        self.replay = Some(replay);
+    }
+
+    /// Stop replaying, and return what is left of the replay
+    pub(super) fn stop_replay(&mut self) -> Option<Replay> {
+        self.replay.take()
+    }
+
+    /// A copy of these host functions for a forked sandbox, which starts
+    /// out neither recording nor replaying, nor waiting on a host function
+    pub(super) fn clone_for_fork(&self) -> Self {
+        Self {
+            functions_map: self.functions_map.clone(),
+            async_functions: self.async_functions.clone(),
+            function_details: self.function_details.clone(),
+            pending: None,
+            recording: None,
+            replay: None,
+        }
+    }
 }
 
 fn register_host_function_helper(
@@ -133,6 +275,16 @@ fn register_host_function_helper(
             .get_host_funcs_mut()
             .insert(hfd.function_name.to_string(), func, None);
     }
+    write_host_function_details(self_, mgr, hfd)
+}
+
+/// Add `hfd` to the details of the host functions, and write them to the
+/// guest's memory
+fn write_host_function_details(
+    self_: &mut HostFuncsWrapper,
+    mgr: &mut SandboxMemoryManager<ExclusiveSharedMemory>,
+    hfd: &HostFunctionDefinition,
+) -> Result<()> {
     self_
         .get_host_func_details_mut()
         .insert_host_function(hfd.clone());
@@ -14,7 +14,10 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
 
 use hyperlight_common::flatbuffer_wrappers::function_types::{
     ParameterValue, ReturnType, ReturnValue,
@@ -22,14 +25,19 @@ use hyperlight_common::flatbuffer_wrappers::function_types::{
 use tracing::{instrument, Span};
 
 use super::host_funcs::HostFuncsWrapper;
+use super::recording::{CallRecording, Replay, ReplayReport};
+use super::uninitialized_evolve::evolve_impl_forked;
 use super::{MemMgrWrapper, WrapperGetter};
 use crate::func::call_ctx::MultiUseGuestCallContext;
-use crate::func::guest_dispatch::call_function_on_guest;
-use crate::hypervisor::hypervisor_handler::HypervisorHandler;
+use crate::func::guest_dispatch::{
+    call_function_on_guest, call_function_on_guest_async, call_function_on_guest_with_time_slice,
+    resume_function_on_guest,
+};
+use crate::hypervisor::hypervisor_handler::{HypervisorHandler, HypervisorHandlerAction};
 use crate::mem::shared_mem::HostSharedMemory;
 use crate::sandbox_state::sandbox::{DevolvableSandbox, EvolvableSandbox, Sandbox};
 use crate::sandbox_state::transition::{MultiUseContextCallback, Noop};
-use crate::Result;
+use crate::{log_then_return, new_error, Result, UninitializedSandbox};
 
 /// A sandbox that supports being used Multiple times.
 /// The implication of being used multiple times is two-fold:
@@ -44,8 +52,14 @@ pub struct MultiUseSandbox {
     pub(super) _host_funcs: Arc<Mutex<HostFuncsWrapper>>,
     pub(crate) mem_mgr: MemMgrWrapper<HostSharedMemory>,
     hv_handler: HypervisorHandler,
+    /// Identifies the sandbox, so that a `SuspendedGuestCall` can only be
+    /// resumed or cancelled on the sandbox it was made on
+    id: u64,
 }
 
+/// The id the next `MultiUseSandbox` gets
+static NEXT_SANDBOX_ID: AtomicU64 = AtomicU64::new(0);
+
 // We need to implement drop to join the
 // threads, because, otherwise, we will
 // be leaking a thread with every
@@ -65,6 +79,127 @@ impl Drop for MultiUseSandbox {
     }
 }
 
+/// The outcome of running a guest function call for a time slice, with
+/// `MultiUseSandbox::call_guest_function_with_time_slice` or
+/// `MultiUseSandbox::resume_guest_call`
+#[derive(Debug)]
+pub enum GuestCallStatus {
+    /// The call finished and returned the given value
+    Completed(ReturnValue),
+    /// The call was still running at the end of its time slice and has
+    /// been suspended. Pass the `SuspendedGuestCall` to
+    /// `MultiUseSandbox::resume_guest_call` to continue it, or to
+    /// `MultiUseSandbox::cancel_guest_call` to discard it.
+    Suspended(SuspendedGuestCall),
+}
+
+/// A guest function call that has been suspended part way through.
+///
+/// The guest's memory and vCPU state are kept in the sandbox the call was
+/// made on; no other guest function can be called on that sandbox until
+/// the call is resumed to completion or cancelled. The sandbox (and this
+/// handle) can be moved to another thread in the meantime. If this handle
+/// is dropped, the call can still be cancelled with
+/// `MultiUseSandbox::cancel_suspended_call`.
+#[derive(Debug)]
+pub struct SuspendedGuestCall {
+    function_name: String,
+    run_time: Duration,
+    /// The id of the sandbox the call was made on
+    sandbox_id: u64,
+}
+
+impl SuspendedGuestCall {
+    /// The name of the suspended guest function
+    pub fn function_name(&self) -> &str {
+        &self.function_name
+    }
+
+    /// The total time the call has spent running so far, across all of its
+    /// time slices
+    pub fn run_time(&self) -> Duration {
+        self.run_time
+    }
+}
+
+/// Discards a guest call made with
+/// `MultiUseSandbox::call_guest_function_by_name_async` if the call's
+/// future is dropped before the call finishes, i.e. while the guest is
+/// suspended waiting on an async host function. The host function's
+/// future is dropped, the vCPU set up again and the sandbox's state
+/// restored, as for `MultiUseSandbox::cancel_suspended_call`.
+struct AsyncCallGuard<'a> {
+    sandbox: &'a mut MultiUseSandbox,
+    finished: bool,
+}
+
+impl Drop for AsyncCallGuard<'_> {
+    fn drop(&mut self) {
+        if self.finished {
+            return;
+        }
+        let ended = self
+            .sandbox
+            ._host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))
+            .map(|mut host_funcs| {
+                host_funcs.end_guest_call(&Err(new_error!(
+                    "The guest call was dropped before it finished"
+                )))
+            });
+        let res = ended.and_then(|()| {
+            if self.sandbox.hv_handler.is_suspended() {
+                self.sandbox.cancel_suspended_call()
+            } else {
+                self.sandbox.restore_state()
+            }
+        });
+        if let Err(e) = res {
+            log::error!("Failed to discard a dropped guest call: {:?}", e);
+        }
+    }
+}
+
+/// A breakdown of the memory a sandbox takes up, returned by
+/// `MultiUseSandbox::memory_footprint`. All sizes are in bytes.
+///
+/// Memory that is shared with other sandboxes is counted in full by each
+/// of them: the pages a fork has not written to since it was forked, the
+/// snapshot forks of the same sandbox share, and shared data mapped with
+/// `UninitializedSandbox::map_shared_data` (which is not counted at all).
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct MemoryFootprint {
+    /// The size of the guest's memory, of which only the pages the guest
+    /// has touched take up physical memory
+    pub guest_memory_size: usize,
+    /// The part of the guest's memory that is resident
+    pub guest_memory: usize,
+    /// The part of the guest's page tables that is resident. This is
+    /// included in `guest_memory`.
+    pub page_tables: usize,
+    /// The part of the buffers guest calls, host function calls and their
+    /// results are passed through that is resident. These are in the
+    /// guest's memory, and included in `guest_memory`.
+    pub io_buffers: usize,
+    /// The part of the snapshots the guest's memory is reset from that is
+    /// resident
+    pub snapshots: usize,
+    /// The part of the stack of the thread that runs the sandbox's vCPU
+    /// that is resident. The stacks of the threads that run worker vCPUs
+    /// (see `SandboxConfiguration::set_vcpu_count`) are not included;
+    /// those threads are parked between calls.
+    pub handler_thread_stack: usize,
+}
+
+impl MemoryFootprint {
+    /// The total memory the sandbox takes up: its resident guest memory
+    /// and snapshots, and its handler thread's stack
+    pub fn total(&self) -> usize {
+        self.guest_memory + self.snapshots + self.handler_thread_stack
+    }
+}
+
 impl MultiUseSandbox {
     /// Move an `UninitializedSandbox` into a new `MultiUseSandbox` instance.
     ///
@@ -81,6 +216,7 @@ impl MultiUseSandbox {
             _host_funcs: host_funcs,
             mem_mgr: mgr,
             hv_handler,
+            id: NEXT_SANDBOX_ID.fetch_add(1, Ordering::Relaxed),
         }
     }
 
@@ -163,14 +299,360 @@ impl MultiUseSandbox {
         func_ret_type: ReturnType,
         args: Option<Vec<ParameterValue>>,
     ) -> Result<ReturnValue> {
+        if self.hv_handler.is_suspended() {
+            log_then_return!(
+                "Cannot call guest function {} while another guest call is suspended",
+                func_name
+            );
+        }
         let res = call_function_on_guest(self, func_name, func_ret_type, args);
         self.restore_state()?;
         res
     }
 
+    /// Call a guest function by name, with the given return type and
+    /// arguments, awaiting any async host functions the guest calls.
+    ///
+    /// This is the same as `call_guest_function_by_name`, except that while
+    /// the guest is suspended waiting on an async host function the
+    /// function's future is awaited by the task calling this, rather than
+    /// blocking its thread. The guest itself still runs on the sandbox's
+    /// own thread, and the task is blocked while it does. The sandbox's
+    /// `max_execution_time` applies to each stretch of guest execution,
+    /// not counting the time spent waiting on host functions.
+    #[instrument(err(Debug), skip(self, args), parent = Span::current())]
+    pub async fn call_guest_function_by_name_async(
+        &mut self,
+        func_name: &str,
+        func_ret_type: ReturnType,
+        args: Option<Vec<ParameterValue>>,
+    ) -> Result<ReturnValue> {
+        if self.hv_handler.is_suspended() {
+            log_then_return!(
+                "Cannot call guest function {} while another guest call is suspended",
+                func_name
+            );
+        }
+        // If this future is dropped before the call finishes, the guard
+        // discards the call so that the sandbox can still be used
+        let mut guard = AsyncCallGuard {
+            sandbox: self,
+            finished: false,
+        };
+        let res =
+            call_function_on_guest_async(&mut *guard.sandbox, func_name, func_ret_type, args).await;
+        guard.finished = true;
+        guard.sandbox.restore_state()?;
+        res
+    }
+
+    /// Call a guest function by name, with the given return type and
+    /// arguments, letting it run for at most `time_slice` before it is
+    /// suspended.
+    ///
+    /// If the call finishes within the time slice, the sandbox's state is
+    /// reset as for `call_guest_function_by_name`. Otherwise the call is
+    /// suspended and a `SuspendedGuestCall` is returned, without losing
+    /// the work done so far. `max_execution_time` does not apply to calls
+    /// made this way: the caller bounds them by choosing whether to resume
+    /// or cancel them.
+    #[instrument(err(Debug), skip(self, args), parent = Span::current())]
+    pub fn call_guest_function_with_time_slice(
+        &mut self,
+        func_name: &str,
+        func_ret_type: ReturnType,
+        args: Option<Vec<ParameterValue>>,
+        time_slice: Duration,
+    ) -> Result<GuestCallStatus> {
+        let start = Instant::now();
+        let res = call_function_on_guest_with_time_slice(
+            self,
+            func_name,
+            func_ret_type,
+            args,
+            time_slice,
+        );
+        self.finish_time_slice(func_name, res, start.elapsed())
+    }
+
+    /// Continue a guest call suspended by
+    /// `call_guest_function_with_time_slice` (or by an earlier call to this
+    /// function) for at most another `time_slice`.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn resume_guest_call(
+        &mut self,
+        call: SuspendedGuestCall,
+        time_slice: Duration,
+    ) -> Result<GuestCallStatus> {
+        self.check_suspended_here(&call)?;
+        let start = Instant::now();
+        let res = resume_function_on_guest(self, &call.function_name, time_slice);
+        self.finish_time_slice(&call.function_name, res, call.run_time + start.elapsed())
+    }
+
+    /// Discard a suspended guest call, resetting the sandbox's state to
+    /// what it was before the call was made.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn cancel_guest_call(&mut self, call: SuspendedGuestCall) -> Result<()> {
+        self.check_suspended_here(&call)?;
+        self.cancel_suspended_call()
+    }
+
+    /// Whether a guest call made on this sandbox is suspended
+    pub fn has_suspended_call(&self) -> bool {
+        self.hv_handler.is_suspended()
+    }
+
+    /// Discard the guest call that is suspended on this sandbox, if any,
+    /// resetting the sandbox's state to what it was before the call was
+    /// made. This is `cancel_guest_call` for when the call's
+    /// `SuspendedGuestCall` has been lost.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn cancel_suspended_call(&mut self) -> Result<()> {
+        if !self.hv_handler.is_suspended() {
+            return Ok(());
+        }
+        // Drop any async host function call it was waiting on
+        self._host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+            .take_pending_host_call();
+        self.restore_state()?;
+        // The vCPU was stopped part way through the call, so set it up
+        // again, as is done after a call is cancelled on a timeout
+        self.hv_handler
+            .execute_hypervisor_handler_action(HypervisorHandlerAction::Initialise)
+    }
+
+    /// Check that `call` is suspended on this sandbox
+    fn check_suspended_here(&self, call: &SuspendedGuestCall) -> Result<()> {
+        if call.sandbox_id != self.id || !self.hv_handler.is_suspended() {
+            log_then_return!(
+                "Guest call {} is not suspended on this sandbox",
+                call.function_name
+            );
+        }
+        Ok(())
+    }
+
+    /// Turn the result of running a guest call for a time slice into a
+    /// `GuestCallStatus`, resetting the sandbox's state unless the call was
+    /// suspended
+    fn finish_time_slice(
+        &mut self,
+        func_name: &str,
+        res: Result<Option<ReturnValue>>,
+        run_time: Duration,
+    ) -> Result<GuestCallStatus> {
+        match res {
+            Ok(None) => Ok(GuestCallStatus::Suspended(SuspendedGuestCall {
+                function_name: func_name.to_string(),
+                run_time,
+                sandbox_id: self.id,
+            })),
+            Ok(Some(ret)) => {
+                self.restore_state()?;
+                Ok(GuestCallStatus::Completed(ret))
+            }
+            Err(e) => {
+                // Leave the state alone if the error was about a different,
+                // still suspended, call
+                if !self.hv_handler.is_suspended() {
+                    self.restore_state()?;
+                }
+                Err(e)
+            }
+        }
+    }
+
+    /// Fork this sandbox into a new, independent `MultiUseSandbox`.
+    ///
+    /// The new sandbox gets its own VM, whose memory starts out as the
+    /// state guest calls in `self` are reset to (i.e. the state captured by
+    /// the last `evolve`), and its own copy of the registered host
+    /// functions. Guest calls in the fork are reset to that same state.
+    ///
+    /// On Linux the fork's memory is a copy-on-write view of that state, so
+    /// after the first fork from a given state, the cost of a fork is
+    /// proportional to the pages it later writes rather than to the size of
+    /// the sandbox. Note that forks share the guest's random seed and stack
+    /// cookie with the sandbox they were forked from, but not any recording
+    /// of guest calls in progress. A sandbox with a channel mapped cannot
+    /// be forked, as the fork would be a second end of the channel.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn fork(&self) -> Result<MultiUseSandbox> {
+        let mgr = MemMgrWrapper::new(
+            self.mem_mgr.unwrap_mgr().fork()?,
+            *self.mem_mgr.get_stack_cookie(),
+        );
+        let host_funcs = Arc::new(Mutex::new(
+            self._host_funcs
+                .try_lock()
+                .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+                .clone_for_fork(),
+        ));
+        let config = self.hv_handler.configuration();
+        let u_sbox = UninitializedSandbox {
+            host_funcs,
+            mgr,
+            run_inprocess: false,
+            max_initialization_time: config.max_init_time,
+            max_execution_time: config.max_exec_time,
+            max_wait_for_cancellation: config.max_wait_for_cancellation,
+            max_guest_log_level: config.max_guest_log_level,
+            #[cfg(gdb)]
+            debug_info: None,
+        };
+        evolve_impl_forked(u_sbox)
+    }
+
+    /// Measure how much memory this sandbox takes up, broken down by what
+    /// it is used for.
+    ///
+    /// Resident sizes are measured on Linux. On Windows every page of the
+    /// guest's memory, snapshots and handler thread stack is counted as
+    /// resident, so the result is an upper bound.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn memory_footprint(&self) -> Result<MemoryFootprint> {
+        let mut footprint = self.mem_mgr.unwrap_mgr().memory_footprint()?;
+        footprint.handler_thread_stack = self.hv_handler.thread_stack_resident_bytes()?;
+        Ok(footprint)
+    }
+
+    /// Start recording the guest calls made to this sandbox, replacing any
+    /// recording already in progress.
+    ///
+    /// Every guest call made from then on, either directly or through a
+    /// `MultiUseGuestCallContext`, is recorded along with the host function
+    /// calls the guest makes during it and the results they return, until
+    /// `stop_recording` is called. The recording can be saved to a file and
+    /// replayed, with `replay_recording`, on a sandbox for the same guest
+    /// that has none of the real host functions.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn start_recording(&mut self) -> Result<()> {
+        self._host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+            .start_recording();
+        Ok(())
+    }
+
+    /// Stop recording guest calls, and return the recording.
+    ///
+    /// Returns an error if `start_recording` has not been called.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn stop_recording(&mut self) -> Result<CallRecording> {
+        self._host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+            .stop_recording()
+            .ok_or_else(|| new_error!("There is no recording of guest calls in progress"))
+    }
+
+    /// Replay the guest calls in `recording` on this sandbox.
+    ///
+    /// The calls are made in the order they were recorded, and the
+    /// sandbox's state is reset after the same calls it was reset after
+    /// when they were recorded. Rather than calling the sandbox's host
+    /// functions, the guest gets the result each host function returned
+    /// when the calls were recorded, so the sandbox only needs stubs for
+    /// them (see `UninitializedSandbox::register_replay_stubs`).
+    ///
+    /// Where the guest behaves differently from when the calls were
+    /// recorded (it calls a different host function or passes different
+    /// arguments, makes fewer host function calls, or a guest call returns
+    /// something different), a description of the difference is added to
+    /// the report's `divergences`, and the replay continues with the next
+    /// guest call.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn replay_recording(&mut self, recording: &CallRecording) -> Result<ReplayReport> {
+        if self.hv_handler.is_suspended() {
+            log_then_return!("Cannot replay a recording while a guest call is suspended");
+        }
+        let mut report = ReplayReport::default();
+        for (i, recorded) in recording.calls().iter().enumerate() {
+            let name = &recorded.call.function_name;
+            self._host_funcs
+                .try_lock()
+                .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+                .start_replay(Replay::new(&recorded.host_calls));
+
+            let start = Instant::now();
+            let res = call_function_on_guest(
+                self,
+                name,
+                recorded.call.expected_return_type,
+                recorded.call.parameters.clone(),
+            );
+            report.elapsed += start.elapsed();
+            report.calls += 1;
+
+            let replay = self
+                ._host_funcs
+                .try_lock()
+                .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+                .stop_replay();
+            if recorded.reset_after {
+                self.restore_state()?;
+            }
+
+            match (&recorded.result, &res) {
+                (Ok(expected), Ok(actual)) if expected != actual => {
+                    report.divergences.push(format!(
+                        "Call {} to {} returned {:?} rather than {:?}",
+                        i, name, actual, expected
+                    ));
+                }
+                (Ok(expected), Err(e)) => {
+                    report.divergences.push(format!(
+                        "Call {} to {} failed with {:?} rather than returning {:?}",
+                        i, name, e, expected
+                    ));
+                }
+                (Err(expected), Ok(actual)) => {
+                    report.divergences.push(format!(
+                        "Call {} to {} returned {:?} rather than failing with {}",
+                        i, name, actual, expected
+                    ));
+                }
+                _ => {}
+            }
+            let remaining = replay.map_or(0, |replay| replay.remaining());
+            if remaining > 0 {
+                report.divergences.push(format!(
+                    "Call {} to {} made {} fewer host function calls than were recorded",
+                    i, name, remaining
+                ));
+            }
+        }
+        Ok(report)
+    }
+
+    /// Write the current state of this sandbox to a snapshot file at `path`.
+    ///
+    /// The file can be loaded with `UninitializedSandbox::from_snapshot_file`
+    /// in this or another process running the same version of this crate,
+    /// skipping guest binary loading and initialisation. The state written
+    /// is the one guest calls are reset to, i.e. the one captured by the
+    /// last `evolve`.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn save_snapshot_file(&mut self, path: &Path) -> Result<()> {
+        if self.hv_handler.is_suspended() {
+            log_then_return!("Cannot save a snapshot file while a guest call is suspended");
+        }
+        let stack_cookie = *self.mem_mgr.get_stack_cookie();
+        self.mem_mgr
+            .unwrap_mgr_mut()
+            .write_snapshot_file(path, stack_cookie)
+    }
+
     /// Restore the Sandbox's state
     #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
     pub(crate) fn restore_state(&mut self) -> Result<()> {
+        self._host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+            .record_reset();
         let mem_mgr = self.mem_mgr.unwrap_mgr_mut();
         mem_mgr.restore_state_from_last_snapshot()
     }
@@ -183,6 +665,9 @@ impl WrapperGetter for MultiUseSandbox {
     fn get_mgr_wrapper_mut(&mut self) -> &mut MemMgrWrapper<HostSharedMemory> {
         &mut self.mem_mgr
     }
+    fn get_host_funcs(&self) -> &Arc<Mutex<HostFuncsWrapper>> {
+        &self._host_funcs
+    }
     fn get_hv_handler(&self) -> &HypervisorHandler {
         &self.hv_handler
     }
@@ -257,13 +742,17 @@ where
 
 #[cfg(test)]
 mod tests {
+    use std::time::Duration;
+
     use hyperlight_common::flatbuffer_wrappers::function_types::{
         ParameterValue, ReturnType, ReturnValue,
     };
     use hyperlight_testing::simple_guest_as_string;
 
     use crate::func::call_ctx::MultiUseGuestCallContext;
-    use crate::sandbox::SandboxConfiguration;
+    #[cfg(kvm)]
+    use crate::sandbox::hypervisor::{get_available_hypervisor, HypervisorType};
+    use crate::sandbox::{GuestCallStatus, SandboxConfiguration};
     use crate::sandbox_state::sandbox::{DevolvableSandbox, EvolvableSandbox};
     use crate::sandbox_state::transition::{MultiUseContextCallback, Noop};
     use crate::{GuestBinary, MultiUseSandbox, UninitializedSandbox};
@@ -351,4 +840,277 @@ mod tests {
             .unwrap();
         assert_eq!(res, ReturnValue::Int(0));
     }
+
+    /// Tests that a forked sandbox starts from the state of the sandbox it
+    /// was forked from, and that forks do not affect each other
+    #[test]
+    fn fork_is_independent() {
+        let sbox1: MultiUseSandbox = {
+            let path = simple_guest_as_string().unwrap();
+            let u_sbox =
+                UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None).unwrap();
+            u_sbox.evolve(Noop::default())
+        }
+        .unwrap();
+
+        let func = Box::new(|call_ctx: &mut MultiUseGuestCallContext| {
+            call_ctx.call(
+                "AddToStatic",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(5)]),
+            )?;
+            Ok(())
+        });
+        let transition_func = MultiUseContextCallback::from(func);
+        let mut parent = sbox1.evolve(transition_func).unwrap();
+
+        let child1 = parent.fork().unwrap();
+        let mut child2 = parent.fork().unwrap();
+
+        let mut ctx = child1.new_call_context();
+        let res = ctx
+            .call(
+                "AddToStatic",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(3)]),
+            )
+            .unwrap();
+        assert_eq!(res, ReturnValue::Int(8));
+        let mut child1 = ctx.finish().unwrap();
+
+        for sbox in [&mut parent, &mut child1, &mut child2] {
+            let res = sbox
+                .call_guest_function_by_name("GetStatic", ReturnType::Int, None)
+                .unwrap();
+            assert_eq!(res, ReturnValue::Int(5));
+        }
+
+        // a fork can itself be forked
+        let mut grandchild = child2.fork().unwrap();
+        let res = grandchild
+            .call_guest_function_by_name("GetStatic", ReturnType::Int, None)
+            .unwrap();
+        assert_eq!(res, ReturnValue::Int(5));
+    }
+
+    #[test]
+    fn memory_footprint_breakdown() {
+        let path = simple_guest_as_string().unwrap();
+        let mut sbox: MultiUseSandbox =
+            UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None)
+                .unwrap()
+                .evolve(Noop::default())
+                .unwrap();
+        sbox.call_guest_function_by_name(
+            "Echo",
+            ReturnType::String,
+            Some(vec![ParameterValue::String("hello".to_string())]),
+        )
+        .unwrap();
+
+        let footprint = sbox.memory_footprint().unwrap();
+        assert!(footprint.guest_memory > 0);
+        assert!(footprint.guest_memory <= footprint.guest_memory_size);
+        assert!(footprint.page_tables > 0);
+        assert!(footprint.page_tables + footprint.io_buffers <= footprint.guest_memory);
+        assert!(footprint.snapshots > 0);
+        assert!(footprint.handler_thread_stack > 0);
+        assert_eq!(
+            footprint.total(),
+            footprint.guest_memory + footprint.snapshots + footprint.handler_thread_stack
+        );
+    }
+
+    /// Tests that a sandbox loaded from a snapshot file resumes from the
+    /// state the original sandbox was in when the file was written
+    #[test]
+    fn snapshot_file_round_trip() {
+        let sbox1: MultiUseSandbox = {
+            let path = simple_guest_as_string().unwrap();
+            let u_sbox =
+                UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None).unwrap();
+            u_sbox.evolve(Noop::default())
+        }
+        .unwrap();
+
+        let func = Box::new(|call_ctx: &mut MultiUseGuestCallContext| {
+            call_ctx.call(
+                "AddToStatic",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(5)]),
+            )?;
+            Ok(())
+        });
+        let transition_func = MultiUseContextCallback::from(func);
+        let mut sbox2 = sbox1.evolve(transition_func).unwrap();
+
+        let dir = tempfile::tempdir().unwrap();
+        let snapshot_path = dir.path().join("sandbox.snapshot");
+        sbox2.save_snapshot_file(&snapshot_path).unwrap();
+        drop(sbox2);
+
+        let u_sbox = UninitializedSandbox::from_snapshot_file(&snapshot_path, None, None).unwrap();
+        let mut sbox3: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+        for _ in 0..2 {
+            let res = sbox3
+                .call_guest_function_by_name("GetStatic", ReturnType::Int, None)
+                .unwrap();
+            assert_eq!(res, ReturnValue::Int(5));
+            let res = sbox3
+                .call_guest_function_by_name(
+                    "Echo",
+                    ReturnType::String,
+                    Some(vec![ParameterValue::String("hello".to_string())]),
+                )
+                .unwrap();
+            assert_eq!(res, ReturnValue::String("hello".to_string()));
+        }
+    }
+
+    #[test]
+    fn suspend_and_resume_guest_call() {
+        const N: i32 = 200_000_000;
+        let expected = (0..N).fold(0i32, |sum, i| sum.wrapping_add(i));
+        let echo = |sbox: &mut MultiUseSandbox| {
+            sbox.call_guest_function_by_name(
+                "Echo",
+                ReturnType::String,
+                Some(vec![ParameterValue::String("hello".to_string())]),
+            )
+        };
+
+        let path = simple_guest_as_string().unwrap();
+        let u_sbox =
+            UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None).unwrap();
+        let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+
+        let mut status = sbox
+            .call_guest_function_with_time_slice(
+                "SumTo",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(N)]),
+                Duration::from_millis(1),
+            )
+            .unwrap();
+        let mut suspensions = 0;
+        let res = loop {
+            match status {
+                GuestCallStatus::Completed(res) => break res,
+                GuestCallStatus::Suspended(call) => {
+                    suspensions += 1;
+                    assert_eq!(call.function_name(), "SumTo");
+                    // Nothing else can run until the call is resumed or
+                    // cancelled
+                    assert!(echo(&mut sbox).is_err());
+                    status = sbox
+                        .resume_guest_call(call, Duration::from_millis(10))
+                        .unwrap();
+                }
+            }
+        };
+        assert!(suspensions > 0);
+        assert_eq!(res, ReturnValue::Int(expected));
+        assert_eq!(
+            echo(&mut sbox).unwrap(),
+            ReturnValue::String("hello".to_string())
+        );
+
+        // A suspended call can also be thrown away
+        let status = sbox
+            .call_guest_function_with_time_slice(
+                "SumTo",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(N)]),
+                Duration::from_millis(1),
+            )
+            .unwrap();
+        match status {
+            GuestCallStatus::Suspended(call) => sbox.cancel_guest_call(call).unwrap(),
+            GuestCallStatus::Completed(_) => panic!("SumTo finished within its time slice"),
+        }
+        assert_eq!(
+            echo(&mut sbox).unwrap(),
+            ReturnValue::String("hello".to_string())
+        );
+
+        // A suspended call can only be resumed on the sandbox it was made
+        // on, and can still be cancelled once its handle is lost
+        let mut other = sbox.fork().unwrap();
+        let status = sbox
+            .call_guest_function_with_time_slice(
+                "SumTo",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(N)]),
+                Duration::from_millis(1),
+            )
+            .unwrap();
+        let GuestCallStatus::Suspended(call) = status else {
+            panic!("SumTo finished within its time slice");
+        };
+        assert!(other.cancel_guest_call(call).is_err());
+        assert!(sbox.has_suspended_call());
+        sbox.cancel_suspended_call().unwrap();
+        assert!(!sbox.has_suspended_call());
+        assert_eq!(
+            echo(&mut sbox).unwrap(),
+            ReturnValue::String("hello".to_string())
+        );
+    }
+
+    #[test]
+    fn parallel_for_on_worker_vcpus() {
+        const N: i32 = 20_000_000;
+        let expected = ReturnValue::Long((N as i64) * (N as i64 - 1) / 2);
+        let new_sandbox = |vcpu_count| -> MultiUseSandbox {
+            let mut cfg = SandboxConfiguration::default();
+            cfg.set_vcpu_count(vcpu_count);
+            let path = simple_guest_as_string().unwrap();
+            let u_sbox =
+                UninitializedSandbox::new(GuestBinary::FilePath(path), Some(cfg), None, None)
+                    .unwrap();
+            u_sbox.evolve(Noop::default()).unwrap()
+        };
+        let sum = |sbox: &mut MultiUseSandbox| {
+            sbox.call_guest_function_by_name(
+                "ParallelSum",
+                ReturnType::Long,
+                Some(vec![ParameterValue::Int(N)]),
+            )
+            .unwrap()
+        };
+
+        // Without workers the loop runs on the only vCPU
+        assert_eq!(sum(&mut new_sandbox(1)), expected);
+
+        // Worker vCPUs are only supported on KVM
+        #[cfg(kvm)]
+        if matches!(*get_available_hypervisor(), Some(HypervisorType::Kvm)) {
+            let mut sbox = new_sandbox(4);
+            for _ in 0..3 {
+                assert_eq!(sum(&mut sbox), expected);
+            }
+
+            // The workers are paused and resumed along with the call
+            let mut status = sbox
+                .call_guest_function_with_time_slice(
+                    "ParallelSum",
+                    ReturnType::Long,
+                    Some(vec![ParameterValue::Int(N)]),
+                    Duration::from_millis(1),
+                )
+                .unwrap();
+            let res = loop {
+                match status {
+                    GuestCallStatus::Completed(res) => break res,
+                    GuestCallStatus::Suspended(call) => {
+                        status = sbox
+                            .resume_guest_call(call, Duration::from_millis(1))
+                            .unwrap();
+                    }
+                }
+            };
+            assert_eq!(res, expected);
+            assert_eq!(sum(&mut sbox), expected);
+        }
+    }
 }
@@ -17,7 +17,7 @@ limitations under the License.
 /// Configuration needed to establish a sandbox.
 pub mod config;
 /// Functionality for reading, but not modifying host functions
-mod host_funcs;
+pub(crate) mod host_funcs;
 /// Functionality for dealing with `Sandbox`es that contain Hypervisors
 pub(crate) mod hypervisor;
 /// Functionality for dealing with initialized sandboxes that can
@@ -36,8 +36,14 @@ pub(crate) mod mem_access;
 /// `SandboxMemoryManager`
 pub(crate) mod mem_mgr;
 pub(crate) mod outb;
+/// Functionality for recording the guest calls made to a sandbox, and
+/// replaying them
+pub mod recording;
 /// Options for configuring a sandbox
 mod run_options;
+/// Functionality for sharing a fixed number of concurrently running guest
+/// calls between many sandboxes
+pub mod scheduler;
 /// Functionality for creating uninitialized sandboxes, manipulating them,
 /// and converting them to initialized sandboxes.
 pub mod uninitialized;
@@ -46,19 +52,28 @@ pub mod uninitialized;
 pub(crate) mod uninitialized_evolve;
 
 use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
 
 /// Re-export for `SandboxConfiguration` type
 pub use config::SandboxConfiguration;
 /// Re-export for the `MultiUseSandbox` type
 pub use initialized_multi_use::MultiUseSandbox;
+/// Re-export for the `GuestCallStatus`, `MemoryFootprint` and
+/// `SuspendedGuestCall` types
+pub use initialized_multi_use::{GuestCallStatus, MemoryFootprint, SuspendedGuestCall};
+/// Re-export for the `CallRecording` and `ReplayReport` types
+pub use recording::{CallRecording, ReplayReport};
 /// Re-export for `SandboxRunOptions` type
 pub use run_options::SandboxRunOptions;
+/// Re-export for the `SandboxScheduler` type
+pub use scheduler::SandboxScheduler;
 use tracing::{instrument, Span};
 /// Re-export for `GuestBinary` type
 pub use uninitialized::GuestBinary;
 /// Re-export for `UninitializedSandbox` type
 pub use uninitialized::UninitializedSandbox;
 
+use self::host_funcs::HostFuncsWrapper;
 use self::mem_mgr::MemMgrWrapper;
 use crate::func::HyperlightFunction;
 use crate::hypervisor::hypervisor_handler::HypervisorHandler;
@@ -142,6 +157,7 @@ pub(crate) trait WrapperGetter {
     #[allow(dead_code)]
     fn get_mgr_wrapper(&self) -> &MemMgrWrapper<HostSharedMemory>;
     fn get_mgr_wrapper_mut(&mut self) -> &mut MemMgrWrapper<HostSharedMemory>;
+    fn get_host_funcs(&self) -> &Arc<Mutex<HostFuncsWrapper>>;
     fn get_hv_handler(&self) -> &HypervisorHandler;
     #[allow(dead_code)]
     fn get_hv_handler_mut(&mut self) -> &mut HypervisorHandler;
@@ -16,7 +16,6 @@ limitations under the License.
 
 use std::sync::{Arc, Mutex};
 
-use hyperlight_common::flatbuffer_wrappers::function_types::ParameterValue;
 use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 use hyperlight_common::flatbuffer_wrappers::guest_log_data::GuestLogData;
 use log::{Level, Record};
@@ -25,15 +24,26 @@ use tracing_log::format_trace;
 
 use super::host_funcs::HostFuncsWrapper;
 use super::mem_mgr::MemMgrWrapper;
-use crate::hypervisor::handlers::{OutBHandler, OutBHandlerFunction, OutBHandlerWrapper};
+use crate::hypervisor::handlers::{OutBHandlerCaller, OutBHandlerWrapper};
 use crate::mem::mgr::SandboxMemoryManager;
 use crate::mem::shared_mem::HostSharedMemory;
 use crate::{new_error, HyperlightError, Result};
 
-pub(super) enum OutBAction {
-    Log,
-    CallFunction,
-    Abort,
+pub(crate) enum OutBAction {
+    Log = 99,
+    CallFunction = 101,
+    Abort = 102,
+    /// Ask how many worker vCPUs the sandbox has. The answer is returned
+    /// in the guest's RAX, which is left untouched (and so 0) by
+    /// hypervisors that do not support worker vCPUs.
+    WorkerCount = 103,
+    /// Start the worker vCPUs; see `hypervisor::kvm_workers`
+    RunWorkers = 104,
+    /// Wait for the worker vCPUs started by `RunWorkers` to halt
+    JoinWorkers = 105,
+    /// Grow the guest heap by at least 2 to the power of the data byte
+    /// bytes; see `SandboxMemoryManager::grow_heap`
+    GrowHeap = 106,
 }
 
 impl TryFrom<u16> for OutBAction {
@@ -44,6 +54,10 @@ impl TryFrom<u16> for OutBAction {
             99 => Ok(OutBAction::Log),
             101 => Ok(OutBAction::CallFunction),
             102 => Ok(OutBAction::Abort),
+            103 => Ok(OutBAction::WorkerCount),
+            104 => Ok(OutBAction::RunWorkers),
+            105 => Ok(OutBAction::JoinWorkers),
+            106 => Ok(OutBAction::GrowHeap),
             _ => Err(new_error!("Invalid OutB value: {}", val)),
         }
     }
@@ -115,7 +129,7 @@ pub(super) fn outb_log(mgr: &mut SandboxMemoryManager<HostSharedMemory>) -> Resu
 #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
 fn handle_outb_impl(
     mem_mgr: &mut MemMgrWrapper<HostSharedMemory>,
-    host_funcs: Arc<Mutex<HostFuncsWrapper>>,
+    host_funcs: &mut HostFuncsWrapper,
     port: u16,
     byte: u64,
 ) -> Result<()> {
@@ -123,12 +137,7 @@ fn handle_outb_impl(
         OutBAction::Log => outb_log(mem_mgr.as_mut()),
         OutBAction::CallFunction => {
             let call = mem_mgr.as_mut().get_host_function_call()?; // pop output buffer
-            let name = call.function_name.clone();
-            let args: Vec<ParameterValue> = call.parameters.unwrap_or(vec![]);
-            let res = host_funcs
-                .try_lock()
-                .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
-                .call_host_function(&name, args)?;
+            let res = host_funcs.call_host_function_for_guest(call)?;
             mem_mgr
                 .as_mut()
                 .write_response_from_host_method_call(&res)?; // push input buffers
@@ -153,6 +162,68 @@ fn handle_outb_impl(
                 )),
             }
         }
+        // Hypervisors with worker vCPUs handle these before they get here;
+        // for the rest, the guest is told it has no workers and so never
+        // asks to start any
+        OutBAction::WorkerCount => Ok(()),
+        OutBAction::RunWorkers | OutBAction::JoinWorkers => {
+            Err(new_error!("This sandbox does not have any worker vCPUs"))
+        }
+        OutBAction::GrowHeap => mem_mgr.as_mut().grow_heap(byte as u8),
+    }
+}
+
+/// The outb handler of a sandbox
+struct SandboxOutBHandler {
+    mem_mgr: MemMgrWrapper<HostSharedMemory>,
+    host_funcs: Arc<Mutex<HostFuncsWrapper>>,
+}
+
+/// The outb handler of a sandbox during a run of its vCPU, with its host
+/// functions locked
+struct LockedOutBHandler<'a> {
+    mem_mgr: &'a mut MemMgrWrapper<HostSharedMemory>,
+    host_funcs: &'a mut HostFuncsWrapper,
+}
+
+impl OutBHandlerCaller for SandboxOutBHandler {
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    fn call(&mut self, port: u16, payload: u64) -> Result<()> {
+        let mut host_funcs = self
+            .host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+        handle_outb_impl(&mut self.mem_mgr, &mut host_funcs, port, payload)
+    }
+
+    fn with_run(
+        &mut self,
+        run: &mut dyn FnMut(&mut dyn OutBHandlerCaller) -> Result<()>,
+    ) -> Result<()> {
+        // Nothing else uses the host functions while the guest runs, so
+        // they are locked once for the whole run rather than on every exit
+        let mut host_funcs = self
+            .host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+        run(&mut LockedOutBHandler {
+            mem_mgr: &mut self.mem_mgr,
+            host_funcs: &mut host_funcs,
+        })
+    }
+}
+
+impl OutBHandlerCaller for LockedOutBHandler<'_> {
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level= "Trace")]
+    fn call(&mut self, port: u16, payload: u64) -> Result<()> {
+        handle_outb_impl(self.mem_mgr, self.host_funcs, port, payload)
+    }
+
+    fn with_run(
+        &mut self,
+        run: &mut dyn FnMut(&mut dyn OutBHandlerCaller) -> Result<()>,
+    ) -> Result<()> {
+        run(self)
     }
 }
 
@@ -162,19 +233,13 @@ fn handle_outb_impl(
 /// TODO: pass at least the `host_funcs_wrapper` param by reference.
 #[instrument(skip_all, parent = Span::current(), level= "Trace")]
 pub(crate) fn outb_handler_wrapper(
-    mut mem_mgr_wrapper: MemMgrWrapper<HostSharedMemory>,
+    mem_mgr_wrapper: MemMgrWrapper<HostSharedMemory>,
     host_funcs_wrapper: Arc<Mutex<HostFuncsWrapper>>,
 ) -> OutBHandlerWrapper {
-    let outb_func: OutBHandlerFunction = Box::new(move |port, payload| {
-        handle_outb_impl(
-            &mut mem_mgr_wrapper,
-            host_funcs_wrapper.clone(),
-            port,
-            payload,
-        )
-    });
-    let outb_hdl = OutBHandler::from(outb_func);
-    Arc::new(Mutex::new(outb_hdl))
+    Arc::new(Mutex::new(SandboxOutBHandler {
+        mem_mgr: mem_mgr_wrapper,
+        host_funcs: host_funcs_wrapper,
+    }))
 }
 
 #[cfg(test)]
@@ -0,0 +1,486 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::collections::VecDeque;
+use std::fs::File;
+use std::io::{BufReader, BufWriter, ErrorKind, Read, Write};
+use std::path::Path;
+use std::time::Duration;
+
+use hyperlight_common::flatbuffer_wrappers::function_call::{FunctionCall, FunctionCallType};
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterValue, ReturnType, ReturnValue,
+};
+use hyperlight_common::flatbuffer_wrappers::host_function_details::HostFunctionDetails;
+use tracing::{instrument, Span};
+
+use crate::{new_error, Result};
+
+/// The first bytes of a recording file, ending with the format's version
+const MAGIC: &[u8; 8] = b"HLCALLS1";
+
+// Each record in a recording file is one of these tags followed by a
+// frame: a little-endian u32 length and that many bytes. Calls and return
+// values are framed as the size-prefixed flatbuffers the host and guest
+// exchange, which are already in that form.
+const GUEST_CALL: u8 = 1;
+const HOST_CALL: u8 = 2;
+const RETURNED: u8 = 3;
+const FAILED: u8 = 4;
+const RESET: u8 = 5;
+
+/// The outcome of a recorded call: the value it returned, or the message
+/// of the error it failed with
+pub type RecordedResult = std::result::Result<ReturnValue, String>;
+
+/// A host function call made by the guest while a recording was in
+/// progress, and the result the host gave it
+#[derive(Clone)]
+pub struct RecordedHostCall {
+    /// The host function the guest called, and its arguments
+    pub call: FunctionCall,
+    /// What the host function returned to the guest
+    pub result: RecordedResult,
+}
+
+/// A guest function call made while a recording was in progress, and the
+/// host function calls the guest made while handling it
+#[derive(Clone)]
+pub struct RecordedGuestCall {
+    /// The guest function that was called, and its arguments
+    pub call: FunctionCall,
+    /// The host function calls the guest made, in the order it made them
+    pub host_calls: Vec<RecordedHostCall>,
+    /// What the guest function returned
+    pub result: RecordedResult,
+    /// Whether the sandbox's memory was reset after the call. It is not
+    /// between the calls made through one `MultiUseGuestCallContext`.
+    pub reset_after: bool,
+}
+
+/// The guest function calls made to a sandbox, with their arguments, and
+/// the results of the host function calls the guest made while handling
+/// them.
+///
+/// Start a recording with `MultiUseSandbox::start_recording`, and replay it
+/// with `MultiUseSandbox::replay_recording` on a sandbox for the same guest
+/// whose host functions are stubbed out with
+/// `UninitializedSandbox::register_replay_stubs`. The replayed guest calls
+/// get the recorded host function results without the host functions
+/// running, so the guest's side of production traffic can be re-run, and
+/// benchmarked, offline.
+#[derive(Clone, Default)]
+pub struct CallRecording {
+    host_functions: HostFunctionDetails,
+    calls: Vec<RecordedGuestCall>,
+    /// The guest call being recorded, until it returns
+    in_progress: Option<RecordedGuestCall>,
+}
+
+impl CallRecording {
+    pub(super) fn new(host_functions: HostFunctionDetails) -> Self {
+        Self {
+            host_functions,
+            ..Default::default()
+        }
+    }
+
+    /// The definitions of the host functions the sandbox had when the
+    /// recording started
+    pub fn host_functions(&self) -> &HostFunctionDetails {
+        &self.host_functions
+    }
+
+    /// The guest function calls that were recorded, in the order they were
+    /// made
+    pub fn calls(&self) -> &[RecordedGuestCall] {
+        &self.calls
+    }
+
+    pub(super) fn begin_guest_call(
+        &mut self,
+        function_name: &str,
+        return_type: ReturnType,
+        args: &Option<Vec<ParameterValue>>,
+    ) {
+        self.in_progress = Some(RecordedGuestCall {
+            call: FunctionCall::new(
+                function_name.to_string(),
+                args.clone(),
+                FunctionCallType::Guest,
+                return_type,
+            ),
+            host_calls: Vec::new(),
+            result: Ok(ReturnValue::Void),
+            reset_after: false,
+        });
+    }
+
+    pub(super) fn record_host_call(&mut self, call: FunctionCall, result: &Result<ReturnValue>) {
+        if let Some(guest_call) = self.in_progress.as_mut() {
+            guest_call.host_calls.push(RecordedHostCall {
+                call,
+                result: to_recorded_result(result),
+            });
+        }
+    }
+
+    pub(super) fn end_guest_call(&mut self, result: &Result<ReturnValue>) {
+        if let Some(mut guest_call) = self.in_progress.take() {
+            guest_call.result = to_recorded_result(result);
+            self.calls.push(guest_call);
+        }
+    }
+
+    pub(super) fn record_reset(&mut self) {
+        // A call still in progress here was suspended and then cancelled,
+        // so it never finished and is not part of the recording
+        self.in_progress = None;
+        if let Some(guest_call) = self.calls.last_mut() {
+            guest_call.reset_after = true;
+        }
+    }
+
+    /// Write the recording to `path`, replacing any file already there
+    #[instrument(err(Debug), skip(self), parent = Span::current())]
+    pub fn save(&self, path: &Path) -> Result<()> {
+        let mut writer = BufWriter::new(File::create(path)?);
+        self.write_to(&mut writer)?;
+        writer.flush()?;
+        Ok(())
+    }
+
+    /// Read a recording written by `save`
+    #[instrument(err(Debug), parent = Span::current())]
+    pub fn load(path: &Path) -> Result<Self> {
+        Self::read_from(&mut BufReader::new(File::open(path)?))
+    }
+
+    /// Write the recording to `writer`, in the format `save` uses
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn write_to(&self, writer: &mut impl Write) -> Result<()> {
+        writer.write_all(MAGIC)?;
+        let host_functions = Vec::<u8>::try_from(&self.host_functions)
+            .map_err(|e| new_error!("Error serializing host function details: {}", e))?;
+        writer.write_all(&host_functions)?;
+
+        for guest_call in &self.calls {
+            write_call(writer, GUEST_CALL, &guest_call.call)?;
+            for host_call in &guest_call.host_calls {
+                write_call(writer, HOST_CALL, &host_call.call)?;
+                write_result(writer, &host_call.result)?;
+            }
+            write_result(writer, &guest_call.result)?;
+            if guest_call.reset_after {
+                writer.write_all(&[RESET])?;
+            }
+        }
+        Ok(())
+    }
+
+    /// Read a recording written by `write_to`
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn read_from(reader: &mut impl Read) -> Result<Self> {
+        let mut magic = [0u8; 8];
+        reader.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            return Err(new_error!("Not a guest call recording"));
+        }
+        let host_functions = HostFunctionDetails::try_from(read_frame(reader)?.as_slice())
+            .map_err(|e| new_error!("Error reading host function details: {}", e))?;
+        let mut recording = Self::new(host_functions);
+
+        loop {
+            let tag = match read_tag(reader)? {
+                Some(tag) => tag,
+                None => break,
+            };
+            match tag {
+                GUEST_CALL => {
+                    let call = read_call(reader)?;
+                    let mut host_calls = Vec::new();
+                    let result = loop {
+                        match read_tag(reader)? {
+                            Some(HOST_CALL) => {
+                                let call = read_call(reader)?;
+                                let tag = read_tag(reader)?;
+                                host_calls.push(RecordedHostCall {
+                                    call,
+                                    result: read_result(reader, tag)?,
+                                });
+                            }
+                            tag => break read_result(reader, tag)?,
+                        }
+                    };
+                    recording.calls.push(RecordedGuestCall {
+                        call,
+                        host_calls,
+                        result,
+                        reset_after: false,
+                    });
+                }
+                RESET => recording.record_reset(),
+                other => return Err(new_error!("Unexpected record {} in recording", other)),
+            }
+        }
+        Ok(recording)
+    }
+}
+
+/// The host function calls a guest call being replayed is expected to
+/// make, and the results to give it
+#[derive(Clone)]
+pub(super) struct Replay {
+    host_calls: VecDeque<RecordedHostCall>,
+}
+
+impl Replay {
+    pub(super) fn new(host_calls: &[RecordedHostCall]) -> Self {
+        Self {
+            host_calls: host_calls.iter().cloned().collect(),
+        }
+    }
+
+    /// The recorded result of `call`, if it is the next host function call
+    /// the recording has
+    pub(super) fn next_host_result(&mut self, call: &FunctionCall) -> Result<ReturnValue> {
+        let expected = self.host_calls.pop_front().ok_or_else(|| {
+            new_error!(
+                "Replay diverged: the guest called host function {} after the last recorded host call",
+                call.function_name
+            )
+        })?;
+        if expected.call.function_name != call.function_name
+            || expected.call.parameters != call.parameters
+        {
+            return Err(new_error!(
+                "Replay diverged: the guest called host function {} with {:?} where the recording has {} with {:?}",
+                call.function_name,
+                call.parameters,
+                expected.call.function_name,
+                expected.call.parameters
+            ));
+        }
+        expected.result.map_err(|message| new_error!("{}", message))
+    }
+
+    /// The number of recorded host function calls the guest did not make
+    pub(super) fn remaining(&self) -> usize {
+        self.host_calls.len()
+    }
+}
+
+/// The outcome of `MultiUseSandbox::replay_recording`
+#[derive(Debug, Default)]
+pub struct ReplayReport {
+    /// The number of guest calls replayed
+    pub calls: usize,
+    /// The time spent in the replayed guest calls, including resetting the
+    /// sandbox after them
+    pub elapsed: Duration,
+    /// A description of each replayed call whose result, or host function
+    /// calls, differed from the recording
+    pub divergences: Vec<String>,
+}
+
+fn to_recorded_result(result: &Result<ReturnValue>) -> RecordedResult {
+    match result {
+        Ok(value) => Ok(value.clone()),
+        Err(e) => Err(e.to_string()),
+    }
+}
+
+fn write_call(writer: &mut impl Write, tag: u8, call: &FunctionCall) -> Result<()> {
+    let buffer = Vec::<u8>::try_from(call.clone())
+        .map_err(|e| new_error!("Error serializing function call: {}", e))?;
+    writer.write_all(&[tag])?;
+    writer.write_all(&buffer)?;
+    Ok(())
+}
+
+fn write_result(writer: &mut impl Write, result: &RecordedResult) -> Result<()> {
+    match result {
+        Ok(value) => {
+            let buffer = Vec::<u8>::try_from(value)
+                .map_err(|e| new_error!("Error serializing return value: {}", e))?;
+            writer.write_all(&[RETURNED])?;
+            writer.write_all(&buffer)?;
+        }
+        Err(message) => {
+            writer.write_all(&[FAILED])?;
+            writer.write_all(&(message.len() as u32).to_le_bytes())?;
+            writer.write_all(message.as_bytes())?;
+        }
+    }
+    Ok(())
+}
+
+/// Read a tag, or `None` at the end of the recording
+fn read_tag(reader: &mut impl Read) -> Result<Option<u8>> {
+    let mut tag = [0u8];
+    match reader.read_exact(&mut tag) {
+        Ok(()) => Ok(Some(tag[0])),
+        Err(e) if e.kind() == ErrorKind::UnexpectedEof => Ok(None),
+        Err(e) => Err(e.into()),
+    }
+}
+
+/// Read a frame, including its length, which is the size prefix of the
+/// flatbuffers framed this way
+fn read_frame(reader: &mut impl Read) -> Result<Vec<u8>> {
+    let mut len = [0u8; 4];
+    reader.read_exact(&mut len)?;
+    let mut frame = len.to_vec();
+    reader
+        .take(u32::from_le_bytes(len) as u64)
+        .read_to_end(&mut frame)?;
+    if frame.len() != 4 + u32::from_le_bytes(len) as usize {
+        return Err(new_error!("Recording ends part way through a record"));
+    }
+    Ok(frame)
+}
+
+fn read_call(reader: &mut impl Read) -> Result<FunctionCall> {
+    FunctionCall::try_from(read_frame(reader)?.as_slice())
+        .map_err(|e| new_error!("Error reading function call: {}", e))
+}
+
+fn read_result(reader: &mut impl Read, tag: Option<u8>) -> Result<RecordedResult> {
+    match tag {
+        Some(RETURNED) => Ok(Ok(ReturnValue::try_from(read_frame(reader)?.as_slice())
+            .map_err(|e| new_error!("Error reading return value: {}", e))?)),
+        Some(FAILED) => {
+            let frame = read_frame(reader)?;
+            Ok(Err(String::from_utf8_lossy(&frame[4..]).into_owned()))
+        }
+        Some(other) => Err(new_error!("Expected a call result, found record {}", other)),
+        None => Err(new_error!("Recording ends part way through a call")),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use hyperlight_common::flatbuffer_wrappers::function_call::{FunctionCall, FunctionCallType};
+    use hyperlight_common::flatbuffer_wrappers::function_types::{
+        ParameterType, ParameterValue, ReturnType, ReturnValue,
+    };
+    use hyperlight_common::flatbuffer_wrappers::host_function_definition::HostFunctionDefinition;
+    use hyperlight_common::flatbuffer_wrappers::host_function_details::HostFunctionDetails;
+
+    use super::{CallRecording, Replay};
+    use crate::new_error;
+
+    fn host_call(a: i32) -> FunctionCall {
+        FunctionCall::new(
+            "HostAdd".to_string(),
+            Some(vec![ParameterValue::Int(a), ParameterValue::Int(1)]),
+            FunctionCallType::Host,
+            ReturnType::Int,
+        )
+    }
+
+    fn new_recording() -> CallRecording {
+        let mut recording = CallRecording::new(HostFunctionDetails::new(Some(vec![
+            HostFunctionDefinition::new(
+                "HostAdd".to_string(),
+                Some(vec![ParameterType::Int, ParameterType::Int]),
+                ReturnType::Int,
+            ),
+        ])));
+
+        let args = Some(vec![ParameterValue::Int(2)]);
+        recording.begin_guest_call("AddRepeatedly", ReturnType::Int, &args);
+        recording.record_host_call(host_call(0), &Ok(ReturnValue::Int(1)));
+        recording.record_host_call(host_call(1), &Ok(ReturnValue::Int(2)));
+        recording.end_guest_call(&Ok(ReturnValue::Int(2)));
+
+        recording.begin_guest_call("AddRepeatedly", ReturnType::Int, &args);
+        recording.record_host_call(host_call(0), &Err(new_error!("host failed")));
+        recording.end_guest_call(&Err(new_error!("guest failed")));
+        recording.record_reset();
+
+        recording.begin_guest_call(
+            "Echo",
+            ReturnType::String,
+            &Some(vec![ParameterValue::String("hello".to_string())]),
+        );
+        recording.end_guest_call(&Ok(ReturnValue::String("hello".to_string())));
+        recording
+    }
+
+    #[test]
+    fn round_trip() {
+        let recording = new_recording();
+        let mut buffer = Vec::new();
+        recording.write_to(&mut buffer).unwrap();
+        let read = CallRecording::read_from(&mut buffer.as_slice()).unwrap();
+
+        assert_eq!(
+            read.host_functions()
+                .find_by_function_name("HostAdd")
+                .unwrap()
+                .parameter_types,
+            Some(vec![ParameterType::Int, ParameterType::Int])
+        );
+        assert_eq!(read.calls().len(), 3);
+        for (read, written) in read.calls().iter().zip(recording.calls()) {
+            assert_eq!(read.call.function_name, written.call.function_name);
+            assert_eq!(read.call.parameters, written.call.parameters);
+            assert_eq!(
+                read.call.expected_return_type,
+                written.call.expected_return_type
+            );
+            assert_eq!(read.result, written.result);
+            assert_eq!(read.reset_after, written.reset_after);
+            assert_eq!(read.host_calls.len(), written.host_calls.len());
+            for (read, written) in read.host_calls.iter().zip(&written.host_calls) {
+                assert_eq!(read.call.parameters, written.call.parameters);
+                assert_eq!(read.result, written.result);
+            }
+        }
+        assert!(!read.calls()[0].reset_after);
+        assert!(read.calls()[1].reset_after);
+        assert!(read.calls()[1].result.is_err());
+    }
+
+    #[test]
+    fn truncated_recording_is_an_error() {
+        let mut buffer = Vec::new();
+        new_recording().write_to(&mut buffer).unwrap();
+        buffer.truncate(buffer.len() - 3);
+        assert!(CallRecording::read_from(&mut buffer.as_slice()).is_err());
+        assert!(CallRecording::read_from(&mut &b"not a recording"[..]).is_err());
+    }
+
+    #[test]
+    fn replay_returns_recorded_results_in_order() {
+        let recording = new_recording();
+        let mut replay = Replay::new(&recording.calls()[0].host_calls);
+        assert_eq!(
+            replay.next_host_result(&host_call(0)).unwrap(),
+            ReturnValue::Int(1)
+        );
+        assert_eq!(replay.remaining(), 1);
+        // a call with different arguments to the recording diverges
+        assert!(replay.next_host_result(&host_call(5)).is_err());
+        // as does a call past the end of the recording
+        assert!(replay.next_host_result(&host_call(1)).is_err());
+
+        let mut replay = Replay::new(&recording.calls()[1].host_calls);
+        assert!(replay.next_host_result(&host_call(0)).is_err());
+        assert_eq!(replay.remaining(), 0);
+    }
+}
@@ -0,0 +1,685 @@
+/*
+Copyright 2024 The Hyperlight Authors.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+use std::collections::{BTreeMap, VecDeque};
+use std::sync::{Arc, Condvar, Mutex, MutexGuard, PoisonError};
+use std::thread::{self, JoinHandle};
+use std::time::{Duration, Instant};
+
+use crossbeam_channel::{Receiver, Sender};
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterValue, ReturnType, ReturnValue,
+};
+use tracing::{instrument, Span};
+
+use super::{GuestCallStatus, MultiUseSandbox, SuspendedGuestCall};
+use crate::{log_then_return, new_error, Result};
+
+/// The weight a tenant's run time is scaled against. A tenant with this
+/// weight is charged exactly the time it ran; a tenant with twice this
+/// weight is charged half, and so gets twice the share of the workers.
+const WEIGHT_UNIT: u128 = 1024;
+
+/// A worker does not start or resume a call once less than this fraction
+/// of the time slice is left, as the call would only be suspended again
+/// almost straight away. The rest of the slice is given up instead.
+const MIN_CALL_SLICE_DIVISOR: u32 = 10;
+
+/// The policy a `SandboxScheduler` uses to choose which tenant runs next
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum SchedulingPolicy {
+    /// Share worker time between tenants in proportion to their weights
+    FairShare,
+    /// Run the runnable tenant with the highest priority. Tenants with the
+    /// same priority share worker time in proportion to their weights.
+    Priority,
+}
+
+/// Identifies a sandbox that has been added to a `SandboxScheduler`
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct TenantId(u64);
+
+/// The result of a guest function call submitted to a `SandboxScheduler`
+pub struct GuestCallHandle(Receiver<Result<ReturnValue>>);
+
+impl GuestCallHandle {
+    /// Block until the call has run, and return its result
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub fn wait(self) -> Result<ReturnValue> {
+        self.0
+            .recv()
+            .map_err(|_| new_error!("The scheduler was dropped before the guest call ran"))?
+    }
+
+    /// Return the result of the call if it has run, or `None` otherwise
+    #[instrument(skip_all, parent = Span::current(), level = "Trace")]
+    pub fn try_get(&self) -> Option<Result<ReturnValue>> {
+        self.0.try_recv().ok()
+    }
+}
+
+/// A guest function call waiting for its tenant to be scheduled
+struct PendingCall {
+    function_name: String,
+    return_type: ReturnType,
+    args: Option<Vec<ParameterValue>>,
+    result_tx: Sender<Result<ReturnValue>>,
+    /// Set once the call has been preempted at the end of a time slice
+    suspended: Option<SuspendedGuestCall>,
+}
+
+struct Tenant {
+    /// The tenant's sandbox, or `None` while a worker is running it
+    sandbox: Option<MultiUseSandbox>,
+    queue: VecDeque<PendingCall>,
+    weight: u32,
+    priority: u8,
+    /// The time the tenant has run, in nanoseconds, scaled by its weight
+    vruntime: u128,
+    /// Whether a worker is currently running the tenant's calls
+    running: bool,
+    /// Whether `remove_tenant` has been called for the tenant
+    removing: bool,
+}
+
+impl Tenant {
+    fn is_runnable(&self) -> bool {
+        !self.running && !self.queue.is_empty()
+    }
+}
+
+struct SchedulerState {
+    tenants: BTreeMap<TenantId, Tenant>,
+    next_tenant_id: u64,
+    /// The smallest `vruntime` of the tenants that are running or have
+    /// calls waiting, as of the last time a tenant started or stopped
+    /// running. It never decreases. A tenant that becomes runnable is
+    /// brought up to at least this, so that a new or previously idle
+    /// tenant cannot monopolise the workers by spending the credit it
+    /// built up while it had nothing to run.
+    min_vruntime: u128,
+    shutdown: bool,
+}
+
+impl SchedulerState {
+    fn tenant_mut(&mut self, id: TenantId) -> Result<&mut Tenant> {
+        self.tenants
+            .get_mut(&id)
+            .ok_or_else(|| new_error!("Unknown tenant {:?}", id))
+    }
+
+    /// Choose the next tenant to run according to `policy`, if any tenant
+    /// has calls waiting and is not already running
+    fn pick_next(&self, policy: SchedulingPolicy) -> Option<TenantId> {
+        self.tenants
+            .iter()
+            .filter(|(_, tenant)| tenant.is_runnable())
+            .min_by_key(|(_, tenant)| match policy {
+                SchedulingPolicy::FairShare => (0, tenant.vruntime),
+                SchedulingPolicy::Priority => (u8::MAX - tenant.priority, tenant.vruntime),
+            })
+            .map(|(id, _)| *id)
+    }
+
+    /// Bring `min_vruntime` up to the smallest `vruntime` of the tenants
+    /// that are running or have calls waiting, if there are any
+    fn update_min_vruntime(&mut self) {
+        if let Some(min) = self
+            .tenants
+            .values()
+            .filter(|tenant| tenant.running || !tenant.queue.is_empty())
+            .map(|tenant| tenant.vruntime)
+            .min()
+        {
+            self.min_vruntime = self.min_vruntime.max(min);
+        }
+    }
+}
+
+struct SchedulerShared {
+    state: Mutex<SchedulerState>,
+    /// Signalled whenever a tenant becomes runnable, a tenant is returned
+    /// by a worker, or the scheduler shuts down
+    changed: Condvar,
+    time_slice: Duration,
+    policy: SchedulingPolicy,
+}
+
+impl SchedulerShared {
+    fn lock(&self) -> Result<MutexGuard<'_, SchedulerState>> {
+        self.state
+            .lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))
+    }
+
+    fn wait<'a>(
+        &self,
+        guard: MutexGuard<'a, SchedulerState>,
+    ) -> Result<MutexGuard<'a, SchedulerState>> {
+        self.changed
+            .wait(guard)
+            .map_err(|e| new_error!("Error waiting at {}:{}: {}", file!(), line!(), e))
+    }
+}
+
+/// Runs guest function calls for many sandboxes ("tenants") on a fixed
+/// pool of worker threads.
+///
+/// Calls are queued per tenant. Each worker repeatedly picks a runnable
+/// tenant according to the `SchedulingPolicy`, takes its sandbox, and runs
+/// its queued calls one after another until the queue is empty or the
+/// tenant has used up its time slice. The tenant is then charged for the
+/// time it ran and requeued, so a tenant with a deep queue cannot hold a
+/// worker while other tenants are waiting.
+///
+/// A guest call still running when the time slice expires is suspended
+/// (see `MultiUseSandbox::call_guest_function_with_time_slice`) and
+/// resumed, possibly on a different worker, the next time the tenant is
+/// scheduled. A long running call therefore cannot hold a worker either.
+///
+/// The pool bounds how many tenants run guest calls at once, not how many
+/// threads there are. Each tenant's vCPU still runs on the sandbox's own
+/// hypervisor handler thread, which a worker drives while it runs the
+/// tenant and which is parked the rest of the time, so every tenant still
+/// costs a thread and its stack.
+pub struct SandboxScheduler {
+    shared: Arc<SchedulerShared>,
+    workers: Vec<JoinHandle<Result<()>>>,
+}
+
+impl SandboxScheduler {
+    /// Create a scheduler with `worker_count` worker threads, or one per
+    /// available CPU if `worker_count` is `None`. At most `worker_count`
+    /// tenants run guest calls at any one time.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub fn new(
+        worker_count: Option<usize>,
+        time_slice: Duration,
+        policy: SchedulingPolicy,
+    ) -> Result<Self> {
+        let worker_count = match worker_count {
+            Some(count) => count,
+            None => thread::available_parallelism()?.get(),
+        };
+        if worker_count == 0 {
+            log_then_return!("A SandboxScheduler needs at least one worker thread");
+        }
+        if time_slice.is_zero() {
+            log_then_return!("The SandboxScheduler time slice must be greater than zero");
+        }
+
+        let shared = Arc::new(SchedulerShared {
+            state: Mutex::new(SchedulerState {
+                tenants: BTreeMap::new(),
+                next_tenant_id: 0,
+                min_vruntime: 0,
+                shutdown: false,
+            }),
+            changed: Condvar::new(),
+            time_slice,
+            policy,
+        });
+
+        let mut scheduler = Self {
+            shared,
+            workers: Vec::with_capacity(worker_count),
+        };
+        for i in 0..worker_count {
+            let shared = scheduler.shared.clone();
+            let worker = thread::Builder::new()
+                .name(format!("Sandbox Scheduler Worker {}", i))
+                .spawn(move || {
+                    let res = worker_loop(&shared);
+                    if let Err(e) = &res {
+                        log::error!("SandboxScheduler worker {} stopped: {:?}", i, e);
+                    }
+                    res
+                })?;
+            scheduler.workers.push(worker);
+        }
+        Ok(scheduler)
+    }
+
+    /// Hand `sandbox` to the scheduler, returning the id to submit calls
+    /// for it with.
+    ///
+    /// `weight` sets the tenant's share of worker time relative to other
+    /// tenants of the same priority, and must be greater than zero.
+    /// `priority` is only used by `SchedulingPolicy::Priority`; higher
+    /// values run first.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub fn add_tenant(
+        &self,
+        sandbox: MultiUseSandbox,
+        weight: u32,
+        priority: u8,
+    ) -> Result<TenantId> {
+        if weight == 0 {
+            log_then_return!("A tenant's weight must be greater than zero");
+        }
+        let mut state = self.shared.lock()?;
+        let id = TenantId(state.next_tenant_id);
+        state.next_tenant_id += 1;
+        let vruntime = state.min_vruntime;
+        state.tenants.insert(
+            id,
+            Tenant {
+                sandbox: Some(sandbox),
+                queue: VecDeque::new(),
+                weight,
+                priority,
+                vruntime,
+                running: false,
+                removing: false,
+            },
+        );
+        Ok(id)
+    }
+
+    /// Queue a call to the guest function `function_name` in the sandbox
+    /// of `tenant`. Calls for the same tenant run in the order they were
+    /// submitted.
+    #[instrument(err(Debug), skip(self, args), parent = Span::current(), level = "Trace")]
+    pub fn submit(
+        &self,
+        tenant: TenantId,
+        function_name: &str,
+        return_type: ReturnType,
+        args: Option<Vec<ParameterValue>>,
+    ) -> Result<GuestCallHandle> {
+        let (result_tx, result_rx) = crossbeam_channel::bounded(1);
+        let mut state = self.shared.lock()?;
+        let min_vruntime = state.min_vruntime;
+        let t = state.tenant_mut(tenant)?;
+        if t.removing {
+            log_then_return!("Tenant {:?} is being removed", tenant);
+        }
+        if !t.running && t.queue.is_empty() {
+            t.vruntime = t.vruntime.max(min_vruntime);
+        }
+        t.queue.push_back(PendingCall {
+            function_name: function_name.to_string(),
+            return_type,
+            args,
+            result_tx,
+            suspended: None,
+        });
+        drop(state);
+        self.shared.changed.notify_all();
+        Ok(GuestCallHandle(result_rx))
+    }
+
+    /// Remove `tenant` from the scheduler and return its sandbox. Calls
+    /// already submitted for the tenant run first; no new calls can be
+    /// submitted once this has been called.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    pub fn remove_tenant(&self, tenant: TenantId) -> Result<MultiUseSandbox> {
+        let mut state = self.shared.lock()?;
+        state.tenant_mut(tenant)?.removing = true;
+        loop {
+            let t = state.tenant_mut(tenant)?;
+            if !t.running && t.queue.is_empty() {
+                break;
+            }
+            state = self.shared.wait(state)?;
+        }
+        state
+            .tenants
+            .remove(&tenant)
+            .and_then(|t| t.sandbox)
+            .ok_or_else(|| new_error!("Tenant {:?} has no sandbox", tenant))
+    }
+}
+
+impl Drop for SandboxScheduler {
+    fn drop(&mut self) {
+        match self.shared.lock() {
+            Ok(mut state) => state.shutdown = true,
+            Err(e) => log::error!("Failed to shut down SandboxScheduler: {:?}", e),
+        }
+        self.shared.changed.notify_all();
+        for worker in self.workers.drain(..) {
+            match worker.join() {
+                Ok(Ok(())) => {}
+                Ok(Err(e)) => log::error!("SandboxScheduler worker failed: {:?}", e),
+                Err(e) => log::error!("SandboxScheduler worker panicked: {:?}", e),
+            }
+        }
+    }
+}
+
+/// A tenant's sandbox while a worker is running it. Dropping this hands
+/// the sandbox back, charges the tenant for the time it ran and marks it
+/// as no longer running, however the worker stopped running it, so that
+/// the tenant can be scheduled again and `remove_tenant` does not wait
+/// for it forever.
+struct RunningTenant<'a> {
+    shared: &'a SchedulerShared,
+    id: TenantId,
+    sandbox: Option<MultiUseSandbox>,
+    slice_start: Instant,
+}
+
+impl Drop for RunningTenant<'_> {
+    fn drop(&mut self) {
+        let ran = self.slice_start.elapsed().as_nanos();
+        // The state is only ever changed in steps that leave it consistent,
+        // so the sandbox is handed back even if another thread panicked
+        // while holding the lock
+        let mut state = self
+            .shared
+            .state
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner);
+        if let Some(tenant) = state.tenants.get_mut(&self.id) {
+            tenant.vruntime += ran * WEIGHT_UNIT / u128::from(tenant.weight);
+            tenant.sandbox = self.sandbox.take();
+            tenant.running = false;
+        }
+        state.update_min_vruntime();
+        drop(state);
+        self.shared.changed.notify_all();
+    }
+}
+
+/// The body of each worker thread. Calls still queued when the scheduler
+/// shuts down are dropped, which fails their `GuestCallHandle`s.
+fn worker_loop(shared: &SchedulerShared) -> Result<()> {
+    loop {
+        let mut tenant = {
+            let mut state = shared.lock()?;
+            let id = loop {
+                if state.shutdown {
+                    return Ok(());
+                }
+                if let Some(id) = state.pick_next(shared.policy) {
+                    break id;
+                }
+                state = shared.wait(state)?;
+            };
+            let t = state.tenant_mut(id)?;
+            let sandbox = t
+                .sandbox
+                .take()
+                .ok_or_else(|| new_error!("Tenant {:?} has no sandbox", id))?;
+            t.running = true;
+            state.update_min_vruntime();
+            RunningTenant {
+                shared,
+                id,
+                sandbox: Some(sandbox),
+                slice_start: Instant::now(),
+            }
+        };
+
+        // Failing to run one tenant's calls should not stop the worker from
+        // running the others
+        if let Err(e) = run_slice(shared, &mut tenant) {
+            log::error!(
+                "SandboxScheduler worker failed to run tenant {:?}: {:?}",
+                tenant.id,
+                e
+            );
+        }
+    }
+}
+
+/// Run the calls queued for `tenant`, one after another, until its queue
+/// is empty, its time slice is used up or the scheduler shuts down
+fn run_slice(shared: &SchedulerShared, tenant: &mut RunningTenant) -> Result<()> {
+    let id = tenant.id;
+    let sandbox = tenant
+        .sandbox
+        .as_mut()
+        .ok_or_else(|| new_error!("Tenant {:?} has no sandbox", id))?;
+    loop {
+        let remaining = shared
+            .time_slice
+            .saturating_sub(tenant.slice_start.elapsed());
+        if remaining < shared.time_slice / MIN_CALL_SLICE_DIVISOR {
+            return Ok(());
+        }
+        let mut call = {
+            let mut state = shared.lock()?;
+            if state.shutdown {
+                return Ok(());
+            }
+            match state.tenant_mut(id)?.queue.pop_front() {
+                Some(call) => call,
+                None => return Ok(()),
+            }
+        };
+
+        let res = match call.suspended.take() {
+            Some(suspended) => sandbox.resume_guest_call(suspended, remaining),
+            None => sandbox.call_guest_function_with_time_slice(
+                &call.function_name,
+                call.return_type,
+                call.args.take(),
+                remaining,
+            ),
+        };
+
+        match res {
+            Ok(GuestCallStatus::Suspended(suspended)) => {
+                // Out of time part way through the call; it goes back to
+                // the front of the queue to be resumed next time
+                call.suspended = Some(suspended);
+                shared.lock()?.tenant_mut(id)?.queue.push_front(call);
+                return Ok(());
+            }
+            Ok(GuestCallStatus::Completed(ret)) => {
+                // The caller may have dropped its handle, in which case
+                // nobody wants the result
+                let _ = call.result_tx.send(Ok(ret));
+            }
+            Err(e) => {
+                let _ = call.result_tx.send(Err(e));
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::{BTreeMap, VecDeque};
+    use std::time::Duration;
+
+    use hyperlight_common::flatbuffer_wrappers::function_types::{
+        ParameterValue, ReturnType, ReturnValue,
+    };
+    use hyperlight_testing::simple_guest_as_string;
+
+    use super::{
+        PendingCall, SandboxScheduler, SchedulerState, SchedulingPolicy, Tenant, TenantId,
+    };
+    use crate::sandbox_state::sandbox::EvolvableSandbox;
+    use crate::sandbox_state::transition::Noop;
+    use crate::{GuestBinary, MultiUseSandbox, UninitializedSandbox};
+
+    fn new_sandbox() -> MultiUseSandbox {
+        let path = simple_guest_as_string().unwrap();
+        let u_sbox =
+            UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None).unwrap();
+        u_sbox.evolve(Noop::default()).unwrap()
+    }
+
+    fn tenant(vruntime: u128, priority: u8, queued: usize, running: bool) -> Tenant {
+        let mut queue = VecDeque::new();
+        for _ in 0..queued {
+            let (result_tx, _) = crossbeam_channel::bounded(1);
+            queue.push_back(PendingCall {
+                function_name: "Echo".to_string(),
+                return_type: ReturnType::String,
+                args: None,
+                result_tx,
+                suspended: None,
+            });
+        }
+        Tenant {
+            sandbox: None,
+            queue,
+            weight: 1024,
+            priority,
+            vruntime,
+            running,
+            removing: false,
+        }
+    }
+
+    fn state(tenants: Vec<Tenant>) -> SchedulerState {
+        SchedulerState {
+            tenants: tenants
+                .into_iter()
+                .enumerate()
+                .map(|(i, t)| (TenantId(i as u64), t))
+                .collect::<BTreeMap<_, _>>(),
+            next_tenant_id: 0,
+            min_vruntime: 0,
+            shutdown: false,
+        }
+    }
+
+    #[test]
+    fn fair_share_picks_least_run_tenant() {
+        let s = state(vec![
+            tenant(300, 0, 1, false),
+            tenant(100, 0, 1, false),
+            // has run the least, but is already running
+            tenant(50, 0, 1, true),
+            // has run the least, but has nothing to run
+            tenant(0, 0, 0, false),
+        ]);
+        assert_eq!(s.pick_next(SchedulingPolicy::FairShare), Some(TenantId(1)));
+    }
+
+    #[test]
+    fn priority_picks_highest_priority_tenant() {
+        let s = state(vec![
+            tenant(0, 1, 1, false),
+            tenant(500, 5, 1, false),
+            tenant(100, 5, 1, false),
+        ]);
+        assert_eq!(s.pick_next(SchedulingPolicy::Priority), Some(TenantId(2)));
+        assert_eq!(s.pick_next(SchedulingPolicy::FairShare), Some(TenantId(0)));
+
+        let idle = state(vec![tenant(0, 1, 0, false), tenant(0, 1, 1, true)]);
+        assert_eq!(idle.pick_next(SchedulingPolicy::Priority), None);
+    }
+
+    #[test]
+    fn min_vruntime_only_counts_active_tenants() {
+        let mut s = state(vec![
+            tenant(300, 0, 1, false),
+            tenant(100, 0, 0, true),
+            // has run the least, but has nothing to run
+            tenant(0, 0, 0, false),
+        ]);
+        s.update_min_vruntime();
+        assert_eq!(s.min_vruntime, 100);
+
+        // It never goes back down
+        s.tenants.get_mut(&TenantId(1)).unwrap().vruntime = 50;
+        s.update_min_vruntime();
+        assert_eq!(s.min_vruntime, 100);
+    }
+
+    #[test]
+    fn runs_calls_for_many_tenants() {
+        let scheduler = SandboxScheduler::new(
+            Some(2),
+            Duration::from_millis(1),
+            SchedulingPolicy::FairShare,
+        )
+        .unwrap();
+        let tenants: Vec<TenantId> = (0..4)
+            .map(|i| scheduler.add_tenant(new_sandbox(), 1 + i, 0).unwrap())
+            .collect();
+
+        let handles: Vec<_> = (0..40)
+            .map(|i| {
+                let msg = format!("hello {}", i);
+                let handle = scheduler
+                    .submit(
+                        tenants[i % tenants.len()],
+                        "Echo",
+                        ReturnType::String,
+                        Some(vec![ParameterValue::String(msg.clone())]),
+                    )
+                    .unwrap();
+                (msg, handle)
+            })
+            .collect();
+
+        for (msg, handle) in handles {
+            assert_eq!(handle.wait().unwrap(), ReturnValue::String(msg));
+        }
+
+        // A removed tenant's sandbox is handed back and still usable
+        let mut sbox = scheduler.remove_tenant(tenants[0]).unwrap();
+        assert!(scheduler
+            .submit(tenants[0], "Echo", ReturnType::String, None)
+            .is_err());
+        let res = sbox
+            .call_guest_function_by_name(
+                "Echo",
+                ReturnType::String,
+                Some(vec![ParameterValue::String("back".to_string())]),
+            )
+            .unwrap();
+        assert_eq!(res, ReturnValue::String("back".to_string()));
+    }
+
+    #[test]
+    fn long_call_does_not_block_other_tenants() {
+        const N: i32 = 200_000_000;
+        let scheduler = SandboxScheduler::new(
+            Some(1),
+            Duration::from_millis(1),
+            SchedulingPolicy::FairShare,
+        )
+        .unwrap();
+        let long = scheduler.add_tenant(new_sandbox(), 1, 0).unwrap();
+        let short = scheduler.add_tenant(new_sandbox(), 1, 0).unwrap();
+
+        let long_call = scheduler
+            .submit(
+                long,
+                "SumTo",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(N)]),
+            )
+            .unwrap();
+        // With a single worker, this only completes before the long call
+        // if the long call is preempted
+        let short_call = scheduler
+            .submit(
+                short,
+                "Echo",
+                ReturnType::String,
+                Some(vec![ParameterValue::String("quick".to_string())]),
+            )
+            .unwrap();
+        assert_eq!(
+            short_call.wait().unwrap(),
+            ReturnValue::String("quick".to_string())
+        );
+        assert!(long_call.try_get().is_none());
+
+        let expected = (0..N).fold(0i32, |sum, i| sum.wrapping_add(i));
+        assert_eq!(long_call.wait().unwrap(), ReturnValue::Int(expected));
+    }
+}
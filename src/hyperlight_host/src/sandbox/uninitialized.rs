@@ -15,11 +15,17 @@ limitations under the License.
 */
 
 use std::fmt::Debug;
+use std::future::Future;
 use std::option::Option;
 use std::path::Path;
 use std::sync::{Arc, Mutex};
 use std::time::Duration;
 
+use hyperlight_common::flatbuffer_wrappers::function_types::{
+    ParameterType, ParameterValue, ReturnType, ReturnValue,
+};
+use hyperlight_common::flatbuffer_wrappers::host_function_definition::HostFunctionDefinition;
+use hyperlight_common::mem::{SHARED_DATA_CHANNEL_RECEIVER, SHARED_DATA_CHANNEL_SENDER};
 use log::LevelFilter;
 use tracing::{instrument, Span};
 
@@ -27,12 +33,17 @@ use tracing::{instrument, Span};
 use super::config::DebugInfo;
 use super::host_funcs::{default_writer_func, HostFuncsWrapper};
 use super::mem_mgr::MemMgrWrapper;
+use super::recording::CallRecording;
 use super::run_options::SandboxRunOptions;
 use super::uninitialized_evolve::evolve_impl_multi_use;
 use crate::error::HyperlightError::GuestBinaryShouldBeAFile;
 use crate::func::host_functions::HostFunction1;
+use crate::func::{AsyncHyperlightFunction, HyperlightFunction};
+use crate::mem::channel::{ChannelReceiver, ChannelSender};
 use crate::mem::exe::ExeInfo;
+use crate::mem::fs_image::FileSystemImage;
 use crate::mem::mgr::{SandboxMemoryManager, STACK_COOKIE_LEN};
+use crate::mem::shared_data::SharedData;
 use crate::mem::shared_mem::ExclusiveSharedMemory;
 use crate::sandbox::SandboxConfiguration;
 use crate::sandbox_state::sandbox::EvolvableSandbox;
@@ -168,8 +179,6 @@ impl UninitializedSandbox {
 
         let sandbox_cfg = cfg.unwrap_or_default();
 
-        #[cfg(gdb)]
-        let debug_info = sandbox_cfg.get_guest_debug_info();
         let mut mem_mgr_wrapper = {
             let mut mgr = UninitializedSandbox::load_guest_binary(
                 sandbox_cfg,
@@ -184,6 +193,59 @@ impl UninitializedSandbox {
 
         mem_mgr_wrapper.write_memory_layout(run_inprocess)?;
 
+        Self::from_mgr(
+            mem_mgr_wrapper,
+            sandbox_cfg,
+            run_inprocess,
+            host_print_writer,
+        )
+    }
+
+    /// Create a new sandbox from a snapshot file previously written by
+    /// `MultiUseSandbox::save_snapshot_file`, possibly in another process.
+    ///
+    /// Rather than loading and initialising a guest binary, the memory image
+    /// in the file is mapped (copy-on-write where the platform supports it)
+    /// and the guest resumes from the state it was in when the snapshot was
+    /// taken. The guest's one-time initialisation has already happened in
+    /// that state, so `evolve` only has to set up the vCPU.
+    ///
+    /// The buffer, stack and heap sizes are taken from the snapshot; only
+    /// the remaining settings in `cfg` (e.g. timeouts) are used, and its
+    /// vCPU count and NUMA nodes must be those the snapshot was taken
+    /// with. Host functions are not part of the snapshot: the guest can
+    /// call only those registered before calling `evolve`, which need not
+    /// be the ones the snapshot was taken with.
+    #[instrument(err(Debug), skip(host_print_writer), parent = Span::current())]
+    pub fn from_snapshot_file(
+        path: &Path,
+        cfg: Option<SandboxConfiguration>,
+        host_print_writer: Option<&dyn HostFunction1<String, i32>>,
+    ) -> Result<Self> {
+        log_build_details();
+
+        #[cfg(target_os = "windows")]
+        check_windows_version()?;
+
+        let sandbox_cfg = cfg.unwrap_or_default();
+        let (mgr, stack_guard) = SandboxMemoryManager::load_snapshot_file(path, sandbox_cfg)?;
+        let mem_mgr_wrapper = MemMgrWrapper::new(mgr, stack_guard);
+
+        Self::from_mgr(mem_mgr_wrapper, sandbox_cfg, false, host_print_writer)
+    }
+
+    /// Wrap a ready memory manager into a new sandbox, registering either
+    /// `host_print_writer` or the default writer as `HostPrint`.
+    #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+    fn from_mgr(
+        mem_mgr_wrapper: MemMgrWrapper<ExclusiveSharedMemory>,
+        sandbox_cfg: SandboxConfiguration,
+        run_inprocess: bool,
+        host_print_writer: Option<&dyn HostFunction1<String, i32>>,
+    ) -> Result<Self> {
+        #[cfg(gdb)]
+        let debug_info = sandbox_cfg.get_guest_debug_info();
+
         let host_funcs = Arc::new(Mutex::new(HostFuncsWrapper::default()));
 
         let mut sandbox = Self {
@@ -309,6 +371,135 @@ impl UninitializedSandbox {
     pub fn set_max_guest_log_level(&mut self, log_level: LevelFilter) {
         self.max_guest_log_level = Some(log_level);
     }
+
+    /// Map `data` read-only into the guest, where
+    /// `hyperlight_guest::shared_data::get(name)` finds it.
+    ///
+    /// The same `SharedData` can be mapped into any number of sandboxes
+    /// without being copied. The guest address space for it must be
+    /// reserved with `SandboxConfiguration::set_shared_data_size`, and
+    /// shared data is not supported for in-process sandboxes, or on
+    /// Windows.
+    #[instrument(err(Debug), skip(self, data), parent = Span::current())]
+    pub fn map_shared_data(&mut self, name: &str, data: &SharedData) -> Result<()> {
+        self.mgr.unwrap_mgr_mut().map_shared_data(name, data, 0)
+    }
+
+    /// Map `sender`, the sending end of a channel, into the guest, where
+    /// `hyperlight_guest::channel::Sender::open(name)` finds it.
+    ///
+    /// The sandbox takes the place of `sender`, so it is the only sender
+    /// on the channel, and the receiving end is used by the host or mapped
+    /// into another sandbox with `map_channel_receiver`. A sandbox with a
+    /// channel mapped cannot be forked. A channel's memory is reserved and
+    /// listed like shared data (see `map_shared_data`), so the names of
+    /// channels and shared data regions must be distinct, and the same
+    /// restrictions apply.
+    #[instrument(err(Debug), skip(self, sender), parent = Span::current())]
+    pub fn map_channel_sender(&mut self, name: &str, sender: ChannelSender) -> Result<()> {
+        self.mgr.unwrap_mgr_mut().map_shared_data(
+            name,
+            sender.shared_data(),
+            SHARED_DATA_CHANNEL_SENDER,
+        )
+    }
+
+    /// Map `receiver`, the receiving end of a channel, into the guest,
+    /// where `hyperlight_guest::channel::Receiver::open(name)` finds it.
+    ///
+    /// As for `map_channel_sender`, the sandbox takes the place of
+    /// `receiver`.
+    #[instrument(err(Debug), skip(self, receiver), parent = Span::current())]
+    pub fn map_channel_receiver(&mut self, name: &str, receiver: ChannelReceiver) -> Result<()> {
+        self.mgr.unwrap_mgr_mut().map_shared_data(
+            name,
+            receiver.shared_data(),
+            SHARED_DATA_CHANNEL_RECEIVER,
+        )
+    }
+
+    /// Map `image` into the guest, where
+    /// `hyperlight_guest::fs::FileSystem::mount(name)` finds it.
+    ///
+    /// The guest reads the files in the image in place, so they cost no
+    /// more than a memory read. An image is mapped and listed like shared
+    /// data (see `map_shared_data`), so the same restrictions apply.
+    #[instrument(err(Debug), skip(self, image), parent = Span::current())]
+    pub fn map_file_system_image(&mut self, name: &str, image: &FileSystemImage) -> Result<()> {
+        self.mgr
+            .unwrap_mgr_mut()
+            .map_shared_data(name, image.shared_data(), 0)
+    }
+
+    /// Register `func` as the async host function `name`, which takes
+    /// parameters of `parameter_types` and returns a value of `return_type`.
+    ///
+    /// When the guest calls it, `func` is called with the parameters to
+    /// start it, and the guest is suspended until the future it returns
+    /// completes, when the guest is given its result and resumed. The future
+    /// is awaited by the task calling
+    /// `MultiUseSandbox::call_guest_function_by_name_async`, or blocked on
+    /// by the thread calling any other guest call method, and does not run
+    /// under the seccomp filter that host functions do. If it returns an
+    /// error, the guest call fails with it.
+    ///
+    /// Async host functions are not supported for in-process sandboxes.
+    #[instrument(err(Debug), skip(self, func), parent = Span::current())]
+    pub fn register_async_host_function<F, Fut>(
+        &mut self,
+        name: &str,
+        parameter_types: Vec<ParameterType>,
+        return_type: ReturnType,
+        func: F,
+    ) -> Result<()>
+    where
+        F: Fn(Vec<ParameterValue>) -> Fut + Send + Sync + 'static,
+        Fut: Future<Output = Result<ReturnValue>> + Send + 'static,
+    {
+        if self.run_inprocess {
+            log_then_return!("Async host functions are not supported for in-process sandboxes");
+        }
+        let parameter_types = (!parameter_types.is_empty()).then_some(parameter_types);
+        self.host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?
+            .register_async_host_function(
+                self.mgr.unwrap_mgr_mut(),
+                &HostFunctionDefinition::new(name.to_string(), parameter_types, return_type),
+                AsyncHyperlightFunction::new(func),
+            )
+    }
+
+    /// Register a stub for each host function in `recording` that has not
+    /// already been registered, so that the recording can be replayed with
+    /// `MultiUseSandbox::replay_recording` on a sandbox evolved from this
+    /// one, without the real host functions.
+    ///
+    /// The guest checks its host function calls against the definitions of
+    /// the registered host functions, so a stub has the same parameter and
+    /// return types as the function it stands in for. Calling a stub other
+    /// than during a replay returns an error.
+    #[instrument(err(Debug), skip_all, parent = Span::current())]
+    pub fn register_replay_stubs(&mut self, recording: &CallRecording) -> Result<()> {
+        let mut host_funcs = self
+            .host_funcs
+            .try_lock()
+            .map_err(|e| new_error!("Error locking at {}:{}: {}", file!(), line!(), e))?;
+        for hfd in recording.host_functions().host_functions.iter().flatten() {
+            if host_funcs.has_host_function(&hfd.function_name) {
+                continue;
+            }
+            let name = hfd.function_name.clone();
+            let stub = HyperlightFunction::new(move |_| {
+                Err(new_error!(
+                    "Host function {} is a stub for replaying a recording, and was called outside a replay",
+                    name
+                ))
+            });
+            host_funcs.register_host_function(self.mgr.unwrap_mgr_mut(), hfd, stub)?;
+        }
+        Ok(())
+    }
 }
 // Check to see if the current version of Windows is supported
 // Hyperlight is only supported on Windows 11 and Windows Server 2022 and later
@@ -100,6 +100,15 @@ pub(super) fn evolve_impl_multi_use(u_sbox: UninitializedSandbox) -> Result<Mult
     })
 }
 
+/// Evolve a sandbox whose memory manager already holds the snapshot that
+/// guest calls should be reset to, such as one forked from another sandbox.
+#[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
+pub(super) fn evolve_impl_forked(u_sbox: UninitializedSandbox) -> Result<MultiUseSandbox> {
+    evolve_impl(u_sbox, |hf, hshm, hv_handler| {
+        Ok(MultiUseSandbox::from_uninit(hf, hshm, hv_handler))
+    })
+}
+
 #[instrument(err(Debug), skip_all, parent = Span::current(), level = "Trace")]
 #[allow(clippy::too_many_arguments)]
 fn hv_init(
@@ -14,10 +14,14 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+use std::sync::{Arc, Mutex};
+
 use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 use hyperlight_common::mem::PAGE_SIZE;
-use hyperlight_host::func::{ParameterValue, ReturnType, ReturnValue};
-use hyperlight_host::sandbox::SandboxConfiguration;
+use hyperlight_host::func::{
+    HostFunction2, ParameterType, ParameterValue, ReturnType, ReturnValue,
+};
+use hyperlight_host::sandbox::{CallRecording, SandboxConfiguration};
 use hyperlight_host::sandbox_state::sandbox::EvolvableSandbox;
 use hyperlight_host::sandbox_state::transition::Noop;
 use hyperlight_host::{GuestBinary, HyperlightError, MultiUseSandbox, UninitializedSandbox};
@@ -185,6 +189,123 @@ fn guest_panic() {
     )
 }
 
+#[test]
+fn guest_validates_host_function_calls() {
+    // this test is rust-specific
+    let cases = [
+        (
+            vec![ParameterValue::String("NotARealHostFunction".to_string())],
+            "Host Function Not Found: NotARealHostFunction",
+        ),
+        (
+            vec![
+                ParameterValue::String("HostPrint".to_string()),
+                ParameterValue::Int(1),
+            ],
+            "Incorrect parameter type for function: HostPrint",
+        ),
+        (
+            vec![ParameterValue::String("HostPrint".to_string())],
+            "Incorrect parameter count for function: HostPrint",
+        ),
+    ];
+
+    for (params, expected) in cases {
+        let mut sbox = new_uninit_rust().unwrap().evolve(Noop::default()).unwrap();
+        let res = sbox
+            .call_guest_function_by_name("FuzzHostFunc", ReturnType::Int, Some(params))
+            .unwrap_err();
+        assert!(
+            matches!(&res, HyperlightError::GuestAborted(_, context) if context.contains(expected)),
+            "expected {:?}, got {:?}",
+            expected,
+            res
+        );
+    }
+}
+
+// Loads a snapshot file taken without `HostAdd` into a sandbox that
+// registers it, and checks that the guest validates its host function calls
+// against the functions registered after loading, not those in the snapshot
+#[test]
+fn snapshot_file_uses_registered_host_functions() {
+    // this test is rust-specific
+    let mut sbox = new_uninit_rust().unwrap().evolve(Noop::default()).unwrap();
+    let dir = tempfile::tempdir().unwrap();
+    let snapshot_path = dir.path().join("sandbox.snapshot");
+    sbox.save_snapshot_file(&snapshot_path).unwrap();
+    drop(sbox);
+
+    let mut u_sbox = UninitializedSandbox::from_snapshot_file(&snapshot_path, None, None).unwrap();
+    let host_add = Arc::new(Mutex::new(
+        |a: i32, b: i32| -> hyperlight_host::Result<i32> { Ok(a + b) },
+    ));
+    host_add.register(&mut u_sbox, "HostAdd").unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+    let res = sbox
+        .call_guest_function_by_name(
+            "Add",
+            ReturnType::Int,
+            Some(vec![ParameterValue::Int(2), ParameterValue::Int(3)]),
+        )
+        .unwrap();
+    assert_eq!(res, ReturnValue::Int(5));
+
+    // And the other way round: a function registered when the snapshot was
+    // taken, but not after loading it, is unknown to the guest
+    let mut u_sbox = new_uninit_rust().unwrap();
+    host_add.register(&mut u_sbox, "HostAdd").unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+    sbox.save_snapshot_file(&snapshot_path).unwrap();
+    drop(sbox);
+
+    let u_sbox = UninitializedSandbox::from_snapshot_file(&snapshot_path, None, None).unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+    let res = sbox
+        .call_guest_function_by_name(
+            "Add",
+            ReturnType::Int,
+            Some(vec![ParameterValue::Int(2), ParameterValue::Int(3)]),
+        )
+        .unwrap_err();
+    assert!(
+        matches!(&res, HyperlightError::GuestError(_, msg) if msg.contains("Host Function Not Found: HostAdd")),
+        "got {:?}",
+        res
+    );
+}
+
+#[test]
+fn guest_function_reads_parameters_in_place() {
+    // this test is rust-specific
+    let mut sbox = new_uninit_rust().unwrap().evolve(Noop::default()).unwrap();
+
+    let data: Vec<u8> = (0..4096).map(|i| i as u8).collect();
+    let expected: u64 = data.iter().map(|&byte| u64::from(byte)).sum();
+    for _ in 0..2 {
+        let res = sbox
+            .call_guest_function_by_name(
+                "SumBytesView",
+                ReturnType::ULong,
+                Some(vec![ParameterValue::VecBytes(data.clone())]),
+            )
+            .unwrap();
+        assert_eq!(res, ReturnValue::ULong(expected));
+    }
+
+    let res = sbox
+        .call_guest_function_by_name(
+            "SumBytesView",
+            ReturnType::ULong,
+            Some(vec![ParameterValue::String("not bytes".to_string())]),
+        )
+        .unwrap_err();
+    assert!(matches!(
+        res,
+        HyperlightError::GuestError(ErrorCode::GuestFunctionParameterTypeMismatch, _)
+    ));
+}
+
 #[test]
 fn guest_malloc() {
     // this test is rust-only
@@ -266,6 +387,240 @@ fn guest_malloc_abort() {
     ));
 }
 
+// checks that a heap allowed to grow does so when the guest runs out, up
+// to its maximum size
+#[test]
+fn guest_heap_grows_on_demand() {
+    let heap_size = 0x4000;
+    let max_heap_size = 0x100_0000;
+    let size_to_allocate = 0x10_0000;
+
+    let mut cfg = SandboxConfiguration::default();
+    cfg.set_heap_size(heap_size);
+    cfg.set_max_heap_size(max_heap_size);
+    let uninit = UninitializedSandbox::new(
+        GuestBinary::FilePath(simple_guest_as_string().unwrap()),
+        Some(cfg),
+        None,
+        None,
+    )
+    .unwrap();
+    let mut sbox = uninit.evolve(Noop::default()).unwrap();
+
+    // the heap is shrunk back after each call, and grows again in the next
+    for _ in 0..2 {
+        let res = sbox
+            .call_guest_function_by_name(
+                "CallMalloc",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(size_to_allocate)]),
+            )
+            .unwrap();
+        assert!(
+            matches!(res, ReturnValue::Int(returned_size) if returned_size == size_to_allocate)
+        );
+    }
+
+    let res = sbox.call_guest_function_by_name(
+        "CallMalloc",
+        ReturnType::Int,
+        Some(vec![ParameterValue::Int(max_heap_size as i32 * 2)]),
+    );
+    assert!(matches!(
+        res.unwrap_err(),
+        HyperlightError::GuestAborted(code, msg) if code == ErrorCode::UnknownError as u8 && msg.contains("memory allocation of ")
+    ));
+}
+
+// checks that one shared data region can be mapped into several sandboxes,
+// and that the guests can read it but not write to it
+#[test]
+#[cfg(target_os = "linux")]
+fn shared_data_is_mapped_read_only() {
+    use hyperlight_host::SharedData;
+
+    let bytes = (0..0x30_0000).map(|i| (i % 251) as u8).collect::<Vec<_>>();
+    let expected_sum = bytes.iter().map(|b| *b as i64).sum::<i64>();
+    let data = SharedData::new(&bytes).unwrap();
+
+    let mut cfg = SandboxConfiguration::default();
+    cfg.set_shared_data_size(0x40_0000);
+    let mut sandboxes = (0..2)
+        .map(|_| {
+            let mut uninit = UninitializedSandbox::new(
+                GuestBinary::FilePath(simple_guest_as_string().unwrap()),
+                Some(cfg),
+                None,
+                None,
+            )
+            .unwrap();
+            uninit.map_shared_data("bytes", &data).unwrap();
+            uninit.evolve(Noop::default()).unwrap()
+        })
+        .collect::<Vec<MultiUseSandbox>>();
+
+    for sbox in &mut sandboxes {
+        for (name, sum) in [("bytes", expected_sum), ("missing", -1)] {
+            let res = sbox
+                .call_guest_function_by_name(
+                    "SumSharedData",
+                    ReturnType::Long,
+                    Some(vec![ParameterValue::String(name.to_string())]),
+                )
+                .unwrap();
+            assert!(matches!(res, ReturnValue::Long(s) if s == sum));
+        }
+    }
+
+    let err = sandboxes[0]
+        .call_guest_function_by_name(
+            "WriteSharedData",
+            ReturnType::Void,
+            Some(vec![ParameterValue::String("bytes".to_string())]),
+        )
+        .unwrap_err();
+    // exception that indicates a page fault
+    assert!(err.to_string().contains("EXCEPTION: 0xe"));
+    assert_eq!(bytes, data.as_slice());
+}
+
+// Passes messages from the host through a pipeline of two sandboxes, each
+// stage of which reads them straight from the channel the previous stage
+// wrote them to
+#[test]
+#[cfg(target_os = "linux")]
+fn channels_connect_sandboxes() {
+    let (mut input, input_rx) = hyperlight_host::channel(4096).unwrap();
+    let (output_tx, output_rx) = hyperlight_host::channel(4096).unwrap();
+
+    let mut cfg = SandboxConfiguration::default();
+    cfg.set_shared_data_size(0x40_0000);
+    let new_uninit = || {
+        UninitializedSandbox::new(
+            GuestBinary::FilePath(simple_guest_as_string().unwrap()),
+            Some(cfg),
+            None,
+            None,
+        )
+        .unwrap()
+    };
+    let mut stage = new_uninit();
+    stage.map_channel_receiver("in", input_rx).unwrap();
+    stage.map_channel_sender("out", output_tx).unwrap();
+    let mut stage: MultiUseSandbox = stage.evolve(Noop::default()).unwrap();
+    let mut sink = new_uninit();
+    sink.map_channel_receiver("in", output_rx).unwrap();
+    let mut sink: MultiUseSandbox = sink.evolve(Noop::default()).unwrap();
+
+    assert!(input.try_send(b"hello").unwrap());
+    assert!(input.try_send(b"world").unwrap());
+    let res = stage
+        .call_guest_function_by_name(
+            "UppercaseChannel",
+            ReturnType::Int,
+            Some(vec![
+                ParameterValue::String("in".to_string()),
+                ParameterValue::String("out".to_string()),
+            ]),
+        )
+        .unwrap();
+    assert_eq!(res, ReturnValue::Int(2));
+    assert!(input.is_empty());
+
+    for expected in [b"HELLO".to_vec(), b"WORLD".to_vec(), vec![]] {
+        let res = sink
+            .call_guest_function_by_name(
+                "ReceiveFromChannel",
+                ReturnType::VecBytes,
+                Some(vec![ParameterValue::String("in".to_string())]),
+            )
+            .unwrap();
+        assert_eq!(res, ReturnValue::VecBytes(expected));
+    }
+
+    // Each guest can only use the end of a channel it was given, and
+    // cannot read a channel as shared data
+    let res = sink.call_guest_function_by_name(
+        "SendToChannel",
+        ReturnType::Bool,
+        Some(vec![
+            ParameterValue::String("in".to_string()),
+            ParameterValue::VecBytes(b"back".to_vec()),
+        ]),
+    );
+    assert!(res.is_err());
+    let res = stage.call_guest_function_by_name(
+        "ReceiveFromChannel",
+        ReturnType::VecBytes,
+        Some(vec![ParameterValue::String("out".to_string())]),
+    );
+    assert!(res.is_err());
+    let res = stage
+        .call_guest_function_by_name(
+            "SumSharedData",
+            ReturnType::Long,
+            Some(vec![ParameterValue::String("in".to_string())]),
+        )
+        .unwrap();
+    assert_eq!(res, ReturnValue::Long(-1));
+    assert!(stage.fork().is_err());
+}
+
+// Maps a file system image into two sandboxes, which both read files
+// from it without any host calls
+#[test]
+#[cfg(target_os = "linux")]
+fn file_system_image_is_readable_in_guests() {
+    use hyperlight_host::FileSystemImage;
+
+    let large = (0..1000).map(|i| (i % 251) as u8).collect::<Vec<_>>();
+    let files: [(&str, &[u8]); 2] = [
+        ("templates/index.html", b"<html></html>"),
+        ("data/large.bin", &large),
+    ];
+    let image = FileSystemImage::new(files).unwrap();
+
+    let mut cfg = SandboxConfiguration::default();
+    cfg.set_shared_data_size(0x20_0000);
+    for _ in 0..2 {
+        let mut uninit = UninitializedSandbox::new(
+            GuestBinary::FilePath(simple_guest_as_string().unwrap()),
+            Some(cfg),
+            None,
+            None,
+        )
+        .unwrap();
+        uninit.map_file_system_image("assets", &image).unwrap();
+        let mut sbox: MultiUseSandbox = uninit.evolve(Noop::default()).unwrap();
+
+        for (path, contents) in files {
+            let res = sbox
+                .call_guest_function_by_name(
+                    "ReadFile",
+                    ReturnType::VecBytes,
+                    Some(vec![
+                        ParameterValue::String("assets".to_string()),
+                        ParameterValue::String(format!("/{}", path)),
+                    ]),
+                )
+                .unwrap();
+            assert_eq!(res, ReturnValue::VecBytes(contents.to_vec()));
+        }
+
+        let res = sbox.call_guest_function_by_name(
+            "ReadFile",
+            ReturnType::VecBytes,
+            Some(vec![
+                ParameterValue::String("assets".to_string()),
+                ParameterValue::String("missing".to_string()),
+            ]),
+        );
+        assert!(
+            matches!(res, Err(HyperlightError::GuestError(_, msg)) if msg.contains("No such file"))
+        );
+    }
+}
+
 // Tests libc alloca
 #[test]
 fn dynamic_stack_allocate_c_guest() {
@@ -293,6 +648,143 @@ fn dynamic_stack_allocate_c_guest() {
     assert!(matches!(res, HyperlightError::StackOverflow()));
 }
 
+// checks that the C guest's printf formats doubles exactly, like glibc does
+#[test]
+fn c_guest_formats_doubles_exactly() {
+    let path = c_simple_guest_as_string().unwrap();
+    let uninit = UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None);
+    let mut sbox: MultiUseSandbox = uninit.unwrap().evolve(Noop::default()).unwrap();
+
+    let cases = [
+        ("%f", 123.456, "123.456000"),
+        ("%.20f", 0.1, "0.10000000000000000555"),
+        ("%.0f", 2.5, "2"),
+        ("%.2f", 2.675, "2.67"),
+        ("%f", 1e23, "99999999999999991611392.000000"),
+        ("%e", 5e-324, "4.940656e-324"),
+        ("%.16e", 1.7976931348623157e308, "1.7976931348623157e+308"),
+        ("%g", 1e-5, "1e-05"),
+        ("%g", 123456789.0, "1.23457e+08"),
+        ("%.17g", 0.3, "0.29999999999999999"),
+        ("%#.3g", 1.0, "1.00"),
+        ("%+09.2f", -0.0, "-00000.00"),
+        ("%8.3e|", f64::INFINITY, "     inf|"),
+    ];
+    for (format, value, expected) in cases {
+        let res = sbox
+            .call_guest_function_by_name(
+                "FormatDouble",
+                ReturnType::String,
+                Some(vec![
+                    ParameterValue::String(format.to_string()),
+                    ParameterValue::Double(value),
+                ]),
+            )
+            .unwrap();
+        assert!(
+            matches!(&res, ReturnValue::String(s) if s == expected),
+            "{format} {value}: {res:?}"
+        );
+    }
+}
+
+#[test]
+fn c_guest_parses_doubles_exactly() {
+    let path = c_simple_guest_as_string().unwrap();
+    let uninit = UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None);
+    let mut sbox: MultiUseSandbox = uninit.unwrap().evolve(Noop::default()).unwrap();
+
+    let cases = [
+        ("3.14159", 3.14159),
+        ("-0.0", -0.0),
+        ("  +.5e1", 5.0),
+        ("9007199254740993", 9007199254740992.0),
+        ("1e23", 1e23),
+        ("0.30000000000000004", 0.30000000000000004),
+        ("123456789012345678901234567890", 1.2345678901234568e29),
+        ("1.7976931348623157e308", f64::MAX),
+        ("2.2250738585072011e-308", 2.2250738585072011e-308),
+        ("4.9e-324", 5e-324),
+        ("1e400", f64::INFINITY),
+        ("0x1.8p1", 3.0),
+        ("-inf", f64::NEG_INFINITY),
+    ];
+    for (text, expected) in cases {
+        let res = sbox
+            .call_guest_function_by_name(
+                "ParseDouble",
+                ReturnType::Double,
+                Some(vec![ParameterValue::String(text.to_string())]),
+            )
+            .unwrap();
+        assert!(
+            matches!(res, ReturnValue::Double(value) if value.to_bits() == expected.to_bits()),
+            "{text}: {res:?}"
+        );
+    }
+}
+
+#[test]
+fn c_guest_qsort_sorts() {
+    let path = c_simple_guest_as_string().unwrap();
+    let uninit = UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None);
+    let mut sbox: MultiUseSandbox = uninit.unwrap().evolve(Noop::default()).unwrap();
+
+    for count in [0, 1, 2, 23, 24, 100, 129, 1000, 16384] {
+        for few_distinct in [false, true] {
+            let res = sbox
+                .call_guest_function_by_name(
+                    "SortInts",
+                    ReturnType::Int,
+                    Some(vec![
+                        ParameterValue::Int(count),
+                        ParameterValue::Bool(few_distinct),
+                    ]),
+                )
+                .unwrap();
+            assert!(
+                matches!(res, ReturnValue::Int(n) if n == count),
+                "{count} {few_distinct}: {res:?}"
+            );
+        }
+    }
+}
+
+#[test]
+fn c_guest_vecmath_matches_libm() {
+    let path = c_simple_guest_as_string().unwrap();
+    let uninit = UninitializedSandbox::new(GuestBinary::FilePath(path), None, None, None);
+    let mut sbox: MultiUseSandbox = uninit.unwrap().evolve(Noop::default()).unwrap();
+
+    // the documented bounds are against the exact result, and the scalar
+    // libm functions are themselves within 1 ulp of that
+    for (name, max_ulp) in [
+        ("exp", 2),
+        ("log", 2),
+        ("sin", 2),
+        ("cos", 2),
+        ("tanh", 3),
+        ("sqrt", 0),
+    ] {
+        for single in [false, true] {
+            let res = sbox
+                .call_guest_function_by_name(
+                    "VecMathMaxUlp",
+                    ReturnType::Int,
+                    Some(vec![
+                        ParameterValue::String(name.to_string()),
+                        ParameterValue::Bool(single),
+                    ]),
+                )
+                .unwrap();
+            assert!(
+                matches!(res, ReturnValue::Int(n) if (0..=max_ulp).contains(&n)),
+                "{name} {single}: {res:?}"
+            );
+        }
+    }
+}
+
 // checks that a small buffer on stack works
 #[test]
 fn static_stack_allocate() {
@@ -540,3 +1032,254 @@ fn log_test_messages(levelfilter: Option<log::LevelFilter>) {
             .unwrap();
     }
 }
+
+// Records some guest calls, saves the recording to a file, and replays it
+// on a sandbox that only has stubs for the host functions
+#[test]
+fn record_and_replay_guest_calls() {
+    let mut u_sbox = new_uninit_rust().unwrap();
+    let host_add = Arc::new(Mutex::new(
+        |a: i32, b: i32| -> hyperlight_host::Result<i32> { Ok(a + b) },
+    ));
+    host_add.register(&mut u_sbox, "HostAdd").unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+
+    sbox.start_recording().unwrap();
+    let res = sbox
+        .call_guest_function_by_name(
+            "AddRepeatedly",
+            ReturnType::Int,
+            Some(vec![ParameterValue::Int(5)]),
+        )
+        .unwrap();
+    assert_eq!(res, ReturnValue::Int(5));
+    sbox.call_guest_function_by_name(
+        "Echo",
+        ReturnType::String,
+        Some(vec![ParameterValue::String("hello".to_string())]),
+    )
+    .unwrap();
+    let recording = sbox.stop_recording().unwrap();
+    assert!(sbox.stop_recording().is_err());
+
+    assert_eq!(recording.calls().len(), 2);
+    assert_eq!(recording.calls()[0].host_calls.len(), 5);
+    assert!(recording.calls()[1].host_calls.is_empty());
+    assert!(recording.calls().iter().all(|call| call.reset_after));
+
+    let file = tempfile::NamedTempFile::new().unwrap();
+    recording.save(file.path()).unwrap();
+    let recording = CallRecording::load(file.path()).unwrap();
+
+    let mut u_sbox = new_uninit_rust().unwrap();
+    u_sbox.register_replay_stubs(&recording).unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+    let report = sbox.replay_recording(&recording).unwrap();
+    assert_eq!(report.calls, 2);
+    assert!(report.divergences.is_empty(), "{:?}", report.divergences);
+
+    // Outside a replay, the stubs fail
+    let res = sbox.call_guest_function_by_name(
+        "AddRepeatedly",
+        ReturnType::Int,
+        Some(vec![ParameterValue::Int(1)]),
+    );
+    assert!(res.is_err());
+
+    // The C guest has no `AddRepeatedly`, so replaying the recording on it
+    // diverges at the first call
+    let mut u_sbox = UninitializedSandbox::new(
+        GuestBinary::FilePath(c_simple_guest_as_string().unwrap()),
+        None,
+        None,
+        None,
+    )
+    .unwrap();
+    u_sbox.register_replay_stubs(&recording).unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+    let report = sbox.replay_recording(&recording).unwrap();
+    assert_eq!(report.calls, 2);
+    assert!(
+        report.divergences[0].starts_with("Call 0 to AddRepeatedly failed"),
+        "{:?}",
+        report.divergences
+    );
+    // ... and it makes none of the recorded `HostAdd` calls
+    assert!(report.divergences[1].starts_with("Call 0 to AddRepeatedly made 5 fewer"));
+}
+
+// Runs a guest benchmark from `hyperlight_guest::bench`, which returns one
+// cycle count per sample
+#[test]
+fn run_guest_benchmark() {
+    let mut sbox = new_uninit_rust().unwrap().evolve(Noop::default()).unwrap();
+
+    for name in ["nop", "memcpy_4KiB"] {
+        let res = sbox
+            .call_guest_function_by_name(
+                "RunGuestBenchmark",
+                ReturnType::VecBytes,
+                Some(vec![
+                    ParameterValue::String(name.to_string()),
+                    ParameterValue::Int(10),
+                    ParameterValue::Int(100),
+                ]),
+            )
+            .unwrap();
+        let ReturnValue::VecBytes(samples) = res else {
+            panic!("Unexpected return value {:?}", res);
+        };
+        assert_eq!(samples.len(), 10 * 8);
+        for sample in samples.chunks(8) {
+            assert!(u64::from_le_bytes(sample.try_into().unwrap()) > 0);
+        }
+    }
+
+    let res = sbox.call_guest_function_by_name(
+        "RunGuestBenchmark",
+        ReturnType::VecBytes,
+        Some(vec![
+            ParameterValue::String("NotABenchmark".to_string()),
+            ParameterValue::Int(1),
+            ParameterValue::Int(1),
+        ]),
+    );
+    assert!(
+        matches!(res, Err(HyperlightError::GuestError(_, msg)) if msg.contains("NotABenchmark"))
+    );
+}
+
+// Registers `HostAdd` as an async host function that adds its parameters
+// after waiting on a timer, which needs the tokio runtime
+fn new_uninit_with_async_host_add() -> UninitializedSandbox {
+    let mut u_sbox = new_uninit_rust().unwrap();
+    u_sbox
+        .register_async_host_function(
+            "HostAdd",
+            vec![ParameterType::Int, ParameterType::Int],
+            ReturnType::Int,
+            |args| async move {
+                tokio::time::sleep(std::time::Duration::from_millis(1)).await;
+                match args.as_slice() {
+                    [ParameterValue::Int(a), ParameterValue::Int(b)] => Ok(ReturnValue::Int(a + b)),
+                    _ => Err(HyperlightError::Error("Unexpected parameters".to_string())),
+                }
+            },
+        )
+        .unwrap();
+    u_sbox
+}
+
+// The guest is suspended while each of its async host function calls is
+// awaited, and carries on with the result
+#[tokio::test]
+async fn async_host_function() {
+    let mut sbox: MultiUseSandbox = new_uninit_with_async_host_add()
+        .evolve(Noop::default())
+        .unwrap();
+
+    for _ in 0..2 {
+        let res = sbox
+            .call_guest_function_by_name_async(
+                "AddRepeatedly",
+                ReturnType::Int,
+                Some(vec![ParameterValue::Int(5)]),
+            )
+            .await
+            .unwrap();
+        assert_eq!(res, ReturnValue::Int(5));
+    }
+}
+
+// A guest call made without awaiting blocks its thread on async host
+// functions instead
+#[test]
+fn async_host_function_called_synchronously() {
+    let runtime = tokio::runtime::Runtime::new().unwrap();
+    let _guard = runtime.enter();
+    let mut sbox: MultiUseSandbox = new_uninit_with_async_host_add()
+        .evolve(Noop::default())
+        .unwrap();
+
+    let res = sbox
+        .call_guest_function_by_name(
+            "AddRepeatedly",
+            ReturnType::Int,
+            Some(vec![ParameterValue::Int(3)]),
+        )
+        .unwrap();
+    assert_eq!(res, ReturnValue::Int(3));
+}
+
+// Dropping the future of a guest call that is waiting on an async host
+// function discards the call, and the sandbox can still be used afterwards
+#[tokio::test]
+async fn async_guest_call_dropped() {
+    let mut u_sbox = new_uninit_rust().unwrap();
+    u_sbox
+        .register_async_host_function(
+            "HostAdd",
+            vec![ParameterType::Int, ParameterType::Int],
+            ReturnType::Int,
+            |_| std::future::pending::<hyperlight_host::Result<ReturnValue>>(),
+        )
+        .unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+
+    let res = tokio::time::timeout(
+        std::time::Duration::from_millis(100),
+        sbox.call_guest_function_by_name_async(
+            "AddRepeatedly",
+            ReturnType::Int,
+            Some(vec![ParameterValue::Int(2)]),
+        ),
+    )
+    .await;
+    assert!(res.is_err());
+    assert!(!sbox.has_suspended_call());
+
+    let res = sbox
+        .call_guest_function_by_name_async(
+            "Echo",
+            ReturnType::String,
+            Some(vec![ParameterValue::String("hello".to_string())]),
+        )
+        .await
+        .unwrap();
+    assert_eq!(res, ReturnValue::String("hello".to_string()));
+}
+
+// An async host function that fails fails the guest call, and the sandbox
+// can still be used afterwards
+#[tokio::test]
+async fn async_host_function_error() {
+    let mut u_sbox = new_uninit_rust().unwrap();
+    u_sbox
+        .register_async_host_function(
+            "HostAdd",
+            vec![ParameterType::Int, ParameterType::Int],
+            ReturnType::Int,
+            |_| async { Err(HyperlightError::Error("HostAdd failed".to_string())) },
+        )
+        .unwrap();
+    let mut sbox: MultiUseSandbox = u_sbox.evolve(Noop::default()).unwrap();
+
+    let res = sbox
+        .call_guest_function_by_name_async(
+            "AddRepeatedly",
+            ReturnType::Int,
+            Some(vec![ParameterValue::Int(2)]),
+        )
+        .await;
+    assert!(matches!(res, Err(HyperlightError::Error(msg)) if msg == "HostAdd failed"));
+
+    let res = sbox
+        .call_guest_function_by_name_async(
+            "Echo",
+            ReturnType::String,
+            Some(vec![ParameterValue::String("hello".to_string())]),
+        )
+        .await
+        .unwrap();
+    assert_eq!(res, ReturnValue::String("hello".to_string()));
+}
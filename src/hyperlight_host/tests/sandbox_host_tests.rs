@@ -388,7 +388,8 @@ fn incorrect_parameter_num() {
 #[test]
 fn max_memory_sandbox() {
     let mut cfg = SandboxConfiguration::default();
-    cfg.set_input_data_size(0x40000000);
+    // Sandboxes are limited to the 512GB a single PDPT can map
+    cfg.set_heap_size(0x80_0000_0000);
     let a = UninitializedSandbox::new(
         GuestBinary::FilePath(simple_guest_as_string().unwrap()),
         Some(cfg),
@@ -4,6 +4,8 @@
 #include "stdint.h"
 #include "string.h"
 #include "stdlib.h"
+#include "math.h"
+#include "vecmath.h"
 // Included from hyperlight_guest/third_party/printf
 #include "printf.h"
 
@@ -232,6 +234,213 @@ int log_message(const char *message, int64_t level) {
   return -1;
 }
 
+static char formatted_double[MAX_BUFFER_SIZE];
+
+const char *format_double(const char *format, double value) {
+  snprintf(formatted_double, sizeof(formatted_double), format, value);
+  return formatted_double;
+}
+
+// Formats count pseudo-random doubles, with three decimals like numbers in a
+// CSV file, and returns the total length of the output. The host uses this
+// to measure the throughput of the guest's float formatting.
+int format_doubles(int32_t count, const char *format) {
+  char buffer[MAX_BUFFER_SIZE];
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  int total = 0;
+  for (int32_t i = 0; i < count; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    total += snprintf(buffer, sizeof(buffer), format, (double)(int64_t)(state >> 24) / 1000.0);
+  }
+  return total;
+}
+
+double parse_double(const char *text) {
+  return strtod(text, NULL);
+}
+
+// Parses the comma separated numbers in text, like a row of a CSV file, and
+// returns their sum. The host uses this to measure the throughput of the
+// guest's float parsing.
+double parse_doubles(const char *text) {
+  double sum = 0;
+  char *end;
+  while (*text) {
+    double value = strtod(text, &end);
+    if (end == text) {
+      text++;
+      continue;
+    }
+    sum += value;
+    text = end;
+  }
+  return sum;
+}
+
+static int compare_ints(const void *a, const void *b) {
+  int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int32_t sort_buffer[16384];
+
+// Sorts count pseudo-random ints with qsort and returns count, or -1 if the
+// result is not sorted. With few_distinct set, the ints only take 16
+// distinct values. The host uses this to measure the guest's qsort.
+int sort_ints(int32_t count, bool few_distinct) {
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  if (count < 0 || count > (int32_t)(sizeof(sort_buffer) / sizeof(sort_buffer[0]))) {
+    hl_set_error(hl_ErrorCode_GuestError, "Invalid count");
+    return -1;
+  }
+  for (int32_t i = 0; i < count; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    sort_buffer[i] = few_distinct ? (int32_t)(state % 16) : (int32_t)state;
+  }
+  qsort(sort_buffer, count, sizeof(sort_buffer[0]), compare_ints);
+  for (int32_t i = 1; i < count; i++) {
+    if (sort_buffer[i - 1] > sort_buffer[i]) {
+      return -1;
+    }
+  }
+  return count;
+}
+
+struct vecmath_function {
+  const char *name;
+  void (*batched)(const double *, double *, size_t);
+  double (*scalar)(double);
+  void (*batchedf)(const float *, float *, size_t);
+  float (*scalarf)(float);
+  // inputs are uniform in [-range, range], or random positive finite
+  // numbers when range is zero
+  double range;
+  float rangef;
+};
+
+static const struct vecmath_function vecmath_functions[] = {
+  {"exp", hl_vexp, exp, hl_vexpf, expf, 710, 90},
+  {"log", hl_vlog, log, hl_vlogf, logf, 0, 0},
+  {"sin", hl_vsin, sin, hl_vsinf, sinf, 1e6, 1e5f},
+  {"cos", hl_vcos, cos, hl_vcosf, cosf, 1e6, 1e5f},
+  {"tanh", hl_vtanh, tanh, hl_vtanhf, tanhf, 30, 12},
+  {"sqrt", hl_vsqrt, sqrt, hl_vsqrtf, sqrtf, 0, 0},
+};
+
+#define VECMATH_COUNT 4096
+
+static double vecmath_in[VECMATH_COUNT], vecmath_out[VECMATH_COUNT];
+static float vecmath_inf[VECMATH_COUNT], vecmath_outf[VECMATH_COUNT];
+
+static const struct vecmath_function *find_vecmath_function(const char *name) {
+  for (size_t i = 0; i < sizeof(vecmath_functions) / sizeof(vecmath_functions[0]); i++) {
+    if (strcmp(vecmath_functions[i].name, name) == 0) {
+      return &vecmath_functions[i];
+    }
+  }
+  hl_set_error(hl_ErrorCode_GuestError, "Unknown function");
+  return NULL;
+}
+
+static void fill_vecmath_inputs(const struct vecmath_function *f) {
+  static const double specials[] = {0.0, -0.0, INFINITY, -INFINITY, NAN, 1e-310, -1e-310, 1e300, -1e300};
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  for (int i = 0; i < VECMATH_COUNT; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    if (i < (int)(sizeof(specials) / sizeof(specials[0]))) {
+      vecmath_in[i] = specials[i];
+      vecmath_inf[i] = (float)specials[i];
+    } else if (f->range == 0) {
+      // a random exponent and mantissa, positive and finite
+      uint64_t bits = state % 0x7FF0000000000000ULL;
+      uint32_t bitsf = (uint32_t)(state >> 32) % 0x7F800000U;
+      memcpy(&vecmath_in[i], &bits, sizeof(bits));
+      memcpy(&vecmath_inf[i], &bitsf, sizeof(bitsf));
+    } else {
+      double unit = (double)(state >> 11) / 9007199254740992.0 * 2 - 1;
+      vecmath_in[i] = unit * f->range;
+      vecmath_inf[i] = (float)unit * f->rangef;
+    }
+  }
+}
+
+// The distance between two results in units in the last place, counting two
+// nans as equal.
+static uint64_t ulp_diff(double a, double b) {
+  int64_t x, y;
+  if (isnan(a) || isnan(b)) {
+    return isnan(a) && isnan(b) ? 0 : INT32_MAX;
+  }
+  memcpy(&x, &a, sizeof(x));
+  memcpy(&y, &b, sizeof(y));
+  x = x < 0 ? INT64_MIN - x : x;
+  y = y < 0 ? INT64_MIN - y : y;
+  return x > y ? (uint64_t)x - (uint64_t)y : (uint64_t)y - (uint64_t)x;
+}
+
+static uint64_t ulp_difff(float a, float b) {
+  int32_t x, y;
+  if (isnan(a) || isnan(b)) {
+    return isnan(a) && isnan(b) ? 0 : INT32_MAX;
+  }
+  memcpy(&x, &a, sizeof(x));
+  memcpy(&y, &b, sizeof(y));
+  x = x < 0 ? INT32_MIN - x : x;
+  y = y < 0 ? INT32_MIN - y : y;
+  return x > y ? (uint64_t)x - (uint64_t)y : (uint64_t)y - (uint64_t)x;
+}
+
+// Returns the largest difference, in units in the last place, between the
+// batched math function called name and its scalar libm counterpart, over
+// pseudo-random and special inputs, or -1 if name is not one of them.
+int vecmath_max_ulp(const char *name, bool single) {
+  const struct vecmath_function *f = find_vecmath_function(name);
+  uint64_t max = 0;
+  if (f == NULL) {
+    return -1;
+  }
+  fill_vecmath_inputs(f);
+  if (single) {
+    f->batchedf(vecmath_inf, vecmath_outf, VECMATH_COUNT);
+  } else {
+    f->batched(vecmath_in, vecmath_out, VECMATH_COUNT);
+  }
+  for (int i = 0; i < VECMATH_COUNT; i++) {
+    uint64_t diff = single ? ulp_difff(vecmath_outf[i], f->scalarf(vecmath_inf[i]))
+                           : ulp_diff(vecmath_out[i], f->scalar(vecmath_in[i]));
+    max = diff > max ? diff : max;
+  }
+  return max > INT32_MAX ? INT32_MAX : (int)max;
+}
+
+// Applies the math function called name to 4096 doubles rounds times, with
+// either the batched function or a loop over the scalar one, and returns
+// rounds, or -1 if name is not one of them. The host uses this to measure
+// the batched math functions.
+int vecmath_run(const char *name, int32_t rounds, bool batched) {
+  const struct vecmath_function *f = find_vecmath_function(name);
+  if (f == NULL) {
+    return -1;
+  }
+  fill_vecmath_inputs(f);
+  for (int32_t round = 0; round < rounds; round++) {
+    if (batched) {
+      f->batched(vecmath_in, vecmath_out, VECMATH_COUNT);
+    } else {
+      for (int i = 0; i < VECMATH_COUNT; i++) {
+        vecmath_out[i] = f->scalar(vecmath_in[i]);
+      }
+    }
+  }
+  return rounds;
+}
+
 HYPERLIGHT_WRAP_FUNCTION(echo, String, 1, String)
 // HYPERLIGHT_WRAP_FUNCTION(set_byte_array_to_zero, 1, VecBytes) is not valid for functions that return VecBytes
 HYPERLIGHT_WRAP_FUNCTION(print_output, Int, 1, String)
@@ -260,6 +469,13 @@ HYPERLIGHT_WRAP_FUNCTION(guest_abort_with_msg, Int, 2, Int, String)
 HYPERLIGHT_WRAP_FUNCTION(guest_abort_with_code, Int, 1, Int)
 HYPERLIGHT_WRAP_FUNCTION(execute_on_stack, Int, 0)
 HYPERLIGHT_WRAP_FUNCTION(log_message, Int, 2, String, Long)
+HYPERLIGHT_WRAP_FUNCTION(format_double, String, 2, String, Double)
+HYPERLIGHT_WRAP_FUNCTION(format_doubles, Int, 2, Int, String)
+HYPERLIGHT_WRAP_FUNCTION(parse_double, Double, 1, String)
+HYPERLIGHT_WRAP_FUNCTION(parse_doubles, Double, 1, String)
+HYPERLIGHT_WRAP_FUNCTION(sort_ints, Int, 2, Int, Bool)
+HYPERLIGHT_WRAP_FUNCTION(vecmath_max_ulp, Int, 2, String, Bool)
+HYPERLIGHT_WRAP_FUNCTION(vecmath_run, Int, 3, String, Int, Bool)
 
 void hyperlight_main(void)
 {
@@ -295,6 +511,13 @@ void hyperlight_main(void)
     HYPERLIGHT_REGISTER_FUNCTION("GuestAbortWithMessage", guest_abort_with_msg);
     HYPERLIGHT_REGISTER_FUNCTION("ExecuteOnStack", execute_on_stack);
     HYPERLIGHT_REGISTER_FUNCTION("LogMessage", log_message);
+    HYPERLIGHT_REGISTER_FUNCTION("FormatDouble", format_double);
+    HYPERLIGHT_REGISTER_FUNCTION("FormatDoubles", format_doubles);
+    HYPERLIGHT_REGISTER_FUNCTION("ParseDouble", parse_double);
+    HYPERLIGHT_REGISTER_FUNCTION("ParseDoubles", parse_doubles);
+    HYPERLIGHT_REGISTER_FUNCTION("SortInts", sort_ints);
+    HYPERLIGHT_REGISTER_FUNCTION("VecMathMaxUlp", vecmath_max_ulp);
+    HYPERLIGHT_REGISTER_FUNCTION("VecMathRun", vecmath_run);
 }
 
 // This dispatch function is only used when the host dispatches a guest function
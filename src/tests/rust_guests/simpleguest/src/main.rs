@@ -31,9 +31,12 @@ use alloc::vec::Vec;
 use alloc::{format, vec};
 use core::ffi::c_char;
 use core::hint::black_box;
-use core::ptr::write_volatile;
+use core::ptr::{addr_of, addr_of_mut, copy_nonoverlapping, null_mut, write_volatile};
+use core::sync::atomic::{AtomicU64, Ordering};
 
-use hyperlight_common::flatbuffer_wrappers::function_call::{FunctionCall, FunctionCallType};
+use hyperlight_common::flatbuffer_wrappers::function_call::{
+    FunctionCall, FunctionCallType, FunctionCallView,
+};
 use hyperlight_common::flatbuffer_wrappers::function_types::{
     ParameterType, ParameterValue, ReturnType,
 };
@@ -41,12 +44,17 @@ use hyperlight_common::flatbuffer_wrappers::guest_error::ErrorCode;
 use hyperlight_common::flatbuffer_wrappers::guest_log_level::LogLevel;
 use hyperlight_common::flatbuffer_wrappers::util::get_flatbuffer_result;
 use hyperlight_common::mem::PAGE_SIZE;
+use hyperlight_guest::bench::register_benchmark;
+use hyperlight_guest::channel::{Receiver, Sender};
 use hyperlight_guest::entrypoint::{abort_with_code, abort_with_code_and_message};
 use hyperlight_guest::error::{HyperlightGuestError, Result};
+use hyperlight_guest::fs::FileSystem;
 use hyperlight_guest::guest_function_definition::GuestFunctionDefinition;
 use hyperlight_guest::guest_function_register::register_function;
 use hyperlight_guest::host_function_call::{call_host_function, get_host_return_value};
 use hyperlight_guest::memory::malloc;
+use hyperlight_guest::parallel::parallel_for;
+use hyperlight_guest::shared_data;
 use hyperlight_guest::{logging, MIN_STACK_ADDRESS};
 use log::{error, LevelFilter};
 
@@ -504,6 +512,13 @@ fn echo(function_call: &FunctionCall) -> Result<Vec<u8>> {
     }
 }
 
+// Reads its parameter in place from the input buffer, rather than copying it
+fn sum_bytes_view(function_call: &FunctionCallView) -> Result<Vec<u8>> {
+    let data = function_call.get::<&[u8]>(0)?;
+    let sum: u64 = data.iter().map(|&byte| u64::from(byte)).sum();
+    Ok(get_flatbuffer_result(sum))
+}
+
 fn get_size_prefixed_buffer(function_call: &FunctionCall) -> Result<Vec<u8>> {
     if let ParameterValue::VecBytes(data) = function_call.parameters.clone().unwrap()[0].clone() {
         Ok(get_flatbuffer_result(&*data))
@@ -714,6 +729,371 @@ fn add(function_call: &FunctionCall) -> Result<Vec<u8>> {
     }
 }
 
+// Calls `HostAdd` `count` times, so each call into this function makes
+// `count` round trips (VM exits) to the host.
+fn add_repeatedly(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::Int(count) = function_call.parameters.clone().unwrap()[0].clone() {
+        let mut total = 0;
+        for _ in 0..count {
+            call_host_function(
+                "HostAdd",
+                Some(Vec::from(&[
+                    ParameterValue::Int(total),
+                    ParameterValue::Int(1),
+                ])),
+                ReturnType::Int,
+            )?;
+            total = get_host_return_value::<i32>()?;
+        }
+
+        Ok(get_flatbuffer_result(total))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to add_repeatedly".to_string(),
+        ))
+    }
+}
+
+// Returns the length of the byte array it is passed, so that calls to it
+// measure the cost of passing a payload from the host to the guest.
+fn byte_length(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let Some(ParameterValue::VecBytes(data)) = function_call
+        .parameters
+        .as_ref()
+        .and_then(|params| params.first())
+    {
+        Ok(get_flatbuffer_result(data.len() as i32))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to byte_length".to_string(),
+        ))
+    }
+}
+
+// Returns `size` zeroed bytes, so that calls to it measure the cost of
+// returning a payload from the guest to the host.
+fn make_bytes(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::Int(size) = function_call.parameters.clone().unwrap()[0].clone() {
+        Ok(get_flatbuffer_result(&*vec![0u8; size as usize]))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to make_bytes".to_string(),
+        ))
+    }
+}
+
+fn add_nested_level(depth: i32) -> Result<i32> {
+    if depth == 0 {
+        return Ok(0);
+    }
+    // the host call comes after the recursion, so that it is made with
+    // every level's frame still on the stack
+    let inner = add_nested_level(depth - 1)?;
+    call_host_function(
+        "HostAdd",
+        Some(Vec::from(&[
+            ParameterValue::Int(inner),
+            ParameterValue::Int(1),
+        ])),
+        ReturnType::Int,
+    )?;
+    get_host_return_value::<i32>()
+}
+
+// Recurses `depth` levels, calling `HostAdd` once from each level, and
+// returns `depth`.
+fn add_nested(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::Int(depth) = function_call.parameters.clone().unwrap()[0].clone() {
+        Ok(get_flatbuffer_result(add_nested_level(depth)?))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to add_nested".to_string(),
+        ))
+    }
+}
+
+// Logs `message` `count` times at info level, and returns `count`.
+fn log_repeatedly(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let (ParameterValue::String(message), ParameterValue::Int(count)) = (
+        function_call.parameters.clone().unwrap()[0].clone(),
+        function_call.parameters.clone().unwrap()[1].clone(),
+    ) {
+        for _ in 0..count {
+            log::info!("{}", &message);
+        }
+        Ok(get_flatbuffer_result(count))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to log_repeatedly".to_string(),
+        ))
+    }
+}
+
+// Allocates `size` bytes on the heap and writes to every cache line of it
+// `passes` times, so that the call is dominated by memory accesses.
+fn touch_memory(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let (ParameterValue::Int(size), ParameterValue::Int(passes)) = (
+        function_call.parameters.clone().unwrap()[0].clone(),
+        function_call.parameters.clone().unwrap()[1].clone(),
+    ) {
+        let mut buffer = vec![0u8; size as usize];
+        for pass in 0..passes {
+            for i in (0..buffer.len()).step_by(64) {
+                buffer[i] = buffer[i].wrapping_add(pass as u8);
+            }
+            black_box(&mut buffer);
+        }
+        Ok(get_flatbuffer_result(size))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to touch_memory".to_string(),
+        ))
+    }
+}
+
+// Busy loops summing 0..n, so that the call takes a while and its
+// result depends on every iteration having run.
+fn sum_to(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::Int(n) = function_call.parameters.clone().unwrap()[0].clone() {
+        let mut sum: i32 = 0;
+        for i in 0..n {
+            sum = sum.wrapping_add(black_box(i));
+        }
+        Ok(get_flatbuffer_result(sum))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to sum_to".to_string(),
+        ))
+    }
+}
+
+// Sums 0..n with parallel_for, so that the result is only right if every
+// iteration ran exactly once, whichever vCPU it ran on.
+fn parallel_sum(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::Int(n) = function_call.parameters.clone().unwrap()[0].clone() {
+        let sum = AtomicU64::new(0);
+        parallel_for(0..n as usize, |i| {
+            sum.fetch_add(black_box(i) as u64, Ordering::Relaxed);
+        });
+        Ok(get_flatbuffer_result(sum.into_inner() as i64))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to parallel_sum".to_string(),
+        ))
+    }
+}
+
+// Sums the bytes of the shared data region with the given name, or
+// returns -1 if there is no such region.
+fn sum_shared_data(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::String(name) = function_call.parameters.clone().unwrap()[0].clone() {
+        let sum = match shared_data::get(&name) {
+            Some(data) => data.iter().map(|b| *b as i64).sum(),
+            None => -1,
+        };
+        Ok(get_flatbuffer_result(sum))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to sum_shared_data".to_string(),
+        ))
+    }
+}
+
+// Writes to the shared data region with the given name, which should
+// fault as the region is read-only.
+fn write_shared_data(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::String(name) = function_call.parameters.clone().unwrap()[0].clone() {
+        if let Some(data) = shared_data::get(&name) {
+            unsafe { write_volatile(data.as_ptr() as *mut u8, 0) };
+        }
+        Ok(get_flatbuffer_result(()))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to write_shared_data".to_string(),
+        ))
+    }
+}
+
+// Sends the given bytes on the channel with the given name, returning
+// whether there was room for them.
+fn send_to_channel(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let (ParameterValue::String(name), ParameterValue::VecBytes(message)) = (
+        function_call.parameters.clone().unwrap()[0].clone(),
+        function_call.parameters.clone().unwrap()[1].clone(),
+    ) {
+        let sent = open_sender(&name)?.try_send(&message)?;
+        Ok(get_flatbuffer_result(sent))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to send_to_channel".to_string(),
+        ))
+    }
+}
+
+// Receives the next message on the channel with the given name, or an
+// empty message if there is none.
+fn receive_from_channel(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let ParameterValue::String(name) = function_call.parameters.clone().unwrap()[0].clone() {
+        let message = open_receiver(&name)?.try_recv()?.unwrap_or_default();
+        Ok(get_flatbuffer_result(&*message))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to receive_from_channel".to_string(),
+        ))
+    }
+}
+
+// A stage of a pipeline: receives every message waiting on the first
+// channel, reading it in place, and sends its first 256 bytes on the
+// second in upper case. Returns the number of messages passed on.
+fn uppercase_channel(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let (ParameterValue::String(from), ParameterValue::String(to)) = (
+        function_call.parameters.clone().unwrap()[0].clone(),
+        function_call.parameters.clone().unwrap()[1].clone(),
+    ) {
+        let (mut from, mut to) = (open_receiver(&from)?, open_sender(&to)?);
+        let mut count = 0;
+        while let Some(sent) = from.try_recv_with(|message| {
+            let mut upper = [0u8; 256];
+            let upper = &mut upper[..message.len().min(256)];
+            for (u, b) in upper.iter_mut().zip(message) {
+                *u = b.to_ascii_uppercase();
+            }
+            to.try_send(upper)
+        })? {
+            if !sent? {
+                return Err(HyperlightGuestError::new(
+                    ErrorCode::GuestError,
+                    "Channel is full".to_string(),
+                ));
+            }
+            count += 1;
+        }
+        Ok(get_flatbuffer_result(count))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to uppercase_channel".to_string(),
+        ))
+    }
+}
+
+fn open_sender(name: &str) -> Result<Sender> {
+    Sender::open(name).ok_or_else(|| {
+        HyperlightGuestError::new(
+            ErrorCode::GuestError,
+            format!("There is no channel to send on called {}", name),
+        )
+    })
+}
+
+fn open_receiver(name: &str) -> Result<Receiver> {
+    Receiver::open(name).ok_or_else(|| {
+        HyperlightGuestError::new(
+            ErrorCode::GuestError,
+            format!("There is no channel to receive on called {}", name),
+        )
+    })
+}
+
+// Reads the file at the given path from the file system image with the
+// given name, 100 bytes at a time.
+fn read_file(function_call: &FunctionCall) -> Result<Vec<u8>> {
+    if let (ParameterValue::String(name), ParameterValue::String(path)) = (
+        function_call.parameters.clone().unwrap()[0].clone(),
+        function_call.parameters.clone().unwrap()[1].clone(),
+    ) {
+        let fs = FileSystem::mount(&name)?;
+        let mut file = fs.open(&path).ok_or_else(|| {
+            HyperlightGuestError::new(ErrorCode::GuestError, format!("No such file {}", path))
+        })?;
+        let mut contents = Vec::with_capacity(file.len());
+        let mut buf = [0u8; 100];
+        loop {
+            let len = file.read(&mut buf);
+            if len == 0 {
+                break;
+            }
+            contents.extend_from_slice(&buf[..len]);
+        }
+        Ok(get_flatbuffer_result(&*contents))
+    } else {
+        Err(HyperlightGuestError::new(
+            ErrorCode::GuestFunctionParameterTypeMismatch,
+            "Invalid parameters passed to read_file".to_string(),
+        ))
+    }
+}
+
+// Benchmarks of the guest runtime, which the host runs with
+// `RunGuestBenchmark`
+
+extern "C" {
+    fn strtod(s: *const c_char, end: *mut *mut c_char) -> f64;
+}
+
+static mut MEMCPY_SRC: [u8; 4096] = [1; 4096];
+static mut MEMCPY_DST: [u8; 4096] = [0; 4096];
+static mut ENCODED_FUNCTION_CALL: Vec<u8> = Vec::new();
+
+fn bench_malloc_free() {
+    black_box(Vec::<u8>::with_capacity(black_box(64)));
+}
+
+fn bench_memcpy() {
+    unsafe {
+        let src = black_box(addr_of!(MEMCPY_SRC) as *const u8);
+        let dst = black_box(addr_of_mut!(MEMCPY_DST) as *mut u8);
+        copy_nonoverlapping(src, dst, 4096);
+    }
+}
+
+fn bench_strtod() {
+    let s = black_box(b"2.718281828459045\0".as_ptr() as *const c_char);
+    black_box(unsafe { strtod(s, null_mut()) });
+}
+
+fn bench_decode_function_call() {
+    let data = unsafe { &*addr_of!(ENCODED_FUNCTION_CALL) };
+    black_box(FunctionCall::try_from(black_box(data.as_slice())).ok());
+}
+
+fn bench_decode_function_call_view() {
+    let data = unsafe { &*addr_of!(ENCODED_FUNCTION_CALL) };
+    black_box(FunctionCallView::try_from(black_box(data.as_slice())).ok());
+}
+
+fn register_benchmarks() {
+    let call = FunctionCall::new(
+        "Echo".to_string(),
+        Some(vec![
+            ParameterValue::String("hello".to_string()),
+            ParameterValue::Int(42),
+        ]),
+        FunctionCallType::Guest,
+        ReturnType::String,
+    );
+    unsafe { ENCODED_FUNCTION_CALL = call.try_into().unwrap() };
+
+    register_benchmark("malloc_free_64B", bench_malloc_free);
+    register_benchmark("memcpy_4KiB", bench_memcpy);
+    register_benchmark("strtod", bench_strtod);
+    register_benchmark("decode_function_call", bench_decode_function_call);
+    register_benchmark("decode_function_call_view", bench_decode_function_call_view);
+}
+
 #[no_mangle]
 pub extern "C" fn hyperlight_main() {
     let set_static_def = GuestFunctionDefinition::new(
@@ -957,6 +1337,14 @@ pub extern "C" fn hyperlight_main() {
     );
     register_function(echo_def);
 
+    let sum_bytes_view_def = GuestFunctionDefinition::new_view(
+        "SumBytesView".to_string(),
+        Vec::from(&[ParameterType::VecBytes]),
+        ReturnType::ULong,
+        sum_bytes_view as usize,
+    );
+    register_function(sum_bytes_view_def);
+
     let get_size_prefixed_buffer_def = GuestFunctionDefinition::new(
         "GetSizePrefixedBuffer".to_string(),
         Vec::from(&[ParameterType::VecBytes]),
@@ -1101,6 +1489,70 @@ pub extern "C" fn hyperlight_main() {
     );
     register_function(add_def);
 
+    let add_repeatedly_def = GuestFunctionDefinition::new(
+        "AddRepeatedly".to_string(),
+        Vec::from(&[ParameterType::Int]),
+        ReturnType::Int,
+        add_repeatedly as usize,
+    );
+    register_function(add_repeatedly_def);
+
+    let byte_length_def = GuestFunctionDefinition::new(
+        "ByteLength".to_string(),
+        Vec::from(&[ParameterType::VecBytes]),
+        ReturnType::Int,
+        byte_length as usize,
+    );
+    register_function(byte_length_def);
+
+    let make_bytes_def = GuestFunctionDefinition::new(
+        "MakeBytes".to_string(),
+        Vec::from(&[ParameterType::Int]),
+        ReturnType::VecBytes,
+        make_bytes as usize,
+    );
+    register_function(make_bytes_def);
+
+    let add_nested_def = GuestFunctionDefinition::new(
+        "AddNested".to_string(),
+        Vec::from(&[ParameterType::Int]),
+        ReturnType::Int,
+        add_nested as usize,
+    );
+    register_function(add_nested_def);
+
+    let log_repeatedly_def = GuestFunctionDefinition::new(
+        "LogRepeatedly".to_string(),
+        Vec::from(&[ParameterType::String, ParameterType::Int]),
+        ReturnType::Int,
+        log_repeatedly as usize,
+    );
+    register_function(log_repeatedly_def);
+
+    let sum_to_def = GuestFunctionDefinition::new(
+        "SumTo".to_string(),
+        Vec::from(&[ParameterType::Int]),
+        ReturnType::Int,
+        sum_to as usize,
+    );
+    register_function(sum_to_def);
+
+    let touch_memory_def = GuestFunctionDefinition::new(
+        "TouchMemory".to_string(),
+        Vec::from(&[ParameterType::Int, ParameterType::Int]),
+        ReturnType::Int,
+        touch_memory as usize,
+    );
+    register_function(touch_memory_def);
+
+    let parallel_sum_def = GuestFunctionDefinition::new(
+        "ParallelSum".to_string(),
+        Vec::from(&[ParameterType::Int]),
+        ReturnType::Long,
+        parallel_sum as usize,
+    );
+    register_function(parallel_sum_def);
+
     let trigger_exception_def = GuestFunctionDefinition::new(
         "TriggerException".to_string(),
         Vec::new(),
@@ -1108,6 +1560,56 @@ pub extern "C" fn hyperlight_main() {
         trigger_exception as usize,
     );
     register_function(trigger_exception_def);
+
+    let sum_shared_data_def = GuestFunctionDefinition::new(
+        "SumSharedData".to_string(),
+        Vec::from(&[ParameterType::String]),
+        ReturnType::Long,
+        sum_shared_data as usize,
+    );
+    register_function(sum_shared_data_def);
+
+    let write_shared_data_def = GuestFunctionDefinition::new(
+        "WriteSharedData".to_string(),
+        Vec::from(&[ParameterType::String]),
+        ReturnType::Void,
+        write_shared_data as usize,
+    );
+    register_function(write_shared_data_def);
+
+    let send_to_channel_def = GuestFunctionDefinition::new(
+        "SendToChannel".to_string(),
+        Vec::from(&[ParameterType::String, ParameterType::VecBytes]),
+        ReturnType::Bool,
+        send_to_channel as usize,
+    );
+    register_function(send_to_channel_def);
+
+    let receive_from_channel_def = GuestFunctionDefinition::new(
+        "ReceiveFromChannel".to_string(),
+        Vec::from(&[ParameterType::String]),
+        ReturnType::VecBytes,
+        receive_from_channel as usize,
+    );
+    register_function(receive_from_channel_def);
+
+    let uppercase_channel_def = GuestFunctionDefinition::new(
+        "UppercaseChannel".to_string(),
+        Vec::from(&[ParameterType::String, ParameterType::String]),
+        ReturnType::Int,
+        uppercase_channel as usize,
+    );
+    register_function(uppercase_channel_def);
+
+    let read_file_def = GuestFunctionDefinition::new(
+        "ReadFile".to_string(),
+        Vec::from(&[ParameterType::String, ParameterType::String]),
+        ReturnType::VecBytes,
+        read_file as usize,
+    );
+    register_function(read_file_def);
+
+    register_benchmarks();
 }
 
 #[no_mangle]
@@ -1140,7 +1642,7 @@ pub fn guest_dispatch_function(function_call: FunctionCall) -> Result<Vec<u8>> {
     let result = get_host_return_value::<i32>()?;
     let function_name = function_call.function_name.clone();
     let param_len = function_call.parameters.clone().unwrap_or_default().len();
-    let call_type = function_call.function_call_type().clone();
+    let call_type = function_call.function_call_type();
 
     if function_name != "ThisIsNotARealFunctionButTheNameIsImportant"
         || param_len != 0